@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <numeric>
+
+#include "BackgroundSaver.h"
+
+
+BackgroundSaver::BackgroundSaver(std::vector<SaveSnapshot> snapshots, ProgressCallback onProgress)
+    : snapshots(std::move(snapshots)), states(std::make_unique<std::atomic<SaveState>[]>(this->snapshots.size())),
+      onProgress(std::move(onProgress)) {
+    auto bytes = [this](size_t index) {
+        return this->snapshots[index].size();
+    };
+    order.resize(this->snapshots.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return bytes(a) > bytes(b); });
+    for (size_t i = 0; i < this->snapshots.size(); ++i) {
+        states[i] = SaveState::Waiting;
+    }
+}
+
+BackgroundSaver::~BackgroundSaver() {
+    wait();
+}
+
+void BackgroundSaver::start() {
+    const size_t count = std::min({ MAX_WRITERS, TaskScheduler::shared().getThreadCount(), snapshots.size() });
+    for (size_t i = 0; i < count; ++i) {
+        writers.run([this] { run(); });
+    }
+}
+
+void BackgroundSaver::wait() {
+    writers.wait();
+}
+
+size_t BackgroundSaver::size() const {
+    return snapshots.size();
+}
+
+const SaveSnapshot& BackgroundSaver::getSnapshot(size_t index) const {
+    return snapshots[index];
+}
+
+SaveState BackgroundSaver::getState(size_t index) const {
+    return states[index];
+}
+
+size_t BackgroundSaver::getFinishedCount() const {
+    return finished;
+}
+
+bool BackgroundSaver::isFinished() const {
+    return finished == snapshots.size();
+}
+
+void BackgroundSaver::run() {
+    for (size_t taken = next++; taken < order.size(); taken = next++) {
+        const size_t index = order[taken];
+        states[index] = SaveState::Saving;
+        const bool saved = writeSnapshot(snapshots[index]);
+        // Blocks the document has since replaced are freed now
+        snapshots[index].text = {};
+        snapshots[index].pieces = {};
+        states[index] = saved ? SaveState::Saved : SaveState::Failed;
+        ++finished;
+        if (onProgress) {
+            onProgress(index);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef BACKGROUNDSAVER_H
+#define BACKGROUNDSAVER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "DocumentSaver.h"
+#include "TaskScheduler.h"
+
+enum class SaveState { Waiting, Saving, Saved, Failed };
+
+// Writes a batch of snapshots on a few tasks of the shared pool, so saving
+// many documents neither blocks the window nor waits on one file at a time.
+// The snapshots are taken on the UI thread beforehand; nothing here touches
+// a document. The largest files start first so that none of them is left
+// running alone at the end.
+class BackgroundSaver {
+public:
+    // Files written at once; more would only make the disk seek
+    static constexpr size_t MAX_WRITERS = 4;
+
+    // Called on a pool thread after each file
+    using ProgressCallback = std::function<void(size_t index)>;
+
+    BackgroundSaver(std::vector<SaveSnapshot> snapshots, ProgressCallback onProgress);
+    ~BackgroundSaver();
+    BackgroundSaver(const BackgroundSaver&) = delete;
+    BackgroundSaver& operator=(const BackgroundSaver&) = delete;
+
+    void start();
+    void wait();
+
+    [[nodiscard]] size_t size() const;
+    // Path and version stay readable; the text is freed once it is written
+    [[nodiscard]] const SaveSnapshot& getSnapshot(size_t index) const;
+    [[nodiscard]] SaveState getState(size_t index) const;
+    [[nodiscard]] size_t getFinishedCount() const;
+    [[nodiscard]] bool isFinished() const;
+
+private:
+    std::vector<SaveSnapshot> snapshots;
+    std::unique_ptr<std::atomic<SaveState>[]> states;
+    std::vector<size_t> order;
+    ProgressCallback onProgress;
+    TaskGroup writers;
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> finished{ 0 };
+
+    void run();
+};
+
+#endif // BACKGROUNDSAVER_H
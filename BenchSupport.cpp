@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <cstring>
+
+#include "BenchSupport.h"
+
+std::string makeCodeText(size_t lines) {
+    std::string text;
+    for (size_t i = 0; i < lines; ++i) {
+        text += "    total += item" + std::to_string(i) + ".value * scale; // running sum\n";
+    }
+    return text;
+}
+
+void loadText(DocumentText& document, std::string_view text) {
+    document.beginLoad(text.size());
+    memcpy(document.getLoadBuffer(), text.data(), text.size());
+    document.appendLoaded(text.size());
+    document.finishLoad();
+}
+
+std::string textOf(const DocumentText& document) {
+    std::string text;
+    text.reserve(document.getLength());
+    for (const std::string_view span : document.getSpans(0, document.getLength())) {
+        text.append(span);
+    }
+    return text;
+}
+
+void printLatencyHeader() {
+    printf("%-24s %10s %10s %10s %10s %10s %10s\n", "", "count", "p50", "p90", "p99", "p99.9", "max");
+}
+
+void printLatency(const char* name, const LatencyHistogram& histogram) {
+    printf("%-24s %10llu %10s %10s %10s %10s %10s\n", name, static_cast<unsigned long long>(histogram.getCount()),
+        formatDuration(histogram.getPercentile(50)).c_str(), formatDuration(histogram.getPercentile(90)).c_str(),
+        formatDuration(histogram.getPercentile(99)).c_str(), formatDuration(histogram.getPercentile(99.9)).c_str(),
+        formatDuration(histogram.getMax()).c_str());
+}
@@ -0,0 +1,25 @@
+#ifndef BENCHSUPPORT_H
+#define BENCHSUPPORT_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "DocumentText.h"
+#include "Profiler.h"
+
+// What the headless benches and tests share: generated text, loading it
+// into a document the way DocumentLoader does, and printing latencies.
+
+// Lines of code-like text, each different: "    total += item42.value * scale; // running sum"
+[[nodiscard]] std::string makeCodeText(size_t lines);
+// Loads the text as if it had been read from a file, in one piece
+void loadText(DocumentText& document, std::string_view text);
+// The whole document as one string
+[[nodiscard]] std::string textOf(const DocumentText& document);
+
+// A table of histograms: the header, then one row for each
+void printLatencyHeader();
+void printLatency(const char* name, const LatencyHistogram& histogram);
+
+#endif // BENCHSUPPORT_H
@@ -0,0 +1,520 @@
+#include <algorithm>
+
+#include "BracketIndex.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+namespace {
+    bool isBracket(char c) {
+        return c == '(' || c == ')' || c == '[' || c == ']' || c == '{' || c == '}';
+    }
+
+    bool isOpen(char c) {
+        return c == '(' || c == '[' || c == '{';
+    }
+
+    bool isPair(char open, char close) {
+        return (open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}');
+    }
+}
+
+
+BracketIndex::BracketIndex(DocumentText& document, ReadyCallback onReady)
+    : document(document), onReady(std::move(onReady)) {
+    // An empty index answers queries until the real one is installed
+    blocks.emplace_back();
+    rebuild();
+    listener = document.addEditListener({
+        [this](size_t position, const char* text, size_t len) {
+            if (ready) {
+                onInserted(position, text, len);
+            }
+            else {
+                countEdit();
+            }
+        },
+        [this](size_t start, size_t end) {
+            if (ready) {
+                onDeleted(start, end);
+            }
+            else {
+                countEdit();
+            }
+        } });
+    submit();
+}
+
+BracketIndex::~BracketIndex() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    tasks.wait();
+    document.removeEditListener(listener);
+}
+
+bool BracketIndex::install() {
+    if (ready) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!indexed) {
+        return false; // still indexing
+    }
+    if (indexedEdits != edits) {
+        indexed.reset();
+        submit();
+        return false;
+    }
+    PROFILE_SCOPE("BracketIndex::install");
+    blocks = std::move(*indexed);
+    indexed.reset();
+    rebuild();
+    ready = true;
+    return true;
+}
+
+bool BracketIndex::isReady() const {
+    return ready;
+}
+
+void BracketIndex::update() {
+    if (!ready) {
+        countEdit();
+        return;
+    }
+    const size_t covered = tree[1].length;
+    if (document.getLength() <= covered) {
+        return;
+    }
+    for (const std::string_view span : document.getSpans(covered, document.getLength() - covered)) {
+        onInserted(tree[1].length, span.data(), span.size());
+    }
+}
+
+void BracketIndex::submit() {
+    tasks.run([this, snapshot = document.snapshot(), forEdits = edits] {
+        index(snapshot, forEdits);
+    }, TaskPriority::Visible);
+}
+
+void BracketIndex::index(const DocumentSnapshot& snapshot, uint64_t forEdits) {
+    PROFILE_SCOPE("BracketIndex::index");
+    const size_t length = snapshot.getLength();
+    std::vector<Block> scanned(std::max<size_t>(1, (length + BLOCK_SIZE - 1) / BLOCK_SIZE));
+    {
+        TaskGroup parts;
+        for (size_t i = 0; i < scanned.size(); ++i) {
+            parts.run([&, i] {
+                Block& block = scanned[i];
+                const size_t start = i * BLOCK_SIZE;
+                block.length = std::min(BLOCK_SIZE, length - std::min(start, length));
+                size_t offset = 0;
+                for (const std::string_view span : snapshot.getSpans(start, block.length)) {
+                    scan(span.data(), span.size(), offset, block.brackets);
+                    offset += span.size();
+                }
+            }, TaskPriority::Visible);
+        }
+        parts.wait();
+    }
+    // Dense text has more brackets to a block than an edit should rescan
+    for (size_t i = scanned.size(); i-- > 0;) {
+        if (scanned[i].brackets.size() > MAX_BRACKETS) {
+            splitLarge(scanned, i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;
+        }
+        indexed = std::move(scanned);
+        indexedEdits = forEdits;
+    }
+    if (onReady) {
+        onReady();
+    }
+}
+
+void BracketIndex::countEdit() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++edits;
+}
+
+size_t BracketIndex::findMatch(size_t position) const {
+    if (position >= tree[1].length) {
+        return npos;
+    }
+    size_t start;
+    const size_t index = findBlock(position, start);
+    const std::vector<Bracket>& brackets = blocks[index].brackets;
+    const auto found = std::lower_bound(brackets.begin(), brackets.end(), position - start,
+        [](const Bracket& bracket, size_t offset) { return bracket.offset < offset; });
+    if (found == brackets.end() || found->offset != position - start) {
+        return npos;
+    }
+    const size_t bracket = found - brackets.begin();
+    char c = 0;
+    if (isOpen(found->c)) {
+        const size_t match = matchForward(index, start, bracket + 1, 1, c);
+        return match != npos && isPair(found->c, c) ? match : npos;
+    }
+    const size_t match = matchBackward(index, start, bracket, 1, c);
+    return match != npos && isPair(c, found->c) ? match : npos;
+}
+
+bool BracketIndex::findEnclosing(size_t position, size_t& open, size_t& close) const {
+    // As if a closing bracket were at position: what it would match opens the pair
+    size_t start;
+    const size_t index = findBlock(std::min(position, tree[1].length), start);
+    const std::vector<Bracket>& brackets = blocks[index].brackets;
+    const size_t before = std::lower_bound(brackets.begin(), brackets.end(), position - start,
+        [](const Bracket& bracket, size_t offset) { return bracket.offset < offset; }) - brackets.begin();
+    char c = 0;
+    const size_t opening = matchBackward(index, start, before, 1, c);
+    if (opening == npos) {
+        return false;
+    }
+    const size_t closing = findMatch(opening);
+    if (closing == npos) {
+        return false;
+    }
+    open = opening;
+    close = closing;
+    return true;
+}
+
+void BracketIndex::getFoldRegions(size_t firstLine, size_t lastLine, std::vector<FoldRegion>& regions) const {
+    const LineIndex& lines = document.lineStarts;
+    if (firstLine >= lines.size() || lastLine < firstLine) {
+        return;
+    }
+    const size_t start = lines[firstLine];
+    const size_t end = lastLine + 1 < lines.size() ? lines[lastLine + 1] : tree[1].length;
+    size_t blockStart;
+    for (size_t index = findBlock(start, blockStart); index < blocks.size() && blockStart < end;
+        blockStart += blocks[index++].length) {
+        for (const Bracket& bracket : blocks[index].brackets) {
+            const size_t position = blockStart + bracket.offset;
+            if (position < start || !isOpen(bracket.c)) {
+                continue;
+            }
+            if (position >= end) {
+                break;
+            }
+            const size_t close = findMatch(position);
+            if (close == npos) {
+                continue;
+            }
+            const size_t first = lines.lineOf(position);
+            const size_t last = lines.lineOf(close);
+            if (last > first) {
+                regions.push_back(FoldRegion{ position, close, first, last });
+            }
+        }
+    }
+}
+
+bool BracketIndex::findFold(size_t position, FoldRegion& region) const {
+    // The first pair to open on the line is the outermost of those that do
+    const LineIndex& lines = document.lineStarts;
+    const size_t line = lines.lineOf(position);
+    std::vector<FoldRegion> regions;
+    getFoldRegions(line, line, regions);
+    if (!regions.empty()) {
+        region = regions.front();
+        return true;
+    }
+    size_t open;
+    size_t close;
+    while (findEnclosing(position, open, close)) {
+        const size_t first = lines.lineOf(open);
+        const size_t last = lines.lineOf(close);
+        if (last > first) {
+            region = FoldRegion{ open, close, first, last };
+            return true;
+        }
+        position = open;
+    }
+    return false;
+}
+
+size_t BracketIndex::getBracketCount() const {
+    return tree[1].brackets;
+}
+
+void BracketIndex::onInserted(size_t position, const char* text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    size_t start;
+    const size_t index = findBlock(position, start);
+    Block& block = blocks[index];
+    const size_t offset = position - start;
+    const auto after = std::lower_bound(block.brackets.begin(), block.brackets.end(), offset,
+        [](const Bracket& bracket, size_t at) { return bracket.offset < at; });
+
+    if (len <= BLOCK_SIZE) {
+        for (auto bracket = after; bracket != block.brackets.end(); ++bracket) {
+            bracket->offset += static_cast<uint32_t>(len);
+        }
+        std::vector<Bracket> added;
+        scan(text, len, offset, added);
+        block.brackets.insert(after, added.begin(), added.end());
+        block.length += len;
+        if (block.length > 4 * BLOCK_SIZE || block.brackets.size() > MAX_BRACKETS) {
+            splitLarge(blocks, index);
+            rebuild();
+        }
+        else {
+            updateLeaf(index);
+        }
+        return;
+    }
+
+    // A large paste becomes blocks of its own, between the halves of the
+    // block it went into
+    std::vector<Block> pasted;
+    for (size_t done = 0; done < len; done += BLOCK_SIZE) {
+        Block piece;
+        piece.length = std::min(BLOCK_SIZE, len - done);
+        scan(text + done, piece.length, 0, piece.brackets);
+        pasted.push_back(std::move(piece));
+    }
+    Block rest;
+    rest.length = block.length - offset;
+    for (auto bracket = after; bracket != block.brackets.end(); ++bracket) {
+        rest.brackets.push_back(Bracket{ static_cast<uint32_t>(bracket->offset - offset), bracket->c });
+    }
+    block.brackets.erase(after, block.brackets.end());
+    block.length = offset;
+    pasted.push_back(std::move(rest));
+    blocks.insert(blocks.begin() + static_cast<ptrdiff_t>(index + 1),
+        std::make_move_iterator(pasted.begin()), std::make_move_iterator(pasted.end()));
+    std::erase_if(blocks, [](const Block& candidate) { return candidate.length == 0; });
+    rebuild();
+}
+
+void BracketIndex::onDeleted(size_t start, size_t end) {
+    size_t blockStart;
+    const size_t first = findBlock(start, blockStart);
+    size_t index = first;
+    size_t offset = start - blockStart;
+    size_t remaining = end - start;
+    bool emptied = false;
+    for (; remaining > 0 && index < blocks.size(); ++index, offset = 0) {
+        Block& block = blocks[index];
+        const size_t removed = std::min(block.length - offset, remaining);
+        auto byOffset = [](const Bracket& bracket, size_t at) { return bracket.offset < at; };
+        const auto from = std::lower_bound(block.brackets.begin(), block.brackets.end(), offset, byOffset);
+        const auto to = std::lower_bound(from, block.brackets.end(), offset + removed, byOffset);
+        for (auto bracket = to; bracket != block.brackets.end(); ++bracket) {
+            bracket->offset -= static_cast<uint32_t>(removed);
+        }
+        block.brackets.erase(from, to);
+        block.length -= removed;
+        remaining -= removed;
+        emptied |= block.length == 0;
+    }
+
+    if (!emptied && index - first <= 1) {
+        updateLeaf(first);
+        return;
+    }
+    std::erase_if(blocks, [](const Block& block) { return block.length == 0; });
+    if (blocks.empty()) {
+        blocks.emplace_back();
+    }
+    rebuild();
+}
+
+void BracketIndex::scan(const char* text, size_t len, size_t offset, std::vector<Bracket>& brackets) {
+    for (size_t i = 0; i < len; ++i) {
+        if (isBracket(text[i])) {
+            brackets.push_back(Bracket{ static_cast<uint32_t>(offset + i), text[i] });
+        }
+    }
+}
+
+BracketIndex::Node BracketIndex::summarize(const Block& block) {
+    Node node;
+    node.length = block.length;
+    node.brackets = block.brackets.size();
+    for (const Bracket& bracket : block.brackets) {
+        if (isOpen(bracket.c)) {
+            ++node.open;
+        }
+        else if (node.open > 0) {
+            --node.open;
+        }
+        else {
+            ++node.close;
+        }
+    }
+    return node;
+}
+
+BracketIndex::Node BracketIndex::combine(const Node& left, const Node& right) {
+    // The left's unmatched opens meet the right's unmatched closes
+    const size_t matched = std::min(left.open, right.close);
+    Node node;
+    node.length = left.length + right.length;
+    node.open = left.open - matched + right.open;
+    node.close = left.close + right.close - matched;
+    node.brackets = left.brackets + right.brackets;
+    return node;
+}
+
+void BracketIndex::rebuild() {
+    leafCount = 1;
+    while (leafCount < blocks.size()) {
+        leafCount *= 2;
+    }
+    tree.assign(2 * leafCount, Node{});
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        tree[leafCount + i] = summarize(blocks[i]);
+    }
+    for (size_t node = leafCount - 1; node >= 1; --node) {
+        tree[node] = combine(tree[2 * node], tree[2 * node + 1]);
+    }
+}
+
+void BracketIndex::updateLeaf(size_t index) {
+    size_t node = leafCount + index;
+    tree[node] = summarize(blocks[index]);
+    for (node /= 2; node >= 1; node /= 2) {
+        tree[node] = combine(tree[2 * node], tree[2 * node + 1]);
+    }
+}
+
+void BracketIndex::splitLarge(std::vector<Block>& blocks, size_t index) {
+    // Pieces of up to BLOCK_SIZE bytes and half of MAX_BRACKETS brackets
+    Block block = std::move(blocks[index]);
+    std::vector<Block> pieces;
+    size_t next = 0;
+    for (size_t pieceStart = 0; pieceStart < block.length;) {
+        size_t pieceEnd = std::min(block.length, pieceStart + BLOCK_SIZE);
+        if (next + MAX_BRACKETS / 2 < block.brackets.size()) {
+            pieceEnd = std::min<size_t>(pieceEnd, block.brackets[next + MAX_BRACKETS / 2].offset);
+        }
+        Block piece;
+        piece.length = pieceEnd - pieceStart;
+        for (; next < block.brackets.size() && block.brackets[next].offset < pieceEnd; ++next) {
+            piece.brackets.push_back(Bracket{ static_cast<uint32_t>(block.brackets[next].offset - pieceStart), block.brackets[next].c });
+        }
+        pieces.push_back(std::move(piece));
+        pieceStart = pieceEnd;
+    }
+    blocks.erase(blocks.begin() + static_cast<ptrdiff_t>(index));
+    blocks.insert(blocks.begin() + static_cast<ptrdiff_t>(index),
+        std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+}
+
+size_t BracketIndex::findBlock(size_t position, size_t& blockStart) const {
+    // The end of the text belongs to the last block
+    if (position >= tree[1].length) {
+        blockStart = tree[1].length - blocks.back().length;
+        return blocks.size() - 1;
+    }
+    size_t node = 1;
+    size_t rest = position;
+    while (node < leafCount) {
+        if (rest < tree[2 * node].length) {
+            node = 2 * node;
+        }
+        else {
+            rest -= tree[2 * node].length;
+            node = 2 * node + 1;
+        }
+    }
+    blockStart = position - rest;
+    return node - leafCount;
+}
+
+size_t BracketIndex::blockStart(size_t index) const {
+    size_t start = 0;
+    for (size_t node = leafCount + index; node > 1; node /= 2) {
+        if (node % 2 == 1) {
+            start += tree[node - 1].length;
+        }
+    }
+    return start;
+}
+
+size_t BracketIndex::findForward(size_t node, size_t lo, size_t hi, size_t from, size_t& open) const {
+    // The first block from `from` on whose unmatched closes reach the
+    // brackets still open; whole ranges short of that are passed over
+    if (hi <= from) {
+        return npos;
+    }
+    if (lo >= from && tree[node].close < open) {
+        open = open - tree[node].close + tree[node].open;
+        return npos;
+    }
+    if (hi - lo == 1) {
+        return lo;
+    }
+    const size_t mid = (lo + hi) / 2;
+    const size_t found = findForward(2 * node, lo, mid, from, open);
+    return found != npos ? found : findForward(2 * node + 1, mid, hi, from, open);
+}
+
+size_t BracketIndex::findBackward(size_t node, size_t lo, size_t hi, size_t before, size_t& close) const {
+    if (lo >= before) {
+        return npos;
+    }
+    if (hi <= before && tree[node].open < close) {
+        close = close - tree[node].open + tree[node].close;
+        return npos;
+    }
+    if (hi - lo == 1) {
+        return lo;
+    }
+    const size_t mid = (lo + hi) / 2;
+    const size_t found = findBackward(2 * node + 1, mid, hi, before, close);
+    return found != npos ? found : findBackward(2 * node, lo, mid, before, close);
+}
+
+size_t BracketIndex::matchForward(size_t index, size_t start, size_t bracket, size_t open, char& c) const {
+    for (;;) {
+        const std::vector<Bracket>& brackets = blocks[index].brackets;
+        for (size_t i = bracket; i < brackets.size(); ++i) {
+            if (isOpen(brackets[i].c)) {
+                ++open;
+            }
+            else if (--open == 0) {
+                c = brackets[i].c;
+                return start + brackets[i].offset;
+            }
+        }
+        index = findForward(1, 0, leafCount, index + 1, open);
+        if (index == npos) {
+            return npos;
+        }
+        start = blockStart(index);
+        bracket = 0;
+    }
+}
+
+size_t BracketIndex::matchBackward(size_t index, size_t start, size_t end, size_t close, char& c) const {
+    for (;;) {
+        const std::vector<Bracket>& brackets = blocks[index].brackets;
+        for (size_t i = end; i-- > 0;) {
+            if (!isOpen(brackets[i].c)) {
+                ++close;
+            }
+            else if (--close == 0) {
+                c = brackets[i].c;
+                return start + brackets[i].offset;
+            }
+        }
+        index = findBackward(1, 0, leafCount, index, close);
+        if (index == npos) {
+            return npos;
+        }
+        start = blockStart(index);
+        end = blocks[index].brackets.size();
+    }
+}
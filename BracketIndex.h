@@ -0,0 +1,141 @@
+#ifndef BRACKETINDEX_H
+#define BRACKETINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "DocumentText.h"
+#include "TaskScheduler.h"
+
+// A pair of brackets whose lines differ, which can be folded away
+struct FoldRegion {
+    size_t open;      // position of the opening bracket
+    size_t close;     // position of the closing one
+    size_t firstLine;
+    size_t lastLine;
+};
+
+// Where the brackets of a document are, and which pairs with which, without
+// reading its text again. ( [ and { all nest together; a pair of different
+// kinds does not match. Brackets in strings and comments count like any
+// other.
+//
+// The text is cut into blocks, each with the offsets of its brackets, and a
+// segment tree over the blocks holds how many of each block's brackets are
+// left unmatched within it: closes at its start and opens at its end. A
+// match is found by scanning the bracket's own block, then going down the
+// tree to the first block whose unmatched brackets close it, then scanning
+// that one, so any match takes O(log n) blocks and two block scans.
+//
+// Edits come from the document's edit listener and only touch the blocks
+// they fall in, on whichever thread edits; queries are made while nothing
+// edits, like those on the line index.
+//
+// The text is first indexed on the pool from a snapshot, and the blocks are
+// only taken into use by install() on the thread that owns the document. If
+// the document was edited meanwhile they are dropped and indexed again, as
+// the highlighter does with its lexing. Until then every query finds nothing.
+class BracketIndex {
+public:
+    // Blocks are cut this size when the text is indexed, and split past
+    // four times that or MAX_BRACKETS brackets
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_BRACKETS = 4096;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // Called on a pool thread once there are blocks to install
+    using ReadyCallback = std::function<void()>;
+
+    // Starts indexing the text as it is now, in parallel on the pool; made
+    // on the thread that owns the document with nothing editing it
+    BracketIndex(DocumentText& document, ReadyCallback onReady);
+    // Waits for indexing under way
+    ~BracketIndex();
+
+    BracketIndex(const BracketIndex&) = delete;
+    BracketIndex& operator=(const BracketIndex&) = delete;
+
+    // Takes the indexed blocks into use, or indexes again if they are out of
+    // date; true once the index is in use. Called while nothing edits.
+    bool install();
+    [[nodiscard]] bool isReady() const;
+
+    // Text appended from the file is not an edit, so it is caught up here
+    void update();
+
+    // The bracket matching the one at position; npos if there is no
+    // bracket there or nothing matches it
+    [[nodiscard]] size_t findMatch(size_t position) const;
+    // The innermost pair around position, not counting a bracket at
+    // position itself; false if there is none
+    bool findEnclosing(size_t position, size_t& open, size_t& close) const;
+    // Pairs opening on lines firstLine to lastLine and closing on a later
+    // line, in the order they open
+    void getFoldRegions(size_t firstLine, size_t lastLine, std::vector<FoldRegion>& regions) const;
+    // The fold that opens on position's line, else the innermost one around it
+    bool findFold(size_t position, FoldRegion& region) const;
+    [[nodiscard]] size_t getBracketCount() const;
+
+private:
+    struct Bracket {
+        uint32_t offset; // in the block
+        char c;
+    };
+
+    struct Block {
+        size_t length = 0;
+        std::vector<Bracket> brackets;
+    };
+
+    // Unmatched closes come first in a range and unmatched opens last
+    struct Node {
+        size_t length = 0;
+        size_t open = 0;
+        size_t close = 0;
+        size_t brackets = 0;
+    };
+
+    DocumentText& document;
+    ReadyCallback onReady;
+    size_t listener;
+    bool ready = false;
+
+    // What the pool indexed, and for how many edits; edits counts only
+    // those made before the index was installed
+    std::mutex mutex;
+    std::optional<std::vector<Block>> indexed;
+    uint64_t indexedEdits = 0;
+    uint64_t edits = 0;
+    bool stopping = false;
+    TaskGroup tasks;
+
+    std::vector<Block> blocks;
+    std::vector<Node> tree; // tree[1] is the root; leaves start at leafCount
+    size_t leafCount = 1;
+
+    void onInserted(size_t position, const char* text, size_t len);
+    void onDeleted(size_t start, size_t end);
+    void submit();
+    void index(const DocumentSnapshot& snapshot, uint64_t forEdits);
+    void countEdit();
+    static void scan(const char* text, size_t len, size_t offset, std::vector<Bracket>& brackets);
+    static Node summarize(const Block& block);
+    static Node combine(const Node& left, const Node& right);
+    void rebuild();
+    void updateLeaf(size_t index);
+    static void splitLarge(std::vector<Block>& blocks, size_t index);
+    [[nodiscard]] size_t findBlock(size_t position, size_t& blockStart) const;
+    [[nodiscard]] size_t blockStart(size_t index) const;
+    [[nodiscard]] size_t findForward(size_t node, size_t lo, size_t hi, size_t from, size_t& open) const;
+    [[nodiscard]] size_t findBackward(size_t node, size_t lo, size_t hi, size_t before, size_t& close) const;
+    // From a bracket in a block with that many brackets open, or back from
+    // before one with that many closed; c is the bracket that settles them
+    [[nodiscard]] size_t matchForward(size_t index, size_t start, size_t bracket, size_t open, char& c) const;
+    [[nodiscard]] size_t matchBackward(size_t index, size_t start, size_t end, size_t close, char& c) const;
+};
+
+#endif // BRACKETINDEX_H
@@ -0,0 +1,48 @@
+#ifndef CANCELTOKEN_H
+#define CANCELTOKEN_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Handed to background work started on one version of something, usually a
+// document. The work checks it between steps and gives up once the source
+// has moved past that version. A default token is never cancelled.
+class CancelToken {
+public:
+    CancelToken() = default;
+
+    [[nodiscard]] bool isCancelled() const {
+        return current && current->load(std::memory_order_relaxed) != version;
+    }
+
+private:
+    friend class CancelSource;
+    std::shared_ptr<const std::atomic<uint64_t>> current;
+    uint64_t version = 0;
+};
+
+// Hands out tokens for the current version; advancing it cancels them all.
+// Tokens keep the counter alive, so they may outlive the source.
+class CancelSource {
+public:
+    [[nodiscard]] CancelToken token() const {
+        CancelToken token;
+        token.current = current;
+        token.version = current->load(std::memory_order_relaxed);
+        return token;
+    }
+
+    void advance(uint64_t version) {
+        current->store(version, std::memory_order_relaxed);
+    }
+
+    void cancel() {
+        current->fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<uint64_t>> current = std::make_shared<std::atomic<uint64_t>>(0);
+};
+
+#endif // CANCELTOKEN_H
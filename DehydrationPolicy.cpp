@@ -0,0 +1,65 @@
+#include <algorithm>
+
+#include "DehydrationPolicy.h"
+
+
+DehydrationPolicy::DehydrationPolicy(size_t budget)
+    : budget(budget) {}
+
+size_t DehydrationPolicy::defaultBudget() {
+    MEMORYSTATUSEX status{};
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status)) {
+        return MAX_BUDGET / 4;
+    }
+    return static_cast<size_t>(std::min<uint64_t>(status.ullTotalPhys / 4, MAX_BUDGET));
+}
+
+void DehydrationPolicy::setBudget(size_t budget) {
+    this->budget = budget;
+}
+
+size_t DehydrationPolicy::getBudget() const {
+    return budget;
+}
+
+void DehydrationPolicy::touch(const DocumentText* document) {
+    lastShown[document] = ++clock;
+}
+
+void DehydrationPolicy::forget(const DocumentText* document) {
+    lastShown.erase(document);
+}
+
+std::vector<DocumentText*> DehydrationPolicy::select(const std::vector<Tab>& tabs, const DocumentText* current,
+    bool lowMemory) const {
+    size_t total = 0;
+    std::vector<const Tab*> candidates;
+    for (const Tab& tab : tabs) {
+        total += tab.memory;
+        if (tab.canDehydrate && tab.document != current && tab.document->getLength() >= MIN_TAB_SIZE) {
+            candidates.push_back(&tab);
+        }
+    }
+    if (!lowMemory && total <= budget) {
+        return {};
+    }
+
+    // Tabs never shown count as the oldest
+    auto shown = [this](const DocumentText* document) {
+        const auto found = lastShown.find(document);
+        return found != lastShown.end() ? found->second : 0;
+    };
+    std::sort(candidates.begin(), candidates.end(),
+        [&](const Tab* a, const Tab* b) { return shown(a->document) < shown(b->document); });
+
+    std::vector<DocumentText*> chosen;
+    for (const Tab* tab : candidates) {
+        if (!lowMemory && total <= budget) {
+            break;
+        }
+        chosen.push_back(tab->document);
+        total -= tab->memory;
+    }
+    return chosen;
+}
@@ -0,0 +1,49 @@
+#ifndef DEHYDRATIONPOLICY_H
+#define DEHYDRATIONPOLICY_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "DocumentText.h"
+
+// Decides which background tabs give up their memory. A tab costs what its
+// text and the Edit control's copy of it have allocated, as the document's
+// memory account and the control measure it. While all the tabs fit in the
+// budget they are left alone; past it, the tabs shown least recently are
+// dehydrated until the rest fit. When the system runs low on memory every
+// background tab is.
+class DehydrationPolicy {
+public:
+    // Smaller tabs are not worth the round trip
+    static constexpr size_t MIN_TAB_SIZE = 256 * 1024;
+    static constexpr size_t MAX_BUDGET = size_t{ 2 } * 1024 * 1024 * 1024;
+
+    struct Tab {
+        DocumentText* document;
+        size_t memory;     // bytes reserved for its text and view
+        bool canDehydrate; // false while something still needs it as it is
+    };
+
+    explicit DehydrationPolicy(size_t budget = defaultBudget());
+
+    // A quarter of physical memory, up to MAX_BUDGET
+    [[nodiscard]] static size_t defaultBudget();
+    void setBudget(size_t budget);
+    [[nodiscard]] size_t getBudget() const;
+
+    // The tab is on screen now
+    void touch(const DocumentText* document);
+    void forget(const DocumentText* document);
+
+    // From the tabs that are not dehydrated, the ones to dehydrate now
+    [[nodiscard]] std::vector<DocumentText*> select(const std::vector<Tab>& tabs, const DocumentText* current,
+        bool lowMemory) const;
+
+private:
+    size_t budget;
+    uint64_t clock = 0;
+    std::unordered_map<const DocumentText*, uint64_t> lastShown;
+};
+
+#endif // DEHYDRATIONPOLICY_H
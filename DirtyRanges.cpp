@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include "DirtyRanges.h"
+
+
+void DirtyRanges::reset(bool inSync) {
+    ranges.clear();
+    this->inSync = inSync;
+}
+
+bool DirtyRanges::isInSync() const {
+    return inSync;
+}
+
+bool DirtyRanges::isClean() const {
+    return inSync && ranges.empty();
+}
+
+const std::vector<DirtyRanges::Range>& DirtyRanges::getRanges() const {
+    return ranges;
+}
+
+void DirtyRanges::onEdit(size_t start, size_t end, size_t inserted, int64_t fileDelta) {
+    if (!inSync) {
+        return;
+    }
+    const auto delta = static_cast<int64_t>(inserted) - static_cast<int64_t>(end - start);
+
+    // Ranges touching the edit are absorbed into one range covering it
+    auto first = std::lower_bound(ranges.begin(), ranges.end(), start,
+        [](const Range& range, size_t position) { return range.end < position; });
+    int64_t shiftBefore = first == ranges.begin() ? 0 : std::prev(first)->shiftAfter;
+    int64_t shiftAtEnd = shiftBefore;
+    size_t mergedStart = start;
+    size_t mergedEnd = end;
+    auto last = first;
+    for (; last != ranges.end() && last->start <= end; ++last) {
+        mergedStart = std::min(mergedStart, last->start);
+        mergedEnd = std::max(mergedEnd, last->end);
+        shiftAtEnd = last->shiftAfter;
+    }
+
+    for (auto behind = last; behind != ranges.end(); ++behind) {
+        behind->start += delta;
+        behind->end += delta;
+        behind->shiftAfter += fileDelta;
+    }
+
+    const Range merged{ mergedStart, static_cast<size_t>(static_cast<int64_t>(mergedEnd) + delta), shiftAtEnd + fileDelta };
+    auto position = ranges.erase(first, last);
+    if (merged.start == merged.end && merged.shiftAfter == shiftBefore) {
+        return; // nothing left to write here
+    }
+    ranges.insert(position, merged);
+    if (ranges.size() > MAX_RANGES) {
+        mergeClosest();
+    }
+}
+
+std::vector<std::pair<size_t, size_t>> DirtyRanges::getWriteRanges(size_t length) const {
+    std::vector<std::pair<size_t, size_t>> result;
+    auto add = [&result](size_t start, size_t end) {
+        if (start >= end) {
+            return;
+        }
+        if (!result.empty() && result.back().second >= start) {
+            result.back().second = std::max(result.back().second, end);
+        }
+        else {
+            result.emplace_back(start, end);
+        }
+    };
+
+    // Unchanged text is written again only when it has moved
+    size_t cleanStart = 0;
+    int64_t shift = 0;
+    for (const Range& range : ranges) {
+        if (shift != 0) {
+            add(cleanStart, range.start);
+        }
+        add(range.start, range.end);
+        cleanStart = range.end;
+        shift = range.shiftAfter;
+    }
+    if (shift != 0) {
+        add(cleanStart, length);
+    }
+    return result;
+}
+
+int64_t DirtyRanges::getFileDelta() const {
+    return ranges.empty() ? 0 : ranges.back().shiftAfter;
+}
+
+void DirtyRanges::mergeClosest() {
+    size_t closest = 0;
+    for (size_t i = 1; i + 1 < ranges.size(); ++i) {
+        if (ranges[i + 1].start - ranges[i].end < ranges[closest + 1].start - ranges[closest].end) {
+            closest = i;
+        }
+    }
+    ranges[closest].end = ranges[closest + 1].end;
+    ranges[closest].shiftAfter = ranges[closest + 1].shiftAfter;
+    ranges.erase(ranges.begin() + closest + 1);
+}
@@ -0,0 +1,49 @@
+#ifndef DIRTYRANGES_H
+#define DIRTYRANGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// What changed in a document since it last matched its file on disk, so a
+// save can write only that. Ranges hold current document offsets. The text
+// between them is unchanged but may have moved: each range records how far
+// the text after it now sits from its place in the file, in file bytes (a
+// CRLF line ending counts twice). Unchanged text that did not move is
+// already in place on disk.
+class DirtyRanges {
+public:
+    // Beyond this many ranges the two closest are merged
+    static constexpr size_t MAX_RANGES = 256;
+
+    struct Range {
+        size_t start;
+        size_t end;
+        int64_t shiftAfter;
+    };
+
+    // inSync: the document matches its file, otherwise nothing is tracked
+    // until the next reset
+    void reset(bool inSync);
+    [[nodiscard]] bool isInSync() const;
+    [[nodiscard]] bool isClean() const;
+    [[nodiscard]] const std::vector<Range>& getRanges() const;
+
+    // [start, end) was replaced by `inserted` bytes, growing the file by fileDelta
+    void onEdit(size_t start, size_t end, size_t inserted, int64_t fileDelta);
+
+    // Document ranges whose text is not already in place in the file, ascending
+    [[nodiscard]] std::vector<std::pair<size_t, size_t>> getWriteRanges(size_t length) const;
+
+    // How much the file grows when saved
+    [[nodiscard]] int64_t getFileDelta() const;
+
+private:
+    std::vector<Range> ranges;
+    bool inSync = false;
+
+    void mergeClosest();
+};
+
+#endif // DIRTYRANGES_H
@@ -0,0 +1,244 @@
+#include <cstring>
+
+#include "DocumentCache.h"
+#include "Gzip.h"
+
+
+namespace {
+    constexpr char MAGIC[4] = { 'N', 'D', 'C', '1' };
+    constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 3 * sizeof(uint64_t) + 4 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+
+    uint64_t fnv1a(const void* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    void put(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    T get(const char* p) {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    std::string toUtf8(const std::wstring& text) {
+        const int size = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+        std::string result(size, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), result.data(), size, nullptr, nullptr);
+        return result;
+    }
+
+    std::wstring fromUtf8(std::string_view text) {
+        const int size = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+        std::wstring result(size, L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), result.data(), size);
+        return result;
+    }
+}
+
+std::wstring DocumentCache::directory() {
+    wchar_t base[MAX_PATH];
+    const DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", base, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH) {
+        return {};
+    }
+    std::wstring path = std::wstring(base, length) + L"\\NickolasTextEditor";
+    CreateDirectoryW(path.c_str(), nullptr);
+    return path;
+}
+
+std::wstring DocumentCache::entryPath(const std::wstring& path) {
+    const std::wstring base = directory();
+    if (base.empty()) {
+        return {};
+    }
+    CreateDirectoryW((base + L"\\cache").c_str(), nullptr);
+    wchar_t name[17];
+    swprintf(name, 17, L"%016llx", static_cast<unsigned long long>(fnv1a(path.data(), path.size() * sizeof(wchar_t))));
+    return base + L"\\cache\\" + name + L".idx";
+}
+
+bool DocumentCache::sampleHash(const std::wstring& path, uint64_t size, uint64_t& hash) {
+    // The start, middle and end of the file, which is where edits that keep
+    // the size and write time (tools that restore timestamps) would show
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    hash = fnv1a(&size, sizeof(size));
+    const uint64_t offsets[3] = { 0, size / 2, size > SAMPLE_SIZE ? size - SAMPLE_SIZE : 0 };
+    std::string sample(SAMPLE_SIZE, '\0');
+    bool ok = true;
+    for (const uint64_t offset : offsets) {
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD got = 0;
+        const DWORD want = static_cast<DWORD>(std::min<uint64_t>(SAMPLE_SIZE, size - offset));
+        if (want > 0 && (!ReadFile(hFile, sample.data(), want, &got, &overlapped) || got != want)) {
+            ok = false;
+            break;
+        }
+        hash = fnv1a(sample.data(), got, hash);
+    }
+    CloseHandle(hFile);
+    return ok;
+}
+
+bool DocumentCache::replaceFile(const std::wstring& path, const std::string& contents) {
+    // Written beside the old entry and renamed over it, so a reader never
+    // maps a half-written one
+    const std::wstring temporary = path + L".tmp";
+    HANDLE hFile = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < contents.size();) {
+        DWORD written = 0;
+        const DWORD want = static_cast<DWORD>(std::min<size_t>(contents.size() - done, 64 * 1024 * 1024));
+        ok = WriteFile(hFile, contents.data() + done, want, &written, nullptr) && written == want;
+        done += written;
+    }
+    CloseHandle(hFile);
+    ok = ok && MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+    if (!ok) {
+        DeleteFileW(temporary.c_str());
+    }
+    return ok;
+}
+
+// Layout: magic, file size, write time, sample hash, line ending style,
+// mixed flag, encoding, padding, caret, first visible line, path length in
+// bytes, then the path, the serialized line index and a CRC of everything
+bool DocumentCache::load(const std::wstring& path, CachedDocument& cached) {
+    FileStamp stamp;
+    const std::wstring entry = entryPath(path);
+    if (entry.empty() || !FileStamp::read(path, stamp)) {
+        return false;
+    }
+    HANDLE hFile = CreateFileW(entry.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE hMapping = GetFileSizeEx(hFile, &size) && static_cast<uint64_t>(size.QuadPart) >= HEADER_SIZE + sizeof(uint32_t)
+        ? CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr)
+        : nullptr;
+    const void* view = hMapping != nullptr ? MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    bool hit = false;
+    if (view != nullptr) {
+        const char* data = static_cast<const char*>(view);
+        const size_t body = static_cast<size_t>(size.QuadPart) - sizeof(uint32_t);
+        const uint32_t pathBytes = get<uint32_t>(data + HEADER_SIZE - sizeof(uint32_t));
+        uint64_t hash = 0;
+        hit = memcmp(data, MAGIC, sizeof(MAGIC)) == 0 &&
+            get<uint64_t>(data + 4) == stamp.size && get<uint64_t>(data + 12) == stamp.lastWrite &&
+            data[31] == static_cast<char>(TextEncoding::Utf8) &&
+            pathBytes == path.size() * sizeof(wchar_t) && pathBytes <= body - HEADER_SIZE &&
+            memcmp(data + HEADER_SIZE, path.data(), pathBytes) == 0 &&
+            get<uint32_t>(data + body) == crc32(0, data, body) &&
+            sampleHash(path, stamp.size, hash) && hash == get<uint64_t>(data + 20);
+        if (hit) {
+            const auto style = static_cast<uint8_t>(data[28]);
+            hit = style <= static_cast<uint8_t>(EolStyle::CR) &&
+                cached.lineStarts.deserialize(std::string_view(data + HEADER_SIZE + pathBytes, body - HEADER_SIZE - pathBytes));
+            cached.eolStyle = static_cast<EolStyle>(style);
+            cached.mixedEol = data[29] != 0;
+            cached.encoding = TextEncoding::Utf8;
+            cached.view.caret = static_cast<size_t>(get<uint64_t>(data + 32));
+            cached.view.firstVisibleLine = static_cast<size_t>(get<uint64_t>(data + 40));
+        }
+        UnmapViewOfFile(view);
+    }
+    if (hMapping != nullptr) {
+        CloseHandle(hMapping);
+    }
+    CloseHandle(hFile);
+    return hit;
+}
+
+bool DocumentCache::store(const std::wstring& path, const DocumentText& document, const ViewState& view) {
+    // The index is of the text on disk, so only an unmodified document that
+    // still matches its file can be cached
+    FileStamp stamp;
+    uint64_t hash;
+    const std::wstring entry = entryPath(path);
+    if (entry.empty() || document.isModified() || isGzipPath(path) || !FileStamp::read(path, stamp) ||
+        !(stamp == document.getSavedStamp()) || !sampleHash(path, stamp.size, hash)) {
+        return false;
+    }
+
+    std::string contents(MAGIC, sizeof(MAGIC));
+    put<uint64_t>(contents, stamp.size);
+    put<uint64_t>(contents, stamp.lastWrite);
+    put<uint64_t>(contents, hash);
+    put<uint8_t>(contents, static_cast<uint8_t>(document.getEolStyle()));
+    put<uint8_t>(contents, document.hasMixedEol() ? 1 : 0);
+    put<uint8_t>(contents, 0);
+    put<uint8_t>(contents, static_cast<uint8_t>(TextEncoding::Utf8));
+    put<uint64_t>(contents, view.caret);
+    put<uint64_t>(contents, view.firstVisibleLine);
+    put<uint32_t>(contents, static_cast<uint32_t>(path.size() * sizeof(wchar_t)));
+    contents.append(reinterpret_cast<const char*>(path.data()), path.size() * sizeof(wchar_t));
+    document.lineStarts.serialize(contents);
+    put<uint32_t>(contents, crc32(0, contents.data(), contents.size()));
+    return replaceFile(entry, contents);
+}
+
+bool DocumentCache::loadSession(std::vector<std::wstring>& paths, size_t& currentTab) {
+    // One UTF-8 line with the current tab, then one per file
+    const std::wstring base = directory();
+    HANDLE hFile = base.empty() ? INVALID_HANDLE_VALUE
+        : CreateFileW((base + L"\\session.txt").c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    std::string text(64 * 1024, '\0');
+    DWORD got = 0;
+    const bool ok = ReadFile(hFile, text.data(), static_cast<DWORD>(text.size()), &got, nullptr);
+    CloseHandle(hFile);
+    if (!ok) {
+        return false;
+    }
+    text.resize(got);
+
+    paths.clear();
+    currentTab = 0;
+    size_t lineStart = 0;
+    for (size_t line = 0; lineStart < text.size(); ++line) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            lineEnd = text.size();
+        }
+        const std::string_view value(text.data() + lineStart, lineEnd - lineStart);
+        if (line == 0) {
+            currentTab = static_cast<size_t>(strtoull(std::string(value).c_str(), nullptr, 10));
+        }
+        else if (!value.empty()) {
+            paths.push_back(fromUtf8(value));
+        }
+        lineStart = lineEnd + 1;
+    }
+    return true;
+}
+
+bool DocumentCache::storeSession(const std::vector<std::wstring>& paths, size_t currentTab) {
+    const std::wstring base = directory();
+    if (base.empty()) {
+        return false;
+    }
+    std::string text = std::to_string(currentTab) + "\n";
+    for (const std::wstring& path : paths) {
+        text += toUtf8(path) + "\n";
+    }
+    return replaceFile(base + L"\\session.txt", text);
+}
@@ -0,0 +1,57 @@
+#ifndef DOCUMENTCACHE_H
+#define DOCUMENTCACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DocumentText.h"
+#include "LineIndex.h"
+
+// What is remembered about a file between sessions, so reopening it skips
+// indexing and puts the view back where it was. Each file gets one cache
+// entry under %LOCALAPPDATA%, named after a hash of its path and keyed on its
+// size, write time and a hash of samples of its content; a file changed in
+// any of those ways simply misses the cache. Entries are read through a
+// memory mapping and checked with a CRC before they are trusted.
+
+// The editor reads and writes UTF-8 only; the field exists so a cache from
+// a build that knows more encodings is not mistaken for this one
+enum class TextEncoding : uint8_t { Utf8 };
+
+// Where the view was when the document was last closed
+struct ViewState {
+    size_t caret = 0;
+    size_t firstVisibleLine = 0;
+};
+
+struct CachedDocument {
+    LineIndex lineStarts;
+    EolStyle eolStyle = EolStyle::CRLF;
+    bool mixedEol = false;
+    TextEncoding encoding = TextEncoding::Utf8;
+    ViewState view;
+};
+
+class DocumentCache {
+public:
+    static constexpr size_t SAMPLE_SIZE = 64 * 1024;
+
+    // False when there is no entry or it does not match the file as it is now
+    static bool load(const std::wstring& path, CachedDocument& cached);
+
+    // Only documents that match their file are cached
+    static bool store(const std::wstring& path, const DocumentText& document, const ViewState& view);
+
+    // The files open in the last session, in tab order
+    static bool loadSession(std::vector<std::wstring>& paths, size_t& currentTab);
+    static bool storeSession(const std::vector<std::wstring>& paths, size_t currentTab);
+
+private:
+    [[nodiscard]] static std::wstring directory();
+    [[nodiscard]] static std::wstring entryPath(const std::wstring& path);
+    [[nodiscard]] static bool sampleHash(const std::wstring& path, uint64_t size, uint64_t& hash);
+    static bool replaceFile(const std::wstring& path, const std::string& contents);
+};
+
+#endif // DOCUMENTCACHE_H
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "DocumentDiff.h"
+
+
+namespace {
+    constexpr size_t COMPARE_BLOCK = 4096;
+
+    size_t lineStart(const DocumentText& document, size_t line) {
+        return line < document.lineStarts.size() ? document.lineStarts[line] : document.getLength();
+    }
+
+    size_t sameForward(const char* a, const char* b, size_t n) {
+        size_t i = 0;
+        while (n - i >= COMPARE_BLOCK && memcmp(a + i, b + i, COMPARE_BLOCK) == 0) {
+            i += COMPARE_BLOCK;
+        }
+        while (i < n && a[i] == b[i]) {
+            ++i;
+        }
+        return i;
+    }
+
+    size_t sameBackward(const char* aEnd, const char* bEnd, size_t n) {
+        size_t i = 0;
+        while (n - i >= COMPARE_BLOCK && memcmp(aEnd - i - COMPARE_BLOCK, bEnd - i - COMPARE_BLOCK, COMPARE_BLOCK) == 0) {
+            i += COMPARE_BLOCK;
+        }
+        while (i < n && *(aEnd - i - 1) == *(bEnd - i - 1)) {
+            ++i;
+        }
+        return i;
+    }
+
+    // Length of the common start of two texts, however their blocks split them
+    size_t matchForward(const TextSpans& a, const TextSpans& b) {
+        size_t ai = 0, bi = 0, aOffset = 0, bOffset = 0, matched = 0;
+        for (;;) {
+            while (ai < a.count() && aOffset == a[ai].size()) {
+                ++ai;
+                aOffset = 0;
+            }
+            while (bi < b.count() && bOffset == b[bi].size()) {
+                ++bi;
+                bOffset = 0;
+            }
+            if (ai == a.count() || bi == b.count()) {
+                return matched;
+            }
+            const size_t n = std::min(a[ai].size() - aOffset, b[bi].size() - bOffset);
+            const size_t same = sameForward(a[ai].data() + aOffset, b[bi].data() + bOffset, n);
+            matched += same;
+            if (same < n) {
+                return matched;
+            }
+            aOffset += n;
+            bOffset += n;
+        }
+    }
+
+    // Length of the common end
+    size_t matchBackward(const TextSpans& a, const TextSpans& b) {
+        size_t ai = a.count(), bi = b.count(), aLeft = 0, bLeft = 0, matched = 0;
+        for (;;) {
+            while (aLeft == 0 && ai > 0) {
+                aLeft = a[--ai].size();
+            }
+            while (bLeft == 0 && bi > 0) {
+                bLeft = b[--bi].size();
+            }
+            if (aLeft == 0 || bLeft == 0) {
+                return matched;
+            }
+            const size_t n = std::min(aLeft, bLeft);
+            const size_t same = sameBackward(a[ai].data() + aLeft, b[bi].data() + bLeft, n);
+            matched += same;
+            if (same < n) {
+                return matched;
+            }
+            aLeft -= n;
+            bLeft -= n;
+        }
+    }
+
+    // A word at a time; lines are told apart by their 64-bit hashes alone
+    uint64_t hashBytes(const char* data, size_t len) {
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ len;
+        for (; len >= sizeof(uint64_t); data += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data, sizeof(word));
+            hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+            hash ^= hash >> 32;
+        }
+        uint64_t word = 0;
+        if (len > 0) {
+            memcpy(&word, data, len);
+        }
+        hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ull;
+        return hash ^ (hash >> 29);
+    }
+
+    uint64_t hashLine(const DocumentText& document, size_t line, std::string& scratch) {
+        const size_t start = lineStart(document, line);
+        const TextSpans spans = document.getSpans(start, lineStart(document, line + 1) - start);
+        if (spans.count() < 2) {
+            return spans.count() == 0 ? hashBytes(nullptr, 0) : hashBytes(spans[0].data(), spans[0].size());
+        }
+        // Only lines split between blocks are copied
+        scratch.clear();
+        for (const std::string_view chunk : spans) {
+            scratch.append(chunk);
+        }
+        return hashBytes(scratch.data(), scratch.size());
+    }
+
+    // Hashes of lines from a starting line on, extended as the search widens
+    struct LineHashes {
+        const DocumentText& document;
+        size_t first;
+        std::vector<uint64_t> hashes;
+
+        void extend(size_t count, std::string& scratch) {
+            while (hashes.size() < count) {
+                hashes.push_back(hashLine(document, first + hashes.size(), scratch));
+            }
+        }
+    };
+
+    // Where the two texts line up again after differing at their first lines:
+    // the pair of lines (oldLine + skipOld, newLine + skipNew) with equal
+    // hashes and the smallest skipOld + skipNew. The window of lines searched
+    // doubles until a match inside it is sure to be the nearest one.
+    bool findResync(const DocumentText& current, size_t oldLine, size_t oldLines,
+        const DocumentText& updated, size_t newLine, size_t newLines, size_t& skipOld, size_t& skipNew) {
+        LineHashes oldHashes{ current, oldLine, {} };
+        LineHashes newHashes{ updated, newLine, {} };
+        std::unordered_map<uint64_t, size_t> firstNew;
+        std::string scratch;
+        for (size_t window = RESYNC_WINDOW; window <= MAX_RESYNC_LINES; window *= 2) {
+            const size_t oldCount = std::min(window, oldLines);
+            const size_t newCount = std::min(window, newLines);
+            oldHashes.extend(oldCount, scratch);
+            const size_t known = newHashes.hashes.size();
+            newHashes.extend(newCount, scratch);
+            for (size_t j = known; j < newCount; ++j) {
+                firstNew.emplace(newHashes.hashes[j], j);
+            }
+
+            size_t best = SIZE_MAX;
+            for (size_t i = 0; i < oldCount && i < best; ++i) {
+                auto match = firstNew.find(oldHashes.hashes[i]);
+                if (match != firstNew.end() && i + match->second > 0 && i + match->second < best) {
+                    best = i + match->second;
+                    skipOld = i;
+                    skipNew = match->second;
+                }
+            }
+            // A pair outside the window is at least window lines away
+            if (best < window) {
+                return true;
+            }
+            if (oldCount == oldLines && newCount == newLines) {
+                return best != SIZE_MAX;
+            }
+        }
+        return false;
+    }
+
+    void addHunk(const DocumentText& current, const DocumentText& updated, DiffHunk hunk, std::vector<DiffHunk>& hunks) {
+        // Only the bytes that differ, so a one-character change in a long
+        // line does not replace the whole line
+        const size_t head = matchForward(current.getSpans(hunk.oldStart, hunk.oldEnd - hunk.oldStart),
+            updated.getSpans(hunk.newStart, hunk.newEnd - hunk.newStart));
+        hunk.oldStart += head;
+        hunk.newStart += head;
+        const size_t tail = matchBackward(current.getSpans(hunk.oldStart, hunk.oldEnd - hunk.oldStart),
+            updated.getSpans(hunk.newStart, hunk.newEnd - hunk.newStart));
+        hunk.oldEnd -= tail;
+        hunk.newEnd -= tail;
+        if (hunk.oldStart < hunk.oldEnd || hunk.newStart < hunk.newEnd) {
+            hunks.push_back(hunk);
+        }
+    }
+}
+
+std::vector<DiffHunk> diffDocuments(const DocumentText& current, const DocumentText& updated) {
+    std::vector<DiffHunk> hunks;
+    const size_t oldLength = current.getLength();
+    const size_t newLength = updated.getLength();
+
+    // Whole lines at the end that are the same in both are left out, so
+    // text added to or cut from the end is found without a scan
+    const size_t tail = matchBackward(current.getSpans(0, oldLength), updated.getSpans(0, newLength));
+    const size_t oldEndLine = std::min(current.lineStarts.lineOf(oldLength - tail) + 1, current.lineStarts.size());
+    const size_t newEndLine = std::min(updated.lineStarts.lineOf(newLength - tail) + 1, updated.lineStarts.size());
+    const size_t oldEnd = lineStart(current, oldEndLine);
+    const size_t newEnd = lineStart(updated, newEndLine);
+
+    size_t oldLine = 0;
+    size_t newLine = 0;
+    for (;;) {
+        // Equal text is passed over by comparing bytes, and only whole lines
+        // of it, which start and end in the same places in both
+        const size_t oldFrom = lineStart(current, oldLine);
+        const size_t newFrom = lineStart(updated, newLine);
+        const size_t same = matchForward(current.getSpans(oldFrom, oldEnd - oldFrom), updated.getSpans(newFrom, newEnd - newFrom));
+        if (same == oldEnd - oldFrom && same == newEnd - newFrom) {
+            break;
+        }
+        const size_t equalLines = current.lineStarts.lineOf(oldFrom + same) - oldLine;
+        oldLine += equalLines;
+        newLine += equalLines;
+
+        // Then the lines that differ, up to where the texts line up again
+        size_t skipOld = oldEndLine - oldLine;
+        size_t skipNew = newEndLine - newLine;
+        if (skipOld > 0 && skipNew > 0) {
+            findResync(current, oldLine, skipOld, updated, newLine, skipNew, skipOld, skipNew);
+        }
+        addHunk(current, updated, DiffHunk{
+            lineStart(current, oldLine), lineStart(current, oldLine + skipOld),
+            lineStart(updated, newLine), lineStart(updated, newLine + skipNew) }, hunks);
+        oldLine += skipOld;
+        newLine += skipNew;
+    }
+    return hunks;
+}
+
+std::unique_ptr<Command> makeReloadCommand(DocumentText& current, const DocumentText& updated, const std::vector<DiffHunk>& hunks) {
+    // The last hunk goes first, so every hunk's offsets still hold when it
+    // runs and, in reverse, when it is undone
+    std::vector<std::unique_ptr<Command>> commands;
+    for (auto hunk = hunks.rbegin(); hunk != hunks.rend(); ++hunk) {
+        if (hunk->oldEnd > hunk->oldStart) {
+            commands.push_back(std::make_unique<DeleteCommand>(current, hunk->oldStart, hunk->oldEnd - hunk->oldStart));
+        }
+        if (hunk->newEnd > hunk->newStart) {
+            std::string text;
+            text.reserve(hunk->newEnd - hunk->newStart);
+            for (const std::string_view chunk : updated.getSpans(hunk->newStart, hunk->newEnd - hunk->newStart)) {
+                text.append(chunk);
+            }
+            commands.push_back(std::make_unique<InsertCommand>(current, std::move(text), hunk->oldStart));
+        }
+    }
+    return std::make_unique<CompoundCommand>(std::move(commands));
+}
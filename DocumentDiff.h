@@ -0,0 +1,34 @@
+#ifndef DOCUMENTDIFF_H
+#define DOCUMENTDIFF_H
+
+#include <memory>
+#include <vector>
+
+#include "DocumentText.h"
+
+// Line diff between a document and a newer copy of its file, used to reload
+// a file changed by another program without replacing the whole buffer.
+// Equal text is passed over by comparing bytes. Where the texts differ, the
+// lines from there on are hashed, a small window at a time, until the
+// nearest pair of equal lines shows where they line up again. A file with a
+// few changes therefore costs about one memcmp of its length.
+
+// Byte ranges of the two texts that differ; the text between hunks is equal
+struct DiffHunk {
+    size_t oldStart, oldEnd;
+    size_t newStart, newEnd;
+};
+
+// Lines hashed on each side at first when looking for where the texts line
+// up again, and the most before the rest of both is taken as one hunk
+constexpr size_t RESYNC_WINDOW = 256;
+constexpr size_t MAX_RESYNC_LINES = 1024 * 1024;
+
+// In increasing order, each trimmed to the bytes that actually differ
+[[nodiscard]] std::vector<DiffHunk> diffDocuments(const DocumentText& current, const DocumentText& updated);
+
+// One undoable command that turns the current text into the updated one
+[[nodiscard]] std::unique_ptr<Command> makeReloadCommand(DocumentText& current, const DocumentText& updated,
+    const std::vector<DiffHunk>& hunks);
+
+#endif // DOCUMENTDIFF_H
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <new>
+#include <string>
+
+#include "DocumentLoader.h"
+#include "FileIO.h"
+#include "Gzip.h"
+#include "Profiler.h"
+
+
+DocumentLoader::DocumentLoader(HWND editControl, ProgressCallback onProgress)
+    : document(std::make_unique<DocumentText>(editControl)), onProgress(std::move(onProgress)) {}
+
+DocumentLoader::~DocumentLoader() {
+    cancel();
+    wait();
+}
+
+bool DocumentLoader::start(const std::wstring& path) {
+    startTime = std::chrono::steady_clock::now();
+    this->path = path;
+    hFile = openOverlapped(path, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize)) {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    totalBytes = static_cast<size_t>(fileSize.QuadPart);
+    compressed = isGzipPath(path);
+
+    worker = std::thread(&DocumentLoader::run, this);
+    return true;
+}
+
+void DocumentLoader::cancel() {
+    cancelled = true;
+}
+
+void DocumentLoader::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void DocumentLoader::run() {
+    PROFILE_SCOPE("DocumentLoader::run");
+    // A file too large for memory fails the load rather than the editor
+    bool loaded;
+    try {
+        loaded = compressed ? loadCompressed() : loadPlain();
+    }
+    catch (const std::bad_alloc&) {
+        loaded = false;
+    }
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+
+    if (cancelled) {
+        state = LoadState::Cancelled;
+    }
+    else if (!loaded) {
+        state = LoadState::Failed;
+    }
+    else {
+        if (!firstScreenReady) {
+            publishFirstScreen(0); // empty file
+        }
+        document->finishLoad();
+        indexedMs = elapsedMs();
+        state = LoadState::Done;
+    }
+    report();
+}
+
+bool DocumentLoader::loadPlain() {
+    const size_t total = totalBytes;
+    document->beginLoad(total);
+    CachedDocument cached;
+    if (DocumentCache::load(path, cached)) {
+        document->adoptIndex(std::move(cached.lineStarts), cached.eolStyle, cached.mixedEol);
+        cachedView = cached.view;
+        cacheHit = true;
+    }
+
+    // A small first read gets the top of the file on screen quickly, the
+    // rest is read in large chunks. Each chunk is indexed while the next one
+    // is being read.
+    size_t read = 0;
+    for (const size_t available : readChunks(hFile, document->getLoadBuffer(), total, FIRST_CHUNK, CHUNK_SIZE)) {
+        read = available;
+        if (!onIndexed(read, document->appendLoaded(read))) {
+            return false;
+        }
+    }
+    return read == total;
+}
+
+bool DocumentLoader::loadCompressed() {
+    // The compressed file is read whole, the text is decompressed straight
+    // into the document
+    const size_t total = totalBytes;
+    std::string data(total, '\0');
+    size_t read = 0;
+    for (const size_t available : readChunks(hFile, data.data(), total, CHUNK_SIZE, CHUNK_SIZE)) {
+        read = available;
+        if (cancelled) {
+            return false;
+        }
+    }
+    if (read != total) {
+        return false;
+    }
+    return loadGzip(data, *document, [this](size_t consumed, size_t indexed) {
+        return onIndexed(consumed, indexed);
+    });
+}
+
+bool DocumentLoader::onIndexed(size_t consumed, size_t indexed) {
+    bytesRead = consumed;
+    linesIndexed = document->lineStarts.size();
+    if (!firstScreenReady && (document->lineStarts.size() > FIRST_SCREEN_LINES ||
+        indexed >= FIRST_SCREEN_BYTES || consumed == totalBytes)) {
+        publishFirstScreen(indexed);
+    }
+    report();
+    return !cancelled;
+}
+
+void DocumentLoader::publishFirstScreen(size_t indexedLength) {
+    // Text that has been indexed is final, the worker only appends after it
+    size_t length = std::min(indexedLength, FIRST_SCREEN_BYTES);
+    if (document->lineStarts.size() > FIRST_SCREEN_LINES) {
+        length = std::min(length, document->lineStarts[FIRST_SCREEN_LINES]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(firstScreenMutex);
+        firstScreen.assign(document->getLoadBuffer(), length);
+    }
+    firstScreenMs = elapsedMs();
+    firstScreenReady = true;
+}
+
+void DocumentLoader::report() {
+    if (onProgress) {
+        onProgress(getProgress());
+    }
+}
+
+LoadProgress DocumentLoader::getProgress() const {
+    LoadProgress progress;
+    progress.bytesRead = bytesRead;
+    progress.totalBytes = totalBytes;
+    progress.linesIndexed = linesIndexed;
+    progress.firstScreenReady = firstScreenReady;
+    progress.state = state;
+    return progress;
+}
+
+std::string DocumentLoader::getFirstScreen() const {
+    std::lock_guard<std::mutex> lock(firstScreenMutex);
+    return firstScreen;
+}
+
+std::unique_ptr<DocumentText> DocumentLoader::takeDocument() {
+    wait();
+    return state == LoadState::Done ? std::move(document) : nullptr;
+}
+
+bool DocumentLoader::getCachedView(ViewState& view) const {
+    // Only read once the worker has finished
+    if (!cacheHit || state != LoadState::Done) {
+        return false;
+    }
+    view = cachedView;
+    return true;
+}
+
+double DocumentLoader::getTimeToFirstScreen() const {
+    return firstScreenMs;
+}
+
+double DocumentLoader::getTimeToIndexed() const {
+    return indexedMs;
+}
+
+double DocumentLoader::elapsedMs() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
@@ -0,0 +1,91 @@
+#ifndef DOCUMENTLOADER_H
+#define DOCUMENTLOADER_H
+
+#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "DocumentCache.h"
+#include "DocumentText.h"
+
+enum class LoadState { Loading, Done, Failed, Cancelled };
+
+struct LoadProgress {
+    size_t bytesRead = 0;
+    size_t totalBytes = 0;
+    size_t linesIndexed = 0;
+    bool firstScreenReady = false;
+    LoadState state = LoadState::Loading;
+};
+
+// Opens a file into a new DocumentText on a worker thread. The file is read
+// (or decompressed, for .gz files) and indexed a chunk at a time, and the first screen of lines is published
+// as soon as those bytes are indexed so it can be shown while the rest is
+// still loading. The document itself must not be touched until the load is
+// done; takeDocument hands it over afterwards. A file with a matching
+// cache entry takes its line index from the cache instead of indexing.
+class DocumentLoader {
+public:
+    static constexpr size_t FIRST_CHUNK = 64 * 1024;
+    static constexpr size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    static constexpr size_t FIRST_SCREEN_LINES = 200;
+    static constexpr size_t FIRST_SCREEN_BYTES = 64 * 1024;
+
+    // Called on the worker thread after every chunk and once at the end
+    using ProgressCallback = std::function<void(const LoadProgress&)>;
+
+    DocumentLoader(HWND editControl, ProgressCallback onProgress);
+    ~DocumentLoader();
+
+    bool start(const std::wstring& path);
+    void cancel();
+    void wait();
+
+    [[nodiscard]] LoadProgress getProgress() const;
+    [[nodiscard]] std::string getFirstScreen() const;
+    [[nodiscard]] std::unique_ptr<DocumentText> takeDocument();
+    // Where the view was when the file was last closed, if it was cached
+    [[nodiscard]] bool getCachedView(ViewState& view) const;
+
+    [[nodiscard]] double getTimeToFirstScreen() const;
+    [[nodiscard]] double getTimeToIndexed() const;
+
+private:
+    std::unique_ptr<DocumentText> document;
+    ProgressCallback onProgress;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    std::wstring path;
+    bool compressed = false;
+    bool cacheHit = false;
+    ViewState cachedView;
+    std::thread worker;
+
+    std::atomic<bool> cancelled{ false };
+    std::atomic<LoadState> state{ LoadState::Loading };
+    std::atomic<size_t> bytesRead{ 0 };
+    std::atomic<size_t> totalBytes{ 0 };
+    std::atomic<size_t> linesIndexed{ 0 };
+    std::atomic<bool> firstScreenReady{ false };
+
+    mutable std::mutex firstScreenMutex;
+    std::string firstScreen;
+
+    std::chrono::steady_clock::time_point startTime;
+    std::atomic<double> firstScreenMs{ 0 };
+    std::atomic<double> indexedMs{ 0 };
+
+    void run();
+    bool loadPlain();
+    bool loadCompressed();
+    bool onIndexed(size_t consumed, size_t indexed);
+    void publishFirstScreen(size_t indexedLength);
+    void report();
+    [[nodiscard]] double elapsedMs() const;
+};
+
+#endif // DOCUMENTLOADER_H
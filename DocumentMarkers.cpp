@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "DocumentMarkers.h"
+
+
+MarkerId DocumentMarkers::addMarker(size_t position, MarkerGravity gravity) {
+    position = std::min(position, textLength);
+
+    MarkerId id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    else {
+        id = slots.size();
+        slots.emplace_back();
+    }
+    slots[id].live = true;
+    slots[id].gravity = gravity;
+    ++liveCount;
+
+    moveSplit(position);
+    pushBehind({ textLength - position, id });
+    return id;
+}
+
+void DocumentMarkers::removeMarker(MarkerId id) {
+    if (id >= slots.size() || !slots[id].live) {
+        return;
+    }
+
+    // Bring the marker to the split; it is then part of the group of markers
+    // sharing its position at the back of the behind stack.
+    moveSplit(getPosition(id));
+    const size_t index = slots[id].index;
+    behind[index] = behind.back();
+    slots[behind[index].id].index = index;
+    behind.pop_back();
+
+    slots[id].live = false;
+    freeIds.push_back(id);
+    --liveCount;
+}
+
+size_t DocumentMarkers::getPosition(MarkerId id) const {
+    if (id >= slots.size() || !slots[id].live) {
+        return npos;
+    }
+    const Slot& slot = slots[id];
+    return slot.behind ? positionOf(behind[slot.index], true) : positionOf(front[slot.index], false);
+}
+
+std::vector<MarkerId> DocumentMarkers::getMarkers(size_t start, size_t end) const {
+    std::vector<MarkerId> result;
+    if (start >= end) {
+        return result;
+    }
+
+    auto first = std::lower_bound(front.begin(), front.end(), start,
+        [](const Entry& entry, size_t value) { return entry.offset < value; });
+    for (auto it = first; it != front.end() && it->offset < end; ++it) {
+        result.push_back(it->id);
+    }
+
+    // The behind stack is ordered by descending position.
+    auto last = std::partition_point(behind.begin(), behind.end(),
+        [&](const Entry& entry) { return positionOf(entry, true) >= end; });
+    const size_t count = result.size();
+    for (auto it = last; it != behind.end() && positionOf(*it, true) >= start; ++it) {
+        result.push_back(it->id);
+    }
+    std::reverse(result.begin() + count, result.end());
+    return result;
+}
+
+MarkerRange DocumentMarkers::addRange(size_t start, size_t end) {
+    return { addMarker(start, MarkerGravity::After), addMarker(end, MarkerGravity::Before) };
+}
+
+void DocumentMarkers::removeRange(const MarkerRange& range) {
+    removeMarker(range.start);
+    removeMarker(range.end);
+}
+
+std::pair<size_t, size_t> DocumentMarkers::getRange(const MarkerRange& range) const {
+    const size_t start = getPosition(range.start);
+    const size_t end = getPosition(range.end);
+    // Typing into an empty range pushes its start past its end.
+    return { start, std::max(start, end) };
+}
+
+size_t DocumentMarkers::size() const {
+    return liveCount;
+}
+
+void DocumentMarkers::reset(size_t length) {
+    front.clear();
+    behind.clear();
+    slots.clear();
+    freeIds.clear();
+    textLength = length;
+    liveCount = 0;
+}
+
+void DocumentMarkers::onInsert(size_t position, size_t len) {
+    position = std::min(position, textLength);
+    moveSplit(position);
+
+    // Markers sitting exactly at the insertion point keep their place in
+    // front of the new text unless they have After gravity.
+    size_t i = behind.size();
+    while (i > 0 && positionOf(behind[i - 1], true) == position) {
+        --i;
+        if (slots[behind[i].id].gravity == MarkerGravity::Before) {
+            const Entry entry = behind[i];
+            behind[i] = behind.back();
+            slots[behind[i].id].index = i;
+            behind.pop_back();
+            pushFront({ position, entry.id });
+        }
+    }
+
+    // Offsets behind the split are relative to the end, so they shift for free.
+    textLength += len;
+}
+
+void DocumentMarkers::onDelete(size_t start, size_t end) {
+    end = std::min(end, textLength);
+    if (start >= end) {
+        return;
+    }
+    moveSplit(start);
+
+    // Markers inside the deleted text collapse onto its start.
+    for (size_t i = behind.size(); i > 0 && positionOf(behind[i - 1], true) < end; --i) {
+        behind[i - 1].offset = textLength - end;
+    }
+    textLength -= end - start;
+}
+
+size_t DocumentMarkers::positionOf(const Entry& entry, bool isBehind) const {
+    return isBehind ? textLength - entry.offset : entry.offset;
+}
+
+void DocumentMarkers::moveSplit(size_t position) {
+    // Afterwards every marker in front is before the position and every
+    // marker behind is at or after it.
+    while (!front.empty() && front.back().offset >= position) {
+        const Entry entry = front.back();
+        front.pop_back();
+        pushBehind({ textLength - entry.offset, entry.id });
+    }
+    while (!behind.empty() && positionOf(behind.back(), true) < position) {
+        const Entry entry = behind.back();
+        behind.pop_back();
+        pushFront({ textLength - entry.offset, entry.id });
+    }
+}
+
+void DocumentMarkers::pushFront(const Entry& entry) {
+    front.push_back(entry);
+    slots[entry.id].behind = false;
+    slots[entry.id].index = front.size() - 1;
+}
+
+void DocumentMarkers::pushBehind(const Entry& entry) {
+    behind.push_back(entry);
+    slots[entry.id].behind = true;
+    slots[entry.id].index = behind.size() - 1;
+}
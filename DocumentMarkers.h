@@ -0,0 +1,72 @@
+#ifndef DOCUMENTMARKERS_H
+#define DOCUMENTMARKERS_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+using MarkerId = size_t;
+
+enum class MarkerGravity {
+    Before, // stays in front of text inserted at its position
+    After   // moves behind text inserted at its position
+};
+
+struct MarkerRange {
+    MarkerId start;
+    MarkerId end;
+};
+
+// Positions attached to a document that follow insertText/deleteText.
+// Markers are kept like the text blocks themselves: the ones in front of the last
+// edit hold absolute offsets, the ones behind it hold offsets from the end of
+// the document. An edit only has to move the markers between its position and
+// the previous edit, so typing at the caret costs O(1) regardless of how many
+// markers exist.
+class DocumentMarkers {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    MarkerId addMarker(size_t position, MarkerGravity gravity = MarkerGravity::After);
+    void removeMarker(MarkerId id);
+    [[nodiscard]] size_t getPosition(MarkerId id) const;
+    [[nodiscard]] std::vector<MarkerId> getMarkers(size_t start, size_t end) const;
+
+    // A range does not grow when text is typed at either of its ends.
+    MarkerRange addRange(size_t start, size_t end);
+    void removeRange(const MarkerRange& range);
+    [[nodiscard]] std::pair<size_t, size_t> getRange(const MarkerRange& range) const;
+
+    [[nodiscard]] size_t size() const;
+
+    void reset(size_t length);
+    void onInsert(size_t position, size_t len);
+    void onDelete(size_t start, size_t end);
+
+private:
+    struct Entry {
+        size_t offset; // absolute in front, distance from the end behind
+        MarkerId id;
+    };
+
+    struct Slot {
+        bool live = false;
+        bool behind = false;
+        size_t index = 0;
+        MarkerGravity gravity = MarkerGravity::After;
+    };
+
+    std::vector<Entry> front;  // ascending positions
+    std::vector<Entry> behind; // descending positions, nearest to the split last
+    std::vector<Slot> slots;
+    std::vector<MarkerId> freeIds;
+    size_t textLength = 0;
+    size_t liveCount = 0;
+
+    [[nodiscard]] size_t positionOf(const Entry& entry, bool isBehind) const;
+    void moveSplit(size_t position);
+    void pushFront(const Entry& entry);
+    void pushBehind(const Entry& entry);
+};
+
+#endif // DOCUMENTMARKERS_H
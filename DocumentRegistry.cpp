@@ -0,0 +1,84 @@
+#include "DocumentRegistry.h"
+
+
+size_t DocumentRegistry::add(std::unique_ptr<DocumentText> document, std::wstring path) {
+    indices[document.get()] = entries.size();
+    entries.push_back(Entry{ std::move(document), std::move(path), {} });
+    return entries.size() - 1;
+}
+
+DocumentRegistry::Entry DocumentRegistry::remove(size_t index) {
+    Entry entry = std::move(entries[index]);
+    entries.erase(entries.begin() + static_cast<ptrdiff_t>(index));
+    indices.erase(entry.document.get());
+    for (size_t i = index; i < entries.size(); ++i) {
+        indices[entries[i].document.get()] = i;
+    }
+    if (shown == entry.document.get()) {
+        shown = nullptr;
+    }
+    return entry;
+}
+
+std::unique_ptr<DocumentText> DocumentRegistry::replace(size_t index, std::unique_ptr<DocumentText> document) {
+    Entry& entry = entries[index];
+    indices.erase(entry.document.get());
+    indices[document.get()] = index;
+    if (shown == entry.document.get()) {
+        shown = document.get();
+    }
+    std::swap(entry.document, document);
+    return document;
+}
+
+size_t DocumentRegistry::size() const {
+    return entries.size();
+}
+
+bool DocumentRegistry::empty() const {
+    return entries.empty();
+}
+
+DocumentText* DocumentRegistry::get(int index) const {
+    if (index < 0 || static_cast<size_t>(index) >= entries.size()) {
+        return nullptr;
+    }
+    return entries[index].document.get();
+}
+
+DocumentRegistry::Entry& DocumentRegistry::at(size_t index) {
+    return entries.at(index);
+}
+
+const DocumentRegistry::Entry& DocumentRegistry::at(size_t index) const {
+    return entries.at(index);
+}
+
+int DocumentRegistry::indexOf(const DocumentText* document) const {
+    const auto found = indices.find(document);
+    return found != indices.end() ? static_cast<int>(found->second) : -1;
+}
+
+DocumentText* DocumentRegistry::getShown() const {
+    return shown;
+}
+
+void DocumentRegistry::setShown(DocumentText* document) {
+    shown = document;
+}
+
+std::vector<DocumentRegistry::Entry>::iterator DocumentRegistry::begin() {
+    return entries.begin();
+}
+
+std::vector<DocumentRegistry::Entry>::iterator DocumentRegistry::end() {
+    return entries.end();
+}
+
+std::vector<DocumentRegistry::Entry>::const_iterator DocumentRegistry::begin() const {
+    return entries.begin();
+}
+
+std::vector<DocumentRegistry::Entry>::const_iterator DocumentRegistry::end() const {
+    return entries.end();
+}
@@ -0,0 +1,66 @@
+#ifndef DOCUMENTREGISTRY_H
+#define DOCUMENTREGISTRY_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DocumentText.h"
+
+// What a tab keeps of the view while another tab is shown
+struct TabView {
+    size_t selectionStart = 0;
+    size_t selectionEnd = 0;
+    size_t firstVisibleLine = 0;
+    // The view's laid-out text, parked until the tab is shown again; owned
+    // by whoever owns the view. Null when it has to be built from the
+    // document again.
+    void* buffer = nullptr;
+};
+
+// The open documents in tab order, each with its path and its parked view,
+// and which of them the one view is showing. It knows nothing of windows,
+// and everything a tab switch asks of it takes the same time however many
+// tabs are open; only opening and closing tabs is linear.
+class DocumentRegistry {
+public:
+    struct Entry {
+        std::unique_ptr<DocumentText> document;
+        std::wstring path;
+        TabView view;
+    };
+
+    // Index of the new last tab
+    size_t add(std::unique_ptr<DocumentText> document, std::wstring path = L"");
+    // The entry goes back to the caller, who frees its view buffer
+    Entry remove(size_t index);
+    // Swaps in the document a load produced and returns the one it replaces
+    std::unique_ptr<DocumentText> replace(size_t index, std::unique_ptr<DocumentText> document);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool empty() const;
+    // Null when index is out of range
+    [[nodiscard]] DocumentText* get(int index) const;
+    [[nodiscard]] Entry& at(size_t index);
+    [[nodiscard]] const Entry& at(size_t index) const;
+    // -1 when the document is not open
+    [[nodiscard]] int indexOf(const DocumentText* document) const;
+
+    // The document the view is bound to, null for none. Closing it unbinds
+    // it without parking anything.
+    [[nodiscard]] DocumentText* getShown() const;
+    void setShown(DocumentText* document);
+
+    [[nodiscard]] std::vector<Entry>::iterator begin();
+    [[nodiscard]] std::vector<Entry>::iterator end();
+    [[nodiscard]] std::vector<Entry>::const_iterator begin() const;
+    [[nodiscard]] std::vector<Entry>::const_iterator end() const;
+
+private:
+    std::vector<Entry> entries;
+    std::unordered_map<const DocumentText*, size_t> indices;
+    DocumentText* shown = nullptr;
+};
+
+#endif // DOCUMENTREGISTRY_H
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "DocumentSaver.h"
+#include "FileIO.h"
+#include "Gzip.h"
+#include "Profiler.h"
+
+
+namespace {
+    constexpr char ROLLBACK_MAGIC[4] = { 'N', 'D', 'R', '1' };
+    constexpr size_t COPY_CHUNK = 4 * 1024 * 1024;
+
+    std::wstring rollbackPath(const std::wstring& path) {
+        return path + L".rollback";
+    }
+
+    OVERLAPPED at(uint64_t offset) {
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        return overlapped;
+    }
+
+    bool readAt(HANDLE hFile, uint64_t offset, char* data, size_t len) {
+        while (len > 0) {
+            OVERLAPPED overlapped = at(offset);
+            const DWORD want = static_cast<DWORD>(std::min(len, COPY_CHUNK));
+            DWORD got = 0;
+            if (!ReadFile(hFile, data, want, &got, &overlapped) || got != want) {
+                return false;
+            }
+            offset += got;
+            data += got;
+            len -= got;
+        }
+        return true;
+    }
+
+    bool writeAt(HANDLE hFile, uint64_t offset, const char* data, size_t len) {
+        while (len > 0) {
+            OVERLAPPED overlapped = at(offset);
+            const DWORD want = static_cast<DWORD>(std::min(len, COPY_CHUNK));
+            DWORD written = 0;
+            if (!WriteFile(hFile, data, want, &written, &overlapped) || written != want) {
+                return false;
+            }
+            offset += written;
+            data += written;
+            len -= written;
+        }
+        return true;
+    }
+
+    // Writes at increasing offsets from a starting point, with the
+    // FileWriter interface so writeText can drive it
+    class PositionedWriter {
+    public:
+        PositionedWriter(HANDLE hFile, uint64_t offset) : hFile(hFile), offset(offset) {}
+
+        std::string& getBlock() { return block; }
+
+        bool submitBlock() {
+            const bool ok = write(block);
+            block.clear();
+            return ok;
+        }
+
+        bool write(std::string_view data) {
+            failed = failed || !writeAt(hFile, offset, data.data(), data.size());
+            offset += data.size();
+            return !failed;
+        }
+
+        bool finish() { return submitBlock(); }
+
+    private:
+        HANDLE hFile;
+        uint64_t offset;
+        std::string block;
+        bool failed = false;
+    };
+
+    // Length of LF text once written in the given style
+    uint64_t fileLength(const TextSpans& text, EolStyle style) {
+        uint64_t length = text.size();
+        if (style == EolStyle::CRLF) {
+            for (const std::string_view chunk : text) {
+                length += std::count(chunk.begin(), chunk.end(), '\n');
+            }
+        }
+        return length;
+    }
+
+    // Sequential writes to the rollback file, keeping a CRC of everything
+    struct RollbackWriter {
+        HANDLE hFile;
+        uint64_t offset = 0;
+        uint32_t crc = 0;
+
+        bool write(const void* data, size_t len) {
+            crc = crc32(crc, static_cast<const char*>(data), len);
+            const bool ok = writeAt(hFile, offset, static_cast<const char*>(data), len);
+            offset += len;
+            return ok;
+        }
+    };
+
+    // Layout: magic, old size, old write time, record count, then for each
+    // record its offset, length and the old bytes, then a CRC of all of it
+    bool writeRollback(const std::wstring& path, HANDLE hTarget, const FileStamp& stamp,
+        const std::vector<std::pair<uint64_t, uint64_t>>& regions) {
+        HANDLE hFile = CreateFileW(rollbackPath(path).c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        RollbackWriter out{ hFile };
+        const uint64_t count = regions.size();
+        bool ok = out.write(ROLLBACK_MAGIC, sizeof(ROLLBACK_MAGIC)) && out.write(&stamp.size, sizeof(stamp.size)) &&
+            out.write(&stamp.lastWrite, sizeof(stamp.lastWrite)) && out.write(&count, sizeof(count));
+
+        std::vector<char> buffer(COPY_CHUNK);
+        for (const auto& [offset, len] : regions) {
+            ok = ok && out.write(&offset, sizeof(offset)) && out.write(&len, sizeof(len));
+            for (uint64_t done = 0; ok && done < len; done += buffer.size()) {
+                const size_t piece = static_cast<size_t>(std::min<uint64_t>(buffer.size(), len - done));
+                ok = readAt(hTarget, offset + done, buffer.data(), piece) && out.write(buffer.data(), piece);
+            }
+        }
+        const uint32_t crc = out.crc;
+        ok = ok && out.write(&crc, sizeof(crc)) && FlushFileBuffers(hFile);
+        CloseHandle(hFile);
+        return ok;
+    }
+}
+
+bool writeWhole(const std::wstring& path, const TextSpans& text, EolStyle style) {
+    PROFILE_SCOPE("writeWhole");
+    PROFILE_COUNT("bytes saved", text.size());
+    HANDLE hFile = openOverlapped(path, GENERIC_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    FileWriter writer(hFile);
+    bool saved;
+    if (isGzipPath(path)) {
+        GzipWriter gzip(writer);
+        const bool written = writeText(gzip, text, style);
+        saved = gzip.finish() && written;
+    }
+    else {
+        const bool written = writeText(writer, text, style);
+        saved = writer.finish() && written;
+    }
+    CloseHandle(hFile);
+    return saved;
+}
+
+SaveSnapshot takeSnapshot(const std::wstring& path, const DocumentText& document) {
+    SaveSnapshot snapshot;
+    snapshot.path = path;
+    snapshot.eolStyle = document.getEolStyle();
+    snapshot.version = document.getVersion();
+    snapshot.newSize = document.getFileOffset(document.getLength());
+
+    const DirtyRanges& dirty = document.getDirtyRanges();
+    FileStamp stamp;
+    snapshot.inPlace = dirty.isInSync() && !isGzipPath(path) && FileStamp::read(path, stamp) &&
+        stamp == document.getSavedStamp() &&
+        static_cast<int64_t>(snapshot.newSize) == static_cast<int64_t>(stamp.size) + dirty.getFileDelta();
+
+    snapshot.text = document.snapshot();
+    if (snapshot.inPlace) {
+        snapshot.baseStamp = stamp;
+        for (const auto& [start, end] : dirty.getWriteRanges(document.getLength())) {
+            snapshot.pieces.push_back({ document.getFileOffset(start), start, end });
+        }
+    }
+    return snapshot;
+}
+
+size_t SaveSnapshot::size() const {
+    if (!inPlace) {
+        return text.getLength();
+    }
+    size_t total = 0;
+    for (const Piece& piece : pieces) {
+        total += piece.end - piece.start;
+    }
+    return total;
+}
+
+bool writeSnapshot(const SaveSnapshot& snapshot) {
+    if (!snapshot.inPlace) {
+        return writeWhole(snapshot.path, snapshot.text.getSpans(0, snapshot.text.getLength()), snapshot.eolStyle);
+    }
+
+    PROFILE_SCOPE("writeSnapshot (in place)");
+    FileStamp stamp;
+    if (!FileStamp::read(snapshot.path, stamp) || !(stamp == snapshot.baseStamp)) {
+        return false; // changed on disk since the snapshot was taken
+    }
+    const uint64_t oldSize = stamp.size;
+    if (snapshot.pieces.empty() && snapshot.newSize == oldSize) {
+        return true;
+    }
+
+    // The old bytes at every offset about to be written or cut off
+    std::vector<std::pair<uint64_t, uint64_t>> regions;
+    for (const SaveSnapshot::Piece& piece : snapshot.pieces) {
+        const uint64_t fileEnd = std::min(piece.fileOffset +
+            fileLength(snapshot.text.getSpans(piece.start, piece.end - piece.start), snapshot.eolStyle), oldSize);
+        if (piece.fileOffset < fileEnd) {
+            regions.emplace_back(piece.fileOffset, fileEnd - piece.fileOffset);
+        }
+    }
+    if (snapshot.newSize < oldSize) {
+        if (!regions.empty() && regions.back().first + regions.back().second >= snapshot.newSize) {
+            regions.back().second = oldSize - regions.back().first;
+        }
+        else {
+            regions.emplace_back(snapshot.newSize, oldSize - snapshot.newSize);
+        }
+    }
+
+    HANDLE hFile = CreateFileW(snapshot.path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (!writeRollback(snapshot.path, hFile, stamp, regions)) {
+        CloseHandle(hFile);
+        DeleteFileW(rollbackPath(snapshot.path).c_str());
+        return false;
+    }
+
+    bool ok = true;
+    for (const SaveSnapshot::Piece& piece : snapshot.pieces) {
+        PositionedWriter writer(hFile, piece.fileOffset);
+        const bool written = writeText(writer, snapshot.text.getSpans(piece.start, piece.end - piece.start), snapshot.eolStyle);
+        if (!writer.finish() || !written) {
+            ok = false;
+            break;
+        }
+    }
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(snapshot.newSize);
+    ok = ok && SetFilePointerEx(hFile, size, nullptr, FILE_BEGIN) && SetEndOfFile(hFile) && FlushFileBuffers(hFile);
+    CloseHandle(hFile);
+    if (!ok) {
+        rollBackInterruptedSave(snapshot.path);
+        return false;
+    }
+
+    // The new file is complete on disk; only now is the old one let go
+    DeleteFileW(rollbackPath(snapshot.path).c_str());
+    return true;
+}
+
+bool saveInPlace(const std::wstring& path, DocumentText& document) {
+    // Only the changed text is written, so this costs what changed
+    const SaveSnapshot snapshot = takeSnapshot(path, document);
+    if (!snapshot.inPlace || !writeSnapshot(snapshot)) {
+        return false;
+    }
+    FileStamp stamp;
+    if (FileStamp::read(path, stamp)) {
+        document.markSaved(stamp);
+    }
+    return true;
+}
+
+void rollBackInterruptedSave(const std::wstring& path) {
+    const std::wstring rollback = rollbackPath(path);
+    HANDLE hFile = CreateFileW(rollback.c_str(), GENERIC_READ, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // A rollback file that is not intact was cut short before the target
+    // was touched, so there is nothing to undo
+    LARGE_INTEGER fileSize;
+    constexpr size_t HEADER_SIZE = sizeof(ROLLBACK_MAGIC) + 3 * sizeof(uint64_t);
+    bool valid = GetFileSizeEx(hFile, &fileSize) && static_cast<uint64_t>(fileSize.QuadPart) >= HEADER_SIZE + sizeof(uint32_t);
+    const uint64_t bodySize = valid ? fileSize.QuadPart - sizeof(uint32_t) : 0;
+    std::vector<char> buffer(COPY_CHUNK);
+    uint32_t crc = 0;
+    for (uint64_t done = 0; valid && done < bodySize; done += buffer.size()) {
+        const size_t piece = static_cast<size_t>(std::min<uint64_t>(buffer.size(), bodySize - done));
+        valid = readAt(hFile, done, buffer.data(), piece);
+        crc = crc32(crc, buffer.data(), piece);
+    }
+    uint32_t stored = 0;
+    char header[HEADER_SIZE];
+    valid = valid && readAt(hFile, bodySize, reinterpret_cast<char*>(&stored), sizeof(stored)) && stored == crc &&
+        readAt(hFile, 0, header, HEADER_SIZE) && memcmp(header, ROLLBACK_MAGIC, sizeof(ROLLBACK_MAGIC)) == 0;
+
+    bool applied = false;
+    HANDLE hTarget = valid
+        ? CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr)
+        : INVALID_HANDLE_VALUE;
+    if (hTarget != INVALID_HANDLE_VALUE) {
+        FileStamp stamp;
+        uint64_t count;
+        memcpy(&stamp.size, header + 4, sizeof(stamp.size));
+        memcpy(&stamp.lastWrite, header + 12, sizeof(stamp.lastWrite));
+        memcpy(&count, header + 20, sizeof(count));
+
+        applied = true;
+        uint64_t position = HEADER_SIZE;
+        for (uint64_t i = 0; applied && i < count; ++i) {
+            uint64_t region[2];
+            applied = readAt(hFile, position, reinterpret_cast<char*>(region), sizeof(region));
+            position += sizeof(region);
+            for (uint64_t done = 0; applied && done < region[1]; done += buffer.size()) {
+                const size_t piece = static_cast<size_t>(std::min<uint64_t>(buffer.size(), region[1] - done));
+                applied = readAt(hFile, position + done, buffer.data(), piece) &&
+                    writeAt(hTarget, region[0] + done, buffer.data(), piece);
+            }
+            position += region[1];
+        }
+
+        // The old write time comes back too, so a journal for the old file
+        // still applies
+        LARGE_INTEGER size;
+        size.QuadPart = static_cast<LONGLONG>(stamp.size);
+        FILETIME lastWrite{ static_cast<DWORD>(stamp.lastWrite), static_cast<DWORD>(stamp.lastWrite >> 32) };
+        applied = applied && SetFilePointerEx(hTarget, size, nullptr, FILE_BEGIN) && SetEndOfFile(hTarget) &&
+            FlushFileBuffers(hTarget) && SetFileTime(hTarget, nullptr, nullptr, &lastWrite);
+        CloseHandle(hTarget);
+    }
+    CloseHandle(hFile);
+
+    // A rollback that could not be applied is kept for the next attempt
+    if (!valid || applied) {
+        DeleteFileW(rollback.c_str());
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef DOCUMENTSAVER_H
+#define DOCUMENTSAVER_H
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "DocumentText.h"
+
+// Writing documents back to their files. The buffer holds LF line breaks;
+// they go out in the style the file was opened with.
+
+constexpr size_t WRITE_BLOCK = 64 * 1024;
+
+// Writes text through anything with the FileWriter interface. LF files go
+// out span by span, the others are translated a block at a time while the
+// previous block is being written. Stops at the first write that fails;
+// the writer's finish() still has to be called.
+template <typename Writer>
+bool writeText(Writer& writer, const TextSpans& text, EolStyle style) {
+    if (style == EolStyle::LF) {
+        for (const std::string_view chunk : text) {
+            if (!writer.write(chunk)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const std::string_view eol = style == EolStyle::CRLF ? "\r\n" : "\r";
+    for (const std::string_view chunk : text) {
+        const char* run = chunk.data();
+        const char* stop = chunk.data() + chunk.size();
+        while (run < stop) {
+            const char* newline = static_cast<const char*>(memchr(run, '\n', stop - run));
+            const char* lineEnd = newline != nullptr ? newline : stop;
+            if (static_cast<size_t>(lineEnd - run) >= WRITE_BLOCK) {
+                // Long runs skip the copy
+                if (!writer.write(std::string_view(run, lineEnd - run))) {
+                    return false;
+                }
+            }
+            else {
+                writer.getBlock().append(run, lineEnd);
+            }
+            if (newline != nullptr) {
+                writer.getBlock() += eol;
+            }
+            run = newline != nullptr ? newline + 1 : stop;
+            if (writer.getBlock().size() >= WRITE_BLOCK && !writer.submitBlock()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Replaces the file with the text; .gz files are compressed on the way out
+bool writeWhole(const std::wstring& path, const TextSpans& text, EolStyle style);
+
+// What saving a document has to write, taken so the writing can run on
+// another thread while editing goes on. The text is a DocumentSnapshot, so
+// nothing is copied; when the file can be patched in place the pieces are
+// the ranges of it that changed.
+struct SaveSnapshot {
+    struct Piece {
+        uint64_t fileOffset;
+        size_t start, end; // in the text
+    };
+
+    std::wstring path;
+    EolStyle eolStyle = EolStyle::CRLF;
+    size_t version = 0;
+    bool inPlace = false;
+    FileStamp baseStamp; // the file the pieces patch
+    uint64_t newSize = 0;
+    DocumentSnapshot text;
+    std::vector<Piece> pieces;
+
+    // Bytes of text the save writes
+    [[nodiscard]] size_t size() const;
+};
+
+[[nodiscard]] SaveSnapshot takeSnapshot(const std::wstring& path, const DocumentText& document);
+
+// Safe on any thread. A failed in-place write is rolled back.
+bool writeSnapshot(const SaveSnapshot& snapshot);
+
+// Saves over the file the document last matched by writing only what
+// changed since: edited text, plus unchanged text that moved because an
+// edit before it changed the length. A same-length edit costs one positioned
+// write; otherwise everything from the first change on is rewritten.
+// The bytes about to be overwritten are copied to a rollback file first, so
+// a crash leaves the old file or the new one, never a mix.
+// Returns false, leaving the file as it was, when the document never matched
+// the file, the file changed on disk since, it is compressed, or a write
+// failed. The caller then saves the whole document instead.
+bool saveInPlace(const std::wstring& path, DocumentText& document);
+
+// Restores the file an interrupted in-place save was writing, if there is
+// one. Called before the file is read.
+void rollBackInterruptedSave(const std::wstring& path);
+
+#endif // DOCUMENTSAVER_H
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "DocumentSearch.h"
+#include "Profiler.h"
+
+
+DocumentSearch::DocumentSearch(const DocumentText& document)
+    : document(document) {}
+
+void DocumentSearch::reset() {
+    const size_t length = document.getLength();
+    blocks.assign((length + BLOCK_SIZE - 1) / BLOCK_SIZE, Block{});
+    version = document.getVersion();
+    nextBlock = 0;
+    remaining = query.empty() ? 0 : blocks.size();
+    if (query.empty()) {
+        for (Block& block : blocks) {
+            block.state = BlockState::Done;
+        }
+    }
+}
+
+void DocumentSearch::setQuery(const std::string& text, size_t viewStart, size_t viewEnd) {
+    const bool refines = !query.empty() && text.size() > query.size() &&
+        text.compare(0, query.size(), query) == 0;
+    const bool stale = version != document.getVersion() ||
+        blocks.size() != (document.getLength() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    query = text;
+    if (stale || !refines) {
+        reset();
+    }
+    else {
+        // Every hit of the longer query is also a hit of the old one, so the
+        // old hits become candidates and only those are checked again.
+        remaining = 0;
+        for (Block& block : blocks) {
+            if (block.state == BlockState::Done) {
+                block.state = BlockState::Verify;
+            }
+            ++remaining;
+        }
+    }
+
+    if (blocks.empty() || remaining == 0) {
+        return;
+    }
+
+    // The visible part of the document is resolved before returning.
+    const size_t first = std::min(viewStart / BLOCK_SIZE, blocks.size() - 1);
+    const size_t last = std::min((viewEnd > viewStart ? viewEnd - 1 : viewStart) / BLOCK_SIZE, blocks.size() - 1);
+    for (size_t i = first; i <= last; ++i) {
+        processBlock(i);
+    }
+    nextBlock = (last + 1) % blocks.size();
+}
+
+bool DocumentSearch::searchMore(size_t budget) {
+    PROFILE_SCOPE("DocumentSearch::searchMore");
+    if (version != document.getVersion()) {
+        reset();
+    }
+
+    size_t processed = 0;
+    while (remaining > 0 && processed < budget) {
+        while (blocks[nextBlock].state == BlockState::Done) {
+            nextBlock = (nextBlock + 1) % blocks.size();
+        }
+        processBlock(nextBlock);
+        processed += BLOCK_SIZE;
+    }
+    return remaining > 0;
+}
+
+void DocumentSearch::clear() {
+    query.clear();
+    reset();
+}
+
+void DocumentSearch::processBlock(size_t index) {
+    Block& block = blocks[index];
+    if (block.state == BlockState::Done) {
+        return;
+    }
+    if (block.state == BlockState::Verify) {
+        verifyBlock(index);
+    }
+    else {
+        scanBlock(index);
+    }
+    block.state = BlockState::Done;
+    --remaining;
+}
+
+void DocumentSearch::scanBlock(size_t index) {
+    Block& block = blocks[index];
+    block.hits.clear();
+
+    const size_t start = index * BLOCK_SIZE;
+    const size_t end = std::min(start + BLOCK_SIZE, document.getLength());
+    // Read past the block end so matches straddling the boundary are found
+    // by the block they start in.
+    const size_t readLen = std::min(end - start + query.size() - 1, document.getLength() - start);
+
+    // Search the text in place unless the block straddles two stored blocks
+    const TextSpans spans = document.getSpans(start, readLen);
+    const char* first;
+    if (spans.count() == 1) {
+        first = spans[0].data();
+    }
+    else {
+        scratch.resize(readLen + 1);
+        document.getText(start, readLen, scratch.data());
+        first = scratch.data();
+    }
+    const char* last = first + readLen;
+    const std::boyer_moore_horspool_searcher searcher(query.begin(), query.end());
+    for (const char* it = std::search(first, last, searcher); it != last; it = std::search(it + 1, last, searcher)) {
+        const size_t position = start + (it - first);
+        if (position >= end) {
+            break;
+        }
+        block.hits.push_back(position);
+    }
+}
+
+void DocumentSearch::verifyBlock(size_t index) {
+    Block& block = blocks[index];
+    const size_t length = document.getLength();
+
+    size_t kept = 0;
+    for (const size_t candidate : block.hits) {
+        if (candidate + query.size() > length) {
+            continue;
+        }
+        size_t compared = 0;
+        bool matches = true;
+        for (const std::string_view chunk : document.getSpans(candidate, query.size())) {
+            if (memcmp(chunk.data(), query.data() + compared, chunk.size()) != 0) {
+                matches = false;
+                break;
+            }
+            compared += chunk.size();
+        }
+        if (matches) {
+            block.hits[kept++] = candidate;
+        }
+    }
+    block.hits.resize(kept);
+}
+
+std::vector<size_t> DocumentSearch::getMatches(size_t start, size_t end) const {
+    std::vector<size_t> result;
+    if (version != document.getVersion() || blocks.empty() || start >= end) {
+        return result;
+    }
+
+    const size_t last = std::min((end - 1) / BLOCK_SIZE, blocks.size() - 1);
+    for (size_t i = start / BLOCK_SIZE; i <= last; ++i) {
+        if (blocks[i].state != BlockState::Done) {
+            continue;
+        }
+        for (const size_t hit : blocks[i].hits) {
+            if (hit >= start && hit < end) {
+                result.push_back(hit);
+            }
+        }
+    }
+    return result;
+}
+
+size_t DocumentSearch::findNext(size_t position) const {
+    if (version != document.getVersion() || blocks.empty()) {
+        return npos;
+    }
+
+    // Search forward from the position, then wrap around to the top.
+    const size_t first = std::min(position / BLOCK_SIZE, blocks.size() - 1);
+    for (size_t n = 0; n <= blocks.size(); ++n) {
+        const size_t i = (first + n) % blocks.size();
+        if (blocks[i].state != BlockState::Done) {
+            continue;
+        }
+        for (const size_t hit : blocks[i].hits) {
+            if (n > 0 || hit >= position) {
+                return hit;
+            }
+        }
+    }
+    return npos;
+}
+
+size_t DocumentSearch::getMatchCount() const {
+    size_t count = 0;
+    for (const Block& block : blocks) {
+        if (block.state == BlockState::Done) {
+            count += block.hits.size();
+        }
+    }
+    return count;
+}
+
+bool DocumentSearch::isComplete() const {
+    return remaining == 0 && version == document.getVersion();
+}
+
+bool DocumentSearch::isCurrent() const {
+    return version == document.getVersion();
+}
+
+const std::string& DocumentSearch::getQuery() const {
+    return query;
+}
+
+const DocumentText* DocumentSearch::getDocument() const {
+    return &document;
+}
@@ -0,0 +1,55 @@
+#ifndef DOCUMENTSEARCH_H
+#define DOCUMENTSEARCH_H
+
+#include <string>
+#include <vector>
+
+#include "DocumentText.h"
+
+// Incremental search over a DocumentText.
+// The document is split into fixed blocks that are searched viewport first and
+// then lazily in the background. When the query grows by appending characters,
+// the previous hits are only re-verified instead of scanning the text again.
+class DocumentSearch {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit DocumentSearch(const DocumentText& document);
+
+    void setQuery(const std::string& text, size_t viewStart, size_t viewEnd);
+    bool searchMore(size_t budget);
+    void clear();
+
+    [[nodiscard]] std::vector<size_t> getMatches(size_t start, size_t end) const;
+    [[nodiscard]] size_t findNext(size_t position) const;
+    [[nodiscard]] size_t getMatchCount() const;
+    [[nodiscard]] bool isComplete() const;
+    // False once the document has changed since the hits were found
+    [[nodiscard]] bool isCurrent() const;
+    [[nodiscard]] const std::string& getQuery() const;
+    [[nodiscard]] const DocumentText* getDocument() const;
+
+private:
+    enum class BlockState { Pending, Verify, Done };
+
+    struct Block {
+        BlockState state = BlockState::Pending;
+        std::vector<size_t> hits;
+    };
+
+    const DocumentText& document;
+    std::string query;
+    std::vector<Block> blocks;
+    size_t version = 0;
+    size_t nextBlock = 0;
+    size_t remaining = 0;
+    std::vector<char> scratch;
+
+    void reset();
+    void processBlock(size_t index);
+    void scanBlock(size_t index);
+    void verifyBlock(size_t index);
+};
+
+#endif // DOCUMENTSEARCH_H
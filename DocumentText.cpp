@@ -7,26 +7,111 @@
 #pragma comment(lib, "Comctl32.lib")
 #include <memory>
 #include <stack>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 
 #include "DocumentText.h"
+#include "FileIO.h"
+#include "Gzip.h"
+#include "LzCodec.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
 
 
 
-DocumentText::DocumentText(HWND parentWindow)
-    : textboxhwnd(parentWindow), buffer(nullptr), bufferSize(0),
-          gapStart(0), gapEnd(0), gapSize(0) {}
+size_t DocumentSnapshot::getLength() const {
+    return blocks.getLength();
+}
+
+size_t DocumentSnapshot::getVersion() const {
+    return version;
+}
+
+EolStyle DocumentSnapshot::getEolStyle() const {
+    return eolStyle;
+}
 
-DocumentText::~DocumentText() {
-    delete[] buffer;
+TextSpans DocumentSnapshot::getSpans(size_t pos, size_t len) const {
+    return blocks.getSpans(pos, len);
+}
+
+CompressedText CompressedText::compress(const DocumentSnapshot& snapshot) {
+    PROFILE_SCOPE("CompressedText::compress");
+    CompressedText text;
+    text.account = snapshot.blocks.getAccount();
+    text.length = snapshot.getLength();
+    text.version = snapshot.getVersion();
+    // Made one by one, since a copy of a chunk would not be charged
+    const size_t count = (text.length + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    text.chunks.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        text.chunks.emplace_back(TaggedAllocator<char, MemoryTag::Compressed>(text.account.get()));
+    }
+    {
+        TaskGroup tasks;
+        for (size_t i = 0; i < text.chunks.size(); ++i) {
+            tasks.run([&, i] {
+                std::string chunk;
+                chunk.reserve(CHUNK_SIZE);
+                for (const std::string_view span : snapshot.getSpans(i * CHUNK_SIZE, CHUNK_SIZE)) {
+                    chunk.append(span);
+                }
+                std::string compressed;
+                lzCompress(chunk, compressed);
+                // An exact fit, charged to the document
+                text.chunks[i].assign(compressed.data(), compressed.size());
+            }, TaskPriority::Idle);
+        }
+        tasks.wait();
+    }
+    for (const Chunk& chunk : text.chunks) {
+        text.compressedSize += chunk.size();
+    }
+    return text;
 }
 
+bool CompressedText::decompress(char* output) const {
+    // Someone is waiting for the text, so it goes ahead of other work
+    std::atomic<bool> failed{ false };
+    TaskGroup tasks;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        tasks.run([&, i] {
+            const size_t start = i * CHUNK_SIZE;
+            if (!lzDecompress(chunks[i], output + start, std::min(CHUNK_SIZE, length - start))) {
+                failed = true;
+            }
+        }, TaskPriority::Visible);
+    }
+    tasks.wait();
+    return !failed;
+}
+
+size_t CompressedText::getLength() const {
+    return length;
+}
+
+size_t CompressedText::getVersion() const {
+    return version;
+}
+
+size_t CompressedText::getCompressedSize() const {
+    return compressedSize;
+}
+
+DocumentText::DocumentText(HWND parentWindow)
+    : memoryAccount(std::make_shared<MemoryAccount>()),
+      lineStarts(memoryAccount),
+      textboxhwnd(parentWindow),
+      blocks(memoryAccount) {}
+
 bool DocumentText::initFile(const wchar_t* filename) {
-    HANDLE hFile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    HANDLE hFile = openOverlapped(filename, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN);
     if (hFile == INVALID_HANDLE_VALUE) {
         MessageBoxW(textboxhwnd, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
         return false;
     }
-    bool result = initHandle(hFile);
+    bool result = isGzipPath(filename) ? initCompressed(hFile) : initHandle(hFile);
     CloseHandle(hFile);
     if (!result) {
         MessageBoxW(textboxhwnd, L"Failed to initialize file buffer", L"Error", MB_OK | MB_ICONERROR);
@@ -35,79 +120,261 @@ bool DocumentText::initFile(const wchar_t* filename) {
 }
 
 bool DocumentText::initHandle(HANDLE hFile) {
-    const DWORD fileSize = GetFileSize(hFile, nullptr);
-    if (fileSize == INVALID_FILE_SIZE) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
         return false;
     }
+    const size_t fileSize = static_cast<size_t>(size.QuadPart);
+
+    // Each chunk is indexed while the next one is read
+    beginLoad(fileSize);
+    size_t bytesRead = 0;
+    for (const size_t available : readChunks(hFile, getLoadBuffer(), fileSize, LOAD_CHUNK, LOAD_CHUNK)) {
+        bytesRead = available;
+        appendLoaded(bytesRead);
+    }
+    if (bytesRead != fileSize) {
+        loadBuffer.reset();
+        return false;
+    }
+    finishLoad();
+    return true;
+}
 
-    bufferSize = fileSize + 1024;
-    buffer = new char[bufferSize];
-
+bool DocumentText::initCompressed(HANDLE hFile) {
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
+        return false;
+    }
+    const size_t fileSize = static_cast<size_t>(size.QuadPart);
 
-    DWORD bytesRead;
-    if (!ReadFile(hFile, buffer, fileSize, &bytesRead, nullptr) || bytesRead != fileSize) {
-        delete[] buffer;
-        buffer = nullptr;
+    std::string compressed(fileSize, '\0');
+    size_t bytesRead = 0;
+    for (const size_t available : readChunks(hFile, compressed.data(), fileSize, LOAD_CHUNK, LOAD_CHUNK)) {
+        bytesRead = available;
+    }
+    if (bytesRead != fileSize || !loadGzip(compressed, *this, nullptr)) {
+        loadBuffer.reset();
         return false;
     }
+    finishLoad();
+    return true;
+}
 
-    gapStart = fileSize;
-    gapEnd = bufferSize;
-    gapSize = gapEnd - gapStart;
+void DocumentText::beginLoad(size_t fileSize) {
+    // The file is read into one allocation that becomes the document's
+    // first block, so loading copies nothing
+    blocks.clear();
+    dehydrated.reset();
+    loadCapacity = fileSize + 1024;
+    loadBuffer = allocateShared(memoryAccount, MemoryTag::Text, loadCapacity);
+
+    loadSize = fileSize;
+    loadRaw = 0;
+    loadLength = 0;
+    std::fill(std::begin(eolCounts), std::end(eolCounts), 0);
+    lineStarts.reset(0);
+    lineStarts.push_back(0);
+}
 
-    updateLineStarts();
-    return true;
+void DocumentText::resizeLoad(size_t fileSize) {
+    // For sources that only learn their size as they go, like compressed files
+    if (fileSize + 1024 > loadCapacity) {
+        std::shared_ptr<char[]> newBuffer = allocateShared(memoryAccount, MemoryTag::Text, fileSize + 1024);
+        memcpy(newBuffer.get(), loadBuffer.get(), loadCapacity);
+        loadBuffer = std::move(newBuffer);
+        loadCapacity = fileSize + 1024;
+    }
+    loadSize = fileSize;
 }
 
-void DocumentText::getText(const size_t pos, const size_t len, char* temp) const {
-    if (pos >= getLength() || len == 0) {
-        temp[0] = '\0';
-        return;
+char* DocumentText::getLoadBuffer() const {
+    return loadBuffer.get();
+}
+
+size_t DocumentText::appendLoaded(size_t rawLength) {
+    // CRLF and lone CR are folded to LF in place and the line index is built
+    // in the same pass. Normalizing only ever shrinks the text, so the output
+    // never overtakes the raw bytes still to be read. memchr does the
+    // scanning so the common no-CR case runs at memory speed.
+    if (indexAdopted && eolStyle == EolStyle::LF && !mixedEol) {
+        // Nothing to fold and the lines are known
+        loadRaw = loadLength = rawLength;
+        return loadLength;
+    }
+
+    char* const buffer = loadBuffer.get();
+    const char* const rawEnd = buffer + rawLength;
+    const char* end = rawEnd;
+    if (rawLength < loadSize && end > buffer + loadRaw && end[-1] == '\r') {
+        --end; // may be the first half of a CRLF split across reads
+    }
+    const char* src = buffer + loadRaw;
+    char* dst = buffer + loadLength;
+    const char* nextCR = static_cast<const char*>(memchr(src, '\r', end - src));
+    const char* nextLF = static_cast<const char*>(memchr(src, '\n', end - src));
+
+    while (nextCR != nullptr || nextLF != nullptr) {
+        const char* eol = (nextCR == nullptr || (nextLF != nullptr && nextLF < nextCR)) ? nextLF : nextCR;
+        const bool isLF = *eol == '\n';
+        if (dst != src) {
+            memmove(dst, src, eol - src);
+        }
+        dst += eol - src;
+        *dst++ = '\n';
+
+        if (isLF) {
+            ++eolCounts[static_cast<int>(EolStyle::LF)];
+            src = eol + 1;
+        }
+        else if (eol + 1 < rawEnd && eol[1] == '\n') {
+            ++eolCounts[static_cast<int>(EolStyle::CRLF)];
+            src = eol + 2;
+        }
+        else {
+            ++eolCounts[static_cast<int>(EolStyle::CR)];
+            src = eol + 1;
+        }
+        if (!indexAdopted) {
+            lineStarts.push_back(dst - buffer);
+        }
+
+        if (nextLF != nullptr && nextLF < src) {
+            nextLF = src < end ? static_cast<const char*>(memchr(src, '\n', end - src)) : nullptr;
+        }
+        if (nextCR != nullptr && nextCR < src) {
+            nextCR = src < end ? static_cast<const char*>(memchr(src, '\r', end - src)) : nullptr;
+        }
+    }
+    if (src < end) {
+        if (dst != src) {
+            memmove(dst, src, end - src);
+        }
+        dst += end - src;
+        src = end;
     }
 
-    const size_t end = std::min(pos + len, getLength());
-    const size_t actualLen = end - pos;
+    loadRaw = src - buffer;
+    loadLength = dst - buffer;
+    return loadLength;
+}
 
-    if (pos < gapStart) {
-        const size_t beforeGap = std::min(actualLen, gapStart - pos);
-        memcpy(temp, buffer + pos, beforeGap);
+void DocumentText::adoptIndex(LineIndex index, EolStyle style, bool mixed) {
+    lineStarts = std::move(index);
+    eolStyle = style;
+    mixedEol = mixed;
+    indexAdopted = true;
+}
 
-        if (beforeGap < actualLen) {
-            size_t afterGap = actualLen - beforeGap;
-            memcpy(temp + beforeGap, buffer + gapEnd, afterGap);
+void DocumentText::finishLoad() {
+    blocks.adopt(std::move(loadBuffer), loadLength);
+    if (indexAdopted) {
+        indexAdopted = false;
+        if (lineStarts.getTextLength() != loadLength) {
+            updateLineStarts(); // the cache was wrong after all
         }
+        lineStarts.setTextLength(loadLength);
+        markers.reset(loadLength);
+        dirtyRanges.reset(false);
+        bumpVersion();
+        savedVersion = version;
+        return;
+    }
+
+    // Files without line breaks keep the Windows default
+    const size_t lf = eolCounts[static_cast<int>(EolStyle::LF)];
+    const size_t crlf = eolCounts[static_cast<int>(EolStyle::CRLF)];
+    const size_t cr = eolCounts[static_cast<int>(EolStyle::CR)];
+    if (lf > crlf && lf >= cr) {
+        eolStyle = EolStyle::LF;
+    }
+    else if (cr > crlf && cr > lf) {
+        eolStyle = EolStyle::CR;
     }
     else {
-        memcpy(temp, buffer + pos + gapSize, actualLen);
+        eolStyle = EolStyle::CRLF;
     }
+    mixedEol = (lf != 0) + (crlf != 0) + (cr != 0) > 1;
 
-    temp[actualLen] = '\0';
+    lineStarts.setTextLength(loadLength);
+    markers.reset(loadLength);
+    dirtyRanges.reset(false);
+    bumpVersion();
+    savedVersion = version;
 }
 
-void DocumentText::insertText(const char* text, size_t len, size_t position) {
-    if (buffer == nullptr) {
-        bufferSize = std::max(len + 1024, static_cast<size_t>(1024));
-        buffer = new char[bufferSize];
-        gapStart = 0;
-        gapEnd = bufferSize;
-        gapSize = bufferSize;
+std::string DocumentText::normalizeEol(std::string_view text) {
+    std::string result;
+    result.reserve(text.size());
+    size_t run = 0;
+    for (size_t cr = text.find('\r'); cr != std::string_view::npos; cr = text.find('\r', run)) {
+        result.append(text, run, cr - run);
+        result += '\n';
+        run = (cr + 1 < text.size() && text[cr + 1] == '\n') ? cr + 2 : cr + 1;
     }
+    result.append(text, run, text.size() - run);
+    return result;
+}
 
-    moveGap(position);
-
-    // Ensure that the gap can accommodate the new text.
-    while (len > gapSize) {
-        expandBuffer();
+void DocumentText::getText(const size_t pos, const size_t len, char* temp) const {
+    size_t copied = 0;
+    for (const std::string_view chunk : getSpans(pos, len)) {
+        memcpy(temp + copied, chunk.data(), chunk.size());
+        copied += chunk.size();
     }
+    temp[copied] = '\0';
+}
 
-    // Perform the copy only when the gap size is sufficient.
-    if (len <= gapSize) {
-        memcpy(buffer + gapStart, text, len);
-        gapStart += len;
-        gapSize -= len;
+TextSpans DocumentText::getSpans(const size_t pos, const size_t len) const {
+    rehydrate();
+    return blocks.getSpans(pos, len);
+}
+
+DocumentSnapshot DocumentText::snapshot() const {
+    rehydrate();
+    DocumentSnapshot snapshot;
+    snapshot.blocks = blocks;
+    snapshot.version = version;
+    snapshot.eolStyle = eolStyle;
+    return snapshot;
+}
+
+void DocumentText::insertText(const char* text, size_t len, size_t position) {
+    PROFILE_SCOPE("DocumentText::insertText");
+    PROFILE_COUNT("bytes inserted", len);
+    position = std::min(position, getLength());
+    const size_t newlines = insertInText(text, len, position);
+    dirtyRanges.onEdit(position, position, len, static_cast<int64_t>(eolStyle == EolStyle::CRLF ? len + newlines : len));
+    for (const auto& [id, listener] : editListeners) {
+        if (listener.onTextInserted) {
+            listener.onTextInserted(position, text, len);
+        }
     }
+}
+
+size_t DocumentText::insertInText(const char* text, size_t len, size_t position) {
+    rehydrate();
+    markers.onInsert(position, len);
+    blocks.insert(position, text, len);
 
-    updateLineStarts();
+    bumpVersion();
+    const size_t linesBefore = lineStarts.size();
+    lineStarts.onInsert(position, text, len);
+    return lineStarts.size() - linesBefore;
+}
+
+void DocumentText::appendFromFile(std::string_view raw, const FileStamp& stamp) {
+    // The file grew by the same text, so it still matches the document as
+    // well as it did, and any dirty ranges still hold
+    const bool matched = !isModified();
+    const std::string text = normalizeEol(raw);
+    if (!text.empty()) {
+        insertInText(text.data(), text.size(), getLength());
+    }
+    savedStamp = stamp;
+    if (matched) {
+        savedVersion = version;
+    }
 }
 
 
@@ -115,79 +382,172 @@ void DocumentText::deleteText(size_t start, size_t end) {
     if (start >= end || start >= getLength() || end > getLength()) {
         return;
     }
-
-    moveGap(start);
-    const size_t deleteSize = end - start;
-    gapEnd = std::min(gapEnd + deleteSize, bufferSize);
-    gapSize = gapEnd - gapStart;
-
-    updateLineStarts();
+    PROFILE_SCOPE("DocumentText::deleteText");
+    PROFILE_COUNT("bytes deleted", end - start);
+
+    rehydrate();
+    markers.onDelete(start, end);
+    const size_t linesBefore = lineStarts.size();
+    lineStarts.onDelete(start, end);
+    const size_t newlines = linesBefore - lineStarts.size();
+    const size_t removed = eolStyle == EolStyle::CRLF ? end - start + newlines : end - start;
+    dirtyRanges.onEdit(start, end, 0, -static_cast<int64_t>(removed));
+    blocks.erase(start, end);
+
+    bumpVersion();
+    for (const auto& [id, listener] : editListeners) {
+        if (listener.onTextDeleted) {
+            listener.onTextDeleted(start, end);
+        }
+    }
 }
 
 size_t DocumentText::getLength() const {
-    return bufferSize - gapSize;
+    return dehydrated ? dehydrated->getLength() : blocks.getLength();
 }
 
-void DocumentText::moveGap(size_t position) {
-    if (position == gapStart)
-        return;
+bool DocumentText::dehydrate(CompressedText text) {
+    if (dehydrated || text.getVersion() != version || text.getLength() != getLength() ||
+        text.getCompressedSize() >= text.getLength()) {
+        return false;
+    }
+    blocks.clear();
+    dehydrated = std::make_unique<CompressedText>(std::move(text));
+    return true;
+}
 
-    // Clamp logical position to valid text range
-    if (const size_t textLength = getLength(); position > textLength)
-        position = textLength;
+void DocumentText::rehydrate() const {
+    if (!dehydrated) {
+        return;
+    }
+    PROFILE_SCOPE("DocumentText::rehydrate");
+    const size_t length = dehydrated->getLength();
+    std::shared_ptr<char[]> storage = allocateShared(memoryAccount, MemoryTag::Text, length);
+    if (!dehydrated->decompress(storage.get())) {
+        throw std::runtime_error("Dehydrated text could not be restored");
+    }
+    blocks.adopt(std::move(storage), length);
+    dehydrated.reset();
+}
 
-    if (position < gapStart) {
-        // Move gap left
-        const size_t moveSize = gapStart - position;
-        memmove(buffer + gapEnd - moveSize,
-                buffer + position,
-                moveSize);
-        gapStart -= moveSize;
-        gapEnd   -= moveSize;
-    } else {
-        // Move gap right
-        size_t moveSize = position - gapStart;
+bool DocumentText::isDehydrated() const {
+    return dehydrated != nullptr;
+}
 
-        // moveSize bytes physically begin at gapEnd
-        memmove(buffer + gapStart,
-                buffer + gapEnd,
-                moveSize);
+size_t DocumentText::getTextMemory() const {
+    return dehydrated ? dehydrated->getCompressedSize() : blocks.getLength();
+}
 
-        gapStart += moveSize;
-        gapEnd   += moveSize;
+MemoryReport DocumentText::getMemoryReport() const {
+    // Reserved bytes come from the account; live ones from what each
+    // component holds now. A loaded file keeps the bytes its line breaks
+    // were folded out of as slack until that block is cut away.
+    MemoryReport report;
+    for (size_t tag = 0; tag < static_cast<size_t>(MemoryTag::Count); ++tag) {
+        report.components[tag].reserved = memoryAccount->getReserved(static_cast<MemoryTag>(tag));
     }
+    report[MemoryTag::Text].live = blocks.getLength();
+    report[MemoryTag::LineIndex].live = lineStarts.getLiveBytes();
+    report[MemoryTag::Undo].live = memoryAccount->getLive(MemoryTag::Undo);
+    report[MemoryTag::Compressed].live = dehydrated ? dehydrated->getCompressedSize() : 0;
+    return report;
+}
+
+const std::shared_ptr<MemoryAccount>& DocumentText::getMemoryAccount() const {
+    return memoryAccount;
+}
+
+size_t DocumentText::getVersion() const {
+    return version;
 }
 
-void DocumentText::expandBuffer() {
-    size_t newSize = bufferSize * 2;
-    char* newBuffer = new char[newSize];
+CancelToken DocumentText::cancelToken() const {
+    return cancelSource.token();
+}
 
-    // Copy content before gap
-    memcpy(newBuffer, buffer, gapStart);
+void DocumentText::bumpVersion() {
+    ++version;
+    cancelSource.advance(version);
+}
 
-    // Copy content after gap
-    const size_t afterGapSize = bufferSize - gapEnd;
-    memcpy(newBuffer + newSize - afterGapSize, buffer + gapEnd, afterGapSize);
+EolStyle DocumentText::getEolStyle() const {
+    return eolStyle;
+}
 
-    delete[] buffer;
-    buffer = newBuffer;
-    gapEnd = newSize - afterGapSize;
-    gapSize = gapEnd - gapStart;
-    bufferSize = newSize;
+bool DocumentText::hasMixedEol() const {
+    return mixedEol;
+}
+
+size_t DocumentText::addEditListener(EditListener listener) {
+    const size_t id = nextListener++;
+    editListeners.emplace_back(id, std::move(listener));
+    return id;
+}
+
+void DocumentText::removeEditListener(size_t id) {
+    std::erase_if(editListeners, [id](const auto& entry) { return entry.first == id; });
+}
+
+DocumentMarkers& DocumentText::getMarkers() {
+    return markers;
+}
+
+const DocumentMarkers& DocumentText::getMarkers() const {
+    return markers;
+}
+
+void DocumentText::markLoaded(const FileStamp& stamp) {
+    savedStamp = stamp;
+    dirtyRanges.reset(!mixedEol);
+}
+
+void DocumentText::markSaved(const FileStamp& stamp) {
+    markSaved(stamp, version);
+}
+
+void DocumentText::markSaved(const FileStamp& stamp, size_t savedVersion) {
+    // Saving writes every line break in the one style
+    savedStamp = stamp;
+    this->savedVersion = savedVersion;
+    mixedEol = false;
+    dirtyRanges.reset(savedVersion == version);
+}
+
+void DocumentText::markReloaded(const FileStamp& stamp, EolStyle style, bool mixed) {
+    eolStyle = style;
+    mixedEol = mixed;
+    savedStamp = stamp;
+    savedVersion = version;
+    dirtyRanges.reset(!mixed);
+}
+
+bool DocumentText::isModified() const {
+    return version != savedVersion;
+}
+
+const FileStamp& DocumentText::getSavedStamp() const {
+    return savedStamp;
+}
+
+const DirtyRanges& DocumentText::getDirtyRanges() const {
+    return dirtyRanges;
+}
+
+uint64_t DocumentText::getFileOffset(size_t position) const {
+    return eolStyle == EolStyle::CRLF ? position + lineStarts.lineOf(position) : position;
 }
 
 void DocumentText::updateLineStarts() {
-    lineStarts.clear();
+    PROFILE_SCOPE("DocumentText::updateLineStarts");
+    lineStarts.reset(getLength());
     lineStarts.push_back(0);
-    for (size_t i = 0; i < gapStart; ++i) {
-        if (buffer[i] == '\n') {
-            lineStarts.push_back(i + 1);
-        }
-    }
-    for (size_t i = gapEnd; i < bufferSize; ++i) {
-        if (buffer[i] == '\n') {
-            lineStarts.push_back(i - gapSize + 1);
+    size_t offset = 0;
+    for (const std::string_view chunk : getSpans(0, getLength())) {
+        const char* end = chunk.data() + chunk.size();
+        for (const char* p = chunk.data(); (p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr; ++p) {
+            lineStarts.push_back(offset + (p - chunk.data()) + 1);
         }
+        offset += chunk.size();
     }
 }
 
@@ -197,47 +557,180 @@ ULONG DocumentText::get_line(ULONG lineno, char* buf, size_t len) const {
     }
     size_t lineStart = lineStarts[lineno];
     size_t lineEnd = (lineno + 1 < lineStarts.size()) ? lineStarts[lineno + 1] - 1 : getLength();
-    size_t lineLength = lineEnd - lineStart;
+    size_t lineLength = std::min(lineEnd - lineStart, len);
 
-    if (lineStart < gapStart) {
-        lineLength = std::min(lineLength, len);
-        memcpy(buf, buffer + lineStart, lineLength);
+    // A line may straddle blocks, so copy it piece by piece
+    size_t copied = 0;
+    for (const std::string_view chunk : getSpans(lineStart, lineLength)) {
+        memcpy(buf + copied, chunk.data(), chunk.size());
+        copied += chunk.size();
     }
-    else {
-        lineStart += gapSize;
-        lineLength = std::min(lineLength, len);
-        memcpy(buf, buffer + lineStart, lineLength);
+    return copied;
+}
+
+size_t DocumentText::getLineLength(ULONG lineno) const {
+    if (lineno >= lineStarts.size()) {
+        return 0;
+    }
+    size_t lineEnd = (lineno + 1 < lineStarts.size()) ? lineStarts[lineno + 1] - 1 : getLength();
+    return lineEnd - lineStarts[lineno];
+}
+
+TextSpans DocumentText::getLineSlice(ULONG lineno, size_t offset, size_t len) const {
+    const size_t lineLength = getLineLength(lineno);
+    if (offset >= lineLength) {
+        return {};
+    }
+    return getSpans(lineStarts[lineno] + offset, std::min(len, lineLength - offset));
+}
+
+size_t DocumentText::getLineOffset(ULONG lineno, size_t column) const {
+    const size_t lineLength = getLineLength(lineno);
+    size_t offset = 0;
+    size_t count = 0;
+
+    // Jump to the last segment starting at or before the column
+    if (lineLength > LONG_LINE && column >= LINE_SEGMENT) {
+        offset = findLineSegment(lineno, column, count);
+    }
+
+    // Count UTF-8 lead bytes up to the column
+    for (const std::string_view chunk : getLineSlice(lineno, offset, lineLength - offset)) {
+        for (const char c : chunk) {
+            if ((c & 0xC0) != 0x80) {
+                if (count == column) {
+                    return offset;
+                }
+                ++count;
+            }
+            ++offset;
+        }
     }
     return lineLength;
 }
 
+size_t DocumentText::findLineSegment(ULONG lineno, size_t column, size_t& count) const {
+    if (segmentsVersion != version) {
+        lineSegments.clear();
+        segmentsVersion = version;
+    }
+
+    // segments[k] is the number of characters in the first k * LINE_SEGMENT
+    // bytes of the line; it is only extended as far as a caller has looked.
+    std::vector<size_t>& segments = lineSegments[lineno];
+    if (segments.empty()) {
+        segments.push_back(0);
+    }
+    const size_t lineLength = getLineLength(lineno);
+    while (segments.back() <= column && segments.size() * LINE_SEGMENT <= lineLength) {
+        size_t chars = segments.back();
+        for (const std::string_view chunk : getLineSlice(lineno, (segments.size() - 1) * LINE_SEGMENT, LINE_SEGMENT)) {
+            for (const char c : chunk) {
+                chars += (c & 0xC0) != 0x80;
+            }
+        }
+        segments.push_back(chars);
+    }
+
+    // The last segment starting at or before the column
+    const size_t segment = std::upper_bound(segments.begin(), segments.end(), column) - segments.begin() - 1;
+    count = segments[segment];
+    return segment * LINE_SEGMENT;
+}
+
 
 void DocumentText::setCaretPosition(size_t position) const {
-    // Set the caret position using Windows API
-    SendMessage(textboxhwnd, EM_SETSEL, (WPARAM)position, static_cast<LPARAM>(position));
+    setSelection(position, position);
 }
 
 size_t DocumentText::getCaretPosition() const {
-    // Get the current caret position using Windows API
+    size_t start, end;
+    getSelection(start, end);
+    return start;
+}
+
+void DocumentText::setSelection(size_t start, size_t end) const {
+    if (lineProjection != nullptr) {
+        // View lines start where the Edit control says; only the column is
+        // the document's
+        const auto toEdit = [this](size_t position) {
+            position = std::min(position, getLength());
+            const size_t line = lineStarts.lineOf(position);
+            const size_t viewLine = lineProjection->toVisibleLine(line);
+            const auto lineIndex = static_cast<size_t>(SendMessage(textboxhwnd, EM_LINEINDEX, viewLine, 0));
+            if (lineProjection->isHidden(line)) {
+                return lineIndex + static_cast<size_t>(SendMessage(textboxhwnd, EM_LINELENGTH, lineIndex, 0));
+            }
+            return lineIndex + position - lineStarts[line];
+        };
+        SendMessage(textboxhwnd, EM_SETSEL, static_cast<WPARAM>(toEdit(start)), static_cast<LPARAM>(toEdit(end)));
+        return;
+    }
+    // The Edit control shows every line break as CRLF, so each line before a
+    // position adds one character to it
+    const size_t editStart = start + lineStarts.lineOf(std::min(start, getLength()));
+    const size_t editEnd = end + lineStarts.lineOf(std::min(end, getLength()));
+    SendMessage(textboxhwnd, EM_SETSEL, static_cast<WPARAM>(editStart), static_cast<LPARAM>(editEnd));
+}
+void DocumentText::getSelection(size_t& start, size_t& end) const {
     DWORD startPos, endPos;
     SendMessage(textboxhwnd, EM_GETSEL, reinterpret_cast<WPARAM>(&startPos), reinterpret_cast<LPARAM>(&endPos));
-    return startPos;
+    if (lineProjection != nullptr) {
+        const auto fromEdit = [this](DWORD position) {
+            const auto viewLine = static_cast<size_t>(SendMessage(textboxhwnd, EM_LINEFROMCHAR, position, 0));
+            const size_t line = lineProjection->toDocumentLine(viewLine);
+            if (line >= lineStarts.size()) {
+                return getLength();
+            }
+            const size_t column = position - static_cast<size_t>(SendMessage(textboxhwnd, EM_LINEINDEX, viewLine, 0));
+            return std::min(lineStarts[line] + column, getLength());
+        };
+        start = fromEdit(startPos);
+        end = fromEdit(endPos);
+        return;
+    }
+    start = startPos - SendMessage(textboxhwnd, EM_LINEFROMCHAR, startPos, 0);
+    end = endPos - SendMessage(textboxhwnd, EM_LINEFROMCHAR, endPos, 0);
+}
+void DocumentText::setLineProjection(const LineProjection* projection) {
+    lineProjection = projection;
 }
 
 
-    InsertCommand::InsertCommand(DocumentText& buf, std::string  t, size_t pos)
-        : buffer(buf), text(std::move(t)), position(pos) {}
+    UndoText::UndoText(const DocumentText& document, std::string_view text)
+        : account(document.getMemoryAccount()),
+          text(text.data(), text.size(), TaggedAllocator<char, MemoryTag::Undo>(account.get())) {
+        // Short text is kept inside the string and reserves nothing
+        account->addLive(MemoryTag::Undo, text.size());
+    }
+
+    UndoText::UndoText(const DocumentText& document, const TextSpans& spans)
+        : account(document.getMemoryAccount()),
+          text(TaggedAllocator<char, MemoryTag::Undo>(account.get())) {
+        text.reserve(spans.size());
+        for (const std::string_view chunk : spans) {
+            text.append(chunk);
+        }
+        account->addLive(MemoryTag::Undo, text.size());
+    }
+
+    UndoText::~UndoText() {
+        account->removeLive(MemoryTag::Undo, text.size());
+    }
+
+    InsertCommand::InsertCommand(DocumentText& buf, std::string_view t, size_t pos)
+        : buffer(buf), text(buf, t), position(pos) {}
 
     void InsertCommand::execute()  {
-        buffer.insertText(text.c_str(), text.length(), position);
+        buffer.insertText(text.data(), text.size(), position);
     }
 
     void InsertCommand::undo()  {
-        buffer.deleteText(position, position + text.length());
+        buffer.deleteText(position, position + text.size());
     }
 
     size_t InsertCommand::getCursorPosition() const {
-        return position + text.length(); // After insertion
+        return position + text.size(); // After insertion
     }
 
     size_t InsertCommand::getUndoCursorPosition() const {
@@ -247,19 +740,14 @@ size_t DocumentText::getCaretPosition() const {
 
 
     DeleteCommand::DeleteCommand(DocumentText& buf, size_t pos, size_t len)
-        : buffer(buf), position(pos) {
-        char* temp = new char[len + 1];
-        buffer.getText(pos, len, temp);
-        deletedText = std::string(temp, len);
-        delete[] temp;
-    }
+        : buffer(buf), position(pos), deletedText(buf, buf.getSpans(pos, len)) {}
 
     void DeleteCommand::execute()  {
-        buffer.deleteText(position, position + deletedText.length());
+        buffer.deleteText(position, position + deletedText.size());
     }
 
     void DeleteCommand::undo()  {
-        buffer.insertText(deletedText.c_str(), deletedText.length(), position);
+        buffer.insertText(deletedText.data(), deletedText.size(), position);
     }
 
     size_t DeleteCommand::getCursorPosition() const  {
@@ -267,10 +755,34 @@ size_t DocumentText::getCaretPosition() const {
     }
 
     size_t DeleteCommand::getUndoCursorPosition() const {
-        return position + deletedText.length();
+        return position + deletedText.size();
+    }
+
+    CompoundCommand::CompoundCommand(std::vector<std::unique_ptr<Command>> commands)
+        : commands(std::move(commands)) {}
+
+    void CompoundCommand::execute() {
+        for (const std::unique_ptr<Command>& command : commands) {
+            command->execute();
+        }
+    }
+
+    void CompoundCommand::undo() {
+        for (auto command = commands.rbegin(); command != commands.rend(); ++command) {
+            (*command)->undo();
+        }
+    }
+
+    size_t CompoundCommand::getCursorPosition() const {
+        return commands.empty() ? 0 : commands.back()->getCursorPosition();
+    }
+
+    size_t CompoundCommand::getUndoCursorPosition() const {
+        return commands.empty() ? 0 : commands.front()->getUndoCursorPosition();
     }
 
     void CommandHistory::executeCommand(std::unique_ptr<Command> cmd) {
+        PROFILE_SCOPE("CommandHistory::executeCommand");
         cmd->execute();
         lastCursorPosition = cmd->getCursorPosition();
         undoStack.push(std::move(cmd));
@@ -281,6 +793,7 @@ size_t DocumentText::getCaretPosition() const {
     }
 
     void CommandHistory::undo() {
+        PROFILE_SCOPE("CommandHistory::undo");
         if (!undoStack.empty()) {
             auto cmd = std::move(undoStack.top());
             undoStack.pop();
@@ -291,6 +804,7 @@ size_t DocumentText::getCaretPosition() const {
     }
 
     void CommandHistory::redo() {
+        PROFILE_SCOPE("CommandHistory::redo");
         if (!redoStack.empty()) {
             auto cmd = std::move(redoStack.top());
             redoStack.pop();
@@ -3,37 +3,217 @@
 
 #include <Windows.h>
 #include <string>
+#include <string_view>
 #include <stack>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include "CancelToken.h"
+#include "DirtyRanges.h"
+#include "DocumentMarkers.h"
+#include "FileIO.h"
+#include "LineIndex.h"
+#include "MemoryAccount.h"
+#include "TextBlocks.h"
+
+
+// Line ending a file was loaded with; the buffer itself always holds LF.
+enum class EolStyle { LF, CRLF, CR };
+
+// The text of a document as it was at one version. Taking one copies only
+// the list of blocks, and it stays as it is, readable from any thread, while
+// the document goes on being edited.
+class DocumentSnapshot {
+public:
+    [[nodiscard]] size_t getLength() const;
+    [[nodiscard]] size_t getVersion() const;
+    [[nodiscard]] EolStyle getEolStyle() const;
+    [[nodiscard]] TextSpans getSpans(size_t pos, size_t len) const;
+
+private:
+    friend class DocumentText;
+    friend class CompressedText;
+
+    TextBlocks blocks;
+    size_t version = 0;
+    EolStyle eolStyle = EolStyle::CRLF;
+};
+
+// The text of a snapshot compressed with lzCompress, in chunks that are
+// compressed and decompressed side by side on the task pool. It is what a
+// dehydrated document keeps instead of its text.
+class CompressedText {
+public:
+    static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+    // Waits for the pool, so call it from a task to keep a thread free
+    [[nodiscard]] static CompressedText compress(const DocumentSnapshot& snapshot);
+    // Into getLength() bytes; false if the chunks are damaged
+    bool decompress(char* output) const;
+
+    [[nodiscard]] size_t getLength() const;
+    [[nodiscard]] size_t getVersion() const;
+    [[nodiscard]] size_t getCompressedSize() const;
+
+private:
+    using Chunk = std::basic_string<char, std::char_traits<char>, TaggedAllocator<char, MemoryTag::Compressed>>;
+
+    // The snapshot's document's, kept alive for the chunks charged to it
+    std::shared_ptr<MemoryAccount> account;
+    size_t length = 0;
+    size_t version = 0;
+    size_t compressedSize = 0;
+    std::vector<Chunk> chunks;
+};
+
+// Which document lines the view shows, when some are left out of it. View
+// lines are the Edit control's; each shows the document line it maps to.
+class LineProjection {
+public:
+    virtual ~LineProjection() = default;
+    // The document line shown as the given view line, or npos past the end
+    [[nodiscard]] virtual size_t toDocumentLine(size_t viewLine) const = 0;
+    // Where a document line shows; a line left out shows as the view line
+    // before it
+    [[nodiscard]] virtual size_t toVisibleLine(size_t documentLine) const = 0;
+    [[nodiscard]] virtual bool isHidden(size_t documentLine) const = 0;
+};
 
 class DocumentText {
+    // Declared first, so it outlives everything charged to it
+    std::shared_ptr<MemoryAccount> memoryAccount;
+
 public:
+    // Lines longer than LONG_LINE get a lazily built index of character counts
+    // every LINE_SEGMENT bytes so a column can be found without a full scan.
+    static constexpr size_t LONG_LINE = 64 * 1024;
+    static constexpr size_t LINE_SEGMENT = 4 * 1024;
+    static constexpr size_t LOAD_CHUNK = 4 * 1024 * 1024;
+
     void setCaretPosition(size_t position) const;
     [[nodiscard]] size_t getCaretPosition() const;
+    void setSelection(size_t start, size_t end) const;
+    void getSelection(size_t& start, size_t& end) const;
+    // Selections go through the projection while one is set; a position on
+    // a line left out is selected at the end of the line shown for it
+    void setLineProjection(const LineProjection* projection);
 
     explicit DocumentText(HWND parentWindow);
-    ~DocumentText();
 
     bool initFile(const wchar_t* filename);
     bool initHandle(HANDLE hFile);
+    bool initCompressed(HANDLE hFile);
+    // Filling the document from raw file bytes, possibly a read at a time:
+    // beginLoad sizes the buffer, raw bytes go to getLoadBuffer() in file
+    // order and appendLoaded indexes everything read so far.
+    void beginLoad(size_t fileSize);
+    void resizeLoad(size_t fileSize);
+    [[nodiscard]] char* getLoadBuffer() const;
+    size_t appendLoaded(size_t rawLength);
+    // A line index cached from an earlier load of the same file; loading
+    // then only reads (and for CR files, folds) the text
+    void adoptIndex(LineIndex index, EolStyle style, bool mixed);
+    void finishLoad();
     ULONG get_line(ULONG lineno, char* buf, size_t len) const;
+    [[nodiscard]] size_t getLineLength(ULONG lineno) const;
+    [[nodiscard]] TextSpans getLineSlice(ULONG lineno, size_t offset, size_t len) const;
+    // UI thread only: it fills in a cache of long lines' segments
+    [[nodiscard]] size_t getLineOffset(ULONG lineno, size_t column) const;
     void insertText(const char* text, size_t len, size_t position);
     void deleteText(size_t start, size_t end);
-    void moveGap(size_t position);
     [[nodiscard]] size_t getLength() const;
-    std::vector<size_t> lineStarts;
+    [[nodiscard]] size_t getVersion() const;
+    // Cancelled by the next edit, for background work on this version
+    [[nodiscard]] CancelToken cancelToken() const;
+    [[nodiscard]] EolStyle getEolStyle() const;
+    [[nodiscard]] bool hasMixedEol() const;
+    [[nodiscard]] static std::string normalizeEol(std::string_view text);
+    LineIndex lineStarts;
     void updateLineStarts();
     void getText(size_t pos, size_t len, char* temp) const;
+    [[nodiscard]] TextSpans getSpans(size_t pos, size_t len) const;
+    // Cheap enough to take on every edit; see TextBlocks
+    [[nodiscard]] DocumentSnapshot snapshot() const;
+    // Swaps the text for a compressed copy of it while nobody is looking at
+    // it. Anything that reads or edits the text brings it back first, so
+    // callers never see the difference; the line index, markers and history
+    // stay as they are. False when the copy is of an older version or does
+    // not save anything.
+    bool dehydrate(CompressedText text);
+    void rehydrate() const;
+    [[nodiscard]] bool isDehydrated() const;
+    // Bytes the text takes up now, compressed or not
+    [[nodiscard]] size_t getTextMemory() const;
+    // What the document holds, by component. The view is left to its owner.
+    [[nodiscard]] MemoryReport getMemoryReport() const;
+    [[nodiscard]] const std::shared_ptr<MemoryAccount>& getMemoryAccount() const;
+    DocumentMarkers& getMarkers();
+    [[nodiscard]] const DocumentMarkers& getMarkers() const;
+
+    // The document now matches the file on disk with this stamp, so edits
+    // from here on are tracked for an in-place save. A save of an earlier
+    // version leaves the document modified and untracked. A file loaded with
+    // mixed line endings is not tracked until its first save unifies them.
+    void markLoaded(const FileStamp& stamp);
+    void markSaved(const FileStamp& stamp);
+    void markSaved(const FileStamp& stamp, size_t savedVersion);
+    // The text was just made to match the file again after another program
+    // changed it, so it takes on that file's line endings as well
+    void markReloaded(const FileStamp& stamp, EolStyle style, bool mixed);
+    // Raw bytes another program appended to the file, which now has this
+    // stamp. They are added at the end like loaded text: not an edit, so
+    // they are neither undone nor journaled.
+    void appendFromFile(std::string_view raw, const FileStamp& stamp);
+    [[nodiscard]] bool isModified() const;
+    [[nodiscard]] const FileStamp& getSavedStamp() const;
+    [[nodiscard]] const DirtyRanges& getDirtyRanges() const;
+    // Offset in the file, as saved, of a document position
+    [[nodiscard]] uint64_t getFileOffset(size_t position) const;
+
+    // Told of every edit once it is made, whether it came from a command,
+    // undo or redo, on the thread that made it. Listeners are added and
+    // removed only while nothing is editing the document.
+    struct EditListener {
+        std::function<void(size_t position, const char* text, size_t len)> onTextInserted;
+        std::function<void(size_t start, size_t end)> onTextDeleted;
+    };
+    size_t addEditListener(EditListener listener);
+    void removeEditListener(size_t id);
 
 
 private:
     HWND textboxhwnd;
-    char* buffer;
-    size_t bufferSize = 1024;
-    size_t gapStart;
-    size_t gapEnd;
-    size_t gapSize;
-    void expandBuffer();
+    const LineProjection* lineProjection = nullptr;
+    // Mutable so that const readers can bring dehydrated text back
+    mutable TextBlocks blocks;
+    mutable std::unique_ptr<CompressedText> dehydrated;
+    std::shared_ptr<char[]> loadBuffer;
+    size_t loadCapacity = 0;
+    size_t version = 0;
+    size_t savedVersion = 0;
+    CancelSource cancelSource;
+    EolStyle eolStyle = EolStyle::CRLF;
+    bool mixedEol = false;
+    size_t loadSize = 0;
+    size_t loadRaw = 0;    // raw bytes already normalized
+    size_t loadLength = 0; // text they normalized to
+    size_t eolCounts[3] = {};
+    bool indexAdopted = false;
+    DocumentMarkers markers;
+    DirtyRanges dirtyRanges;
+    std::vector<std::pair<size_t, EditListener>> editListeners;
+    size_t nextListener = 1;
+    FileStamp savedStamp;
+    // getLineOffset's cache; other threads read snapshots, not this
+    mutable std::unordered_map<ULONG, std::vector<size_t>> lineSegments;
+    mutable size_t segmentsVersion = 0;
+    size_t insertInText(const char* text, size_t len, size_t position);
+    void bumpVersion();
+    // Byte offset of the segment of the line holding the column, and in
+    // count the characters before it
+    size_t findLineSegment(ULONG lineno, size_t column, size_t& count) const;
     
 };
 
@@ -47,13 +227,31 @@ public:
     [[nodiscard]] virtual size_t getUndoCursorPosition() const = 0;
 };
 
+// Undo text charged to its document. A command can outlive its document's
+// tab, so it keeps the account alive until the text is freed.
+class UndoText {
+public:
+    UndoText(const DocumentText& document, std::string_view text);
+    UndoText(const DocumentText& document, const TextSpans& spans);
+    ~UndoText();
+    UndoText(const UndoText&) = delete;
+    UndoText& operator=(const UndoText&) = delete;
+
+    [[nodiscard]] const char* data() const { return text.data(); }
+    [[nodiscard]] size_t size() const { return text.size(); }
+
+private:
+    std::shared_ptr<MemoryAccount> account;
+    std::basic_string<char, std::char_traits<char>, TaggedAllocator<char, MemoryTag::Undo>> text;
+};
+
 class InsertCommand : public Command{
     DocumentText & buffer;
-    std::string text;
+    UndoText text;
     size_t position;
 
 public:
-    InsertCommand(DocumentText& buf, std::string  t, size_t pos);
+    InsertCommand(DocumentText& buf, std::string_view t, size_t pos);
 
     void execute() override;
     [[nodiscard]] size_t getCursorPosition() const override;
@@ -68,8 +266,8 @@ public:
 // Update DeleteCommand
 class DeleteCommand : public Command {
     DocumentText& buffer;
-    std::string deletedText;
     size_t position;
+    UndoText deletedText;
 
 public:
     DeleteCommand(DocumentText& buf, size_t pos, size_t len);
@@ -83,6 +281,23 @@ public:
     [[nodiscard]] size_t getUndoCursorPosition() const override;
 };
 
+// Several commands undone and redone as one step. They run in order and
+// are undone in reverse.
+class CompoundCommand : public Command {
+    std::vector<std::unique_ptr<Command>> commands;
+
+public:
+    explicit CompoundCommand(std::vector<std::unique_ptr<Command>> commands);
+
+    void execute() override;
+
+    void undo() override;
+
+    [[nodiscard]] size_t getCursorPosition() const override;
+
+    [[nodiscard]] size_t getUndoCursorPosition() const override;
+};
+
 // Modify CommandHistory to store the last command
 class CommandHistory {
 private:
@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include "EditEngine.h"
+#include "EditTrace.h"
+#include "Profiler.h"
+
+
+EditEngine::EditEngine(CommandHistory& history, CommitCallback onCommit)
+    : history(history), onCommit(std::move(onCommit)),
+      wakeEvent(CreateEventW(nullptr, FALSE, FALSE, nullptr)), idleEvent(CreateEventW(nullptr, FALSE, FALSE, nullptr)) {
+    worker = std::thread(&EditEngine::run, this);
+}
+
+EditEngine::~EditEngine() {
+    stopping = true;
+    SetEvent(wakeEvent);
+    worker.join();
+    CloseHandle(wakeEvent);
+    CloseHandle(idleEvent);
+}
+
+uint64_t EditEngine::submit(EditOp op) {
+    // A full queue means the engine is thousands of edits behind; typing
+    // waits for room rather than dropping a key
+    while (!queue.push(std::move(op))) {
+        SetEvent(wakeEvent);
+        Sleep(0);
+    }
+    ++submitted;
+    // Pairs with the fence in run, so either the engine sees the edit before
+    // it sleeps or this sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load()) {
+        SetEvent(wakeEvent);
+    }
+    return submitted;
+}
+
+void EditEngine::sync() {
+    if (committed.load(std::memory_order_acquire) == submitted) {
+        return;
+    }
+    waiting = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (committed.load(std::memory_order_acquire) != submitted) {
+        WaitForSingleObject(idleEvent, INFINITE);
+    }
+    waiting = false;
+}
+
+uint64_t EditEngine::getSubmitted() const {
+    return submitted;
+}
+
+uint64_t EditEngine::getCommitted() const {
+    return committed.load(std::memory_order_acquire);
+}
+
+void EditEngine::setRecorder(EditTraceRecorder* recorder) {
+    this->recorder.store(recorder, std::memory_order_release);
+}
+
+void EditEngine::run() {
+    EditOp op;
+    for (;;) {
+        bool applied = false;
+        while (queue.pop(op)) {
+            if (EditTraceRecorder* trace = recorder.load(std::memory_order_acquire)) {
+                if (op.kind == EditKind::Insert) {
+                    trace->recordInsert(*op.document, op.position, op.text);
+                }
+                else {
+                    trace->recordDelete(*op.document, op.position, op.length);
+                }
+            }
+            apply(history, op);
+            committed.fetch_add(1, std::memory_order_release);
+            applied = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting.load()) {
+                SetEvent(idleEvent);
+            }
+        }
+        if (applied && onCommit) {
+            onCommit(committed.load(std::memory_order_relaxed));
+        }
+        if (stopping) {
+            return;
+        }
+
+        sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (queue.empty() && !stopping) {
+            WaitForSingleObject(wakeEvent, INFINITE);
+        }
+        sleeping = false;
+    }
+}
+
+void EditEngine::apply(CommandHistory& history, EditOp& op) {
+    // Positions past the end, such as Delete at the very end, do nothing
+    PROFILE_COUNT("edits applied", 1);
+    DocumentText& document = *op.document;
+    const size_t length = document.getLength();
+    if (op.kind == EditKind::Insert) {
+        if (!op.text.empty()) {
+            history.executeCommand(std::make_unique<InsertCommand>(document, std::move(op.text), std::min(op.position, length)));
+        }
+    }
+    else if (op.position < length && op.length > 0) {
+        history.executeCommand(std::make_unique<DeleteCommand>(document, op.position, std::min(op.length, length - op.position)));
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef EDITENGINE_H
+#define EDITENGINE_H
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "DocumentText.h"
+#include "SpscQueue.h"
+
+class EditTraceRecorder;
+
+enum class EditKind : uint8_t { Insert, Delete };
+
+// One edit typed into a document, with positions as the Edit control had
+// them when it was typed
+struct EditOp {
+    DocumentText* document = nullptr;
+    EditKind kind = EditKind::Insert;
+    size_t position = 0;
+    size_t length = 0; // bytes to delete
+    std::string text;  // to insert, LF line breaks
+};
+
+// Applies typing to the documents on a thread of its own, so a slow edit
+// does not hold up the window. The UI thread queues edits in the order they
+// are typed and the Edit control shows them at once; the engine applies
+// them in that order through the command history and reports how far it
+// has got. Anything else that reads or changes the documents or the history
+// calls sync() first, which waits for the queue to drain; from then until
+// the next submit they belong to the UI thread alone.
+class EditEngine {
+public:
+    static constexpr size_t QUEUE_SIZE = 4096;
+
+    // Called on the engine thread whenever it has caught up with the queue,
+    // with the number of edits applied so far
+    using CommitCallback = std::function<void(uint64_t committed)>;
+
+    EditEngine(CommandHistory& history, CommitCallback onCommit);
+    ~EditEngine();
+
+    EditEngine(const EditEngine&) = delete;
+    EditEngine& operator=(const EditEngine&) = delete;
+
+    // UI thread only. Returns the edit's number, counting from 1.
+    uint64_t submit(EditOp op);
+    // UI thread only
+    void sync();
+    [[nodiscard]] uint64_t getSubmitted() const;
+    [[nodiscard]] uint64_t getCommitted() const;
+    // Edits are recorded on the engine thread as they are applied; null
+    // stops recording. The recorder must outlive the engine or be unset
+    // after a sync().
+    void setRecorder(EditTraceRecorder* recorder);
+
+    // Applies one edit through the history, clamping positions the way the
+    // engine does; the trace replayer uses it too
+    static void apply(CommandHistory& history, EditOp& op);
+
+private:
+    CommandHistory& history;
+    CommitCallback onCommit;
+    SpscQueue<EditOp, QUEUE_SIZE> queue;
+    uint64_t submitted = 0;
+    std::atomic<uint64_t> committed{ 0 };
+    std::atomic<bool> sleeping{ false };
+    std::atomic<bool> waiting{ false };
+    std::atomic<bool> stopping{ false };
+    std::atomic<EditTraceRecorder*> recorder{ nullptr };
+    HANDLE wakeEvent; // the engine sleeps on it when the queue is empty
+    HANDLE idleEvent; // sync waits on it
+    std::thread worker;
+
+    void run();
+};
+
+#endif // EDITENGINE_H
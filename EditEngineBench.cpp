@@ -0,0 +1,140 @@
+// Types into the edit engine as fast as a key repeat, without a window, and
+// prints how long the UI thread spent queueing each keystroke and how long
+// each took from being queued to being committed:
+//
+//   edit-engine-bench [keystrokes] [burst]
+//
+// Keystrokes come in bursts of back-to-back edits with a millisecond between
+// them; one in PASTE_EVERY is a large paste somewhere else in the file,
+// which the engine has to catch up from. A keystroke counts as committed
+// when the engine reports it has caught up past it, as the window hears of
+// it. The same edits are then applied one by one to a second copy of the
+// file, and the two must match: exits 1 if the engine applied them out of
+// order or lost one.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BenchSupport.h"
+#include "EditEngine.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t PASTE_EVERY = 5000;
+    constexpr size_t PASTE_BYTES = 256 * 1024;
+
+    // Typing at a cursor that now and then jumps elsewhere: letters, Enter
+    // and Backspace, and a paste every PASTE_EVERY keystrokes
+    std::vector<EditOp> makeEdits(DocumentText& document, size_t count, uint32_t seed) {
+        std::mt19937 random(seed);
+        const char keys[] = "abcdefghijklmnopqrstuvwxyz (){};=+\n";
+        std::vector<EditOp> edits(count);
+        size_t length = document.getLength();
+        size_t cursor = length / 2;
+        for (size_t i = 0; i < count; ++i) {
+            EditOp& op = edits[i];
+            op.document = &document;
+            if (i % PASTE_EVERY == PASTE_EVERY - 1) {
+                op.position = random() % (length + 1);
+                op.text.assign(PASTE_BYTES, 'p');
+                for (size_t k = 79; k < op.text.size(); k += 80) {
+                    op.text[k] = '\n';
+                }
+                length += op.text.size();
+                continue;
+            }
+            if (random() % 200 == 0) {
+                cursor = random() % (length + 1);
+            }
+            if (random() % 10 == 0 && cursor > 0) {
+                op.kind = EditKind::Delete;
+                op.position = --cursor;
+                op.length = 1;
+                --length;
+                continue;
+            }
+            op.position = cursor++;
+            op.text.assign(1, keys[random() % (sizeof(keys) - 1)]);
+            ++length;
+        }
+        return edits;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t keystrokes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    const size_t burst = argc > 2 ? strtoull(argv[2], nullptr, 10) : 64;
+    if (keystrokes == 0 || burst == 0) {
+        fprintf(stderr, "Usage: edit-engine-bench [keystrokes] [burst]\n");
+        return 2;
+    }
+
+    const std::string text = makeCodeText(100000);
+    DocumentText document(nullptr);
+    loadText(document, text);
+    const std::vector<EditOp> edits = makeEdits(document, keystrokes, 1);
+
+    // Written on the engine thread as it catches up, read once it has
+    std::vector<Clock::time_point> submitTimes(keystrokes + 1);
+    std::vector<Clock::time_point> commitTimes(keystrokes + 1);
+    std::atomic<uint64_t> reported{ 0 };
+    CommandHistory history;
+    LatencyHistogram submitLatency;
+    uint64_t deepest = 0;
+    {
+        EditEngine engine(history, [&](uint64_t committed) {
+            const auto now = Clock::now();
+            for (uint64_t n = reported.load(std::memory_order_relaxed) + 1; n <= committed; ++n) {
+                commitTimes[n] = now;
+            }
+            reported.store(committed, std::memory_order_release);
+        });
+        for (size_t i = 0; i < keystrokes; ++i) {
+            if (i > 0 && i % burst == 0) {
+                Sleep(1);
+            }
+            const auto before = Clock::now();
+            submitTimes[i + 1] = before;
+            engine.submit(edits[i]);
+            submitLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count()));
+            deepest = std::max(deepest, engine.getSubmitted() - engine.getCommitted());
+        }
+        engine.sync();
+        while (reported.load(std::memory_order_acquire) != keystrokes) {
+            Sleep(0);
+        }
+    }
+
+    LatencyHistogram commitLatency;
+    for (size_t n = 1; n <= keystrokes; ++n) {
+        commitLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(commitTimes[n] - submitTimes[n]).count()));
+    }
+    printf("%zu keystrokes in bursts of %zu, a %zu KB paste every %zu; at most %llu queued\n\n", keystrokes, burst,
+        PASTE_BYTES / 1024, PASTE_EVERY, static_cast<unsigned long long>(deepest));
+    printLatencyHeader();
+    printLatency("submit (UI thread)", submitLatency);
+    printLatency("input to commit", commitLatency);
+
+    // The same edits one at a time, in order
+    DocumentText expected(nullptr);
+    loadText(expected, text);
+    CommandHistory expectedHistory;
+    for (EditOp op : edits) {
+        op.document = &expected;
+        EditEngine::apply(expectedHistory, op);
+    }
+    if (textOf(document) != textOf(expected)) {
+        fprintf(stderr, "the engine's document differs from the edits applied in order\n");
+        return 1;
+    }
+    printf("\nthe engine's document matches the edits applied in order\n");
+    return 0;
+}
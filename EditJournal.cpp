@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "EditJournal.h"
+#include "DocumentText.h"
+#include "Gzip.h"
+
+
+namespace {
+    constexpr char MAGIC[4] = { 'N', 'D', 'J', '1' };
+    constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(uint64_t);
+    constexpr size_t RECORD_OVERHEAD = 1 + 2 * sizeof(uint64_t) + sizeof(uint32_t);
+    constexpr char RECORD_INSERT = 1;
+    constexpr char RECORD_DELETE = 2;
+
+    void putU64(std::vector<char>& out, uint64_t value) {
+        char bytes[sizeof(value)];
+        memcpy(bytes, &value, sizeof(value));
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+
+    uint64_t getU64(const char* p) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    bool readWhole(const std::wstring& path, std::vector<char>& contents) {
+        HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        bool ok = GetFileSizeEx(hFile, &size) != 0;
+        if (ok) {
+            contents.resize(static_cast<size_t>(size.QuadPart));
+            size_t done = 0;
+            while (ok && done < contents.size()) {
+                DWORD got = 0;
+                const DWORD want = static_cast<DWORD>(std::min<size_t>(contents.size() - done, 64 * 1024 * 1024));
+                ok = ReadFile(hFile, contents.data() + done, want, &got, nullptr) && got > 0;
+                done += got;
+            }
+        }
+        CloseHandle(hFile);
+        return ok;
+    }
+}
+
+EditJournal::EditJournal(std::wstring filePath, FailureCallback onFailure)
+    : filePath(std::move(filePath)), onFailure(std::move(onFailure)) {}
+
+EditJournal::~EditJournal() {
+    stop();
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+        if (!recorded) {
+            DeleteFileW(journalPath(filePath).c_str());
+        }
+    }
+}
+
+std::wstring EditJournal::journalPath(const std::wstring& filePath) {
+    return filePath + L".journal";
+}
+
+size_t EditJournal::validLength(const std::vector<char>& journal, const FileStamp& stamp) {
+    // 0 when the journal is for another version of the file, otherwise the
+    // length of the records that are intact
+    if (journal.size() < HEADER_SIZE || memcmp(journal.data(), MAGIC, sizeof(MAGIC)) != 0 ||
+        getU64(journal.data() + 4) != stamp.size || getU64(journal.data() + 12) != stamp.lastWrite) {
+        return 0;
+    }
+
+    size_t pos = HEADER_SIZE;
+    while (journal.size() - pos >= RECORD_OVERHEAD) {
+        const char* record = journal.data() + pos;
+        const size_t payload = record[0] == RECORD_INSERT ? getU64(record + 9) : 0;
+        if ((record[0] != RECORD_INSERT && record[0] != RECORD_DELETE) ||
+            payload > journal.size() - pos - RECORD_OVERHEAD) {
+            break;
+        }
+        const size_t bodySize = RECORD_OVERHEAD - sizeof(uint32_t) + payload;
+        uint32_t crc;
+        memcpy(&crc, record + bodySize, sizeof(crc));
+        if (crc != crc32(0, record, bodySize)) {
+            break;
+        }
+        pos += bodySize + sizeof(crc);
+    }
+    return pos;
+}
+
+bool EditJournal::hasRecovery(const std::wstring& filePath) {
+    FileStamp stamp;
+    std::vector<char> journal;
+    return FileStamp::read(filePath, stamp) && readWhole(journalPath(filePath), journal) &&
+        validLength(journal, stamp) > HEADER_SIZE;
+}
+
+size_t EditJournal::recover(const std::wstring& filePath, DocumentText& document) {
+    FileStamp stamp;
+    std::vector<char> journal;
+    if (!FileStamp::read(filePath, stamp) || !readWhole(journalPath(filePath), journal)) {
+        return 0;
+    }
+    const size_t end = validLength(journal, stamp);
+
+    size_t applied = 0;
+    for (size_t pos = HEADER_SIZE; pos < end; ++applied) {
+        const char* record = journal.data() + pos;
+        const uint64_t first = getU64(record + 1);
+        const uint64_t second = getU64(record + 9);
+        if (record[0] == RECORD_INSERT) {
+            document.insertText(record + RECORD_OVERHEAD - sizeof(uint32_t), second, first);
+            pos += RECORD_OVERHEAD + second;
+        }
+        else {
+            document.deleteText(first, second);
+            pos += RECORD_OVERHEAD;
+        }
+    }
+    return applied;
+}
+
+bool EditJournal::start() {
+    FileStamp stamp;
+    std::vector<char> journal;
+    const size_t keep = FileStamp::read(filePath, stamp) && readWhole(journalPath(filePath), journal)
+        ? validLength(journal, stamp) : 0;
+
+    hFile = CreateFileW(journalPath(filePath).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        OPEN_ALWAYS, FILE_ATTRIBUTE_HIDDEN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // Appends must follow the last intact record, never a torn one
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(keep);
+    if (!SetFilePointerEx(hFile, position, nullptr, FILE_BEGIN) || !SetEndOfFile(hFile) ||
+        (keep == 0 && !writeHeader())) {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    if (keep > 0) {
+        written = keep;
+    }
+    stopping = false;
+    recorded = keep > HEADER_SIZE;
+    flusher = std::thread(&EditJournal::run, this);
+    return true;
+}
+
+void EditJournal::recordInsert(size_t position, const char* text, size_t len) {
+    append(RECORD_INSERT, position, len, text, len);
+}
+
+void EditJournal::recordDelete(size_t start, size_t end) {
+    append(RECORD_DELETE, start, end, nullptr, 0);
+}
+
+void EditJournal::append(char type, uint64_t first, uint64_t second, const char* payload, size_t len) {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    const size_t start = pending.size();
+    recorded = true;
+    pending.push_back(type);
+    putU64(pending, first);
+    putU64(pending, second);
+    pending.insert(pending.end(), payload, payload + len);
+    const uint32_t crc = crc32(0, pending.data() + start, pending.size() - start);
+    const char* crcBytes = reinterpret_cast<const char*>(&crc);
+    pending.insert(pending.end(), crcBytes, crcBytes + sizeof(crc));
+}
+
+bool EditJournal::flush() {
+    // Taking the batch under fileMutex keeps a reset from slipping in
+    // between, which would append edits the saved file already holds
+    std::lock_guard<std::mutex> lock(fileMutex);
+    std::vector<char> batch;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        batch.swap(pending);
+    }
+    if (batch.empty() || hFile == INVALID_HANDLE_VALUE) {
+        return batch.empty();
+    }
+
+    // Every write goes where the last whole one ended, so a retry follows
+    // the bytes a short write did take
+    size_t done = 0;
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(written);
+    bool ok = SetFilePointerEx(hFile, position, nullptr, FILE_BEGIN) != 0;
+    while (ok && done < batch.size()) {
+        DWORD count = 0;
+        const DWORD want = static_cast<DWORD>(std::min<size_t>(batch.size() - done, 64 * 1024 * 1024));
+        ok = WriteFile(hFile, batch.data() + done, want, &count, nullptr) && count > 0;
+        done += count;
+        written += count;
+    }
+    ok = FlushFileBuffers(hFile) && ok;
+    if (done < batch.size()) {
+        // Still in front of whatever was recorded meanwhile
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        pending.insert(pending.begin(), batch.begin() + static_cast<ptrdiff_t>(done), batch.end());
+    }
+
+    const bool wasFailing = failing.exchange(!ok);
+    if (!ok && !wasFailing && onFailure) {
+        onFailure();
+    }
+    return ok;
+}
+
+bool EditJournal::isFailing() const {
+    return failing;
+}
+
+void EditJournal::reset() {
+    reset(mark());
+}
+
+uint64_t EditJournal::mark() {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    std::lock_guard<std::mutex> pendingLock(pendingMutex);
+    return written + pending.size();
+}
+
+void EditJournal::reset(uint64_t mark) {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    std::vector<char> kept;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        kept.swap(pending);
+    }
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    // Records after the mark were made since the saved version; they move
+    // behind a header for the file as it is now
+    if (mark < written) {
+        std::vector<char> onDisk(static_cast<size_t>(written - mark));
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(mark);
+        overlapped.OffsetHigh = static_cast<DWORD>(mark >> 32);
+        DWORD got = 0;
+        ReadFile(hFile, onDisk.data(), static_cast<DWORD>(onDisk.size()), &got, &overlapped);
+        onDisk.resize(got);
+        kept.insert(kept.begin(), onDisk.begin(), onDisk.end());
+    }
+    else {
+        kept.erase(kept.begin(), kept.begin() + static_cast<ptrdiff_t>(std::min<uint64_t>(mark - written, kept.size())));
+    }
+
+    LARGE_INTEGER zero{};
+    SetFilePointerEx(hFile, zero, nullptr, FILE_BEGIN);
+    SetEndOfFile(hFile);
+    writeHeader();
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingMutex);
+        recorded = !kept.empty() || !pending.empty();
+        kept.insert(kept.end(), pending.begin(), pending.end());
+        pending.swap(kept);
+    }
+}
+
+void EditJournal::discard() {
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.clear();
+    }
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        DeleteFileW(journalPath(filePath).c_str());
+    }
+}
+
+void EditJournal::attach(DocumentText& document) {
+    listener = document.addEditListener({
+        [this](size_t position, const char* text, size_t len) { recordInsert(position, text, len); },
+        [this](size_t start, size_t end) { recordDelete(start, end); } });
+}
+
+void EditJournal::detach(DocumentText& document) {
+    document.removeEditListener(listener);
+    listener = 0;
+}
+
+bool EditJournal::writeHeader() {
+    FileStamp stamp;
+    if (!FileStamp::read(filePath, stamp)) {
+        return false;
+    }
+    std::vector<char> header(MAGIC, MAGIC + sizeof(MAGIC));
+    putU64(header, stamp.size);
+    putU64(header, stamp.lastWrite);
+    DWORD count = 0;
+    written = 0;
+    if (!WriteFile(hFile, header.data(), static_cast<DWORD>(header.size()), &count, nullptr) || count != header.size()) {
+        return false;
+    }
+    written = count;
+    return FlushFileBuffers(hFile);
+}
+
+void EditJournal::run() {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this] { return stopping; });
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+void EditJournal::stop() {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    flush();
+}
@@ -0,0 +1,99 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <Windows.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FileIO.h"
+
+class DocumentText;
+
+// Append-only log of the edits made to a document since it was last saved,
+// kept next to the file so unsaved work survives a crash.
+// Recording an edit only copies it into memory; a background thread writes
+// and flushes everything recorded every FLUSH_INTERVAL_MS (group commit), so
+// at most that much typing can be lost. Every record carries a CRC, so a
+// record torn by a crash is detected and recovery stops in front of it.
+// Bytes a write did not take stay pending and are retried at the next
+// flush right where the file ends, so records reach it whole and in order
+// however many writes that takes.
+class EditJournal {
+public:
+    static constexpr DWORD FLUSH_INTERVAL_MS = 50;
+
+    // Called on the flushing thread when writes start failing; not again
+    // until one has succeeded
+    using FailureCallback = std::function<void()>;
+
+    explicit EditJournal(std::wstring filePath, FailureCallback onFailure = nullptr);
+    // Keeps the journal file only when it holds edits that were not saved
+    ~EditJournal();
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    [[nodiscard]] static std::wstring journalPath(const std::wstring& filePath);
+
+    // True when a journal left behind for the file still matches it
+    [[nodiscard]] static bool hasRecovery(const std::wstring& filePath);
+
+    // Replays the journal onto a document holding the file as it is on disk.
+    // Returns the number of edits applied.
+    static size_t recover(const std::wstring& filePath, DocumentText& document);
+
+    // Starts journaling. Records that survived recovery are kept, anything
+    // else is replaced by a fresh journal for the file on disk.
+    bool start();
+    void recordInsert(size_t position, const char* text, size_t len);
+    void recordDelete(size_t start, size_t end);
+    // Writes what is pending; false if some of it is still not on disk
+    bool flush();
+    // The last flush left edits that are not on disk
+    [[nodiscard]] bool isFailing() const;
+
+    // The file now holds every recorded edit, so the records are dropped
+    void reset();
+
+    // Position after the last edit recorded so far. After a save of the
+    // document as it was then, reset(mark) drops only the records before it.
+    [[nodiscard]] uint64_t mark();
+    void reset(uint64_t mark);
+
+    // Stops journaling and deletes the journal file
+    void discard();
+
+    // Journals the document's edits from now on, until detach
+    void attach(DocumentText& document);
+    void detach(DocumentText& document);
+
+private:
+    std::wstring filePath;
+    FailureCallback onFailure;
+    size_t listener = 0;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+
+    std::mutex pendingMutex;
+    std::condition_variable wake;
+    std::vector<char> pending;
+    bool stopping = false;
+    bool recorded = false;
+    std::thread flusher;
+
+    std::mutex fileMutex;
+    uint64_t written = 0; // bytes in the file
+    std::atomic<bool> failing{ false };
+
+    static size_t validLength(const std::vector<char>& journal, const FileStamp& stamp);
+    bool writeHeader();
+    void append(char type, uint64_t first, uint64_t second, const char* payload, size_t len);
+    void run();
+    void stop();
+};
+
+#endif // EDITJOURNAL_H
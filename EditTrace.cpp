@@ -0,0 +1,412 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "EditEngine.h"
+#include "EditTrace.h"
+
+namespace {
+    void putVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    bool takeVarint(std::string_view& data, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && !data.empty(); shift += 7) {
+            const auto byte = static_cast<uint8_t>(data.front());
+            data.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    char anonymized(char c) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c & 0x80) != 0) {
+            return 'x';
+        }
+        return c >= '0' && c <= '9' ? '0' : c;
+    }
+
+    // Text of the given length with its line breaks spread evenly
+    std::string makeText(uint64_t length, uint64_t lines) {
+        std::string text(length, 'x');
+        const uint64_t breaks = length == 0 ? 0 : std::min(lines > 0 ? lines - 1 : 0, length - 1);
+        for (uint64_t k = 1; k <= breaks; ++k) {
+            text[k * length / (breaks + 1)] = '\n';
+        }
+        return text;
+    }
+}
+
+
+const char* editTraceOpName(EditTraceOp op) {
+    switch (op) {
+    case EditTraceOp::Open:
+        return "open";
+    case EditTraceOp::Insert:
+        return "insert";
+    case EditTraceOp::Delete:
+        return "delete";
+    case EditTraceOp::Undo:
+        return "undo";
+    case EditTraceOp::Redo:
+        return "redo";
+    case EditTraceOp::Save:
+        return "save";
+    case EditTraceOp::Close:
+        return "close";
+    default:
+        return "unknown";
+    }
+}
+
+EditTraceRecorder::EditTraceRecorder(std::wstring path, bool anonymize)
+    : path(std::move(path)), anonymize(anonymize) {}
+
+EditTraceRecorder::~EditTraceRecorder() {
+    stop();
+}
+
+bool EditTraceRecorder::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    origin = Clock::now();
+    lastTime = 0;
+    buffer.assign(MAGIC, sizeof(MAGIC));
+    return true;
+}
+
+bool EditTraceRecorder::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        flushBuffer();
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+    }
+    return !failed;
+}
+
+const std::wstring& EditTraceRecorder::getPath() const {
+    return path;
+}
+
+void EditTraceRecorder::recordOpen(const DocumentText& document) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        documentNumber(document);
+    }
+}
+
+void EditTraceRecorder::recordInsert(const DocumentText& document, size_t position, std::string_view text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    const uint32_t number = documentNumber(document);
+    beginRecord(EditTraceOp::Insert);
+    putVarint(buffer, number);
+    putVarint(buffer, position);
+    putVarint(buffer, text.size());
+    if (anonymize) {
+        std::transform(text.begin(), text.end(), std::back_inserter(buffer), anonymized);
+    }
+    else {
+        buffer.append(text);
+    }
+    if (buffer.size() >= FLUSH_SIZE) {
+        flushBuffer();
+    }
+}
+
+void EditTraceRecorder::recordDelete(const DocumentText& document, size_t position, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    const uint32_t number = documentNumber(document);
+    beginRecord(EditTraceOp::Delete);
+    putVarint(buffer, number);
+    putVarint(buffer, position);
+    putVarint(buffer, length);
+    if (buffer.size() >= FLUSH_SIZE) {
+        flushBuffer();
+    }
+}
+
+void EditTraceRecorder::recordUndo() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        beginRecord(EditTraceOp::Undo);
+    }
+}
+
+void EditTraceRecorder::recordRedo() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile != INVALID_HANDLE_VALUE) {
+        beginRecord(EditTraceOp::Redo);
+    }
+}
+
+void EditTraceRecorder::recordSave(const DocumentText& document) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    const uint32_t number = documentNumber(document);
+    beginRecord(EditTraceOp::Save);
+    putVarint(buffer, number);
+}
+
+void EditTraceRecorder::recordClose(const DocumentText& document) {
+    // The number goes with the document, whose address may be used again
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto found = documents.find(&document);
+    if (hFile == INVALID_HANDLE_VALUE || found == documents.end()) {
+        return;
+    }
+    beginRecord(EditTraceOp::Close);
+    putVarint(buffer, found->second);
+    documents.erase(found);
+}
+
+uint32_t EditTraceRecorder::documentNumber(const DocumentText& document) {
+    if (const auto found = documents.find(&document); found != documents.end()) {
+        return found->second;
+    }
+    const uint32_t number = nextDocument++;
+    documents[&document] = number;
+    beginRecord(EditTraceOp::Open);
+    putVarint(buffer, number);
+    putVarint(buffer, document.getLength());
+    putVarint(buffer, document.lineStarts.size());
+    return number;
+}
+
+void EditTraceRecorder::beginRecord(EditTraceOp op) {
+    const auto now = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - origin).count());
+    buffer += static_cast<char>(op);
+    putVarint(buffer, now - lastTime);
+    lastTime = now;
+}
+
+void EditTraceRecorder::flushBuffer() {
+    for (size_t done = 0; !failed && done < buffer.size();) {
+        DWORD written = 0;
+        const DWORD want = static_cast<DWORD>(std::min<size_t>(buffer.size() - done, 64 * 1024 * 1024));
+        failed = !WriteFile(hFile, buffer.data() + done, want, &written, nullptr) || written != want;
+        done += written;
+    }
+    buffer.clear();
+}
+
+bool parseEditTrace(std::string_view data, std::vector<EditTraceRecord>& records) {
+    if (data.size() < sizeof(EditTraceRecorder::MAGIC) ||
+        memcmp(data.data(), EditTraceRecorder::MAGIC, sizeof(EditTraceRecorder::MAGIC)) != 0) {
+        return false;
+    }
+    data.remove_prefix(sizeof(EditTraceRecorder::MAGIC));
+
+    uint64_t time = 0;
+    while (!data.empty()) {
+        EditTraceRecord record;
+        const auto op = static_cast<uint8_t>(data.front());
+        data.remove_prefix(1);
+        uint64_t delta;
+        if (op >= static_cast<uint8_t>(EditTraceOp::Count) || !takeVarint(data, delta)) {
+            return false;
+        }
+        record.op = static_cast<EditTraceOp>(op);
+        time += delta;
+        record.time = time;
+        if (record.op != EditTraceOp::Undo && record.op != EditTraceOp::Redo) {
+            uint64_t document;
+            if (!takeVarint(data, document) || document == 0 || document > UINT32_MAX) {
+                return false;
+            }
+            record.document = static_cast<uint32_t>(document);
+        }
+
+        bool ok = true;
+        uint64_t size = 0;
+        switch (record.op) {
+        case EditTraceOp::Open:
+            ok = takeVarint(data, record.length) && takeVarint(data, record.lines);
+            break;
+        case EditTraceOp::Insert:
+            ok = takeVarint(data, record.position) && takeVarint(data, size) && size <= data.size();
+            if (ok) {
+                record.text.assign(data.data(), static_cast<size_t>(size));
+                data.remove_prefix(static_cast<size_t>(size));
+            }
+            break;
+        case EditTraceOp::Delete:
+            ok = takeVarint(data, record.position) && takeVarint(data, record.length);
+            break;
+        default:
+            break;
+        }
+        if (!ok) {
+            return false;
+        }
+        records.push_back(std::move(record));
+    }
+    return true;
+}
+
+bool readEditTrace(const std::wstring& path, std::vector<EditTraceRecord>& records) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    bool ok = GetFileSizeEx(hFile, &size) != FALSE;
+    std::string data(ok ? static_cast<size_t>(size.QuadPart) : 0, '\0');
+    for (size_t done = 0; ok && done < data.size();) {
+        DWORD read = 0;
+        const DWORD want = static_cast<DWORD>(std::min<size_t>(data.size() - done, 64 * 1024 * 1024));
+        ok = ReadFile(hFile, data.data() + done, want, &read, nullptr) && read == want;
+        done += read;
+    }
+    CloseHandle(hFile);
+    return ok && parseEditTrace(data, records);
+}
+
+EditTraceReplayer::EditTraceReplayer(bool realTime)
+    : realTime(realTime), latency(std::make_unique<LatencyHistogram[]>(static_cast<size_t>(EditTraceOp::Count))) {}
+
+void EditTraceReplayer::replay(const std::vector<EditTraceRecord>& records) {
+    using Clock = std::chrono::steady_clock;
+    // Closed documents stay until the end, as undo may still reach them
+    std::unordered_map<uint32_t, std::unique_ptr<DocumentText>> open;
+    std::vector<std::unique_ptr<DocumentText>> closed;
+    CommandHistory history;
+
+    const auto start = Clock::now();
+    for (const EditTraceRecord& record : records) {
+        if (realTime) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(record.time));
+        }
+        DocumentText* document = nullptr;
+        if (record.op != EditTraceOp::Open && record.op != EditTraceOp::Undo && record.op != EditTraceOp::Redo) {
+            const auto found = open.find(record.document);
+            if (found == open.end()) {
+                ++skipped;
+                continue;
+            }
+            document = found->second.get();
+        }
+
+        // Whatever an operation needs is made before its clock starts
+        std::string text;
+        EditOp edit;
+        if (record.op == EditTraceOp::Open) {
+            text = makeText(record.length, record.lines);
+        }
+        else if (record.op == EditTraceOp::Insert || record.op == EditTraceOp::Delete) {
+            edit.document = document;
+            edit.kind = record.op == EditTraceOp::Insert ? EditKind::Insert : EditKind::Delete;
+            edit.position = static_cast<size_t>(record.position);
+            edit.length = static_cast<size_t>(record.length);
+            edit.text = record.text;
+        }
+
+        const auto before = Clock::now();
+        switch (record.op) {
+        case EditTraceOp::Open: {
+            auto opened = std::make_unique<DocumentText>(nullptr);
+            opened->beginLoad(text.size());
+            memcpy(opened->getLoadBuffer(), text.data(), text.size());
+            opened->appendLoaded(text.size());
+            opened->finishLoad();
+            std::unique_ptr<DocumentText>& slot = open[record.document];
+            if (slot) {
+                closed.push_back(std::move(slot));
+            }
+            slot = std::move(opened);
+            break;
+        }
+        case EditTraceOp::Insert:
+        case EditTraceOp::Delete:
+            EditEngine::apply(history, edit);
+            break;
+        case EditTraceOp::Undo:
+            history.undo();
+            break;
+        case EditTraceOp::Redo:
+            history.redo();
+            break;
+        case EditTraceOp::Save: {
+            // Everything a save does short of the disk: the snapshot, and
+            // reading it through counting the line breaks it would expand
+            const DocumentSnapshot snapshot = document->snapshot();
+            size_t bytes = snapshot.getLength();
+            for (const std::string_view span : snapshot.getSpans(0, snapshot.getLength())) {
+                bytes += std::count(span.begin(), span.end(), '\n');
+            }
+            savedBytes += bytes;
+            break;
+        }
+        case EditTraceOp::Close:
+            closed.push_back(std::move(open[record.document]));
+            open.erase(record.document);
+            break;
+        default:
+            break;
+        }
+        latency[static_cast<size_t>(record.op)].record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count()));
+    }
+    seconds += std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+const LatencyHistogram& EditTraceReplayer::getLatency(EditTraceOp op) const {
+    return latency[static_cast<size_t>(op)];
+}
+
+size_t EditTraceReplayer::getSkipped() const {
+    return skipped;
+}
+
+double EditTraceReplayer::getSeconds() const {
+    return seconds;
+}
+
+std::string EditTraceReplayer::summary() const {
+    std::string out;
+    char line[256];
+    snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "operation", "count", "p50", "p90", "p99", "p99.9", "max", "total");
+    out += line;
+    uint64_t operations = 0;
+    for (size_t op = 0; op < static_cast<size_t>(EditTraceOp::Count); ++op) {
+        const LatencyHistogram& histogram = latency[op];
+        const uint64_t count = histogram.getCount();
+        if (count == 0) {
+            continue;
+        }
+        operations += count;
+        snprintf(line, sizeof(line), "%-10s %10llu %10s %10s %10s %10s %10s %10s\n",
+            editTraceOpName(static_cast<EditTraceOp>(op)), static_cast<unsigned long long>(count),
+            formatDuration(histogram.getPercentile(50)).c_str(), formatDuration(histogram.getPercentile(90)).c_str(),
+            formatDuration(histogram.getPercentile(99)).c_str(), formatDuration(histogram.getPercentile(99.9)).c_str(),
+            formatDuration(histogram.getMax()).c_str(), formatDuration(histogram.getTotal()).c_str());
+        out += line;
+    }
+    snprintf(line, sizeof(line), "\n%llu operations in %.3f s (%.0f a second), %zu skipped, %zu bytes saved\n",
+        static_cast<unsigned long long>(operations), seconds, seconds > 0 ? static_cast<double>(operations) / seconds : 0.0,
+        skipped, savedBytes);
+    out += line;
+    return out;
+}
@@ -0,0 +1,126 @@
+#ifndef EDITTRACE_H
+#define EDITTRACE_H
+
+#include <Windows.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "DocumentText.h"
+#include "Profiler.h"
+
+// A recording of an editing session, to replay its operations against the
+// engine and time them. Documents are numbered in the order the trace first
+// sees them, and only their length and line count are recorded, never their
+// text; a replay opens made-up text of the same shape.
+//
+// File layout: the magic "EDTRACE1", then one record per operation: the op
+// byte followed by LEB128 varints, first the microseconds since the previous
+// record, then the document number (not for undo and redo), then
+//   Open:   length, lines
+//   Insert: position, size, then the inserted bytes
+//   Delete: position, length
+// Typing comes to about eight bytes a keystroke.
+enum class EditTraceOp : uint8_t { Open, Insert, Delete, Undo, Redo, Save, Close, Count };
+
+[[nodiscard]] const char* editTraceOpName(EditTraceOp op);
+
+struct EditTraceRecord {
+    EditTraceOp op = EditTraceOp::Open;
+    uint64_t time = 0;     // microseconds since the trace started
+    uint32_t document = 0; // 0 for undo and redo, which act on whatever the history did last
+    uint64_t position = 0; // Insert and Delete
+    uint64_t length = 0;   // Open: bytes of text; Delete: bytes deleted
+    uint64_t lines = 0;    // Open
+    std::string text;      // Insert
+};
+
+// Records the operations the editor receives, from any thread. Inserted text
+// is anonymized by default: letters become x, digits 0 and other non-ASCII
+// bytes x, keeping line breaks, spaces and punctuation so the trace keeps
+// its shape. Records are buffered and written every FLUSH_SIZE bytes.
+class EditTraceRecorder {
+public:
+    static constexpr size_t FLUSH_SIZE = 1024 * 1024;
+    static constexpr char MAGIC[8] = { 'E', 'D', 'T', 'R', 'A', 'C', 'E', '1' };
+
+    explicit EditTraceRecorder(std::wstring path, bool anonymize = true);
+    ~EditTraceRecorder();
+    EditTraceRecorder(const EditTraceRecorder&) = delete;
+    EditTraceRecorder& operator=(const EditTraceRecorder&) = delete;
+
+    bool start();
+    // Writes out what is buffered and closes the file; false if any write failed
+    bool stop();
+    [[nodiscard]] const std::wstring& getPath() const;
+
+    // A document the trace has not seen yet is recorded as opened, as it is
+    // now, the first time it comes up
+    void recordOpen(const DocumentText& document);
+    void recordInsert(const DocumentText& document, size_t position, std::string_view text);
+    void recordDelete(const DocumentText& document, size_t position, size_t length);
+    void recordUndo();
+    void recordRedo();
+    void recordSave(const DocumentText& document);
+    void recordClose(const DocumentText& document);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::wstring path;
+    const bool anonymize;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    std::mutex mutex;
+    std::string buffer;
+    bool failed = false;
+    Clock::time_point origin;
+    uint64_t lastTime = 0;
+    std::unordered_map<const DocumentText*, uint32_t> documents;
+    uint32_t nextDocument = 1;
+
+    // Callers hold the mutex
+    uint32_t documentNumber(const DocumentText& document);
+    void beginRecord(EditTraceOp op);
+    void flushBuffer();
+};
+
+// False if the data is not a trace or is cut short; records read up to
+// the damage are kept
+bool parseEditTrace(std::string_view data, std::vector<EditTraceRecord>& records);
+bool readEditTrace(const std::wstring& path, std::vector<EditTraceRecord>& records);
+
+// Runs a trace on documents of its own and one command history, the way
+// the editor would have: typing goes through EditEngine::apply, undo and
+// redo through the history, opening through the loader's path, and saving
+// takes a snapshot and reads it through without writing a file. Each
+// operation's latency goes into the histogram for its kind.
+class EditTraceReplayer {
+public:
+    // In real time, operations wait for their recorded moment; otherwise
+    // they run back to back
+    explicit EditTraceReplayer(bool realTime = false);
+
+    // Runs add to the same histograms, so a trace can be replayed a few
+    // times for steadier numbers
+    void replay(const std::vector<EditTraceRecord>& records);
+
+    [[nodiscard]] const LatencyHistogram& getLatency(EditTraceOp op) const;
+    // Operations on documents the trace never opened
+    [[nodiscard]] size_t getSkipped() const;
+    [[nodiscard]] double getSeconds() const;
+    [[nodiscard]] std::string summary() const;
+
+private:
+    const bool realTime;
+    std::unique_ptr<LatencyHistogram[]> latency;
+    size_t skipped = 0;
+    size_t savedBytes = 0; // as CRLF files, so the reads are not optimized away
+    double seconds = 0;
+};
+
+#endif // EDITTRACE_H
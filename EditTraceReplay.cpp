@@ -0,0 +1,55 @@
+// Replays edit traces recorded with View > Record Edit Trace and prints how
+// long each kind of operation took, without a window:
+//
+//   edittrace-replay [--realtime] [--repeat N] trace.edittrace
+//
+// --realtime keeps the recorded pauses between operations; without it they
+// run back to back. --repeat replays the trace N times into the same
+// histograms.
+
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <vector>
+
+#include "EditTrace.h"
+
+int wmain(int argc, wchar_t* argv[]) {
+    bool realTime = false;
+    int repeat = 1;
+    const wchar_t* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (wcscmp(argv[i], L"--realtime") == 0) {
+            realTime = true;
+        }
+        else if (wcscmp(argv[i], L"--repeat") == 0 && i + 1 < argc) {
+            repeat = _wtoi(argv[++i]);
+        }
+        else if (path == nullptr && argv[i][0] != L'-') {
+            path = argv[i];
+        }
+        else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr || repeat < 1) {
+        fwprintf(stderr, L"Usage: edittrace-replay [--realtime] [--repeat N] trace.edittrace\n");
+        return 2;
+    }
+
+    std::vector<EditTraceRecord> records;
+    if (!readEditTrace(path, records)) {
+        fwprintf(stderr, L"%ls: not an edit trace, or cut short after %zu records\n", path, records.size());
+        if (records.empty()) {
+            return 1;
+        }
+    }
+
+    EditTraceReplayer replayer(realTime);
+    for (int run = 0; run < repeat; ++run) {
+        replayer.replay(records);
+    }
+    fputs(replayer.summary().c_str(), stdout);
+    return 0;
+}
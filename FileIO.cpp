@@ -0,0 +1,193 @@
+#include <algorithm>
+
+#include "FileIO.h"
+
+
+HANDLE openOverlapped(const std::wstring& path, DWORD access, DWORD share, DWORD disposition, DWORD flags) {
+    HANDLE hFile = CreateFileW(path.c_str(), access, share, nullptr, disposition, flags | FILE_FLAG_OVERLAPPED, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        hFile = CreateFileW(path.c_str(), access, share, nullptr, disposition, flags, nullptr);
+    }
+    return hFile;
+}
+
+bool FileStamp::read(const std::wstring& path, FileStamp& stamp) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    stamp.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    stamp.lastWrite = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+namespace {
+    // One read request; the destructor makes sure the kernel is done with
+    // the target buffer, whether or not the caller waited for the result.
+    struct PendingRead {
+        HANDLE hFile;
+        OVERLAPPED overlapped{};
+        DWORD length = 0;
+        bool pending = false;
+
+        explicit PendingRead(HANDLE hFile) : hFile(hFile) {
+            overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        }
+        PendingRead(const PendingRead&) = delete;
+        PendingRead& operator=(const PendingRead&) = delete;
+        ~PendingRead() {
+            if (pending) {
+                DWORD ignored;
+                CancelIoEx(hFile, &overlapped);
+                GetOverlappedResult(hFile, &overlapped, &ignored, TRUE);
+            }
+            CloseHandle(overlapped.hEvent);
+        }
+
+        bool issue(char* target, size_t offset, DWORD len) {
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(static_cast<unsigned long long>(offset) >> 32);
+            ResetEvent(overlapped.hEvent);
+            length = len;
+            DWORD ignored;
+            pending = ReadFile(hFile, target + offset, len, &ignored, &overlapped) || GetLastError() == ERROR_IO_PENDING;
+            return pending;
+        }
+
+        DWORD wait() {
+            DWORD got = 0;
+            if (!GetOverlappedResult(hFile, &overlapped, &got, TRUE)) {
+                got = 0;
+            }
+            pending = false;
+            return got;
+        }
+    };
+}
+
+Generator<size_t> readChunks(HANDLE hFile, char* target, size_t total, size_t firstChunk, size_t chunkSize) {
+    PendingRead reads[2] = { PendingRead(hFile), PendingRead(hFile) };
+    size_t issued = 0; // bytes requested so far
+    size_t done = 0;   // bytes landed in target
+    size_t slot = 0;
+    size_t chunk = firstChunk;
+
+    auto issueNext = [&](PendingRead& read) {
+        if (issued >= total) {
+            return false;
+        }
+        const DWORD len = static_cast<DWORD>(std::min(chunk, total - issued));
+        if (!read.issue(target, issued, len)) {
+            return false;
+        }
+        issued += len;
+        chunk = chunkSize;
+        return true;
+    };
+
+    issueNext(reads[0]);
+    while (reads[slot].pending) {
+        const DWORD requested = reads[slot].length;
+        const DWORD got = reads[slot].wait();
+        done += got;
+        if (got < requested) {
+            co_return; // read error, or the file shrank underneath us
+        }
+
+        // Keep the disk busy while the caller works on what just arrived
+        issueNext(reads[slot ^ 1]);
+        co_yield done;
+        slot ^= 1;
+    }
+}
+
+FileWriter::FileWriter(HANDLE hFile) : hFile(hFile) {
+    for (Slot& slot : slots) {
+        slot.overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    }
+}
+
+FileWriter::~FileWriter() {
+    finish();
+    for (Slot& slot : slots) {
+        CloseHandle(slot.overlapped.hEvent);
+    }
+}
+
+std::string& FileWriter::getBlock() {
+    // The block belongs to the slot it is sent through, which may still be busy
+    complete(current);
+    return blocks[current];
+}
+
+bool FileWriter::submitBlock() {
+    complete(current);
+    if (blocks[current].empty()) {
+        return !failed;
+    }
+    const size_t index = current;
+    if (!submit(blocks[index].data(), blocks[index].size())) {
+        return false;
+    }
+    slots[index].holdsBlock = true;
+    return true;
+}
+
+bool FileWriter::write(std::string_view data) {
+    if (!submitBlock()) {
+        return false;
+    }
+    for (size_t done = 0; done < data.size(); done += MAX_WRITE) {
+        if (!submit(data.data() + done, std::min(MAX_WRITE, data.size() - done))) {
+            return false;
+        }
+    }
+    return !failed;
+}
+
+bool FileWriter::finish() {
+    const bool submitted = submitBlock();
+    complete(0);
+    complete(1);
+    return submitted && !failed;
+}
+
+bool FileWriter::submit(const char* data, size_t len) {
+    Slot& slot = slots[current];
+    complete(current);
+    if (failed) {
+        return false;
+    }
+
+    slot.overlapped.Offset = static_cast<DWORD>(offset);
+    slot.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    ResetEvent(slot.overlapped.hEvent);
+    slot.requested = static_cast<DWORD>(len);
+    DWORD ignored;
+    if (!WriteFile(hFile, data, slot.requested, &ignored, &slot.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+        failed = true;
+        return false;
+    }
+    slot.pending = true;
+    offset += len;
+    current ^= 1;
+    return true;
+}
+
+bool FileWriter::complete(size_t index) {
+    // A block is only cleared once the write sending it has finished
+    Slot& slot = slots[index];
+    if (slot.pending) {
+        // A short write, as on a full disk, would leave a hole in the file
+        DWORD written = 0;
+        if (!GetOverlappedResult(hFile, &slot.overlapped, &written, TRUE) || written != slot.requested) {
+            failed = true;
+        }
+        slot.pending = false;
+    }
+    if (slot.holdsBlock) {
+        blocks[index].clear();
+        slot.holdsBlock = false;
+    }
+    return !failed;
+}
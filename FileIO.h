@@ -0,0 +1,74 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "Generator.h"
+
+// Overlapped file I/O so that processing one chunk runs while the next one
+// is being read or written. Handles opened without FILE_FLAG_OVERLAPPED work
+// too; every request then simply completes before it returns.
+
+// Size and write time of a file, used to tell whether something derived
+// from the file still matches it
+struct FileStamp {
+    uint64_t size = 0;
+    uint64_t lastWrite = 0;
+
+    [[nodiscard]] static bool read(const std::wstring& path, FileStamp& stamp);
+    bool operator==(const FileStamp& other) const = default;
+};
+
+// Opens with FILE_FLAG_OVERLAPPED, falling back to a plain handle when the
+// file system refuses it
+HANDLE openOverlapped(const std::wstring& path, DWORD access, DWORD share, DWORD disposition, DWORD flags = 0);
+
+// Reads the first `total` bytes of the file into target, contiguously.
+// Yields the number of bytes in target after each chunk completes, with the
+// following chunk already in flight. Stops early on a read error, so the
+// last value is less than total. Leaving the loop early cancels the read
+// still in flight and waits for it before returning.
+Generator<size_t> readChunks(HANDLE hFile, char* target, size_t total, size_t firstChunk, size_t chunkSize);
+
+// Writes sequentially from offset 0 with at most two writes in flight.
+// Text can be built in getBlock() and sent with submitBlock(), or passed to
+// write() directly when it stays valid until the writer is finished.
+// A write that fails or writes fewer bytes than it was given fails the
+// writer: every call after it returns false, finish() included.
+class FileWriter {
+public:
+    static constexpr size_t MAX_WRITE = 64 * 1024 * 1024;
+
+    explicit FileWriter(HANDLE hFile);
+    ~FileWriter();
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    std::string& getBlock();
+    bool submitBlock();
+    bool write(std::string_view data);
+    bool finish();
+
+private:
+    struct Slot {
+        OVERLAPPED overlapped{};
+        DWORD requested = 0;
+        bool pending = false;
+        bool holdsBlock = false;
+    };
+
+    HANDLE hFile;
+    Slot slots[2];
+    std::string blocks[2];
+    size_t current = 0;
+    unsigned long long offset = 0;
+    bool failed = false;
+
+    bool submit(const char* data, size_t len);
+    bool complete(size_t index);
+};
+
+#endif // FILEIO_H
@@ -0,0 +1,110 @@
+#include <vector>
+
+#include "FileWatcher.h"
+
+
+FileWatcher::FileWatcher(ChangeCallback onChange)
+    : onChange(std::move(onChange)), wakeEvent(CreateEventW(nullptr, FALSE, FALSE, nullptr)) {
+    worker = std::thread(&FileWatcher::run, this);
+}
+
+FileWatcher::~FileWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(foldersMutex);
+        stopping = true;
+    }
+    SetEvent(wakeEvent);
+    worker.join();
+    CloseHandle(wakeEvent);
+}
+
+std::wstring FileWatcher::folderOf(const std::wstring& filePath) {
+    const size_t slash = filePath.find_last_of(L"\\/");
+    return slash != std::wstring::npos ? filePath.substr(0, slash + 1) : L".";
+}
+
+void FileWatcher::watch(const std::wstring& filePath) {
+    if (filePath.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(foldersMutex);
+        ++folders[folderOf(filePath)];
+    }
+    SetEvent(wakeEvent);
+}
+
+void FileWatcher::unwatch(const std::wstring& filePath) {
+    if (filePath.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(foldersMutex);
+        auto folder = folders.find(folderOf(filePath));
+        if (folder == folders.end() || --folder->second > 0) {
+            return;
+        }
+        folders.erase(folder);
+    }
+    SetEvent(wakeEvent);
+}
+
+void FileWatcher::run() {
+    // The notification handles belong to this thread; watch and unwatch only
+    // change the folder list and wake it up to catch up
+    std::map<std::wstring, HANDLE> handles;
+    std::vector<HANDLE> waits;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(foldersMutex);
+            if (stopping) {
+                break;
+            }
+            std::erase_if(handles, [this](const auto& watched) {
+                if (folders.contains(watched.first)) {
+                    return false;
+                }
+                FindCloseChangeNotification(watched.second);
+                return true;
+            });
+            for (const auto& folder : folders) {
+                if (handles.size() < MAX_FOLDERS && !handles.contains(folder.first)) {
+                    HANDLE handle = FindFirstChangeNotificationW(folder.first.c_str(), FALSE,
+                        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+                    if (handle != INVALID_HANDLE_VALUE) {
+                        handles.emplace(folder.first, handle);
+                    }
+                }
+            }
+        }
+        waits.assign(1, wakeEvent);
+        for (const auto& watched : handles) {
+            waits.push_back(watched.second);
+        }
+
+        const DWORD count = static_cast<DWORD>(waits.size());
+        DWORD signalled = WaitForMultipleObjects(count, waits.data(), FALSE, INFINITE);
+        if (signalled == WAIT_OBJECT_0) {
+            continue; // the folder list changed
+        }
+        if (signalled >= WAIT_OBJECT_0 + count) {
+            Sleep(SETTLE_MS); // a folder went away under its handle; the next pass reopens what is left
+            continue;
+        }
+        // Give the writer a moment to finish, then take in everything that
+        // fired meanwhile. A fixed pause rather than waiting for quiet, since
+        // the edit journals keep their folders busy while someone types.
+        FindNextChangeNotification(waits[signalled - WAIT_OBJECT_0]);
+        Sleep(SETTLE_MS);
+        while ((signalled = WaitForMultipleObjects(count, waits.data(), FALSE, 0)) > WAIT_OBJECT_0 &&
+            signalled < WAIT_OBJECT_0 + count) {
+            FindNextChangeNotification(waits[signalled - WAIT_OBJECT_0]);
+        }
+        if (onChange) {
+            onChange();
+        }
+    }
+    for (const auto& watched : handles) {
+        FindCloseChangeNotification(watched.second);
+    }
+}
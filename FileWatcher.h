@@ -0,0 +1,47 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <Windows.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Watches the folders of the open files for changes made by other programs.
+// A change notification only says that something in a folder changed, so
+// the callback carries no path; the editor compares the stamps of its files
+// to find out which one it was. Notifications that arrive together (a tool
+// writing a file in several steps) are coalesced into one callback.
+class FileWatcher {
+public:
+    static constexpr DWORD SETTLE_MS = 100;
+    // One wait slot is taken by the wake event
+    static constexpr size_t MAX_FOLDERS = MAXIMUM_WAIT_OBJECTS - 1;
+
+    // Called on the watcher thread
+    using ChangeCallback = std::function<void()>;
+
+    explicit FileWatcher(ChangeCallback onChange);
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Counted, so a file open in two tabs stays watched until both close
+    void watch(const std::wstring& filePath);
+    void unwatch(const std::wstring& filePath);
+
+private:
+    ChangeCallback onChange;
+    HANDLE wakeEvent;
+    std::thread worker;
+
+    std::mutex foldersMutex;
+    std::map<std::wstring, size_t> folders; // folder -> files watched in it
+    bool stopping = false;
+
+    [[nodiscard]] static std::wstring folderOf(const std::wstring& filePath);
+    void run();
+};
+
+#endif // FILEWATCHER_H
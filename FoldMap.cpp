@@ -0,0 +1,181 @@
+#include <algorithm>
+
+#include "FoldMap.h"
+
+FoldMap::FoldMap(DocumentText& document)
+    : document(document) {}
+
+FoldMap::~FoldMap() {
+    unfoldAll();
+}
+
+void FoldMap::fold(const FoldRegion& region) {
+    for (const MarkerRange& range : folds) {
+        if (document.getMarkers().getRange(range).first == region.open) {
+            return; // folded already
+        }
+    }
+    folds.push_back(document.getMarkers().addRange(region.open, region.close));
+    document.setLineProjection(this);
+    builtVersion = npos;
+}
+
+bool FoldMap::unfold(size_t line) {
+    const size_t before = folds.size();
+    std::erase_if(folds, [&](const MarkerRange& range) {
+        if (!spans(range, line)) {
+            return false;
+        }
+        document.getMarkers().removeRange(range);
+        return true;
+    });
+    if (folds.empty()) {
+        document.setLineProjection(nullptr);
+    }
+    builtVersion = npos;
+    return folds.size() != before;
+}
+
+void FoldMap::unfoldAll() {
+    for (const MarkerRange& range : folds) {
+        document.getMarkers().removeRange(range);
+    }
+    folds.clear();
+    document.setLineProjection(nullptr);
+    builtVersion = npos;
+}
+
+bool FoldMap::isFolded(size_t line) const {
+    refresh();
+    return std::binary_search(foldLines.begin(), foldLines.end(), line);
+}
+
+bool FoldMap::isHidden(size_t line) const {
+    refresh();
+    const auto run = std::upper_bound(runs.begin(), runs.end(), line,
+        [](size_t target, const Run& candidate) { return target < candidate.first; });
+    return run != runs.begin() && line <= std::prev(run)->last;
+}
+
+bool FoldMap::empty() const {
+    return folds.empty();
+}
+
+size_t FoldMap::getFoldEnd(size_t line) const {
+    size_t end = npos;
+    for (const MarkerRange& range : folds) {
+        if (spans(range, line)) {
+            const size_t last = document.lineStarts.lineOf(document.getMarkers().getRange(range).second);
+            end = end == npos ? last : std::max(end, last);
+        }
+    }
+    return end;
+}
+
+bool FoldMap::findFold(size_t firstLine, size_t lastLine, size_t& first, size_t& last) const {
+    const LineIndex& lines = document.lineStarts;
+    bool found = false;
+    for (const MarkerRange& range : folds) {
+        const auto [open, close] = document.getMarkers().getRange(range);
+        const size_t openLine = lines.lineOf(open);
+        const size_t closeLine = lines.lineOf(close);
+        if (openLine < closeLine && openLine <= lastLine && closeLine >= firstLine &&
+            (!found || closeLine - openLine > last - first)) {
+            first = openLine;
+            last = closeLine;
+            found = true;
+        }
+    }
+    return found;
+}
+
+size_t FoldMap::getVisibleLineCount() const {
+    refresh();
+    return document.lineStarts.size() - hiddenLines;
+}
+
+size_t FoldMap::toDocumentLine(size_t visibleLine) const {
+    refresh();
+    // The runs that start at or before the visible line are all behind it
+    const auto run = std::upper_bound(runs.begin(), runs.end(), visibleLine,
+        [](size_t target, const Run& candidate) { return target < candidate.first - candidate.hiddenBefore; });
+    size_t line = visibleLine;
+    if (run != runs.begin()) {
+        const Run& previous = *std::prev(run);
+        line += previous.hiddenBefore + previous.last - previous.first + 1;
+    }
+    return line < document.lineStarts.size() ? line : npos;
+}
+
+size_t FoldMap::toVisibleLine(size_t documentLine) const {
+    refresh();
+    const auto run = std::upper_bound(runs.begin(), runs.end(), documentLine,
+        [](size_t target, const Run& candidate) { return target < candidate.first; });
+    if (run == runs.begin()) {
+        return documentLine;
+    }
+    const Run& previous = *std::prev(run);
+    if (documentLine <= previous.last) {
+        return previous.first - 1 - previous.hiddenBefore;
+    }
+    return documentLine - previous.hiddenBefore - (previous.last - previous.first + 1);
+}
+
+std::vector<std::pair<size_t, size_t>> FoldMap::getShownLines() const {
+    refresh();
+    std::vector<std::pair<size_t, size_t>> shown;
+    size_t next = 0;
+    for (const Run& run : runs) {
+        shown.emplace_back(next, run.first);
+        next = run.last + 1;
+    }
+    shown.emplace_back(next, document.lineStarts.size());
+    return shown;
+}
+
+void FoldMap::refresh() const {
+    if (builtVersion == document.getVersion()) {
+        return;
+    }
+    builtVersion = document.getVersion();
+    runs.clear();
+    foldLines.clear();
+    const LineIndex& lines = document.lineStarts;
+    for (const MarkerRange& range : folds) {
+        const auto [open, close] = document.getMarkers().getRange(range);
+        const size_t first = lines.lineOf(open);
+        const size_t last = lines.lineOf(close);
+        if (last <= first) {
+            continue; // the lines between were deleted
+        }
+        foldLines.push_back(first);
+        if (last > first + 1) {
+            runs.push_back(Run{ first + 1, last - 1, 0 });
+        }
+    }
+    std::sort(foldLines.begin(), foldLines.end());
+
+    // Nested and touching runs become one
+    std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (const Run& run : runs) {
+        if (merged > 0 && run.first <= runs[merged - 1].last + 1) {
+            runs[merged - 1].last = std::max(runs[merged - 1].last, run.last);
+        }
+        else {
+            runs[merged++] = run;
+        }
+    }
+    runs.resize(merged);
+    hiddenLines = 0;
+    for (Run& run : runs) {
+        run.hiddenBefore = hiddenLines;
+        hiddenLines += run.last - run.first + 1;
+    }
+}
+
+bool FoldMap::spans(const MarkerRange& range, size_t line) const {
+    const auto [open, close] = document.getMarkers().getRange(range);
+    const LineIndex& lines = document.lineStarts;
+    return lines.lineOf(open) <= line && line < lines.lineOf(close);
+}
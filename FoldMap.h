@@ -0,0 +1,77 @@
+#ifndef FOLDMAP_H
+#define FOLDMAP_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "BracketIndex.h"
+#include "DocumentText.h"
+
+// Which lines of a document are folded away, and where the rest fall once
+// they are. A folded region keeps its first and last lines and hides those
+// between them.
+//
+// Each fold holds its brackets as a marker range of the document, so folds
+// follow edits. The hidden line runs are worked out from the markers again
+// only when the document's version has moved on; every lookup after that is
+// a binary search over the runs, so scrolling past a fold costs the same
+// however many lines it hides. Used on the thread that owns the document.
+//
+// While anything is folded it is the document's line projection: the view
+// holds only the lines left, so a folded region costs nothing to scroll.
+// Whoever folds keeps the view's text in step with the map.
+class FoldMap : public LineProjection {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit FoldMap(DocumentText& document);
+    ~FoldMap() override;
+
+    FoldMap(const FoldMap&) = delete;
+    FoldMap& operator=(const FoldMap&) = delete;
+
+    void fold(const FoldRegion& region);
+    // Unfolds what opens on line or hides it; false if nothing did
+    bool unfold(size_t line);
+    void unfoldAll();
+    // A fold opens on the line
+    [[nodiscard]] bool isFolded(size_t line) const;
+    [[nodiscard]] bool isHidden(size_t line) const override;
+    [[nodiscard]] bool empty() const;
+    // The last line of the widest fold that unfold(line) would take away,
+    // or npos
+    [[nodiscard]] size_t getFoldEnd(size_t line) const;
+    // The first and last lines of the widest fold on any of the lines
+    // firstLine to lastLine; false if there is none
+    bool findFold(size_t firstLine, size_t lastLine, size_t& first, size_t& last) const;
+
+    [[nodiscard]] size_t getVisibleLineCount() const;
+    // The document line shown as the given visible line, or npos past the end
+    [[nodiscard]] size_t toDocumentLine(size_t visibleLine) const override;
+    // Where a document line shows; a hidden one shows as the line its fold
+    // opens on
+    [[nodiscard]] size_t toVisibleLine(size_t documentLine) const override;
+    // The lines shown, as [first, end) runs of document lines in order
+    [[nodiscard]] std::vector<std::pair<size_t, size_t>> getShownLines() const;
+
+private:
+    // Document lines first to last are hidden, after hiddenBefore others
+    struct Run {
+        size_t first;
+        size_t last;
+        size_t hiddenBefore;
+    };
+
+    DocumentText& document;
+    std::vector<MarkerRange> folds;
+    mutable std::vector<Run> runs;
+    mutable std::vector<size_t> foldLines; // sorted lines that folds open on
+    mutable size_t hiddenLines = 0;
+    mutable size_t builtVersion = npos;
+
+    void refresh() const;
+    [[nodiscard]] bool spans(const MarkerRange& range, size_t line) const;
+};
+
+#endif // FOLDMAP_H
@@ -0,0 +1,388 @@
+#include <algorithm>
+#include <cwctype>
+
+#include "Grammar.h"
+
+namespace {
+    // Appends tokens, merging neighbours of the same kind
+    class TokenWriter {
+    public:
+        explicit TokenWriter(std::vector<Token>* tokens)
+            : tokens(tokens) {}
+
+        void add(size_t start, TokenKind kind) {
+            if (tokens == nullptr) {
+                return;
+            }
+            if (!tokens->empty() && tokens->back().start == start) {
+                tokens->pop_back();
+            }
+            if (tokens->empty() || tokens->back().kind != kind) {
+                tokens->push_back(Token{ static_cast<uint32_t>(std::min<size_t>(start, UINT32_MAX)), kind });
+            }
+        }
+
+    private:
+        std::vector<Token>* tokens;
+    };
+
+    bool isIdentifierStart(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (c & 0x80) != 0;
+    }
+
+    bool isIdentifierPart(char c) {
+        return isIdentifierStart(c) || (c >= '0' && c <= '9');
+    }
+
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    bool endsWithBackslash(std::string_view line) {
+        return !line.empty() && line.back() == '\\';
+    }
+
+    // Past the closing quote, or npos if the line ends first
+    size_t skipQuoted(std::string_view line, size_t i, char quote) {
+        for (; i < line.size(); ++i) {
+            if (line[i] == '\\') {
+                ++i;
+            }
+            else if (line[i] == quote) {
+                return i + 1;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    // Digits, digit separators, a fraction, an exponent with its sign and suffixes
+    size_t skipNumber(std::string_view line, size_t i) {
+        while (i < line.size()) {
+            const char c = line[i];
+            if ((c == 'e' || c == 'E' || c == 'p' || c == 'P') && i + 1 < line.size() &&
+                (line[i + 1] == '+' || line[i + 1] == '-')) {
+                i += 2;
+            }
+            else if (isIdentifierPart(c) || c == '.' || c == '\'') {
+                ++i;
+            }
+            else {
+                break;
+            }
+        }
+        return i;
+    }
+
+    // The state is what the line ends inside of, in the low bits; a raw
+    // string keeps a hash of its delimiter above them
+    enum CppState : LexState {
+        CPP_NORMAL,
+        CPP_BLOCK_COMMENT,
+        CPP_LINE_COMMENT,  // continued with a backslash
+        CPP_STRING,        // continued with a backslash
+        CPP_PREPROCESSOR,  // continued with a backslash
+        CPP_RAW_STRING,
+    };
+    constexpr LexState CPP_KIND_MASK = 0xF;
+    constexpr size_t MAX_DELIMITER = 16;
+
+    LexState rawStringState(std::string_view delimiter) {
+        uint32_t hash = 2166136261u;
+        for (const char c : delimiter) {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+        }
+        return CPP_RAW_STRING | hash << 4;
+    }
+
+    // Past the )delimiter" that closes a raw string in this state, or npos
+    size_t findRawStringEnd(std::string_view line, size_t i, LexState state) {
+        for (; (i = line.find(')', i)) != std::string_view::npos; ++i) {
+            const size_t quote = line.find('"', i + 1);
+            if (quote != std::string_view::npos && quote - i - 1 <= MAX_DELIMITER &&
+                rawStringState(line.substr(i + 1, quote - i - 1)) == state) {
+                return quote + 1;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    bool isOneOf(std::string_view word, const std::string_view* sorted, size_t count) {
+        return std::binary_search(sorted, sorted + count, word);
+    }
+
+    constexpr std::string_view CPP_KEYWORDS[] = {
+        "alignas", "alignof", "asm", "auto", "break", "case", "catch", "class", "co_await", "co_return",
+        "co_yield", "concept", "const", "const_cast", "consteval", "constexpr", "constinit", "continue",
+        "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit", "export", "extern",
+        "final", "for", "friend", "goto", "if", "inline", "mutable", "namespace", "new", "noexcept", "operator",
+        "override", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return",
+        "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this",
+        "thread_local", "throw", "try", "typedef", "typeid", "typename", "union", "using", "virtual",
+        "volatile", "while",
+    };
+    constexpr std::string_view CPP_TYPES[] = {
+        "bool", "char", "char16_t", "char32_t", "char8_t", "double", "float", "int", "int16_t", "int32_t",
+        "int64_t", "int8_t", "intptr_t", "long", "ptrdiff_t", "short", "signed", "size_t", "uint16_t",
+        "uint32_t", "uint64_t", "uint8_t", "uintptr_t", "unsigned", "void", "wchar_t",
+    };
+    constexpr std::string_view CPP_LITERALS[] = { "false", "nullptr", "true" };
+
+    class CppGrammar : public Grammar {
+    public:
+        [[nodiscard]] const char* getName() const override {
+            return "C++";
+        }
+
+        LexState lexLine(std::string_view line, LexState state, std::vector<Token>* tokens) const override {
+            TokenWriter out(tokens);
+            size_t i = 0;
+            bool directive = false;
+
+            // First whatever the previous line left open
+            switch (state & CPP_KIND_MASK) {
+            case CPP_BLOCK_COMMENT:
+                out.add(0, TokenKind::Comment);
+                i = line.find("*/");
+                if (i == std::string_view::npos) {
+                    return CPP_BLOCK_COMMENT;
+                }
+                i += 2;
+                break;
+            case CPP_LINE_COMMENT:
+                out.add(0, TokenKind::Comment);
+                return endsWithBackslash(line) ? CPP_LINE_COMMENT : CPP_NORMAL;
+            case CPP_STRING:
+                out.add(0, TokenKind::String);
+                i = skipQuoted(line, 0, '"');
+                if (i == std::string_view::npos) {
+                    return endsWithBackslash(line) ? CPP_STRING : CPP_NORMAL;
+                }
+                break;
+            case CPP_PREPROCESSOR:
+                directive = true;
+                break;
+            case CPP_RAW_STRING:
+                out.add(0, TokenKind::String);
+                i = findRawStringEnd(line, 0, state);
+                if (i == std::string_view::npos) {
+                    return state;
+                }
+                break;
+            default:
+                break;
+            }
+
+            if (!directive && i == 0) {
+                const size_t first = line.find_first_not_of(" \t");
+                directive = first != std::string_view::npos && line[first] == '#';
+            }
+            const TokenKind base = directive ? TokenKind::Preprocessor : TokenKind::Text;
+            out.add(i, base);
+
+            while (i < line.size()) {
+                const char c = line[i];
+                if (isSpace(c)) {
+                    ++i;
+                }
+                else if (c == '/' && i + 1 < line.size() && line[i + 1] == '/') {
+                    out.add(i, TokenKind::Comment);
+                    return endsWithBackslash(line) ? CPP_LINE_COMMENT : CPP_NORMAL;
+                }
+                else if (c == '/' && i + 1 < line.size() && line[i + 1] == '*') {
+                    out.add(i, TokenKind::Comment);
+                    const size_t end = line.find("*/", i + 2);
+                    if (end == std::string_view::npos) {
+                        return CPP_BLOCK_COMMENT;
+                    }
+                    i = end + 2;
+                    out.add(i, base);
+                }
+                else if (c == '"' || c == '\'') {
+                    out.add(i, TokenKind::String);
+                    i = skipQuoted(line, i + 1, c);
+                    if (i == std::string_view::npos) {
+                        // Only a string goes on past a backslash at the end
+                        if (c == '"' && endsWithBackslash(line)) {
+                            return CPP_STRING;
+                        }
+                        break;
+                    }
+                    out.add(i, base);
+                }
+                else if (isDigit(c) || (c == '.' && i + 1 < line.size() && isDigit(line[i + 1]))) {
+                    out.add(i, TokenKind::Number);
+                    i = skipNumber(line, i);
+                    out.add(i, base);
+                }
+                else if (isIdentifierStart(c)) {
+                    const size_t start = i;
+                    while (i < line.size() && isIdentifierPart(line[i])) {
+                        ++i;
+                    }
+                    const std::string_view word = line.substr(start, i - start);
+                    if (i < line.size() && (line[i] == '"' || line[i] == '\'') &&
+                        (word == "L" || word == "u" || word == "U" || word == "u8")) {
+                        i = start + word.size();
+                        out.add(start, TokenKind::String);
+                        const char quote = line[i];
+                        i = skipQuoted(line, i + 1, quote);
+                        if (i == std::string_view::npos) {
+                            if (quote == '"' && endsWithBackslash(line)) {
+                                return CPP_STRING;
+                            }
+                            break;
+                        }
+                        out.add(i, base);
+                    }
+                    else if (i < line.size() && line[i] == '"' && !word.empty() && word.back() == 'R' &&
+                        (word == "R" || word == "LR" || word == "uR" || word == "UR" || word == "u8R")) {
+                        out.add(start, TokenKind::String);
+                        const size_t open = line.find('(', i + 1);
+                        if (open == std::string_view::npos || open - i - 1 > MAX_DELIMITER) {
+                            i = line.size(); // not a raw string after all
+                            break;
+                        }
+                        const LexState raw = rawStringState(line.substr(i + 1, open - i - 1));
+                        i = findRawStringEnd(line, open + 1, raw);
+                        if (i == std::string_view::npos) {
+                            return raw;
+                        }
+                        out.add(i, base);
+                    }
+                    else if (!directive) {
+                        TokenKind kind = TokenKind::Text;
+                        if (isOneOf(word, CPP_KEYWORDS, std::size(CPP_KEYWORDS))) {
+                            kind = TokenKind::Keyword;
+                        }
+                        else if (isOneOf(word, CPP_TYPES, std::size(CPP_TYPES))) {
+                            kind = TokenKind::Type;
+                        }
+                        else if (isOneOf(word, CPP_LITERALS, std::size(CPP_LITERALS))) {
+                            kind = TokenKind::Literal;
+                        }
+                        out.add(start, kind);
+                        out.add(i, base);
+                    }
+                }
+                else {
+                    ++i;
+                }
+            }
+            return directive && endsWithBackslash(line) ? CPP_PREPROCESSOR : CPP_NORMAL;
+        }
+    };
+
+    enum JsonState : LexState { JSON_NORMAL, JSON_BLOCK_COMMENT };
+
+    class JsonGrammar : public Grammar {
+    public:
+        [[nodiscard]] const char* getName() const override {
+            return "JSON";
+        }
+
+        LexState lexLine(std::string_view line, LexState state, std::vector<Token>* tokens) const override {
+            TokenWriter out(tokens);
+            size_t i = 0;
+            if (state == JSON_BLOCK_COMMENT) {
+                out.add(0, TokenKind::Comment);
+                i = line.find("*/");
+                if (i == std::string_view::npos) {
+                    return JSON_BLOCK_COMMENT;
+                }
+                i += 2;
+            }
+            out.add(i, TokenKind::Text);
+
+            while (i < line.size()) {
+                const char c = line[i];
+                if (c == '"') {
+                    // A string followed by a colon is a key
+                    const size_t start = i;
+                    i = skipQuoted(line, i + 1, '"');
+                    if (i == std::string_view::npos) {
+                        out.add(start, TokenKind::String);
+                        break;
+                    }
+                    const size_t next = line.find_first_not_of(" \t", i);
+                    out.add(start, next != std::string_view::npos && line[next] == ':' ? TokenKind::Key : TokenKind::String);
+                    out.add(i, TokenKind::Text);
+                }
+                else if (isDigit(c) || c == '-') {
+                    out.add(i, TokenKind::Number);
+                    i = skipNumber(line, i + 1);
+                    out.add(i, TokenKind::Text);
+                }
+                else if (c == '/' && i + 1 < line.size() && line[i + 1] == '/') {
+                    out.add(i, TokenKind::Comment);
+                    break;
+                }
+                else if (c == '/' && i + 1 < line.size() && line[i + 1] == '*') {
+                    out.add(i, TokenKind::Comment);
+                    const size_t end = line.find("*/", i + 2);
+                    if (end == std::string_view::npos) {
+                        return JSON_BLOCK_COMMENT;
+                    }
+                    i = end + 2;
+                    out.add(i, TokenKind::Text);
+                }
+                else if (isIdentifierStart(c)) {
+                    const size_t start = i;
+                    while (i < line.size() && isIdentifierPart(line[i])) {
+                        ++i;
+                    }
+                    const std::string_view word = line.substr(start, i - start);
+                    if (word == "true" || word == "false" || word == "null") {
+                        out.add(start, TokenKind::Literal);
+                        out.add(i, TokenKind::Text);
+                    }
+                }
+                else {
+                    ++i;
+                }
+            }
+            return JSON_NORMAL;
+        }
+    };
+
+    bool hasExtension(const std::wstring& path, const wchar_t* extension) {
+        const size_t length = wcslen(extension);
+        if (path.size() < length) {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i) {
+            if (static_cast<wchar_t>(towlower(path[path.size() - length + i])) != extension[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+
+const Grammar& cppGrammar() {
+    static const CppGrammar grammar;
+    return grammar;
+}
+
+const Grammar& jsonGrammar() {
+    static const JsonGrammar grammar;
+    return grammar;
+}
+
+const Grammar* grammarForPath(const std::wstring& path) {
+    for (const wchar_t* extension : { L".cpp", L".cc", L".cxx", L".c", L".h", L".hpp", L".hh", L".hxx", L".inl" }) {
+        if (hasExtension(path, extension)) {
+            return &cppGrammar();
+        }
+    }
+    for (const wchar_t* extension : { L".json", L".jsonc" }) {
+        if (hasExtension(path, extension)) {
+            return &jsonGrammar();
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,43 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What a run of text is, for colouring it
+enum class TokenKind : uint8_t { Text, Keyword, Type, Number, String, Comment, Preprocessor, Key, Literal, Count };
+
+// A run of one kind, from start to the next token's start or the end of the line
+struct Token {
+    uint32_t start;
+    TokenKind kind;
+};
+
+// What a lexer carries from the end of one line to the start of the next,
+// such as being inside a block comment. A line lexes the same way whenever
+// it starts in the same state, so a highlighter can stop re-lexing once a
+// line ends in the state it ended in before an edit.
+using LexState = uint32_t;
+
+// A language's lexer. Lexing is line by line and keeps nothing between
+// calls, so one grammar serves every document on every thread.
+class Grammar {
+public:
+    virtual ~Grammar() = default;
+
+    [[nodiscard]] virtual const char* getName() const = 0;
+    // Lexes one line, without its line break, from the state it starts in
+    // and returns the state the next line starts in. Tokens are appended if
+    // asked for; neighbours are of different kinds.
+    virtual LexState lexLine(std::string_view line, LexState state, std::vector<Token>* tokens) const = 0;
+};
+
+[[nodiscard]] const Grammar& cppGrammar();
+// JSON, with the comments JSONC allows
+[[nodiscard]] const Grammar& jsonGrammar();
+// By file extension; null for files that are not highlighted
+[[nodiscard]] const Grammar* grammarForPath(const std::wstring& path);
+
+#endif // GRAMMAR_H
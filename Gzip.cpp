@@ -0,0 +1,793 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "Gzip.h"
+#include "DocumentText.h"
+#include "TaskScheduler.h"
+
+
+namespace {
+    constexpr size_t WINDOW_SIZE = 32 * 1024;
+    constexpr size_t HEADER_SIZE = 18; // BGZF member header
+    constexpr size_t TRAILER_SIZE = 8;
+    // The most deflate can expand its input, so a member recording more
+    // text than this is corrupt or hostile
+    constexpr size_t MAX_RATIO = 1032;
+    constexpr size_t MAX_BGZF_MEMBER = 64 * 1024; // text per BGZF member
+
+    constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    constexpr uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    constexpr uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    constexpr uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // Empty member that marks the end of a BGZF file
+    constexpr uint8_t BGZF_EOF[28] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+        0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    struct CrcTable {
+        uint32_t values[256];
+        CrcTable() {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                values[n] = c;
+            }
+        }
+    };
+
+    uint32_t readLE32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    void appendLE(std::string& out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    uint32_t reverseBits(uint32_t code, int len) {
+        uint32_t result = 0;
+        for (int i = 0; i < len; ++i) {
+            result = (result << 1) | ((code >> i) & 1);
+        }
+        return result;
+    }
+
+    // Canonical Huffman code decoded with a single lookup on the next maxLen
+    // bits. Entries hold symbol << 4 | code length, 0 for unused codes.
+    struct Huffman {
+        std::vector<uint16_t> table;
+        int maxLen = 0;
+
+        bool build(const uint8_t* lengths, int count) {
+            int lengthCount[16] = {};
+            maxLen = 0;
+            for (int i = 0; i < count; ++i) {
+                ++lengthCount[lengths[i]];
+                maxLen = std::max<int>(maxLen, lengths[i]);
+            }
+            lengthCount[0] = 0;
+            if (maxLen == 0) {
+                table.assign(1, 0);
+                return true; // no codes, only valid if never used
+            }
+
+            int left = 1;
+            uint32_t nextCode[16] = {};
+            uint32_t code = 0;
+            for (int len = 1; len <= 15; ++len) {
+                left <<= 1;
+                left -= lengthCount[len];
+                if (left < 0) {
+                    return false; // over-subscribed
+                }
+                code = (code + lengthCount[len - 1]) << 1;
+                nextCode[len] = code;
+            }
+
+            table.assign(size_t(1) << maxLen, 0);
+            for (int symbol = 0; symbol < count; ++symbol) {
+                const int len = lengths[symbol];
+                if (len == 0) {
+                    continue;
+                }
+                const uint16_t entry = static_cast<uint16_t>(symbol << 4 | len);
+                for (uint32_t index = reverseBits(nextCode[len]++, len); index < table.size(); index += 1u << len) {
+                    table[index] = entry;
+                }
+            }
+            return true;
+        }
+    };
+
+    // Decodes a raw deflate stream held entirely in memory, a block at a time
+    class Inflater {
+    public:
+        Inflater(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+        // Appends the output of the next block to out, which must already
+        // hold the previous 32 KiB of output for back references.
+        bool inflateBlock(std::string& out) {
+            if (!need(3)) {
+                return false;
+            }
+            last = take(1) != 0;
+            switch (take(2)) {
+            case 0:
+                return stored(out);
+            case 1:
+                return codes(out, fixedLiterals(), fixedDistances());
+            case 2:
+                return dynamic(out);
+            default:
+                return false;
+            }
+        }
+
+        [[nodiscard]] bool isDone() const {
+            return last;
+        }
+
+        // Whole bytes of input used so far
+        [[nodiscard]] size_t consumed() const {
+            return pos - bitCount / 8;
+        }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t pos = 0;
+        uint64_t bitBuffer = 0;
+        int bitCount = 0;
+        bool last = false;
+
+        void refill() {
+            while (bitCount <= 56 && pos < size) {
+                bitBuffer |= static_cast<uint64_t>(data[pos++]) << bitCount;
+                bitCount += 8;
+            }
+        }
+
+        bool need(int bits) {
+            if (bitCount < bits) {
+                refill();
+            }
+            return bitCount >= bits;
+        }
+
+        uint32_t take(int bits) {
+            const uint32_t value = static_cast<uint32_t>(bitBuffer & ((uint64_t(1) << bits) - 1));
+            bitBuffer >>= bits;
+            bitCount -= bits;
+            return value;
+        }
+
+        bool decode(const Huffman& huffman, int& symbol) {
+            refill();
+            const uint16_t entry = huffman.table[bitBuffer & ((uint64_t(1) << huffman.maxLen) - 1)];
+            const int len = entry & 15;
+            if (len == 0 || len > bitCount) {
+                return false;
+            }
+            take(len);
+            symbol = entry >> 4;
+            return true;
+        }
+
+        bool stored(std::string& out) {
+            take(bitCount % 8);
+            if (!need(32)) {
+                return false;
+            }
+            const uint32_t len = take(16);
+            if ((take(16) ^ 0xffff) != len) {
+                return false;
+            }
+            // Hand the bytes still buffered back to the input
+            pos -= bitCount / 8;
+            bitBuffer = 0;
+            bitCount = 0;
+            if (size - pos < len) {
+                return false;
+            }
+            out.append(reinterpret_cast<const char*>(data + pos), len);
+            pos += len;
+            return true;
+        }
+
+        bool codes(std::string& out, const Huffman& literals, const Huffman& distances) {
+            for (;;) {
+                int symbol;
+                if (!decode(literals, symbol)) {
+                    return false;
+                }
+                if (symbol < 256) {
+                    out += static_cast<char>(symbol);
+                    continue;
+                }
+                if (symbol == 256) {
+                    return true;
+                }
+
+                symbol -= 257;
+                if (symbol >= 29 || !need(LENGTH_EXTRA[symbol])) {
+                    return false;
+                }
+                const size_t length = LENGTH_BASE[symbol] + take(LENGTH_EXTRA[symbol]);
+                int distSymbol;
+                if (!decode(distances, distSymbol) || distSymbol >= 30 || !need(DIST_EXTRA[distSymbol])) {
+                    return false;
+                }
+                const size_t distance = DIST_BASE[distSymbol] + take(DIST_EXTRA[distSymbol]);
+                if (distance > out.size()) {
+                    return false;
+                }
+
+                // Byte by byte, the copy may overlap what it produces
+                const size_t at = out.size();
+                out.resize(at + length);
+                char* p = out.data() + at;
+                for (size_t i = 0; i < length; ++i) {
+                    p[i] = p[i - distance];
+                }
+            }
+        }
+
+        bool dynamic(std::string& out) {
+            if (!need(14)) {
+                return false;
+            }
+            const int literalCount = take(5) + 257;
+            const int distanceCount = take(5) + 1;
+            const int codeLengthCount = take(4) + 4;
+            if (literalCount > 286 || distanceCount > 30) {
+                return false;
+            }
+
+            uint8_t lengths[320] = {};
+            for (int i = 0; i < codeLengthCount; ++i) {
+                if (!need(3)) {
+                    return false;
+                }
+                lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(take(3));
+            }
+            Huffman codeLengths;
+            if (!codeLengths.build(lengths, 19)) {
+                return false;
+            }
+
+            std::fill(std::begin(lengths), std::end(lengths), 0);
+            int index = 0;
+            while (index < literalCount + distanceCount) {
+                int symbol;
+                if (!decode(codeLengths, symbol)) {
+                    return false;
+                }
+                if (symbol < 16) {
+                    lengths[index++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                uint8_t value = 0;
+                int repeat;
+                if (symbol == 16) {
+                    if (index == 0 || !need(2)) {
+                        return false;
+                    }
+                    value = lengths[index - 1];
+                    repeat = 3 + take(2);
+                }
+                else if (symbol == 17) {
+                    if (!need(3)) {
+                        return false;
+                    }
+                    repeat = 3 + take(3);
+                }
+                else {
+                    if (!need(7)) {
+                        return false;
+                    }
+                    repeat = 11 + take(7);
+                }
+                if (index + repeat > literalCount + distanceCount) {
+                    return false;
+                }
+                while (repeat-- > 0) {
+                    lengths[index++] = value;
+                }
+            }
+
+            Huffman literals, distances;
+            if (lengths[256] == 0 || !literals.build(lengths, literalCount) ||
+                !distances.build(lengths + literalCount, distanceCount)) {
+                return false;
+            }
+            return codes(out, literals, distances);
+        }
+
+        static const Huffman& fixedLiterals() {
+            static const Huffman huffman = [] {
+                uint8_t lengths[288];
+                std::fill(lengths, lengths + 144, 8);
+                std::fill(lengths + 144, lengths + 256, 9);
+                std::fill(lengths + 256, lengths + 280, 7);
+                std::fill(lengths + 280, lengths + 288, 8);
+                Huffman result;
+                result.build(lengths, 288);
+                return result;
+            }();
+            return huffman;
+        }
+
+        static const Huffman& fixedDistances() {
+            static const Huffman huffman = [] {
+                uint8_t lengths[30];
+                std::fill(lengths, lengths + 30, 5);
+                Huffman result;
+                result.build(lengths, 30);
+                return result;
+            }();
+            return huffman;
+        }
+    };
+
+    // Skips a gzip member header, returning the offset of its deflate data or 0
+    size_t parseHeader(const uint8_t* data, size_t size) {
+        if (size < 10 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8) {
+            return 0;
+        }
+        const uint8_t flags = data[3];
+        size_t pos = 10;
+        if (flags & 4) { // FEXTRA
+            if (size < pos + 2) {
+                return 0;
+            }
+            pos += 2 + (data[pos] | (data[pos + 1] << 8));
+        }
+        for (const uint8_t field : { uint8_t(8), uint8_t(16) }) { // FNAME, FCOMMENT
+            if (flags & field) {
+                while (pos < size && data[pos] != 0) {
+                    ++pos;
+                }
+                ++pos;
+            }
+        }
+        if (flags & 2) { // FHCRC
+            pos += 2;
+        }
+        return pos < size ? pos : 0;
+    }
+
+    struct Member {
+        size_t start;
+        size_t size;
+        size_t outOffset;
+        size_t outSize;
+    };
+
+    // Lists the members of a BGZF file by hopping over their recorded sizes.
+    // Fails for any other gzip file, which then has to be read in order.
+    bool findBgzfMembers(std::string_view compressed, std::vector<Member>& members) {
+        const auto* data = reinterpret_cast<const uint8_t*>(compressed.data());
+        size_t pos = 0;
+        size_t outOffset = 0;
+        while (pos < compressed.size()) {
+            const uint8_t* p = data + pos;
+            const size_t left = compressed.size() - pos;
+            if (left < HEADER_SIZE + TRAILER_SIZE || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4) ||
+                p[10] != 6 || p[11] != 0 || p[12] != 'B' || p[13] != 'C' || p[14] != 2 || p[15] != 0) {
+                return false;
+            }
+            const size_t memberSize = (p[16] | (p[17] << 8)) + 1;
+            if (memberSize > left || memberSize < HEADER_SIZE + TRAILER_SIZE) {
+                return false;
+            }
+            // The recorded sizes size the load, so they are only trusted
+            // as far as the compressed bytes could produce them
+            const size_t outSize = readLE32(p + memberSize - 4);
+            if (outSize > MAX_BGZF_MEMBER || outSize > memberSize * MAX_RATIO) {
+                return false;
+            }
+            members.push_back(Member{ pos, memberSize, outOffset, outSize });
+            outOffset += outSize;
+            pos += memberSize;
+        }
+        return !members.empty();
+    }
+
+    bool inflateMember(std::string_view member, char* target, size_t outSize) {
+        const auto* data = reinterpret_cast<const uint8_t*>(member.data());
+        const size_t start = parseHeader(data, member.size());
+        if (start == 0) {
+            return false;
+        }
+        std::string out;
+        out.reserve(outSize);
+        Inflater inflater(data + start, member.size() - start - TRAILER_SIZE);
+        while (!inflater.isDone()) {
+            if (!inflater.inflateBlock(out)) {
+                return false;
+            }
+        }
+        const uint8_t* trailer = data + member.size() - TRAILER_SIZE;
+        if (out.size() != outSize || readLE32(trailer) != crc32(0, out.data(), out.size())) {
+            return false;
+        }
+        memcpy(target, out.data(), out.size());
+        return true;
+    }
+
+    bool loadParallel(std::string_view compressed, const std::vector<Member>& members, DocumentText& document,
+        const GzipProgress& onProgress) {
+        const size_t total = members.back().outOffset + members.back().outSize;
+        document.beginLoad(total);
+        char* target = document.getLoadBuffer();
+
+        // The pool inflates members in order; this thread indexes the text as
+        // the front of the file completes. Text is only ever indexed below the
+        // member the workers are writing, so they never touch the same bytes.
+        enum : int { PENDING, DONE, FAILED };
+        std::vector<int> status(members.size(), PENDING);
+        std::mutex mutex;
+        std::condition_variable finished;
+        // Members not yet started are dropped once the load fails or is
+        // cancelled
+        CancelSource stop;
+        TaskGroup tasks;
+
+        for (size_t i = 0; i < members.size(); ++i) {
+            tasks.run([&, i] {
+                const Member& member = members[i];
+                bool ok;
+                try {
+                    ok = inflateMember(compressed.substr(member.start, member.size), target + member.outOffset,
+                        member.outSize);
+                }
+                catch (const std::bad_alloc&) {
+                    ok = false;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    status[i] = ok ? DONE : FAILED;
+                }
+                finished.notify_all();
+            }, TaskPriority::Normal, stop.token());
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < members.size() && ok; ++i) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return status[i] != PENDING; });
+                ok = status[i] == DONE;
+            }
+            if (ok) {
+                const size_t indexed = document.appendLoaded(members[i].outOffset + members[i].outSize);
+                ok = !onProgress || onProgress(members[i].start + members[i].size, indexed);
+            }
+        }
+
+        stop.cancel();
+        tasks.wait();
+        return ok;
+    }
+
+    bool loadSequential(std::string_view compressed, DocumentText& document, const GzipProgress& onProgress) {
+        const auto* data = reinterpret_cast<const uint8_t*>(compressed.data());
+
+        // The last member records its own size, a good first guess as long
+        // as it is within what deflate can possibly expand to
+        const size_t recorded = readLE32(data + compressed.size() - 4);
+        size_t capacity = std::max(compressed.size(), std::min(recorded, compressed.size() * MAX_RATIO));
+        document.beginLoad(capacity);
+
+        size_t written = 0;
+        size_t pos = 0;
+        std::string window;
+        while (pos < compressed.size()) {
+            const size_t start = parseHeader(data + pos, compressed.size() - pos);
+            if (start == 0) {
+                if (pos == 0) {
+                    return false;
+                }
+                break; // trailing garbage, keep what was read like gzip does
+            }
+
+            Inflater inflater(data + pos + start, compressed.size() - pos - start);
+            window.clear();
+            uint32_t crc = 0;
+            size_t memberSize = 0;
+            while (!inflater.isDone()) {
+                const size_t before = window.size();
+                if (!inflater.inflateBlock(window)) {
+                    return false;
+                }
+                const size_t produced = window.size() - before;
+                crc = crc32(crc, window.data() + before, produced);
+                memberSize += produced;
+
+                if (written + produced > capacity) {
+                    capacity = std::max(written + produced, capacity + capacity / 2);
+                    document.resizeLoad(capacity);
+                }
+                memcpy(document.getLoadBuffer() + written, window.data() + before, produced);
+                written += produced;
+                const size_t indexed = document.appendLoaded(written);
+                if (onProgress && !onProgress(pos + start + inflater.consumed(), indexed)) {
+                    return false;
+                }
+
+                // Only the last 32 KiB can be referred back to
+                if (window.size() > 4 * WINDOW_SIZE) {
+                    window.erase(0, window.size() - WINDOW_SIZE);
+                }
+            }
+
+            const size_t end = pos + start + inflater.consumed();
+            if (compressed.size() - end < TRAILER_SIZE || readLE32(data + end) != crc ||
+                readLE32(data + end + 4) != static_cast<uint32_t>(memberSize)) {
+                return false;
+            }
+            pos = end + TRAILER_SIZE;
+        }
+
+        document.resizeLoad(written);
+        const size_t indexed = document.appendLoaded(written);
+        return !onProgress || onProgress(compressed.size(), indexed);
+    }
+
+    // Fixed-Huffman deflate with greedy LZ77 matching. Worse than zlib's
+    // dynamic trees, but simple, and log text still shrinks severalfold.
+    class Deflater {
+    public:
+        static constexpr int HASH_BITS = 15;
+        static constexpr int MAX_CHAIN = 32;
+        static constexpr size_t MAX_MATCH = 258;
+
+        explicit Deflater(std::string& out) : out(out) {}
+
+        void compress(std::string_view in) {
+            const size_t start = out.size();
+            bitBuffer = 0;
+            bitCount = 0;
+            put(1, 1); // final block
+            put(1, 2); // fixed Huffman codes
+
+            head.assign(size_t(1) << HASH_BITS, -1);
+            chain.assign(in.size(), -1);
+            const auto* p = reinterpret_cast<const uint8_t*>(in.data());
+            size_t i = 0;
+            while (i < in.size()) {
+                size_t bestLength = 0;
+                size_t bestDistance = 0;
+                if (i + 3 <= in.size()) {
+                    const uint32_t hash = hashAt(p + i);
+                    int candidate = head[hash];
+                    for (int depth = 0; candidate >= 0 && depth < MAX_CHAIN; ++depth, candidate = chain[candidate]) {
+                        const size_t distance = i - candidate;
+                        if (distance > WINDOW_SIZE) {
+                            break;
+                        }
+                        const size_t limit = std::min(MAX_MATCH, in.size() - i);
+                        size_t length = 0;
+                        while (length < limit && p[candidate + length] == p[i + length]) {
+                            ++length;
+                        }
+                        if (length > bestLength) {
+                            bestLength = length;
+                            bestDistance = distance;
+                            if (length == limit) {
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                if (bestLength >= 3) {
+                    putMatch(bestLength, bestDistance);
+                    for (size_t end = i + bestLength; i < end; ++i) {
+                        insertHash(p, i, in.size());
+                    }
+                }
+                else {
+                    putLiteral(p[i]);
+                    insertHash(p, i, in.size());
+                    ++i;
+                }
+            }
+            putLiteral(256);
+            flush();
+
+            // Incompressible data goes out as a stored block instead
+            if (out.size() - start > in.size() + 5) {
+                out.resize(start);
+                out += '\x01';
+                appendLE(out, static_cast<uint32_t>(in.size()), 2);
+                appendLE(out, static_cast<uint32_t>(in.size()) ^ 0xffff, 2);
+                out.append(in);
+            }
+        }
+
+    private:
+        std::string& out;
+        std::vector<int> head;
+        std::vector<int> chain;
+        uint64_t bitBuffer = 0;
+        int bitCount = 0;
+
+        static uint32_t hashAt(const uint8_t* p) {
+            return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        void insertHash(const uint8_t* p, size_t i, size_t size) {
+            if (i + 3 <= size) {
+                const uint32_t hash = hashAt(p + i);
+                chain[i] = head[hash];
+                head[hash] = static_cast<int>(i);
+            }
+        }
+
+        void put(uint32_t value, int bits) {
+            bitBuffer |= static_cast<uint64_t>(value) << bitCount;
+            bitCount += bits;
+            while (bitCount >= 8) {
+                out += static_cast<char>(bitBuffer & 0xff);
+                bitBuffer >>= 8;
+                bitCount -= 8;
+            }
+        }
+
+        void flush() {
+            if (bitCount > 0) {
+                out += static_cast<char>(bitBuffer & 0xff);
+            }
+            bitBuffer = 0;
+            bitCount = 0;
+        }
+
+        void putCode(uint32_t code, int len) {
+            put(reverseBits(code, len), len);
+        }
+
+        void putLiteral(int symbol) {
+            if (symbol < 144) {
+                putCode(0x30 + symbol, 8);
+            }
+            else if (symbol < 256) {
+                putCode(0x190 + symbol - 144, 9);
+            }
+            else if (symbol < 280) {
+                putCode(symbol - 256, 7);
+            }
+            else {
+                putCode(0xc0 + symbol - 280, 8);
+            }
+        }
+
+        void putMatch(size_t length, size_t distance) {
+            const int lengthCode = static_cast<int>(std::upper_bound(std::begin(LENGTH_BASE), std::end(LENGTH_BASE), length) - std::begin(LENGTH_BASE)) - 1;
+            putLiteral(257 + lengthCode);
+            put(static_cast<uint32_t>(length - LENGTH_BASE[lengthCode]), LENGTH_EXTRA[lengthCode]);
+
+            const int distCode = static_cast<int>(std::upper_bound(std::begin(DIST_BASE), std::end(DIST_BASE), distance) - std::begin(DIST_BASE)) - 1;
+            putCode(distCode, 5);
+            put(static_cast<uint32_t>(distance - DIST_BASE[distCode]), DIST_EXTRA[distCode]);
+        }
+    };
+
+    std::string compressMember(std::string_view block) {
+        std::string member;
+        member.reserve(HEADER_SIZE + block.size() + block.size() / 8 + TRAILER_SIZE);
+        member.append(reinterpret_cast<const char*>(BGZF_EOF), 16); // same header, size patched below
+        member.append(2, '\0');
+        Deflater(member).compress(block);
+        appendLE(member, crc32(0, block.data(), block.size()), 4);
+        appendLE(member, static_cast<uint32_t>(block.size()), 4);
+        const uint32_t blockSize = static_cast<uint32_t>(member.size() - 1);
+        member[16] = static_cast<char>(blockSize & 0xff);
+        member[17] = static_cast<char>(blockSize >> 8);
+        return member;
+    }
+}
+
+uint32_t crc32(uint32_t crc, const char* data, size_t len) {
+    static const CrcTable table;
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table.values[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool isGzipPath(const std::wstring& path) {
+    return path.size() > 3 && _wcsicmp(path.c_str() + path.size() - 3, L".gz") == 0;
+}
+
+bool isGzipData(std::string_view data) {
+    return data.size() >= 18 && static_cast<uint8_t>(data[0]) == 0x1f && static_cast<uint8_t>(data[1]) == 0x8b;
+}
+
+bool loadGzip(std::string_view compressed, DocumentText& document, const GzipProgress& onProgress) {
+    if (!isGzipData(compressed)) {
+        document.beginLoad(compressed.size());
+        memcpy(document.getLoadBuffer(), compressed.data(), compressed.size());
+        const size_t indexed = document.appendLoaded(compressed.size());
+        return !onProgress || onProgress(compressed.size(), indexed);
+    }
+
+    std::vector<Member> members;
+    if (findBgzfMembers(compressed, members)) {
+        // The end-of-file marker holds no text
+        while (members.size() > 1 && members.back().outSize == 0) {
+            members.pop_back();
+        }
+        return loadParallel(compressed, members, document, onProgress);
+    }
+    return loadSequential(compressed, document, onProgress);
+}
+
+GzipWriter::GzipWriter(FileWriter& writer)
+    : writer(writer), threads(TaskScheduler::shared().getThreadCount()) {}
+
+std::string& GzipWriter::getBlock() {
+    return pending;
+}
+
+bool GzipWriter::submitBlock() {
+    if (pending.size() >= threads * BLOCKS_PER_THREAD * BLOCK_SIZE) {
+        return compressPending(false);
+    }
+    return !failed;
+}
+
+bool GzipWriter::write(std::string_view data) {
+    pending.append(data);
+    return submitBlock();
+}
+
+bool GzipWriter::finish() {
+    compressPending(true);
+    if (!failed) {
+        writer.getBlock().append(reinterpret_cast<const char*>(BGZF_EOF), sizeof(BGZF_EOF));
+    }
+    return writer.finish() && !failed;
+}
+
+bool GzipWriter::compressPending(bool all) {
+    // Full blocks only, unless this is the end of the file
+    const size_t blockCount = all ? (pending.size() + BLOCK_SIZE - 1) / BLOCK_SIZE : pending.size() / BLOCK_SIZE;
+    if (blockCount == 0 || failed) {
+        return !failed;
+    }
+
+    std::vector<std::string> members(blockCount);
+    TaskGroup tasks;
+    for (size_t i = 0; i < blockCount; ++i) {
+        tasks.run([&, i] {
+            members[i] = compressMember(std::string_view(pending).substr(i * BLOCK_SIZE, BLOCK_SIZE));
+        });
+    }
+    tasks.wait();
+
+    for (const std::string& member : members) {
+        writer.getBlock().append(member);
+        if (!writer.submitBlock()) {
+            failed = true;
+            break;
+        }
+    }
+    pending.erase(0, std::min(pending.size(), blockCount * BLOCK_SIZE));
+    return !failed;
+}
@@ -0,0 +1,59 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "FileIO.h"
+
+class DocumentText;
+
+// Opening and saving .gz files without a decompressed copy on disk.
+// Files are saved in the BGZF layout: a run of independent gzip members that
+// each hold at most BLOCK_SIZE bytes and record their own compressed size in
+// the header. Any gzip reader accepts them, and they let both compression
+// and decompression run a member per task on the shared TaskScheduler.
+// Other gzip files (single or multi-member) are decompressed on one thread.
+
+// Standard CRC-32 as used by gzip, chainable by passing the previous result
+[[nodiscard]] uint32_t crc32(uint32_t crc, const char* data, size_t len);
+
+[[nodiscard]] bool isGzipPath(const std::wstring& path);
+[[nodiscard]] bool isGzipData(std::string_view data);
+
+// Called after each decompressed piece with the compressed bytes consumed and
+// the document text indexed so far. Returning false cancels the load.
+using GzipProgress = std::function<bool(size_t consumed, size_t indexed)>;
+
+// Decompresses straight into the load buffer of a document, indexing lines
+// as the text arrives. Begins the load; the caller finishes it. Data without
+// a gzip header is loaded as it is.
+bool loadGzip(std::string_view compressed, DocumentText& document, const GzipProgress& onProgress);
+
+// Same interface as FileWriter, compressing what is written into BGZF
+// members on all cores before handing them to the file writer.
+class GzipWriter {
+public:
+    static constexpr size_t BLOCK_SIZE = 0xff00;
+    static constexpr size_t BLOCKS_PER_THREAD = 4;
+
+    explicit GzipWriter(FileWriter& writer);
+
+    std::string& getBlock();
+    bool submitBlock();
+    bool write(std::string_view data);
+    bool finish();
+
+private:
+    FileWriter& writer;
+    std::string pending;
+    size_t threads;
+    bool failed = false;
+
+    bool compressPending(bool all);
+};
+
+#endif // GZIP_H
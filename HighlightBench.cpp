@@ -0,0 +1,120 @@
+// Times re-highlighting after single keystrokes in a large generated file,
+// without a window:
+//
+//   highlight-bench [lines] [keystrokes]
+//
+// Defaults to a million-line C++ file and a JSON file of the same length,
+// with two thousand keystrokes each at random lines. A keystroke is timed
+// from the edit until every line starts in a known state again, which is
+// what a paint of any line would wait for.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "BenchSupport.h"
+#include "SyntaxHighlighter.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    std::string makeCpp(size_t lines) {
+        std::string text;
+        for (size_t i = 0; i < lines; ++i) {
+            switch (i % 8) {
+            case 0:
+                text += "// Line " + std::to_string(i) + " of the generated file\n";
+                break;
+            case 1:
+                text += "static const int value" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+                break;
+            case 2:
+                text += "/* A block comment\n";
+                break;
+            case 3:
+                text += "   that ends here */ total += 2.5;\n";
+                break;
+            case 4:
+                text += "#include \"header.h\"\n";
+                break;
+            case 5:
+                text += "const char* name = \"a string with \\\" a quote\";\n";
+                break;
+            case 6:
+                text += "for (size_t k = 0; k < count; ++k) { sum += k; }\n";
+                break;
+            default:
+                text += "\n";
+                break;
+            }
+        }
+        return text;
+    }
+
+    std::string makeJson(size_t lines) {
+        std::string text = "[\n";
+        for (size_t i = 2; i < lines; ++i) {
+            text += "  {\"id\": " + std::to_string(i) + ", \"name\": \"item\", \"active\": true, \"ratio\": 0.25},\n";
+        }
+        text += "]";
+        return text;
+    }
+
+    void waitUntilComplete(const SyntaxHighlighter& highlighter) {
+        while (!highlighter.isComplete()) {
+            std::this_thread::yield();
+        }
+    }
+
+    void run(const char* name, const std::string& text, const Grammar& grammar, size_t keystrokes) {
+        DocumentText document(nullptr);
+        loadText(document, text);
+
+        SyntaxHighlighter highlighter(document, grammar, nullptr);
+        const auto start = Clock::now();
+        highlighter.update(0, 60);
+        while (highlighter.getStaleLine() <= 60) {
+            std::this_thread::yield();
+        }
+        const auto screen = Clock::now();
+        waitUntilComplete(highlighter);
+        const auto whole = Clock::now();
+
+        // Keystrokes of the kinds that do and do not carry over to the next line
+        std::mt19937 random(1);
+        const char keys[] = { 'a', 'x', '1', ';', ' ', '"', '/', '*' };
+        LatencyHistogram latency;
+        for (size_t i = 0; i < keystrokes; ++i) {
+            const size_t line = random() % document.lineStarts.size();
+            const size_t position = document.lineStarts[line] + random() % (document.getLineLength(static_cast<ULONG>(line)) + 1);
+            const auto before = Clock::now();
+            document.insertText(&keys[random() % std::size(keys)], 1, position);
+            highlighter.update(line, line + 60);
+            waitUntilComplete(highlighter);
+            latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count()));
+        }
+
+        printf("%s, %zu lines: first screen %s, whole file %s\n", name, document.lineStarts.size(),
+            formatDuration(std::chrono::duration_cast<std::chrono::nanoseconds>(screen - start).count()).c_str(),
+            formatDuration(std::chrono::duration_cast<std::chrono::nanoseconds>(whole - start).count()).c_str());
+        printf("  %zu keystrokes: p50 %s, p90 %s, p99 %s, max %s\n", keystrokes,
+            formatDuration(latency.getPercentile(50)).c_str(), formatDuration(latency.getPercentile(90)).c_str(),
+            formatDuration(latency.getPercentile(99)).c_str(), formatDuration(latency.getMax()).c_str());
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t lines = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    const size_t keystrokes = argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000;
+    if (lines < 2) {
+        fprintf(stderr, "Usage: highlight-bench [lines] [keystrokes]\n");
+        return 2;
+    }
+    run("C++", makeCpp(lines), cppGrammar(), keystrokes);
+    run("JSON", makeJson(lines), jsonGrammar(), keystrokes);
+    return 0;
+}
@@ -0,0 +1,212 @@
+// Kills a process while it journals edits and checks that recovery gives
+// back exactly the edits up to some point, never a torn or mixed one:
+//
+//   journal-crash-test [rounds] [folder]
+//
+// Each round starts this program again as the writer, which journals random
+// edits to a generated file as fast as it can, and terminates it after a
+// random delay, mid-batch or mid-write as it happens. The journal left
+// behind is recovered onto the file and compared with the same edits
+// replayed one by one. Copies of it cut short at every length across its
+// last records, as a write torn by the crash would leave it, are recovered
+// and compared too. Exits 1 on the first mismatch.
+
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BenchSupport.h"
+#include "EditJournal.h"
+
+namespace {
+    constexpr size_t TORN_TAIL = 128; // every cut across the journal's last bytes
+    constexpr size_t TORN_RANDOM = 16; // and this many anywhere before them
+
+    std::string makeText(uint32_t seed) {
+        std::mt19937 random(seed);
+        std::string text;
+        for (int line = 0; line < 2000; ++line) {
+            text += "line " + std::to_string(line) + " of the journaled file " + std::to_string(random()) + "\n";
+        }
+        return text;
+    }
+
+    // The same seed makes the same edits, one at a time, onto the same text
+    class EditScript {
+    public:
+        explicit EditScript(uint32_t seed) : random(seed) {}
+
+        void apply(DocumentText& document) {
+            const size_t length = document.getLength();
+            if (length > 0 && random() % 3 == 0) {
+                const size_t start = random() % length;
+                document.deleteText(start, std::min(length, start + 1 + random() % 40));
+                return;
+            }
+            std::string text(1 + random() % 60, 'a');
+            for (char& c : text) {
+                c = static_cast<char>(random() % 8 == 0 ? '\n' : 'a' + random() % 26);
+            }
+            document.insertText(text.data(), text.size(), random() % (length + 1));
+        }
+
+    private:
+        std::mt19937 random;
+    };
+
+    bool writeWhole(const std::wstring& path, const char* data, size_t len) {
+        HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        DWORD count = 0;
+        const bool ok = WriteFile(hFile, data, static_cast<DWORD>(len), &count, nullptr) && count == len;
+        CloseHandle(hFile);
+        return ok;
+    }
+
+    bool readWhole(const std::wstring& path, std::vector<char>& contents) {
+        HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        bool ok = GetFileSizeEx(hFile, &size) != 0;
+        contents.resize(ok ? static_cast<size_t>(size.QuadPart) : 0);
+        DWORD count = 0;
+        ok = ok && (contents.empty() || (ReadFile(hFile, contents.data(), static_cast<DWORD>(contents.size()), &count, nullptr) &&
+            count == contents.size()));
+        CloseHandle(hFile);
+        return ok;
+    }
+
+    // Journals edits until it is killed
+    int runWriter(uint32_t seed, const std::wstring& path) {
+        DocumentText document(nullptr);
+        loadText(document, makeText(seed));
+        EditJournal journal(path);
+        if (!journal.start()) {
+            return 1;
+        }
+        journal.attach(document);
+        EditScript script(seed);
+        for (;;) {
+            for (int i = 0; i < 64; ++i) {
+                script.apply(document);
+            }
+            Sleep(1);
+        }
+    }
+
+    // Recovers the journal there now and compares it with the edits replayed
+    // onto expected, which is moved on as far as recovery got
+    bool check(uint32_t seed, const std::wstring& path, DocumentText& expected, EditScript& script, size_t& replayed, size_t& applied) {
+        DocumentText recovered(nullptr);
+        loadText(recovered, makeText(seed));
+        applied = EditJournal::recover(path, recovered);
+        if (applied < replayed) {
+            return false; // a longer journal recovered fewer edits
+        }
+        for (; replayed < applied; ++replayed) {
+            script.apply(expected);
+        }
+        return textOf(recovered) == textOf(expected);
+    }
+
+    bool runRound(const std::wstring& self, const std::wstring& folder, uint32_t seed, std::mt19937& random) {
+        const std::wstring separator = folder.back() == L'\\' ? L"" : L"\\";
+        const std::wstring path = folder + separator + L"journal-crash-" + std::to_wstring(seed) + L".txt";
+        const std::wstring journalPath = EditJournal::journalPath(path);
+        const std::string text = makeText(seed);
+        DeleteFileW(journalPath.c_str());
+        if (!writeWhole(path, text.data(), text.size())) {
+            fwprintf(stderr, L"%ls: cannot write\n", path.c_str());
+            return false;
+        }
+
+        std::wstring commandLine = L"\"" + self + L"\" --writer " + std::to_wstring(seed) + L" \"" + path + L"\"";
+        STARTUPINFOW startup{};
+        startup.cb = sizeof(startup);
+        PROCESS_INFORMATION process{};
+        if (!CreateProcessW(self.c_str(), commandLine.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process)) {
+            fwprintf(stderr, L"cannot start the writer\n");
+            return false;
+        }
+        const DWORD delay = 50 + random() % 300;
+        Sleep(delay);
+        TerminateProcess(process.hProcess, 1);
+        WaitForSingleObject(process.hProcess, INFINITE);
+        CloseHandle(process.hThread);
+        CloseHandle(process.hProcess);
+
+        std::vector<char> journal;
+        if (!readWhole(journalPath, journal)) {
+            fwprintf(stderr, L"round %u: no journal after %lu ms\n", seed, delay);
+            return false;
+        }
+
+        // The journal as the kill left it, then cut short everywhere across
+        // its tail and at random before it, shortest first
+        std::vector<size_t> cuts;
+        for (size_t cut = journal.size() - std::min(journal.size(), TORN_TAIL); cut < journal.size(); ++cut) {
+            cuts.push_back(cut);
+        }
+        for (size_t i = 0; i < TORN_RANDOM && !journal.empty(); ++i) {
+            cuts.push_back(random() % journal.size());
+        }
+        std::sort(cuts.begin(), cuts.end());
+
+        DocumentText expected(nullptr);
+        loadText(expected, text);
+        EditScript script(seed);
+        size_t replayed = 0;
+        size_t applied = 0;
+        for (const size_t cut : cuts) {
+            if (!writeWhole(journalPath, journal.data(), cut) || !check(seed, path, expected, script, replayed, applied)) {
+                fwprintf(stderr, L"round %u: journal cut to %zu of %zu bytes does not recover a prefix of the edits\n",
+                    seed, cut, journal.size());
+                return false;
+            }
+        }
+        if (!writeWhole(journalPath, journal.data(), journal.size()) || !check(seed, path, expected, script, replayed, applied)) {
+            fwprintf(stderr, L"round %u: the journal left by the kill does not recover a prefix of the edits\n", seed);
+            return false;
+        }
+        wprintf(L"round %u: killed after %lu ms, %zu bytes journaled, %zu edits recovered, %zu torn copies checked\n",
+            seed, delay, journal.size(), applied, cuts.size());
+
+        DeleteFileW(journalPath.c_str());
+        DeleteFileW(path.c_str());
+        return true;
+    }
+}
+
+
+int wmain(int argc, wchar_t* argv[]) {
+    if (argc == 4 && wcscmp(argv[1], L"--writer") == 0) {
+        return runWriter(static_cast<uint32_t>(_wtoi(argv[2])), argv[3]);
+    }
+    const int rounds = argc > 1 ? _wtoi(argv[1]) : 20;
+    wchar_t temp[MAX_PATH];
+    const std::wstring folder = argc > 2 ? std::wstring(argv[2]) : std::wstring(temp, GetTempPathW(MAX_PATH, temp));
+    if (rounds < 1 || folder.empty()) {
+        fwprintf(stderr, L"Usage: journal-crash-test [rounds] [folder]\n");
+        return 2;
+    }
+    wchar_t self[MAX_PATH];
+    if (GetModuleFileNameW(nullptr, self, MAX_PATH) == 0) {
+        return 1;
+    }
+
+    std::mt19937 random(12345);
+    for (int round = 1; round <= rounds; ++round) {
+        if (!runRound(self, folder, static_cast<uint32_t>(round), random)) {
+            return 1;
+        }
+    }
+    wprintf(L"%d rounds, every recovery a prefix of the edits\n", rounds);
+    return 0;
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "LineIndex.h"
+
+
+LineIndex::LineIndex(std::shared_ptr<MemoryAccount> account)
+    : account(std::move(account)),
+      front(TaggedAllocator<Block, MemoryTag::LineIndex>(this->account.get())),
+      behind(TaggedAllocator<Block, MemoryTag::LineIndex>(this->account.get())) {
+    reset(0);
+    push_back(0);
+}
+
+LineIndex::LineIndex(const LineIndex& other, std::shared_ptr<MemoryAccount> account)
+    : LineIndex(std::move(account)) {
+    front.clear();
+    front.reserve(other.front.size());
+    for (const Block& block : other.front) {
+        front.push_back(makeBlock(block.firstLine, block.anchor, block.width));
+        front.back().count = block.count;
+        front.back().offsets.assign(block.offsets.begin(), block.offsets.end());
+    }
+    behind.reserve(other.behind.size());
+    for (const Block& block : other.behind) {
+        behind.push_back(makeBlock(block.firstLine, block.anchor, block.width));
+        behind.back().count = block.count;
+        behind.back().offsets.assign(block.offsets.begin(), block.offsets.end());
+    }
+    lineCount = other.lineCount;
+    textLength = other.textLength;
+}
+
+LineIndex::LineIndex(const LineIndex& other)
+    : LineIndex(other, nullptr) {}
+
+LineIndex& LineIndex::operator=(const LineIndex& other) {
+    if (this != &other) {
+        *this = LineIndex(other, account);
+    }
+    return *this;
+}
+
+LineIndex& LineIndex::operator=(LineIndex&& other) {
+    if (other.account != account) {
+        // Blocks charged elsewhere are copied into ones charged here
+        return *this = LineIndex(other, account);
+    }
+    front = std::move(other.front);
+    behind = std::move(other.behind);
+    lineCount = other.lineCount;
+    textLength = other.textLength;
+    return *this;
+}
+
+size_t LineIndex::size() const {
+    return lineCount;
+}
+
+size_t LineIndex::operator[](size_t line) const {
+    bool isBehind;
+    const Block& block = findLine(line, isBehind);
+    return anchorOf(block, isBehind) + offsetAt(block, line - firstLineOf(block, isBehind));
+}
+
+size_t LineIndex::lineOf(size_t position) const {
+    // Blocks are ordered by anchor on both sides of the split
+    const bool inFront = behind.empty() || position < anchorOf(behind.back(), true);
+    const Block* block;
+    bool isBehind = false;
+    if (inFront) {
+        auto it = std::upper_bound(front.begin(), front.end(), position,
+            [](size_t value, const Block& b) { return value < b.anchor; });
+        block = &*(it - 1);
+    }
+    else {
+        // Stored anchors grow towards the front of the document
+        auto it = std::lower_bound(behind.begin(), behind.end(), textLength - position,
+            [](const Block& b, size_t value) { return b.anchor < value; });
+        block = &*it;
+        isBehind = true;
+    }
+    return firstLineOf(*block, isBehind) + countAtOrBelow(*block, position - anchorOf(*block, isBehind)) - 1;
+}
+
+size_t LineIndex::getLiveBytes() const {
+    size_t bytes = (front.size() + behind.size()) * sizeof(Block);
+    for (const Block& block : front) {
+        bytes += block.offsets.size();
+    }
+    for (const Block& block : behind) {
+        bytes += block.offsets.size();
+    }
+    return bytes;
+}
+
+void LineIndex::reset(size_t length) {
+    front.clear();
+    behind.clear();
+    lineCount = 0;
+    textLength = length;
+}
+
+void LineIndex::setTextLength(size_t length) {
+    // For builders that only know the final length after pushing every start
+    moveSplitToEnd();
+    textLength = length;
+}
+
+void LineIndex::push_back(size_t start) {
+    moveSplitToEnd();
+    if (front.empty() || front.back().count == BLOCK_LINES) {
+        front.push_back(makeBlock(lineCount, start, 2));
+    }
+    else {
+        appendOffset(front.back(), start - front.back().anchor);
+    }
+    ++lineCount;
+}
+
+void LineIndex::onInsert(size_t position, const char* text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    const size_t line = lineOf(position);
+    moveSplitToLine(line);
+    const size_t firstLine = front.back().firstLine;
+    std::vector<size_t> starts;
+    decode(front.back(), starts);
+    front.pop_back();
+
+    // Starts up to the position stay, the inserted newlines add starts and
+    // everything after the position moves by len.
+    std::vector<size_t> updated;
+    updated.reserve(starts.size() + 1);
+    size_t i = 0;
+    while (i < starts.size() && starts[i] <= position) {
+        updated.push_back(starts[i++]);
+    }
+    for (const char* p = text; (p = static_cast<const char*>(memchr(p, '\n', text + len - p))) != nullptr; ++p) {
+        updated.push_back(position + (p - text) + 1);
+    }
+    for (; i < starts.size(); ++i) {
+        updated.push_back(starts[i] + len);
+    }
+
+    // Blocks behind the split are relative to the end and shift on their own
+    lineCount += updated.size() - starts.size();
+    textLength += len;
+    encode(updated, firstLine);
+}
+
+void LineIndex::onDelete(size_t start, size_t end) {
+    end = std::min(end, textLength);
+    if (start >= end) {
+        return;
+    }
+
+    const size_t line = lineOf(start);
+    moveSplitToLine(line);
+    const size_t firstLine = front.back().firstLine;
+    std::vector<size_t> starts;
+    decode(front.back(), starts);
+    front.pop_back();
+
+    // Pull in every following block that has lines inside the deleted text
+    while (!behind.empty() && anchorOf(behind.back(), true) <= end) {
+        Block block = std::move(behind.back());
+        behind.pop_back();
+        flip(block);
+        decode(block, starts);
+    }
+
+    std::vector<size_t> updated;
+    updated.reserve(starts.size());
+    for (const size_t lineStart : starts) {
+        if (lineStart <= start) {
+            updated.push_back(lineStart);
+        }
+        else if (lineStart > end) {
+            updated.push_back(lineStart - (end - start));
+        }
+    }
+
+    lineCount -= starts.size() - updated.size();
+    textLength -= end - start;
+
+    // Keep blocks from shrinking away to a handful of lines
+    if (updated.size() < BLOCK_LINES / 4 && !behind.empty()) {
+        Block block = std::move(behind.back());
+        behind.pop_back();
+        flip(block);
+        decode(block, updated);
+    }
+    encode(updated, firstLine);
+}
+
+template <typename T>
+static void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool take(std::string_view& data, T& value) {
+    if (data.size() < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, data.data(), sizeof(value));
+    data.remove_prefix(sizeof(value));
+    return true;
+}
+
+void LineIndex::serialize(std::string& out) const {
+    // Layout: line count, text length, block count, then per block its
+    // absolute anchor, width, line count and stored offsets
+    put<uint64_t>(out, lineCount);
+    put<uint64_t>(out, textLength);
+    put<uint64_t>(out, front.size() + behind.size());
+    auto putBlock = [&out](const Block& block, size_t anchor) {
+        put<uint64_t>(out, anchor);
+        put<uint8_t>(out, block.width);
+        put<uint8_t>(out, block.count);
+        out.append(reinterpret_cast<const char*>(block.offsets.data()), block.offsets.size());
+    };
+    for (const Block& block : front) {
+        putBlock(block, block.anchor);
+    }
+    for (auto it = behind.rbegin(); it != behind.rend(); ++it) {
+        putBlock(*it, anchorOf(*it, true));
+    }
+}
+
+bool LineIndex::deserialize(std::string_view data) {
+    uint64_t lines, length, blockCount;
+    if (!take(data, lines) || !take(data, length) || !take(data, blockCount) || lines == 0 ||
+        blockCount > data.size() / (sizeof(uint64_t) + 2)) {
+        return false;
+    }
+
+    Blocks blocks(front.get_allocator());
+    blocks.reserve(blockCount);
+    size_t firstLine = 0;
+    for (uint64_t i = 0; i < blockCount; ++i) {
+        uint64_t anchor;
+        uint8_t width, count;
+        if (!take(data, anchor) || !take(data, width) || !take(data, count) || count == 0 || count > BLOCK_LINES ||
+            (width != 2 && width != 4 && width != 8) || data.size() < static_cast<size_t>(count - 1) * width ||
+            (!blocks.empty() && anchor <= blocks.back().anchor) || anchor > length) {
+            return false;
+        }
+        const size_t bytes = static_cast<size_t>(count - 1) * width;
+        Block block = makeBlock(firstLine, static_cast<size_t>(anchor), width);
+        block.count = count;
+        block.offsets.assign(data.begin(), data.begin() + bytes);
+        data.remove_prefix(bytes);
+        firstLine += count;
+        blocks.push_back(std::move(block));
+    }
+    if (firstLine != lines || !data.empty() || blocks.front().anchor != 0) {
+        return false;
+    }
+
+    front = std::move(blocks);
+    behind.clear();
+    lineCount = static_cast<size_t>(lines);
+    textLength = static_cast<size_t>(length);
+    return true;
+}
+
+size_t LineIndex::getTextLength() const {
+    return textLength;
+}
+
+LineIndex::Block LineIndex::makeBlock(size_t firstLine, size_t anchor, uint8_t width) const {
+    // One line, with its offsets charged wherever the index's blocks are
+    return Block{ firstLine, anchor, width, 1, Offsets(TaggedAllocator<uint8_t, MemoryTag::LineIndex>(account.get())) };
+}
+
+uint8_t LineIndex::widthFor(size_t offset) {
+    if (offset <= 0xFFFF) {
+        return 2;
+    }
+    return offset <= 0xFFFFFFFF ? 4 : 8;
+}
+
+size_t LineIndex::offsetAt(const Block& block, size_t index) {
+    if (index == 0) {
+        return 0;
+    }
+    const uint8_t* p = block.offsets.data() + (index - 1) * block.width;
+    if (block.width == 2) {
+        uint16_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    if (block.width == 4) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+template <typename T>
+static size_t countNotAbove(const uint8_t* data, size_t count, size_t limit) {
+    // Branch-free so the compiler can vectorize the comparison
+    size_t result = 0;
+    for (size_t i = 0; i < count; ++i) {
+        T value;
+        memcpy(&value, data + i * sizeof(T), sizeof(T));
+        result += static_cast<size_t>(value) <= limit;
+    }
+    return result;
+}
+
+size_t LineIndex::countAtOrBelow(const Block& block, size_t offset) {
+    // The first line sits at offset 0 and always counts
+    const size_t stored = block.count - 1;
+    switch (block.width) {
+    case 2:
+        return 1 + countNotAbove<uint16_t>(block.offsets.data(), stored, offset);
+    case 4:
+        return 1 + countNotAbove<uint32_t>(block.offsets.data(), stored, offset);
+    default:
+        return 1 + countNotAbove<uint64_t>(block.offsets.data(), stored, offset);
+    }
+}
+
+size_t LineIndex::firstLineOf(const Block& block, bool isBehind) const {
+    return isBehind ? lineCount - block.firstLine : block.firstLine;
+}
+
+size_t LineIndex::anchorOf(const Block& block, bool isBehind) const {
+    return isBehind ? textLength - block.anchor : block.anchor;
+}
+
+const LineIndex::Block& LineIndex::findLine(size_t line, bool& isBehind) const {
+    isBehind = !(behind.empty() || line < firstLineOf(behind.back(), true));
+
+    // Most blocks stay full, so first try the block a full-block layout would
+    // put the line in before falling back to a binary search.
+    if (!isBehind) {
+        const size_t guess = std::min(line / BLOCK_LINES, front.size() - 1);
+        if (front[guess].firstLine <= line && (guess + 1 == front.size() || front[guess + 1].firstLine > line)) {
+            return front[guess];
+        }
+        auto it = std::upper_bound(front.begin(), front.end(), line,
+            [](size_t value, const Block& b) { return value < b.firstLine; });
+        return *(it - 1);
+    }
+    const size_t fromEnd = std::min((lineCount - 1 - line) / BLOCK_LINES, behind.size() - 1);
+    if (behind[fromEnd].firstLine >= lineCount - line && (fromEnd == 0 || behind[fromEnd - 1].firstLine < lineCount - line)) {
+        return behind[fromEnd];
+    }
+    auto it = std::lower_bound(behind.begin(), behind.end(), lineCount - line,
+        [](const Block& b, size_t value) { return b.firstLine < value; });
+    return *it;
+}
+
+void LineIndex::flip(Block& block) const {
+    // Converts between absolute and end-relative values, both ways
+    block.firstLine = lineCount - block.firstLine;
+    block.anchor = textLength - block.anchor;
+}
+
+void LineIndex::moveSplitToLine(size_t line) {
+    // Afterwards front.back() is the block holding the line
+    while (front.size() > 1 && front.back().firstLine > line) {
+        behind.push_back(std::move(front.back()));
+        front.pop_back();
+        flip(behind.back());
+    }
+    while (!behind.empty() && firstLineOf(behind.back(), true) <= line) {
+        front.push_back(std::move(behind.back()));
+        behind.pop_back();
+        flip(front.back());
+    }
+}
+
+void LineIndex::moveSplitToEnd() {
+    while (!behind.empty()) {
+        front.push_back(std::move(behind.back()));
+        behind.pop_back();
+        flip(front.back());
+    }
+}
+
+void LineIndex::decode(const Block& block, std::vector<size_t>& starts) const {
+    for (size_t i = 0; i < block.count; ++i) {
+        starts.push_back(block.anchor + offsetAt(block, i));
+    }
+}
+
+void LineIndex::encode(const std::vector<size_t>& starts, size_t firstLine) {
+    // Split evenly so a block that just overflowed leaves room in both halves
+    const size_t blockCount = (starts.size() + BLOCK_LINES - 1) / BLOCK_LINES;
+    size_t begin = 0;
+    for (size_t n = 0; n < blockCount; ++n) {
+        const size_t end = starts.size() * (n + 1) / blockCount;
+        Block block = makeBlock(firstLine + begin, starts[begin], widthFor(starts[end - 1] - starts[begin]));
+        block.offsets.reserve((end - begin - 1) * block.width);
+        for (size_t i = begin + 1; i < end; ++i) {
+            appendOffset(block, starts[i] - block.anchor);
+        }
+        front.push_back(std::move(block));
+        begin = end;
+    }
+}
+
+void LineIndex::appendOffset(Block& block, size_t offset) {
+    const uint8_t width = widthFor(offset);
+    if (width > block.width) {
+        // Re-encode the block with wider offsets
+        std::vector<size_t> values;
+        for (size_t i = 1; i < block.count; ++i) {
+            values.push_back(offsetAt(block, i));
+        }
+        block.width = width;
+        block.offsets.clear();
+        for (const size_t value : values) {
+            block.offsets.resize(block.offsets.size() + width);
+            memcpy(block.offsets.data() + block.offsets.size() - width, &value, width);
+        }
+    }
+    block.offsets.resize(block.offsets.size() + block.width);
+    memcpy(block.offsets.data() + block.offsets.size() - block.width, &offset, block.width);
+    ++block.count;
+}
@@ -0,0 +1,86 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MemoryAccount.h"
+
+// Start offsets of every line of a document, stored compactly.
+// Lines are grouped in blocks of up to BLOCK_LINES. Each block keeps the
+// absolute start of its first line and the other starts as offsets from it,
+// 16, 32 or 64 bits wide depending on how much text the block covers, which
+// keeps typical text under 3 bytes per line (see lineindex-bench).
+// Like the text blocks, blocks in front of the last edit hold absolute values
+// and blocks behind it hold values counted from the end, so an edit only
+// re-encodes the block it touches.
+// An index made with an account charges its blocks to it, and keeps doing
+// so whatever is assigned to it. A copy is not charged.
+class LineIndex {
+public:
+    static constexpr size_t BLOCK_LINES = 64;
+
+    explicit LineIndex(std::shared_ptr<MemoryAccount> account = nullptr);
+    // A copy of other whose blocks are charged to account
+    LineIndex(const LineIndex& other, std::shared_ptr<MemoryAccount> account);
+    LineIndex(const LineIndex& other);
+    LineIndex(LineIndex&&) = default;
+    LineIndex& operator=(const LineIndex& other);
+    LineIndex& operator=(LineIndex&& other);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] size_t operator[](size_t line) const;
+    [[nodiscard]] size_t lineOf(size_t position) const;
+    // Bytes the blocks need, as opposed to the bytes allocated for them
+    [[nodiscard]] size_t getLiveBytes() const;
+
+    void reset(size_t length);
+    void setTextLength(size_t length);
+    void push_back(size_t start);
+    void onInsert(size_t position, const char* text, size_t len);
+    void onDelete(size_t start, size_t end);
+
+    // The blocks as they are stored, for caching the index on disk.
+    // deserialize returns false, leaving the index unchanged, on bad data.
+    void serialize(std::string& out) const;
+    bool deserialize(std::string_view data);
+    [[nodiscard]] size_t getTextLength() const;
+
+private:
+    using Offsets = std::vector<uint8_t, TaggedAllocator<uint8_t, MemoryTag::LineIndex>>;
+
+    struct Block {
+        size_t firstLine; // absolute in front, counted from the last line behind
+        size_t anchor;    // start of the first line, absolute in front, from the end behind
+        uint8_t width;    // bytes per stored offset: 2, 4 or 8
+        uint8_t count;    // lines in the block
+        Offsets offsets;  // starts of the remaining lines relative to anchor
+    };
+
+    using Blocks = std::vector<Block, TaggedAllocator<Block, MemoryTag::LineIndex>>;
+
+    std::shared_ptr<MemoryAccount> account; // first, so it outlives the blocks
+    Blocks front;  // ascending
+    Blocks behind; // descending, the block right after the split last
+    size_t lineCount = 0;
+    size_t textLength = 0;
+
+    [[nodiscard]] Block makeBlock(size_t firstLine, size_t anchor, uint8_t width) const;
+    [[nodiscard]] static uint8_t widthFor(size_t offset);
+    [[nodiscard]] static size_t offsetAt(const Block& block, size_t index);
+    [[nodiscard]] static size_t countAtOrBelow(const Block& block, size_t offset);
+    [[nodiscard]] size_t firstLineOf(const Block& block, bool isBehind) const;
+    [[nodiscard]] size_t anchorOf(const Block& block, bool isBehind) const;
+    [[nodiscard]] const Block& findLine(size_t line, bool& isBehind) const;
+    void flip(Block& block) const;
+    void moveSplitToLine(size_t line);
+    void moveSplitToEnd();
+    void decode(const Block& block, std::vector<size_t>& starts) const;
+    void encode(const std::vector<size_t>& starts, size_t firstLine);
+    void appendOffset(Block& block, size_t offset);
+};
+
+#endif // LINEINDEX_H
@@ -0,0 +1,215 @@
+// Compares the compact line index with a plain vector of line starts on a
+// generated log, without a window:
+//
+//   lineindex-bench [lines] [edits]
+//
+// Builds both for a log of the given number of lines (10 million by
+// default; the vector needs 8 bytes a line, so 100 million needs 800 MB for
+// it alone), then prints the memory each takes and the time to build it,
+// look up random lines' starts, find the line of random positions, scan
+// every line in order and apply small edits, at random places and then
+// each next to the one before. The index must agree with the vector after
+// every step; exits 1 where it does not.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "LineIndex.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t LOOKUPS = 4 * 1000 * 1000;
+
+    double nanosecondsEach(Clock::time_point start, size_t count) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(count);
+    }
+
+    // Line lengths as in a log: mostly 60 to 200 bytes, now and then a
+    // stack trace line or a dumped payload of a few kilobytes
+    std::vector<size_t> makeStarts(size_t lines, size_t& length) {
+        std::mt19937 random(1);
+        std::vector<size_t> starts;
+        starts.reserve(lines);
+        size_t at = 0;
+        for (size_t i = 0; i < lines; ++i) {
+            starts.push_back(at);
+            at += random() % 1000 == 0 ? 1000 + random() % 8000 : 60 + random() % 140;
+        }
+        length = at;
+        return starts;
+    }
+
+    // The edits as the vector would apply them: every later start moves
+    void insertInto(std::vector<size_t>& starts, size_t position, const std::string& text) {
+        auto it = std::upper_bound(starts.begin(), starts.end(), position);
+        for (auto later = it; later != starts.end(); ++later) {
+            *later += text.size();
+        }
+        std::vector<size_t> added;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '\n') {
+                added.push_back(position + i + 1);
+            }
+        }
+        starts.insert(it, added.begin(), added.end());
+    }
+
+    void eraseFrom(std::vector<size_t>& starts, size_t start, size_t end) {
+        auto first = std::upper_bound(starts.begin(), starts.end(), start);
+        auto last = std::upper_bound(first, starts.end(), end);
+        for (auto later = last; later != starts.end(); ++later) {
+            *later -= end - start;
+        }
+        starts.erase(first, last);
+    }
+
+    bool same(const LineIndex& index, const std::vector<size_t>& starts, std::mt19937& random) {
+        if (index.size() != starts.size()) {
+            return false;
+        }
+        for (int i = 0; i < 1000; ++i) {
+            const size_t line = random() % starts.size();
+            if (index[line] != starts[line]) {
+                return false;
+            }
+        }
+        return index[0] == starts[0] && index[starts.size() - 1] == starts.back();
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t lines = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10 * 1000 * 1000;
+    const size_t edits = argc > 2 ? strtoull(argv[2], nullptr, 10) : 200;
+    if (lines < 2) {
+        fprintf(stderr, "Usage: lineindex-bench [lines] [edits]\n");
+        return 2;
+    }
+
+    size_t length = 0;
+    const std::vector<size_t> generated = makeStarts(lines, length);
+    auto start = Clock::now();
+    std::vector<size_t> starts;
+    for (const size_t lineStart : generated) {
+        starts.push_back(lineStart);
+    }
+    const double vectorBuild = nanosecondsEach(start, lines);
+
+    auto account = std::make_shared<MemoryAccount>();
+    LineIndex index(account);
+    start = Clock::now();
+    index.reset(length);
+    for (const size_t lineStart : generated) {
+        index.push_back(lineStart);
+    }
+    const double indexBuild = nanosecondsEach(start, lines);
+
+    std::mt19937 random(2);
+    if (!same(index, starts, random)) {
+        fprintf(stderr, "the built index differs from the vector\n");
+        return 1;
+    }
+    // The vector as the document kept it, sized to fit
+    const double vectorBytes = static_cast<double>(starts.size() * sizeof(size_t));
+    const double indexBytes = static_cast<double>(account->getReserved(MemoryTag::LineIndex));
+    printf("%zu lines, %zu MB of text\n\n", lines, length >> 20);
+    printf("%-28s %14s %14s\n", "", "vector", "line index");
+    printf("%-28s %11.1f MB %11.1f MB  (%.2f and %.2f bytes a line, %.1fx smaller; %.2f bytes a line in use)\n", "memory",
+        vectorBytes / 1048576, indexBytes / 1048576, vectorBytes / static_cast<double>(lines),
+        indexBytes / static_cast<double>(lines), vectorBytes / indexBytes,
+        static_cast<double>(index.getLiveBytes()) / static_cast<double>(lines));
+    printf("%-28s %11.1f ns %11.1f ns\n", "build, per line", vectorBuild, indexBuild);
+
+    // The same random lines and positions for both
+    std::vector<size_t> lookups(LOOKUPS);
+    for (size_t& line : lookups) {
+        line = random() % lines;
+    }
+    size_t sum = 0;
+    start = Clock::now();
+    for (const size_t line : lookups) {
+        sum += starts[line];
+    }
+    const double vectorLookup = nanosecondsEach(start, LOOKUPS);
+    start = Clock::now();
+    for (const size_t line : lookups) {
+        sum -= index[line];
+    }
+    const double indexLookup = nanosecondsEach(start, LOOKUPS);
+    printf("%-28s %11.1f ns %11.1f ns\n", "start of a random line", vectorLookup, indexLookup);
+
+    for (size_t& position : lookups) {
+        position = random() % length;
+    }
+    start = Clock::now();
+    for (const size_t position : lookups) {
+        sum += static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), position) - starts.begin()) - 1;
+    }
+    const double vectorLineOf = nanosecondsEach(start, LOOKUPS);
+    start = Clock::now();
+    for (const size_t position : lookups) {
+        sum -= index.lineOf(position);
+    }
+    const double indexLineOf = nanosecondsEach(start, LOOKUPS);
+    printf("%-28s %11.1f ns %11.1f ns\n", "line of a random position", vectorLineOf, indexLineOf);
+
+    start = Clock::now();
+    for (size_t line = 0; line < lines; ++line) {
+        sum += starts[line];
+    }
+    const double vectorScan = nanosecondsEach(start, lines);
+    start = Clock::now();
+    for (size_t line = 0; line < lines; ++line) {
+        sum -= index[line];
+    }
+    const double indexScan = nanosecondsEach(start, lines);
+    printf("%-28s %11.1f ns %11.1f ns\n", "every line in order, each", vectorScan, indexScan);
+    if (sum != 0) {
+        fprintf(stderr, "the index and the vector gave different starts or lines\n");
+        return 1;
+    }
+
+    // Typing a character, Enter, or deleting a short span, at random
+    // places and then each next to the one before, as typing goes
+    for (const bool nearby : { false, true }) {
+        double vectorEdits = 0;
+        double indexEdits = 0;
+        size_t position = random() % length;
+        for (size_t i = 0; i < edits; ++i) {
+            position = nearby ? std::min(length - 1, position + random() % 80) : random() % length;
+            if (i % 3 == 2) {
+                const size_t end = std::min(length, position + 1 + random() % 300);
+                start = Clock::now();
+                eraseFrom(starts, position, end);
+                vectorEdits += nanosecondsEach(start, edits);
+                start = Clock::now();
+                index.onDelete(position, end);
+                indexEdits += nanosecondsEach(start, edits);
+                length -= end - position;
+            }
+            else {
+                const std::string text = i % 3 == 0 ? "x" : "\n";
+                start = Clock::now();
+                insertInto(starts, position, text);
+                vectorEdits += nanosecondsEach(start, edits);
+                start = Clock::now();
+                index.onInsert(position, text.data(), text.size());
+                indexEdits += nanosecondsEach(start, edits);
+                length += text.size();
+            }
+            if (!same(index, starts, random)) {
+                fprintf(stderr, "edit %zu: the index differs from the vector\n", i);
+                return 1;
+            }
+        }
+        printf("%-28s %11.1f us %11.1f us\n", nearby ? "edit next to the last" : "edit at a random place",
+            vectorEdits / 1000, indexEdits / 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "LzCodec.h"
+
+namespace {
+    constexpr size_t MIN_MATCH = 4;
+    constexpr size_t MAX_OFFSET = 65535;
+    constexpr int HASH_BITS = 16;
+    // Past this many misses in a row the step grows, so text that does not
+    // compress goes through quickly
+    constexpr int SKIP_SHIFT = 6;
+    constexpr size_t FAST_COPY = 16;
+
+    uint32_t read32(const uint8_t* data) {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint32_t hash(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    void putLength(std::string& output, size_t length) {
+        for (; length >= 255; length -= 255) {
+            output += static_cast<char>(255);
+        }
+        output += static_cast<char>(length);
+    }
+
+    void putSequence(std::string& output, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+        const size_t extra = matchLength - MIN_MATCH;
+        const auto token = static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(extra, 15));
+        output += static_cast<char>(token);
+        if (literalCount >= 15) {
+            putLength(output, literalCount - 15);
+        }
+        output.append(reinterpret_cast<const char*>(literals), literalCount);
+        output += static_cast<char>(offset & 0xff);
+        output += static_cast<char>(offset >> 8);
+        if (extra >= 15) {
+            putLength(output, extra - 15);
+        }
+    }
+
+    void putLiterals(std::string& output, const uint8_t* literals, size_t literalCount) {
+        output += static_cast<char>(std::min<size_t>(literalCount, 15) << 4);
+        if (literalCount >= 15) {
+            putLength(output, literalCount - 15);
+        }
+        output.append(reinterpret_cast<const char*>(literals), literalCount);
+    }
+
+    bool getLength(const uint8_t*& in, const uint8_t* end, size_t& length) {
+        for (;;) {
+            if (in == end) {
+                return false;
+            }
+            const uint8_t byte = *in++;
+            length += byte;
+            if (byte != 255) {
+                return true;
+            }
+        }
+    }
+}
+
+
+void lzCompress(std::string_view input, std::string& output) {
+    const auto* data = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t size = input.size();
+    output.reserve(output.size() + size / 2 + 16);
+
+    std::vector<uint32_t> table(size_t{ 1 } << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t position = 0;
+    while (position + MIN_MATCH <= size) {
+        const uint32_t sequence = read32(data + position);
+        uint32_t& slot = table[hash(sequence)];
+        const size_t candidate = slot;
+        slot = static_cast<uint32_t>(position);
+        if (candidate >= position || position - candidate > MAX_OFFSET || read32(data + candidate) != sequence) {
+            position += 1 + ((position - anchor) >> SKIP_SHIFT);
+            continue;
+        }
+
+        size_t length = MIN_MATCH;
+        while (position + length < size && data[candidate + length] == data[position + length]) {
+            ++length;
+        }
+        putSequence(output, data + anchor, position - anchor, position - candidate, length);
+        position += length;
+        anchor = position;
+    }
+    putLiterals(output, data + anchor, size - anchor);
+}
+
+bool lzDecompress(std::string_view input, char* output, size_t outputLength) {
+    const auto* in = reinterpret_cast<const uint8_t*>(input.data());
+    const uint8_t* end = in + input.size();
+    char* out = output;
+    char* outEnd = output + outputLength;
+
+    while (in < end) {
+        const uint8_t token = *in++;
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !getLength(in, end, literalCount)) {
+            return false;
+        }
+        if (literalCount > static_cast<size_t>(end - in) || literalCount > static_cast<size_t>(outEnd - out)) {
+            return false;
+        }
+        // Short runs are copied a fixed 16 bytes at a time where there is
+        // room; whatever lands past them is written over next
+        if (literalCount <= FAST_COPY && end - in >= static_cast<ptrdiff_t>(FAST_COPY) &&
+            outEnd - out >= static_cast<ptrdiff_t>(FAST_COPY)) {
+            memcpy(out, in, FAST_COPY);
+        }
+        else {
+            memcpy(out, in, literalCount);
+        }
+        in += literalCount;
+        out += literalCount;
+        if (in == end) {
+            break; // the last sequence has no match
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        const size_t offset = in[0] | (static_cast<size_t>(in[1]) << 8);
+        in += 2;
+        size_t length = (token & 15) + MIN_MATCH;
+        if ((token & 15) == 15 && !getLength(in, end, length)) {
+            return false;
+        }
+        if (offset == 0 || offset > static_cast<size_t>(out - output) || length > static_cast<size_t>(outEnd - out)) {
+            return false;
+        }
+        // Short matches far enough back are two fixed copies, the second
+        // reading at most up to where the first one ended
+        const char* from = out - offset;
+        if (offset >= FAST_COPY && length <= 2 * FAST_COPY && outEnd - out >= static_cast<ptrdiff_t>(2 * FAST_COPY)) {
+            memcpy(out, from, FAST_COPY);
+            memcpy(out + FAST_COPY, from + FAST_COPY, FAST_COPY);
+            out += length;
+            continue;
+        }
+        // Otherwise a match may overlap what it produces. Copying from its
+        // start in steps no longer than the distance covered so far keeps
+        // each copy apart, and the steps double, so even long runs take few
+        // copies.
+        while (length > 0) {
+            const size_t step = std::min(length, static_cast<size_t>(out - from));
+            memcpy(out, from, step);
+            out += step;
+            length -= step;
+        }
+    }
+    return out == outEnd;
+}
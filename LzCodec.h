@@ -0,0 +1,25 @@
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Byte-oriented LZ77 in the style of LZ4, for text kept compressed in memory.
+// It trades ratio for speed: typical text shrinks to a third or so, and
+// decompresses at memory speed, so a tab can come back faster than its file
+// could be read. The output is private to this process; it is not a file
+// format and carries no checksum.
+//
+// Each sequence is a token byte (literal count in the high four bits, match
+// length minus MIN_MATCH in the low four, 15 meaning more bytes of 255 follow),
+// the literals, a two-byte offset back into the output and any extra length.
+// The last sequence is literals only.
+
+// Appends the compressed form of input to output. Inputs are meant to be
+// chunks of a few megabytes; offsets into them are kept in 32 bits.
+void lzCompress(std::string_view input, std::string& output);
+// False when input is damaged or does not expand to exactly outputLength bytes
+[[nodiscard]] bool lzDecompress(std::string_view input, char* output, size_t outputLength);
+
+#endif // LZCODEC_H
@@ -0,0 +1,269 @@
+// Checks DocumentMarkers against a plain vector of positions:
+//
+//   markers-test [steps]
+//
+// Random inserts and deletes are applied to both, with markers and ranges
+// added and removed between them. Edits often land exactly on a marker,
+// deletes often swallow several, and edit positions jump around so the
+// split between the markers in front and behind is moved across them both
+// ways. After every step each marker's position, each range and a random
+// window of getMarkers must match the vector, which is updated the obvious
+// way. Exits 1 on the first difference.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "DocumentMarkers.h"
+
+namespace {
+    // What DocumentMarkers keeps, without the split
+    struct ModelMarker {
+        bool live = false;
+        size_t position = 0;
+        MarkerGravity gravity = MarkerGravity::After;
+    };
+
+    class Model {
+    public:
+        explicit Model(size_t length) : length(length) {}
+
+        void add(MarkerId id, size_t position, MarkerGravity gravity) {
+            if (id >= markers.size()) {
+                markers.resize(id + 1);
+            }
+            markers[id] = { true, std::min(position, length), gravity };
+        }
+
+        void remove(MarkerId id) {
+            markers[id].live = false;
+        }
+
+        void insert(size_t position, size_t len) {
+            position = std::min(position, length);
+            for (ModelMarker& marker : markers) {
+                if (marker.position > position || (marker.position == position && marker.gravity == MarkerGravity::After)) {
+                    marker.position += len;
+                }
+            }
+            length += len;
+        }
+
+        void erase(size_t start, size_t end) {
+            end = std::min(end, length);
+            if (start >= end) {
+                return;
+            }
+            for (ModelMarker& marker : markers) {
+                if (marker.position >= end) {
+                    marker.position -= end - start;
+                }
+                else if (marker.position > start) {
+                    marker.position = start;
+                }
+            }
+            length -= end - start;
+        }
+
+        // Ids of the live markers in [start, end), in id order
+        [[nodiscard]] std::vector<MarkerId> within(size_t start, size_t end) const {
+            std::vector<MarkerId> ids;
+            for (MarkerId id = 0; id < markers.size(); ++id) {
+                if (markers[id].live && markers[id].position >= start && markers[id].position < end) {
+                    ids.push_back(id);
+                }
+            }
+            return ids;
+        }
+
+        std::vector<ModelMarker> markers;
+        size_t length;
+    };
+
+    bool check(const DocumentMarkers& markers, const Model& model, const std::vector<MarkerRange>& ranges,
+               std::mt19937& random, size_t step, const char* operation) {
+        size_t live = 0;
+        for (MarkerId id = 0; id < model.markers.size(); ++id) {
+            if (!model.markers[id].live) {
+                continue;
+            }
+            ++live;
+            const size_t position = markers.getPosition(id);
+            if (position != model.markers[id].position) {
+                fprintf(stderr, "step %zu, after %s: marker %zu is at %zu, expected %zu\n", step, operation, id,
+                    position, model.markers[id].position);
+                return false;
+            }
+        }
+        if (markers.size() != live) {
+            fprintf(stderr, "step %zu, after %s: %zu markers, expected %zu\n", step, operation, markers.size(), live);
+            return false;
+        }
+        for (const MarkerRange& range : ranges) {
+            const size_t start = model.markers[range.start].position;
+            const size_t end = std::max(start, model.markers[range.end].position);
+            if (markers.getRange(range) != std::make_pair(start, end)) {
+                fprintf(stderr, "step %zu, after %s: range %zu-%zu is not [%zu, %zu)\n", step, operation, range.start,
+                    range.end, start, end);
+                return false;
+            }
+        }
+
+        // getMarkers orders by position; markers sharing one come in any order
+        const size_t start = random() % (model.length + 1);
+        const size_t end = start + random() % (model.length - start + 2);
+        std::vector<MarkerId> found = markers.getMarkers(start, end);
+        for (size_t i = 1; i < found.size(); ++i) {
+            if (markers.getPosition(found[i - 1]) > markers.getPosition(found[i])) {
+                fprintf(stderr, "step %zu, after %s: getMarkers(%zu, %zu) is out of order\n", step, operation, start, end);
+                return false;
+            }
+        }
+        std::sort(found.begin(), found.end());
+        if (found != model.within(start, end)) {
+            fprintf(stderr, "step %zu, after %s: getMarkers(%zu, %zu) gave %zu markers, expected %zu\n", step,
+                operation, start, end, found.size(), model.within(start, end).size());
+            return false;
+        }
+        return true;
+    }
+
+    // A live marker's position picked at random, or anywhere when there are none
+    size_t pickPosition(const Model& model, std::mt19937& random) {
+        std::vector<size_t> positions;
+        for (const ModelMarker& marker : model.markers) {
+            if (marker.live) {
+                positions.push_back(marker.position);
+            }
+        }
+        return positions.empty() ? random() % (model.length + 1) : positions[random() % positions.size()];
+    }
+
+    bool runSteps(size_t steps) {
+        std::mt19937 random(1);
+        constexpr size_t START_LENGTH = 1000;
+        constexpr size_t MAX_MARKERS = 200;
+        DocumentMarkers markers;
+        markers.reset(START_LENGTH);
+        Model model(START_LENGTH);
+        std::vector<MarkerRange> ranges;
+        for (size_t step = 0; step < steps; ++step) {
+            const char* operation = nullptr;
+            // Positions jump between the two ends so the split crosses markers
+            const size_t anywhere = random() % 2 == 0 ? random() % (model.length / 4 + 1)
+                                                      : model.length - random() % (model.length / 4 + 1);
+            // Past MAX_MARKERS, adding one removes one instead
+            unsigned choice = random() % 12;
+            if (choice <= 2 && markers.size() >= MAX_MARKERS) {
+                choice = 3;
+            }
+            switch (choice) {
+            case 0:
+            case 1: {
+                operation = "add marker";
+                const size_t position = random() % 3 == 0 ? pickPosition(model, random) : anywhere;
+                const MarkerGravity gravity = random() % 2 == 0 ? MarkerGravity::Before : MarkerGravity::After;
+                model.add(markers.addMarker(position, gravity), position, gravity);
+                break;
+            }
+            case 2: {
+                operation = "add range";
+                const size_t start = std::min(anywhere, model.length);
+                const size_t end = std::min(start + random() % 50, model.length);
+                const MarkerRange range = markers.addRange(start, end);
+                model.add(range.start, start, MarkerGravity::After);
+                model.add(range.end, end, MarkerGravity::Before);
+                ranges.push_back(range);
+                break;
+            }
+            case 3: {
+                // Ranges are removed whole; markers of theirs are left alone
+                operation = "remove";
+                if (!ranges.empty() && random() % 2 == 0) {
+                    const size_t index = random() % ranges.size();
+                    markers.removeRange(ranges[index]);
+                    model.remove(ranges[index].start);
+                    model.remove(ranges[index].end);
+                    ranges.erase(ranges.begin() + index);
+                    break;
+                }
+                std::vector<MarkerId> loose;
+                for (MarkerId id = 0; id < model.markers.size(); ++id) {
+                    const bool inRange = std::any_of(ranges.begin(), ranges.end(),
+                        [id](const MarkerRange& range) { return range.start == id || range.end == id; });
+                    if (model.markers[id].live && !inRange) {
+                        loose.push_back(id);
+                    }
+                }
+                if (!loose.empty()) {
+                    const MarkerId id = loose[random() % loose.size()];
+                    markers.removeMarker(id);
+                    model.remove(id);
+                }
+                break;
+            }
+            case 4:
+            case 5: {
+                operation = "insert at a marker";
+                const size_t position = pickPosition(model, random);
+                const size_t len = 1 + random() % 8;
+                markers.onInsert(position, len);
+                model.insert(position, len);
+                break;
+            }
+            case 6:
+            case 7: {
+                operation = "insert";
+                const size_t len = 1 + random() % 8;
+                markers.onInsert(anywhere, len);
+                model.insert(anywhere, len);
+                break;
+            }
+            case 8:
+            case 9: {
+                // Starts on a marker or just before one, and runs over it
+                // and often the ones after it
+                operation = "delete over markers";
+                const size_t position = pickPosition(model, random);
+                const size_t start = position - std::min(position, static_cast<size_t>(random() % 3));
+                const size_t end = start + 1 + random() % 40;
+                markers.onDelete(start, end);
+                model.erase(start, end);
+                break;
+            }
+            default: {
+                operation = "delete";
+                const size_t end = anywhere + random() % 8;
+                markers.onDelete(anywhere, end);
+                model.erase(anywhere, end);
+                break;
+            }
+            }
+            // Keep the text from running out or growing without bound
+            if (model.length < START_LENGTH / 2) {
+                markers.onInsert(model.length / 2, START_LENGTH);
+                model.insert(model.length / 2, START_LENGTH);
+            }
+            if (!check(markers, model, ranges, random, step, operation)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t steps = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    if (steps == 0) {
+        fprintf(stderr, "Usage: markers-test [steps]\n");
+        return 2;
+    }
+    if (!runSteps(steps)) {
+        return 1;
+    }
+    printf("%zu steps of inserts, deletes and marker changes: every marker where a vector of positions puts it\n", steps);
+    return 0;
+}
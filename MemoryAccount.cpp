@@ -0,0 +1,132 @@
+#include <cstdio>
+
+#include "MemoryAccount.h"
+
+namespace {
+    void appendJsonString(std::string& out, const std::string& text) {
+        out += '"';
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                out += escaped;
+            }
+            else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    void appendUsage(std::string& out, const MemoryUsage& usage) {
+        char fields[80];
+        snprintf(fields, sizeof(fields), "{\"live\":%zu,\"reserved\":%zu}", usage.live, usage.reserved);
+        out += fields;
+    }
+
+    void appendReport(std::string& out, const MemoryReport& report) {
+        out += "\"components\":{";
+        for (size_t tag = 0; tag < static_cast<size_t>(MemoryTag::Count); ++tag) {
+            if (tag > 0) {
+                out += ',';
+            }
+            out += '"';
+            out += memoryTagName(static_cast<MemoryTag>(tag));
+            out += "\":";
+            appendUsage(out, report.components[tag]);
+        }
+        out += "},\"total\":";
+        appendUsage(out, report.total());
+    }
+}
+
+
+const char* memoryTagName(MemoryTag tag) {
+    switch (tag) {
+    case MemoryTag::Text:
+        return "text";
+    case MemoryTag::LineIndex:
+        return "lineIndex";
+    case MemoryTag::Undo:
+        return "undo";
+    case MemoryTag::Compressed:
+        return "compressed";
+    case MemoryTag::View:
+        return "view";
+    default:
+        return "unknown";
+    }
+}
+
+MemoryUsage MemoryReport::total() const {
+    MemoryUsage sum;
+    for (const MemoryUsage& usage : components) {
+        sum.live += usage.live;
+        sum.reserved += usage.reserved;
+    }
+    return sum;
+}
+
+MemoryReport& MemoryReport::operator+=(const MemoryReport& other) {
+    for (size_t tag = 0; tag < static_cast<size_t>(MemoryTag::Count); ++tag) {
+        components[tag].live += other.components[tag].live;
+        components[tag].reserved += other.components[tag].reserved;
+    }
+    return *this;
+}
+
+void MemoryAccount::reserve(MemoryTag tag, size_t bytes) {
+    reserved[static_cast<size_t>(tag)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccount::release(MemoryTag tag, size_t bytes) {
+    reserved[static_cast<size_t>(tag)].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccount::addLive(MemoryTag tag, size_t bytes) {
+    live[static_cast<size_t>(tag)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void MemoryAccount::removeLive(MemoryTag tag, size_t bytes) {
+    live[static_cast<size_t>(tag)].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t MemoryAccount::getReserved(MemoryTag tag) const {
+    return reserved[static_cast<size_t>(tag)].load(std::memory_order_relaxed);
+}
+
+size_t MemoryAccount::getLive(MemoryTag tag) const {
+    return live[static_cast<size_t>(tag)].load(std::memory_order_relaxed);
+}
+
+std::shared_ptr<char[]> allocateShared(const std::shared_ptr<MemoryAccount>& account, MemoryTag tag, size_t size) {
+    if (account == nullptr) {
+        return std::shared_ptr<char[]>(new char[size]);
+    }
+    account->reserve(tag, size);
+    return std::shared_ptr<char[]>(new char[size], [account, tag, size](char* memory) {
+        account->release(tag, size);
+        delete[] memory;
+    });
+}
+
+std::string memoryReportJson(const std::vector<DocumentMemory>& documents) {
+    std::string out = "{\"documents\":[";
+    MemoryReport all;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        out += i == 0 ? "\n{\"name\":" : ",\n{\"name\":";
+        appendJsonString(out, documents[i].name);
+        out += ',';
+        appendReport(out, documents[i].report);
+        out += '}';
+        all += documents[i].report;
+    }
+    out += "\n],";
+    appendReport(out, all);
+    out += "}\n";
+    return out;
+}
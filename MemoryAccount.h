@@ -0,0 +1,129 @@
+#ifndef MEMORYACCOUNT_H
+#define MEMORYACCOUNT_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// What a document's memory is spent on
+enum class MemoryTag {
+    Text,       // text blocks and the list of them
+    LineIndex,  // line start blocks
+    Undo,       // text kept by undo and redo commands
+    Compressed, // text of a dehydrated document
+    View,       // the Edit control's copy of the text, parked or shown
+    Count
+};
+
+[[nodiscard]] const char* memoryTagName(MemoryTag tag);
+
+// Live bytes are what a component's contents take; reserved bytes are what
+// it has allocated to hold them. Reserved above live is slack, and slack
+// that keeps growing is a leak.
+struct MemoryUsage {
+    size_t live = 0;
+    size_t reserved = 0;
+};
+
+// A document's memory by component
+struct MemoryReport {
+    MemoryUsage components[static_cast<size_t>(MemoryTag::Count)];
+
+    [[nodiscard]] MemoryUsage& operator[](MemoryTag tag) { return components[static_cast<size_t>(tag)]; }
+    [[nodiscard]] const MemoryUsage& operator[](MemoryTag tag) const { return components[static_cast<size_t>(tag)]; }
+    [[nodiscard]] MemoryUsage total() const;
+    MemoryReport& operator+=(const MemoryReport& other);
+};
+
+// The allocations made for one document, by tag. TaggedAllocator and
+// allocateShared charge it as memory is allocated and credit it as memory
+// is freed, so reserved bytes are exact whichever thread frees them. Live
+// bytes are mostly worked out from the components when a report is made;
+// the ones that cannot be are added here.
+//
+// Allocators carry a bare pointer to keep containers small, so whatever
+// holds tagged memory also holds the account's shared_ptr, which keeps it
+// alive until the last of that memory is freed.
+class MemoryAccount {
+public:
+    void reserve(MemoryTag tag, size_t bytes);
+    void release(MemoryTag tag, size_t bytes);
+    void addLive(MemoryTag tag, size_t bytes);
+    void removeLive(MemoryTag tag, size_t bytes);
+
+    [[nodiscard]] size_t getReserved(MemoryTag tag) const;
+    [[nodiscard]] size_t getLive(MemoryTag tag) const;
+
+private:
+    std::atomic<size_t> reserved[static_cast<size_t>(MemoryTag::Count)] = {};
+    std::atomic<size_t> live[static_cast<size_t>(MemoryTag::Count)] = {};
+};
+
+// Charges what a container allocates to an account. Without one it is a
+// plain allocator. Copying a container does not copy its account: a copy
+// belongs to whoever made it, not to the document it came from.
+template <typename T, MemoryTag Tag>
+class TaggedAllocator {
+public:
+    using value_type = T;
+    using is_always_equal = std::false_type;
+
+    template <typename U>
+    struct rebind {
+        using other = TaggedAllocator<U, Tag>;
+    };
+
+    TaggedAllocator() = default;
+    explicit TaggedAllocator(MemoryAccount* account)
+        : account(account) {}
+    template <typename U>
+    TaggedAllocator(const TaggedAllocator<U, Tag>& other)
+        : account(other.getAccount()) {}
+
+    [[nodiscard]] T* allocate(size_t count) {
+        T* memory = std::allocator<T>().allocate(count);
+        if (account != nullptr) {
+            account->reserve(Tag, count * sizeof(T));
+        }
+        return memory;
+    }
+
+    void deallocate(T* memory, size_t count) {
+        if (account != nullptr) {
+            account->release(Tag, count * sizeof(T));
+        }
+        std::allocator<T>().deallocate(memory, count);
+    }
+
+    [[nodiscard]] TaggedAllocator select_on_container_copy_construction() const {
+        return TaggedAllocator();
+    }
+
+    [[nodiscard]] MemoryAccount* getAccount() const { return account; }
+
+    template <typename U>
+    [[nodiscard]] bool operator==(const TaggedAllocator<U, Tag>& other) const { return account == other.getAccount(); }
+
+private:
+    MemoryAccount* account = nullptr;
+};
+
+// Shared bytes charged to the account until their last holder lets go;
+// each holder keeps the account alive that long
+[[nodiscard]] std::shared_ptr<char[]> allocateShared(const std::shared_ptr<MemoryAccount>& account, MemoryTag tag,
+    size_t size);
+
+struct DocumentMemory {
+    std::string name; // UTF-8
+    MemoryReport report;
+};
+
+// {"documents":[{"name":..., "components":{"text":{"live":..,"reserved":..},...},
+// "total":{...}},...], "components":{...}, "total":{...}}, the last two summed
+// over every document, with each size in bytes
+[[nodiscard]] std::string memoryReportJson(const std::vector<DocumentMemory>& documents);
+
+#endif // MEMORYACCOUNT_H
@@ -0,0 +1,105 @@
+// Measures what the profiler adds to the edit path, without a window:
+//
+//   profile-bench [keystrokes] [rounds]
+//
+// Types into a generated file through the command history, the way the
+// engine applies typing, and prints the time per keystroke, the fastest of
+// the rounds. Built twice, as profile-bench with EDITOR_PROFILE and as
+// profile-bench-off without it: the difference between the two is what the
+// timers cost. It also times a timed scope on its own, with tracing off and
+// on, and with EDITOR_PROFILE shows how many scopes a keystroke went through
+// and what share of the keystroke they take.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "BenchSupport.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t SCOPE_RUNS = 10 * 1000 * 1000;
+
+    double nanosecondsSince(Clock::time_point start, size_t count) {
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) /
+            static_cast<double>(count);
+    }
+
+    // Typing a line at a time, with a Backspace every so often
+    double typeRound(const std::string& text, size_t keystrokes) {
+        DocumentText document(nullptr);
+        loadText(document, text);
+        CommandHistory history;
+
+        const char typed[] = "value = compute(a, b);\n";
+        size_t position = document.lineStarts[document.lineStarts.size() / 2];
+        const auto start = Clock::now();
+        for (size_t i = 0; i < keystrokes; ++i) {
+            if (i % 16 == 15) {
+                history.executeCommand(std::make_unique<DeleteCommand>(document, position - 1, 1));
+                --position;
+                continue;
+            }
+            history.executeCommand(std::make_unique<InsertCommand>(document, std::string_view(&typed[i % (sizeof(typed) - 1)], 1), position));
+            ++position;
+        }
+        return nanosecondsSince(start, keystrokes);
+    }
+
+    double timeScopes(ProfileSite& site) {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < SCOPE_RUNS; ++i) {
+            const ScopedTimer timer(site);
+        }
+        return nanosecondsSince(start, SCOPE_RUNS);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t keystrokes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    const int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (keystrokes == 0 || rounds < 1) {
+        fprintf(stderr, "Usage: profile-bench [keystrokes] [rounds]\n");
+        return 2;
+    }
+
+    const std::string text = makeCodeText(100000);
+    double best = 0;
+    for (int round = 0; round < rounds; ++round) {
+        const double perKeystroke = typeRound(text, keystrokes);
+        best = round == 0 ? perKeystroke : std::min(best, perKeystroke);
+    }
+#ifdef EDITOR_PROFILE
+    printf("profiled: %.0f ns per keystroke, best of %d rounds of %zu\n", best, rounds, keystrokes);
+#else
+    printf("unprofiled: %.0f ns per keystroke, best of %d rounds of %zu\n", best, rounds, keystrokes);
+#endif
+
+    Profiler& profiler = Profiler::instance();
+#ifdef EDITOR_PROFILE
+    // The sites the keystrokes went through, before the scopes timed below
+    const std::string summary = profiler.summary();
+    uint64_t scopes = 0;
+    for (const char* name : { "CommandHistory::executeCommand", "DocumentText::insertText", "DocumentText::deleteText",
+        "DocumentText::updateLineStarts" }) {
+        scopes += profiler.site(name).calls.load(std::memory_order_relaxed);
+    }
+    const double scopesPerKeystroke = static_cast<double>(scopes) / static_cast<double>(keystrokes * rounds);
+#endif
+
+    ProfileSite& site = profiler.site("profile-bench scope");
+    const double untraced = timeScopes(site);
+    profiler.setTracing(true);
+    const double traced = timeScopes(site);
+    profiler.setTracing(false);
+    printf("a timed scope: %.1f ns, %.1f ns while tracing\n", untraced, traced);
+#ifdef EDITOR_PROFILE
+    printf("%.1f scopes per keystroke, about %.1f%% of it\n", scopesPerKeystroke, 100.0 * scopesPerKeystroke * untraced / best);
+    printf("\n%s", summary.c_str());
+#endif
+    return 0;
+}
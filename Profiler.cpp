@@ -0,0 +1,314 @@
+#include <Windows.h>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "Profiler.h"
+
+namespace {
+    thread_local void* currentThreadEvents = nullptr;
+
+    void appendJsonString(std::string& out, const char* text) {
+        out += '"';
+        for (; *text != '\0'; ++text) {
+            if (*text == '"' || *text == '\\') {
+                out += '\\';
+            }
+            out += *text;
+        }
+        out += '"';
+    }
+}
+
+
+std::string formatDuration(uint64_t nanoseconds) {
+    char text[32];
+    if (nanoseconds < 1000) {
+        snprintf(text, sizeof(text), "%llu ns", static_cast<unsigned long long>(nanoseconds));
+    }
+    else if (nanoseconds < 1000 * 1000) {
+        snprintf(text, sizeof(text), "%.1f us", static_cast<double>(nanoseconds) / 1e3);
+    }
+    else if (nanoseconds < 1000 * 1000 * 1000) {
+        snprintf(text, sizeof(text), "%.1f ms", static_cast<double>(nanoseconds) / 1e6);
+    }
+    else {
+        snprintf(text, sizeof(text), "%.2f s", static_cast<double>(nanoseconds) / 1e9);
+    }
+    return text;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    counts[bucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t seen = max.load(std::memory_order_relaxed);
+    while (nanoseconds > seen && !max.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::reset() {
+    for (std::atomic<uint64_t>& bucket : counts) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    total = 0;
+    max = 0;
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    // Summed from the buckets to keep recording to one less atomic
+    uint64_t recorded = 0;
+    for (const std::atomic<uint64_t>& bucket : counts) {
+        recorded += bucket.load(std::memory_order_relaxed);
+    }
+    return recorded;
+}
+
+uint64_t LatencyHistogram::getTotal() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+    return max.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const {
+    const uint64_t recorded = getCount();
+    if (recorded == 0) {
+        return 0;
+    }
+    const double clamped = std::clamp(percentile, 0.0, 100.0);
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(recorded))));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += counts[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(highestInBucket(bucket), getMax());
+        }
+    }
+    return getMax();
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t nanoseconds) {
+    nanoseconds = std::min(nanoseconds, (uint64_t{ 1 } << MAX_VALUE_BITS) - 1);
+    if (nanoseconds < SUB_BUCKETS) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    // The top SUB_BUCKET_BITS + 1 bits pick the bucket, the rest are dropped
+    const int shift = std::bit_width(nanoseconds) - (SUB_BUCKET_BITS + 1);
+    return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((nanoseconds >> shift) - SUB_BUCKETS));
+}
+
+uint64_t LatencyHistogram::highestInBucket(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const size_t shift = bucket / SUB_BUCKETS - 1;
+    const uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+
+uint64_t ProfileSite::estimateTotal() const {
+    const uint64_t timed = histogram.getCount();
+    if (timed == 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(static_cast<double>(histogram.getTotal()) *
+        static_cast<double>(calls.load(std::memory_order_relaxed)) / static_cast<double>(timed));
+}
+
+
+Profiler::Profiler()
+    : origin(ProfileClock::now()) {
+    // Ticks counted against steady_clock over a short spin
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end;
+    do {
+        end = std::chrono::steady_clock::now();
+    } while (end - start < CALIBRATION);
+    const uint64_t ticks = ProfileClock::now() - origin;
+    if (ticks > 0) {
+        nanosecondsPerTick = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) /
+            static_cast<double>(ticks);
+    }
+}
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+ProfileSite& Profiler::site(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<ProfileSite>& site : sites) {
+        if (strcmp(site->name, name) == 0) {
+            return *site;
+        }
+    }
+    sites.push_back(std::make_unique<ProfileSite>());
+    sites.back()->name = name;
+    return *sites.back();
+}
+
+ProfileCounter& Profiler::counter(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<ProfileCounter>& counter : counters) {
+        if (strcmp(counter->name, name) == 0) {
+            return *counter;
+        }
+    }
+    counters.push_back(std::make_unique<ProfileCounter>());
+    counters.back()->name = name;
+    return *counters.back();
+}
+
+void Profiler::record(ProfileSite& site, uint64_t start, uint64_t end) {
+    const auto duration = static_cast<int64_t>(static_cast<double>(end > start ? end - start : 0) * nanosecondsPerTick);
+    site.histogram.record(static_cast<uint64_t>(duration));
+    if (!tracing.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ThreadEvents& thread = threadEvents();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    if (thread.events.size() < MAX_THREAD_EVENTS) {
+        thread.events.push_back(TraceEvent{ &site,
+            static_cast<int64_t>(static_cast<double>(start - origin) * nanosecondsPerTick), duration });
+    }
+    else {
+        ++thread.dropped;
+    }
+}
+
+double Profiler::getNanosecondsPerTick() const {
+    return nanosecondsPerTick;
+}
+
+void Profiler::setTracing(bool on) {
+    tracing = on;
+}
+
+bool Profiler::isTracing() const {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<ProfileSite>& site : sites) {
+        site->calls = 0;
+        site->histogram.reset();
+    }
+    for (const std::unique_ptr<ProfileCounter>& counter : counters) {
+        counter->value = 0;
+    }
+    for (const std::unique_ptr<ThreadEvents>& thread : threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        thread->events.clear();
+        thread->dropped = 0;
+    }
+}
+
+Profiler::ThreadEvents& Profiler::threadEvents() {
+    if (currentThreadEvents == nullptr) {
+        auto thread = std::make_unique<ThreadEvents>();
+        thread->threadId = GetCurrentThreadId();
+        currentThreadEvents = thread.get();
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::move(thread));
+    }
+    return *static_cast<ThreadEvents*>(currentThreadEvents);
+}
+
+std::string Profiler::summary() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string out;
+    char line[256];
+    snprintf(line, sizeof(line), "%-36s %10s %10s %10s %10s %10s %10s %10s\n",
+        "operation", "count", "p50", "p90", "p99", "p99.9", "max", "total");
+    out += line;
+    for (const std::unique_ptr<ProfileSite>& site : sites) {
+        const LatencyHistogram& histogram = site->histogram;
+        if (histogram.getCount() == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-36s %10llu %10s %10s %10s %10s %10s %10s\n", site->name,
+            static_cast<unsigned long long>(site->calls.load(std::memory_order_relaxed)),
+            formatDuration(histogram.getPercentile(50)).c_str(), formatDuration(histogram.getPercentile(90)).c_str(),
+            formatDuration(histogram.getPercentile(99)).c_str(), formatDuration(histogram.getPercentile(99.9)).c_str(),
+            formatDuration(histogram.getMax()).c_str(), formatDuration(site->estimateTotal()).c_str());
+        out += line;
+    }
+    out += "(percentiles and max of the calls timed: all of a site's first " + std::to_string(TIMED_FIRST) +
+        ", about one in " + std::to_string(SAMPLE_ONE_IN) + " after them; totals estimated from those)\n";
+    if (!counters.empty()) {
+        out += "\n";
+        snprintf(line, sizeof(line), "%-36s %10s\n", "counter", "value");
+        out += line;
+    }
+    for (const std::unique_ptr<ProfileCounter>& counter : counters) {
+        snprintf(line, sizeof(line), "%-36s %10llu\n", counter->name,
+            static_cast<unsigned long long>(counter->value.load(std::memory_order_relaxed)));
+        out += line;
+    }
+    return out;
+}
+
+std::string Profiler::traceJson() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const unsigned long processId = GetCurrentProcessId();
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    size_t dropped = 0;
+    char fields[160];
+    for (const std::unique_ptr<ThreadEvents>& thread : threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        out.reserve(out.size() + thread->events.size() * 110);
+        dropped += thread->dropped;
+        for (const TraceEvent& event : thread->events) {
+            out += first ? "\n{\"name\":" : ",\n{\"name\":";
+            first = false;
+            appendJsonString(out, event.site->name);
+            snprintf(fields, sizeof(fields), ",\"cat\":\"editor\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu}",
+                static_cast<double>(event.start) / 1e3, static_cast<double>(event.duration) / 1e3, processId,
+                static_cast<unsigned long>(thread->threadId));
+            out += fields;
+        }
+    }
+    // Counters as they stand at the end of the trace
+    const double now = static_cast<double>(ProfileClock::now() - origin) * nanosecondsPerTick / 1e3;
+    for (const std::unique_ptr<ProfileCounter>& counter : counters) {
+        out += first ? "\n{\"name\":" : ",\n{\"name\":";
+        first = false;
+        appendJsonString(out, counter->name);
+        snprintf(fields, sizeof(fields), ",\"cat\":\"editor\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%lu,\"args\":{\"value\":%llu}}",
+            now, processId, static_cast<unsigned long long>(counter->value.load(std::memory_order_relaxed)));
+        out += fields;
+    }
+    snprintf(fields, sizeof(fields), "\n],\"otherData\":{\"droppedEvents\":%zu}}\n", dropped);
+    out += fields;
+    return out;
+}
+
+bool Profiler::writeSummary(const std::wstring& path) const {
+    return writeFile(path, summary());
+}
+
+bool Profiler::writeTrace(const std::wstring& path) const {
+    return writeFile(path, traceJson());
+}
+
+bool Profiler::writeFile(const std::wstring& path, const std::string& contents) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < contents.size();) {
+        DWORD written = 0;
+        const DWORD want = static_cast<DWORD>(std::min<size_t>(contents.size() - done, 64 * 1024 * 1024));
+        ok = WriteFile(hFile, contents.data() + done, want, &written, nullptr) && written == want;
+        done += written;
+    }
+    CloseHandle(hFile);
+    return ok;
+}
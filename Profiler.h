@@ -0,0 +1,224 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Latencies of the editor's hot paths and counts of the bytes and events
+// going through them. PROFILE_SCOPE times the rest of the enclosing block
+// and PROFILE_COUNT adds to a counter; both compile to nothing unless
+// EDITOR_PROFILE is defined (the EDITOR_PROFILE CMake option), so release
+// builds pay nothing. With it, every call of a timed scope is counted, but
+// past a site's first TIMED_FIRST calls only about one in SAMPLE_ONE_IN is
+// timed, unless a trace is being recorded: a call that is not costs a
+// relaxed atomic add and a random number, one that is two reads of the
+// CPU's time-stamp counter and the histogram's atomics as well.
+// profile-bench measures what that adds to a keystroke. Operations quicker
+// than a clock read are counted instead of timed.
+//
+// The results come out as a text summary of each operation's latency
+// percentiles and each counter, and as Chrome trace-event JSON that
+// chrome://tracing and Perfetto open.
+
+// Latencies in nanoseconds, in buckets of constant relative width like an
+// HdrHistogram: values below SUB_BUCKETS exactly, larger ones to within
+// 1/SUB_BUCKETS (under 2%) up to about 19 hours. Recording is lock-free and
+// may happen on any number of threads at once.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{ 1 } << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 46;
+    static constexpr size_t BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t nanoseconds);
+    void reset();
+
+    [[nodiscard]] uint64_t getCount() const;
+    [[nodiscard]] uint64_t getTotal() const;
+    [[nodiscard]] uint64_t getMax() const;
+    // The largest value that falls in the same bucket as the given
+    // percentile (0 to 100) of what was recorded; 0 when nothing was
+    [[nodiscard]] uint64_t getPercentile(double percentile) const;
+
+    [[nodiscard]] static size_t bucketOf(uint64_t nanoseconds);
+    [[nodiscard]] static uint64_t highestInBucket(size_t bucket);
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{ 0 };
+    std::atomic<uint64_t> max{ 0 };
+};
+
+// "850 ns", "12.3 us", "4.5 ms" or "1.25 s"
+[[nodiscard]] std::string formatDuration(uint64_t nanoseconds);
+
+// One timed operation, named by a string literal. The histogram holds the
+// calls that were timed, a sample of them all once there are many.
+struct ProfileSite {
+    const char* name;
+    std::atomic<uint64_t> calls{ 0 };
+    LatencyHistogram histogram;
+
+    // Time spent in every call, estimated from the timed ones
+    [[nodiscard]] uint64_t estimateTotal() const;
+};
+
+struct ProfileCounter {
+    const char* name;
+    std::atomic<uint64_t> value{ 0 };
+
+    void add(uint64_t amount) { value.fetch_add(amount, std::memory_order_relaxed); }
+};
+
+// The timers' clock: the time-stamp counter on x86, read in a few
+// nanoseconds where steady_clock's QueryPerformanceCounter takes tens, and
+// hundreds under some hypervisors; steady_clock in nanoseconds elsewhere.
+// Ticks become nanoseconds when recorded, at a rate the profiler measures
+// against steady_clock when it starts. The counter is taken to be
+// invariant, as on every x86 CPU of the last fifteen years.
+struct ProfileClock {
+    [[nodiscard]] static uint64_t now() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+};
+
+class Profiler {
+public:
+    // Events each thread keeps for the trace; later ones are counted and dropped
+    static constexpr size_t MAX_THREAD_EVENTS = size_t{ 1 } << 20;
+    // Each site's first calls are all timed, so rare operations keep every
+    // latency; later ones are timed at random one in SAMPLE_ONE_IN (a power
+    // of two) unless tracing, which needs every call's event
+    static constexpr uint64_t TIMED_FIRST = 1024;
+    static constexpr uint32_t SAMPLE_ONE_IN = 16;
+
+    static Profiler& instance();
+
+    // The same name always gives the same site or counter. Looked up once
+    // per call site by the macros, so the map is not on the hot path.
+    ProfileSite& site(const char* name);
+    ProfileCounter& counter(const char* name);
+
+    // Counts a call of the site; true if it is to be timed
+    [[nodiscard]] bool begin(ProfileSite& site) {
+        if (site.calls.fetch_add(1, std::memory_order_relaxed) < TIMED_FIRST || tracing.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        // xorshift32: random enough not to fall into step with the caller
+        sampleState ^= sampleState << 13;
+        sampleState ^= sampleState >> 17;
+        sampleState ^= sampleState << 5;
+        return (sampleState & (SAMPLE_ONE_IN - 1)) == 0;
+    }
+    // Start and end in ProfileClock ticks
+    void record(ProfileSite& site, uint64_t start, uint64_t end);
+    [[nodiscard]] double getNanosecondsPerTick() const;
+
+    // Events are kept for the trace only while tracing is on
+    void setTracing(bool on);
+    [[nodiscard]] bool isTracing() const;
+    // Clears every histogram, counter and recorded event
+    void reset();
+
+    [[nodiscard]] std::string summary() const;
+    [[nodiscard]] std::string traceJson() const;
+    bool writeSummary(const std::wstring& path) const;
+    bool writeTrace(const std::wstring& path) const;
+
+private:
+    struct TraceEvent {
+        const ProfileSite* site;
+        int64_t start;    // nanoseconds since the profiler started
+        int64_t duration;
+    };
+
+    // Written by its own thread, read when exporting; the lock is never
+    // contended while the editor runs
+    struct ThreadEvents {
+        std::mutex mutex;
+        uint32_t threadId = 0;
+        std::vector<TraceEvent> events;
+        size_t dropped = 0;
+    };
+
+    // How long the clock rate is measured for when the profiler starts
+    static constexpr auto CALIBRATION = std::chrono::milliseconds(10);
+
+    Profiler();
+
+    const uint64_t origin;
+    double nanosecondsPerTick = 1.0;
+    std::atomic<bool> tracing{ false };
+    static inline thread_local uint32_t sampleState = 0x9E3779B9u;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileSite>> sites;
+    std::vector<std::unique_ptr<ProfileCounter>> counters;
+    std::vector<std::unique_ptr<ThreadEvents>> threads;
+
+    ThreadEvents& threadEvents();
+    static bool writeFile(const std::wstring& path, const std::string& contents);
+};
+
+// Counts the scope it is declared in and times it when it is sampled
+class ScopedTimer {
+public:
+    explicit ScopedTimer(ProfileSite& site)
+        : site(site), timed(Profiler::instance().begin(site)), start(timed ? ProfileClock::now() : 0) {}
+
+    ~ScopedTimer() {
+        if (timed) {
+            Profiler::instance().record(site, start, ProfileClock::now());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    ProfileSite& site;
+    const bool timed;
+    const uint64_t start;
+};
+
+#ifdef EDITOR_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) \
+    static ProfileSite& PROFILE_CONCAT(profileSite, __LINE__) = Profiler::instance().site(name); \
+    const ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(PROFILE_CONCAT(profileSite, __LINE__))
+#define PROFILE_COUNT(name, amount) \
+    do { \
+        static ProfileCounter& profileCounter = Profiler::instance().counter(name); \
+        profileCounter.add(static_cast<uint64_t>(amount)); \
+    } while (false)
+// A duration timed elsewhere, such as on a worker, recorded as one call
+#define PROFILE_DURATION(name, nanoseconds) \
+    do { \
+        static ProfileSite& profileSite = Profiler::instance().site(name); \
+        profileSite.calls.fetch_add(1, std::memory_order_relaxed); \
+        profileSite.histogram.record(static_cast<uint64_t>(nanoseconds)); \
+    } while (false)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(name, amount) ((void)0)
+#define PROFILE_DURATION(name, nanoseconds) ((void)0)
+#endif
+
+#endif // PROFILER_H
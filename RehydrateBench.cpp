@@ -0,0 +1,134 @@
+// Times dehydrating and rehydrating a large document, without a window:
+//
+//   rehydrate-bench [megabytes] [target-ms] [rounds]
+//
+// Compresses a generated log of the given size (100 MB by default) on the
+// task pool as a background tab would be, swaps it in, and brings the text
+// back the way selecting the tab does, five times by default. Prints the
+// compressed size and each step's time, and checks the text came back
+// unchanged. Exits 1 if it did not, or if the slowest rehydration took
+// longer than the target (250 ms by default); the Edit control's copy of
+// the text, which the window adds on top, is not part of it. Also times the
+// dehydration policy choosing among POLICY_TABS open tabs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BenchSupport.h"
+#include "DehydrationPolicy.h"
+#include "TaskScheduler.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t POLICY_TABS = 500;
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Log lines repeat a lot but not exactly, like most large files opened
+    std::string makeLog(size_t bytes) {
+        std::mt19937 random(1);
+        const char* levels[] = { "INFO ", "DEBUG", "WARN ", "ERROR" };
+        const char* events[] = { "request served", "cache miss for key", "retrying connection to",
+            "user signed in from", "slow query on table" };
+        std::string text;
+        text.reserve(bytes + 160);
+        char line[160];
+        for (uint64_t i = 0; text.size() < bytes; ++i) {
+            snprintf(line, sizeof(line), "2024-05-01T%02u:%02u:%02u.%03u %s [worker-%02u] %s %08x in %u ms\n",
+                static_cast<unsigned>(i / 3600000 % 24), static_cast<unsigned>(i / 60000 % 60),
+                static_cast<unsigned>(i / 1000 % 60), static_cast<unsigned>(i % 1000), levels[random() % 4],
+                static_cast<unsigned>(random() % 32), events[random() % 5], static_cast<unsigned>(random()),
+                static_cast<unsigned>(random() % 2000));
+            text += line;
+        }
+        return text;
+    }
+
+    bool matches(const DocumentText& document, const std::string& text) {
+        size_t at = 0;
+        for (const std::string_view span : document.getSpans(0, document.getLength())) {
+            if (text.compare(at, span.size(), span) != 0) {
+                return false;
+            }
+            at += span.size();
+        }
+        return at == text.size();
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100;
+    const double target = argc > 2 ? atof(argv[2]) : 250;
+    const int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    if (megabytes == 0 || target <= 0 || rounds < 1) {
+        fprintf(stderr, "Usage: rehydrate-bench [megabytes] [target-ms] [rounds]\n");
+        return 2;
+    }
+
+    const std::string text = makeLog(megabytes * 1024 * 1024);
+    DocumentText document(nullptr);
+    loadText(document, text);
+
+    printf("%zu MB log, %zu lines, %zu threads in the pool\n\n", text.size() >> 20, document.lineStarts.size(),
+        TaskScheduler::shared().getThreadCount());
+    printf("%6s %12s %12s %12s %12s\n", "round", "compress", "ratio", "swap in", "rehydrate");
+    std::vector<double> rehydrations;
+    for (int round = 1; round <= rounds; ++round) {
+        auto start = Clock::now();
+        CompressedText compressed = CompressedText::compress(document.snapshot());
+        const double compressTime = millisecondsSince(start);
+        const double ratio = static_cast<double>(compressed.getLength()) / static_cast<double>(compressed.getCompressedSize());
+
+        start = Clock::now();
+        if (!document.dehydrate(std::move(compressed))) {
+            fprintf(stderr, "round %d: the document would not take its compressed text\n", round);
+            return 1;
+        }
+        const double swapTime = millisecondsSince(start);
+
+        start = Clock::now();
+        document.rehydrate();
+        rehydrations.push_back(millisecondsSince(start));
+        printf("%6d %9.1f ms %11.2fx %9.2f ms %9.1f ms\n", round, compressTime, ratio, swapTime, rehydrations.back());
+
+        if (!matches(document, text)) {
+            fprintf(stderr, "round %d: the rehydrated text differs from the original\n", round);
+            return 1;
+        }
+    }
+
+    // Tabs of the smallest size worth dehydrating, each taking twice that
+    // with its view, so that together they take twice the budget
+    {
+        const std::string tabText(DehydrationPolicy::MIN_TAB_SIZE, 'x');
+        std::vector<std::unique_ptr<DocumentText>> documents;
+        std::vector<DehydrationPolicy::Tab> tabs;
+        DehydrationPolicy policy(POLICY_TABS * DehydrationPolicy::MIN_TAB_SIZE);
+        for (size_t i = 0; i < POLICY_TABS; ++i) {
+            documents.push_back(std::make_unique<DocumentText>(nullptr));
+            loadText(*documents.back(), tabText);
+            tabs.push_back({ documents.back().get(), 2 * DehydrationPolicy::MIN_TAB_SIZE, true });
+            policy.touch(documents.back().get());
+        }
+        const auto start = Clock::now();
+        const size_t chosen = policy.select(tabs, documents.front().get(), false).size();
+        printf("\npolicy: %zu of %zu tabs chosen in %.3f ms\n", chosen, POLICY_TABS, millisecondsSince(start));
+    }
+
+    std::sort(rehydrations.begin(), rehydrations.end());
+    const double slowest = rehydrations.back();
+    printf("rehydration: fastest %.1f ms, median %.1f ms, slowest %.1f ms (%.0f MB/s); target %.0f ms: %s\n",
+        rehydrations.front(), rehydrations[rehydrations.size() / 2], slowest,
+        static_cast<double>(text.size()) / (1024 * 1024) / (slowest / 1000), target, slowest <= target ? "met" : "missed");
+    return slowest <= target ? 0 : 1;
+}
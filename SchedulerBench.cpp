@@ -0,0 +1,144 @@
+// Times the task pool's parallel work on pools of 1 to N threads, without a
+// window:
+//
+//   scheduler-bench [megabytes] [threads]
+//
+// Two workloads over a snapshot of a generated file, split into PART_SIZE
+// parts that run as the tasks of one group: indexing, which finds every
+// line start the way a load does, and search, which finds every match of a
+// word. Each is timed on pools of every size from one thread to the given
+// count (by default one per core), best of ROUNDS, and printed with its
+// speedup over one thread. A pool larger than the machine has cores shows
+// what oversubscription costs rather than how the work scales.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "BenchSupport.h"
+#include "TaskScheduler.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t PART_SIZE = 1024 * 1024;
+    constexpr int ROUNDS = 3;
+    constexpr std::string_view NEEDLE = "scheduler";
+
+    std::string makeText(size_t bytes) {
+        std::mt19937 random(1);
+        std::string text;
+        text.reserve(bytes + 128);
+        while (text.size() < bytes) {
+            text += "2024-05-01 12:00:0" + std::to_string(random() % 10) + " worker " + std::to_string(random() % 64);
+            text += random() % 50 == 0 ? " scheduler stalled for " : " finished task ";
+            text += std::to_string(random()) + "\n";
+        }
+        return text;
+    }
+
+    // The part's bytes; search parts run on into the next by the needle's
+    // length less one, so a match across the boundary is found once
+    std::string readPart(const DocumentSnapshot& snapshot, size_t part, size_t overlap) {
+        std::string text;
+        for (const std::string_view span : snapshot.getSpans(part * PART_SIZE, PART_SIZE + overlap)) {
+            text.append(span);
+        }
+        return text;
+    }
+
+    size_t countLines(const DocumentSnapshot& snapshot, size_t part, std::vector<size_t>& starts) {
+        size_t offset = part * PART_SIZE;
+        for (const std::string_view span : snapshot.getSpans(offset, PART_SIZE)) {
+            const char* end = span.data() + span.size();
+            for (const char* p = span.data(); (p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr; ++p) {
+                starts.push_back(offset + (p - span.data()) + 1);
+            }
+            offset += span.size();
+        }
+        return starts.size();
+    }
+
+    size_t countMatches(const DocumentSnapshot& snapshot, size_t part) {
+        const std::string text = readPart(snapshot, part, NEEDLE.size() - 1);
+        const std::string_view view(text);
+        size_t matches = 0;
+        for (size_t at = view.find(NEEDLE); at != std::string_view::npos; at = view.find(NEEDLE, at + 1)) {
+            ++matches;
+        }
+        return matches;
+    }
+
+    // Best of ROUNDS; work runs one part and returns what it found there
+    template <typename Work>
+    double timeParts(TaskScheduler& pool, size_t parts, Work work, size_t& found) {
+        double best = 0;
+        for (int round = 0; round < ROUNDS; ++round) {
+            std::vector<size_t> results(parts);
+            const auto start = Clock::now();
+            {
+                TaskGroup tasks(pool);
+                for (size_t part = 0; part < parts; ++part) {
+                    tasks.run([&, part] { results[part] = work(part); });
+                }
+                tasks.wait();
+            }
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            best = round == 0 ? ms : std::min(best, ms);
+            found = 0;
+            for (const size_t result : results) {
+                found += result;
+            }
+        }
+        return best;
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    const size_t maxThreads = argc > 2 ? strtoull(argv[2], nullptr, 10) : cores;
+    if (megabytes == 0 || maxThreads == 0) {
+        fprintf(stderr, "Usage: scheduler-bench [megabytes] [threads]\n");
+        return 2;
+    }
+
+    const std::string text = makeText(megabytes * 1024 * 1024);
+    DocumentText document(nullptr);
+    loadText(document, text);
+    const DocumentSnapshot snapshot = document.snapshot();
+    const size_t parts = (snapshot.getLength() + PART_SIZE - 1) / PART_SIZE;
+
+    printf("%zu MB in %zu parts of %zu KB, %zu cores\n", megabytes, parts, PART_SIZE / 1024, cores);
+    if (maxThreads > cores) {
+        printf("pools past %zu threads are oversubscribed: they show the cost of that, not scaling\n", cores);
+    }
+    printf("\n%8s %12s %8s %12s %8s\n", "threads", "index", "speedup", "search", "speedup");
+    double indexOne = 0;
+    double searchOne = 0;
+    size_t lines = 0;
+    size_t matches = 0;
+    for (size_t threads = 1; threads <= maxThreads; ++threads) {
+        TaskScheduler pool(threads);
+        const double index = timeParts(pool, parts, [&](size_t part) {
+            std::vector<size_t> starts;
+            return countLines(snapshot, part, starts);
+        }, lines);
+        const double search = timeParts(pool, parts, [&](size_t part) { return countMatches(snapshot, part); }, matches);
+        if (threads == 1) {
+            indexOne = index;
+            searchOne = search;
+        }
+        printf("%8zu %9.1f ms %7.2fx %9.1f ms %7.2fx\n", threads, index, indexOne / index, search, searchOne / search);
+    }
+    printf("\n%zu line breaks, %zu matches of \"%.*s\"\n", lines, matches, static_cast<int>(NEEDLE.size()), NEEDLE.data());
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Times snapshots of a document taken while it is typed into, without a
+// window:
+//
+//   snapshot-bench [keystrokes] [every]
+//
+// Types into a generated file twice: once alone, and once taking a snapshot
+// every few keystrokes, as the highlighter and the search do after an edit.
+// The snapshots go to a reader thread that reads the lines around the
+// typing from the newest and keeps the last HELD it read, so edits keep
+// meeting blocks a snapshot still shares; the oldest is dropped as each new
+// one arrives, and any it had no time to read are dropped unread. Prints
+// the keystrokes' latency both ways, what taking and dropping a snapshot
+// cost, and the text memory at its peak and once the last snapshot is gone.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "BenchSupport.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr size_t HELD = 8;
+    constexpr size_t READ_BYTES = 64 * 1024;
+
+    uint64_t nanosecondsSince(Clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    }
+
+    // Reads the snapshots it is given on a thread of its own and times
+    // dropping them
+    class Reader {
+    public:
+        Reader() : thread(&Reader::run, this) {}
+
+        ~Reader() {
+            finish();
+        }
+
+        // Drops the snapshots still held and stops
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+        void give(DocumentSnapshot snapshot, size_t position) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                incoming.push_back({ std::move(snapshot), position });
+            }
+            wake.notify_one();
+        }
+
+        // Read once finished
+        LatencyHistogram released;
+        uint64_t checksum = 0;
+
+    private:
+        struct Item {
+            DocumentSnapshot snapshot;
+            size_t position;
+        };
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<Item> incoming;
+        bool stopping = false;
+        std::thread thread;
+
+        void drop(DocumentSnapshot&& snapshot) {
+            const auto before = Clock::now();
+            {
+                const DocumentSnapshot gone(std::move(snapshot));
+            }
+            released.record(nanosecondsSince(before));
+        }
+
+        // Reads only the newest of the snapshots waiting, as the highlighter
+        // does when it falls behind, and drops the others unread
+        void run() {
+            std::deque<DocumentSnapshot> held;
+            for (;;) {
+                std::deque<Item> waiting;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !incoming.empty(); });
+                    if (incoming.empty()) {
+                        break;
+                    }
+                    waiting.swap(incoming);
+                }
+                Item item = std::move(waiting.back());
+                waiting.pop_back();
+                for (Item& skipped : waiting) {
+                    drop(std::move(skipped.snapshot));
+                }
+                const size_t start = item.position - std::min(item.position, READ_BYTES / 2);
+                for (const std::string_view span : item.snapshot.getSpans(start, READ_BYTES)) {
+                    for (const char c : span) {
+                        checksum += static_cast<unsigned char>(c);
+                    }
+                }
+                held.push_back(std::move(item.snapshot));
+                if (held.size() > HELD) {
+                    drop(std::move(held.front()));
+                    held.pop_front();
+                }
+            }
+            for (DocumentSnapshot& snapshot : held) {
+                drop(std::move(snapshot));
+            }
+        }
+    };
+
+    // Typing at a cursor that jumps elsewhere now and then, with a
+    // Backspace every so often; a snapshot every `every` keystrokes if
+    // there is a reader
+    void type(DocumentText& document, size_t keystrokes, size_t every, Reader* reader, LatencyHistogram& typed,
+        LatencyHistogram& taken, size_t& peakReserved) {
+        std::mt19937 random(1);
+        const char keys[] = "abcdefghijklmnopqrstuvwxyz (){};=+\n";
+        const std::shared_ptr<MemoryAccount>& account = document.getMemoryAccount();
+        size_t cursor = document.getLength() / 2;
+        for (size_t i = 0; i < keystrokes; ++i) {
+            if (random() % 500 == 0) {
+                cursor = random() % (document.getLength() + 1);
+            }
+            const auto before = Clock::now();
+            if (i % 16 == 15 && cursor > 0) {
+                document.deleteText(cursor - 1, cursor);
+                --cursor;
+            }
+            else {
+                document.insertText(&keys[random() % (sizeof(keys) - 1)], 1, cursor);
+                ++cursor;
+            }
+            typed.record(nanosecondsSince(before));
+
+            if (reader != nullptr && i % every == every - 1) {
+                const auto start = Clock::now();
+                DocumentSnapshot snapshot = document.snapshot();
+                taken.record(nanosecondsSince(start));
+                reader->give(std::move(snapshot), cursor);
+            }
+            peakReserved = std::max(peakReserved, account->getReserved(MemoryTag::Text));
+        }
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t keystrokes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    const size_t every = argc > 2 ? strtoull(argv[2], nullptr, 10) : 16;
+    if (keystrokes == 0 || every == 0) {
+        fprintf(stderr, "Usage: snapshot-bench [keystrokes] [every]\n");
+        return 2;
+    }
+    const std::string text = makeCodeText(200000);
+
+    LatencyHistogram alone;
+    LatencyHistogram unused;
+    size_t aloneReserved = 0;
+    {
+        DocumentText document(nullptr);
+        loadText(document, text);
+        type(document, keystrokes, every, nullptr, alone, unused, aloneReserved);
+    }
+
+    LatencyHistogram typed;
+    LatencyHistogram taken;
+    size_t peakReserved = 0;
+    DocumentText document(nullptr);
+    loadText(document, text);
+    Reader reader;
+    type(document, keystrokes, every, &reader, typed, taken, peakReserved);
+    reader.finish();
+    const size_t settledReserved = document.getMemoryAccount()->getReserved(MemoryTag::Text);
+    size_t blocks = 0;
+    for (const std::string_view span : document.getSpans(0, document.getLength())) {
+        blocks += !span.empty();
+    }
+
+    printf("%zu keystrokes into %zu KB, a snapshot every %zu, the last %zu held\n\n", keystrokes, text.size() / 1024,
+        every, HELD);
+    printLatencyHeader();
+    printLatency("keystroke, no snapshots", alone);
+    printLatency("keystroke, snapshots", typed);
+    printLatency("take a snapshot", taken);
+    printLatency("drop a snapshot", reader.released);
+    printf("\ntext memory: %zu KB at most without snapshots, %zu KB with them, %zu KB once they are gone; %zu blocks\n",
+        aloneReserved / 1024, peakReserved / 1024, settledReserved / 1024, blocks);
+    return reader.checksum == 0 ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded queue between exactly one producer thread and one consumer thread,
+// without locks. Each side writes only its own index and keeps a cached copy
+// of the other's, so it touches the other side's cache line only when the
+// queue looks full or empty.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer only. Leaves value alone and returns false when full.
+    bool push(T&& value) {
+        const size_t position = tail.load(std::memory_order_relaxed);
+        if (position - cachedHead == Capacity) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (position - cachedHead == Capacity) {
+                return false;
+            }
+        }
+        slots[position & (Capacity - 1)] = std::move(value);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false when empty.
+    bool pop(T& value) {
+        const size_t position = head.load(std::memory_order_relaxed);
+        if (position == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (position == cachedTail) {
+                return false;
+            }
+        }
+        value = std::move(slots[position & (Capacity - 1)]);
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; only a hint while the other side is running
+    [[nodiscard]] bool empty() const {
+        return head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_seq_cst);
+    }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    // Consumer side
+    alignas(CACHE_LINE) std::atomic<size_t> head{ 0 };
+    size_t cachedTail = 0;
+    // Producer side
+    alignas(CACHE_LINE) std::atomic<size_t> tail{ 0 };
+    size_t cachedHead = 0;
+
+    alignas(CACHE_LINE) std::unique_ptr<T[]> slots = std::make_unique<T[]>(Capacity);
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Profiler.h"
+#include "SyntaxHighlighter.h"
+
+namespace {
+    // Reads a snapshot a line at a time from a line start onwards
+    class LineReader {
+    public:
+        LineReader(const DocumentSnapshot& snapshot, size_t position)
+            : spans(snapshot.getSpans(position, snapshot.getLength() - std::min(position, snapshot.getLength()))),
+              position(position) {}
+
+        // The next line without its line break; false past the last line
+        bool next(std::string_view& line) {
+            if (finished) {
+                return false;
+            }
+            joined.clear();
+            bool pieces = false;
+            while (part < spans.count()) {
+                const std::string_view rest = spans[part].substr(offset);
+                const void* found = memchr(rest.data(), '\n', rest.size());
+                const size_t length = found ? static_cast<const char*>(found) - rest.data() : rest.size();
+                if (found == nullptr) {
+                    // The line goes on in the next part
+                    joined.append(rest);
+                    pieces = true;
+                    position += rest.size();
+                    ++part;
+                    offset = 0;
+                    continue;
+                }
+                position += length + 1;
+                offset += length + 1;
+                if (pieces) {
+                    joined.append(rest.substr(0, length));
+                    line = joined;
+                }
+                else {
+                    line = rest.substr(0, length);
+                }
+                return true;
+            }
+            // The last line has no line break
+            finished = true;
+            line = joined;
+            return true;
+        }
+
+        void skip(size_t lines) {
+            std::string_view line;
+            for (size_t i = 0; i < lines && next(line); ++i) {}
+        }
+
+        [[nodiscard]] size_t getPosition() const { return position; }
+
+    private:
+        TextSpans spans;
+        size_t part = 0;
+        size_t offset = 0;
+        size_t position;
+        std::string joined;
+        bool finished = false;
+    };
+}
+
+
+SyntaxHighlighter::SyntaxHighlighter(DocumentText& document, const Grammar& grammar, ReadyCallback onReady)
+    : document(document), grammar(grammar), onReady(std::move(onReady)) {
+    // Nothing is lexed yet, so every line counts as changed
+    lines.assign(document.lineStarts.size(), CHANGED);
+    changedLines = lines.size();
+    listener = document.addEditListener({
+        [this](size_t position, const char* text, size_t len) { onInserted(position, text, len); },
+        [this](size_t start, size_t) { onDeleted(start); } });
+}
+
+SyntaxHighlighter::~SyntaxHighlighter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    tasks.wait();
+    document.removeEditListener(listener);
+}
+
+void SyntaxHighlighter::update(size_t firstVisible, size_t lastVisible) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Text appended from the file is not an edit, so it is caught up here
+    if (lines.size() != document.lineStarts.size()) {
+        resize(document.lineStarts.size());
+        ++edits;
+    }
+    visibleEnd = std::min(std::max(firstVisible, lastVisible) + 1, lines.size());
+    if (stopping || staleLine >= lines.size() || (lexing && chain == edits)) {
+        return; // done, or the lexing under way reads the new visible lines as it goes
+    }
+    lexing = true;
+    chain = edits;
+    submit(document.snapshot(), staleLine, document.lineStarts[staleLine], edits);
+}
+
+bool SyntaxHighlighter::getTokens(size_t line, std::string_view text, std::vector<Token>& tokens) const {
+    tokens.clear();
+    LexState state;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (line >= lines.size() || line > staleLine) {
+            return false;
+        }
+        state = lines[line] & ~CHANGED;
+    }
+    grammar.lexLine(text, state, &tokens);
+    return true;
+}
+
+bool SyntaxHighlighter::isComplete() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return staleLine >= lines.size();
+}
+
+size_t SyntaxHighlighter::getStaleLine() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return staleLine;
+}
+
+const Grammar& SyntaxHighlighter::getGrammar() const {
+    return grammar;
+}
+
+void SyntaxHighlighter::onInserted(size_t position, const char* text, size_t len) {
+    // The line the text went into changed, and the lines it added follow it
+    const size_t line = document.lineStarts.lineOf(position);
+    const size_t added = std::count(text, text + len, '\n');
+    std::lock_guard<std::mutex> lock(mutex);
+    if (line >= lines.size()) {
+        resize(document.lineStarts.size());
+    }
+    else {
+        lines.insert(lines.begin() + static_cast<ptrdiff_t>(line + 1), added, CHANGED);
+        changedLines += added;
+        markChanged(line);
+    }
+    ++edits;
+}
+
+void SyntaxHighlighter::onDeleted(size_t start) {
+    // The text is gone by now, so the lines it took are told by the count
+    const size_t line = document.lineStarts.lineOf(start);
+    const size_t count = document.lineStarts.size();
+    std::lock_guard<std::mutex> lock(mutex);
+    const size_t removed = lines.size() > count ? lines.size() - count : 0;
+    const auto first = lines.begin() + static_cast<ptrdiff_t>(std::min(line + 1, lines.size()));
+    const auto last = first + static_cast<ptrdiff_t>(std::min<size_t>(removed, lines.end() - first));
+    changedLines -= std::count_if(first, last, [](LexState entry) { return (entry & CHANGED) != 0; });
+    lines.erase(first, last);
+    if (lines.size() != count) {
+        resize(count);
+    }
+    if (line < lines.size()) {
+        markChanged(line);
+    }
+    ++edits;
+}
+
+void SyntaxHighlighter::markChanged(size_t line) {
+    if ((lines[line] & CHANGED) == 0) {
+        lines[line] |= CHANGED;
+        ++changedLines;
+    }
+    staleLine = std::min(staleLine, line);
+}
+
+void SyntaxHighlighter::resize(size_t count) {
+    // Lines come and go at the end; the last one left has changed too
+    for (size_t line = count; line < lines.size(); ++line) {
+        changedLines -= (lines[line] & CHANGED) != 0;
+    }
+    const size_t kept = std::min(count, lines.size());
+    lines.resize(count, CHANGED);
+    changedLines += count - kept;
+    if (kept > 0) {
+        markChanged(kept - 1);
+    }
+    staleLine = std::min(staleLine, count);
+}
+
+void SyntaxHighlighter::submit(DocumentSnapshot snapshot, size_t line, size_t position, uint64_t forEdits) {
+    // Lines on screen go first; the same worker takes every chunk
+    tasks.run([this, snapshot = std::move(snapshot), line, position, forEdits]() mutable {
+        lexChunk(std::move(snapshot), line, position, forEdits);
+    }, line < visibleEnd ? TaskPriority::Visible : TaskPriority::Idle, {}, this);
+}
+
+void SyntaxHighlighter::lexChunk(DocumentSnapshot snapshot, size_t line, size_t position, uint64_t forEdits) {
+    PROFILE_SCOPE("SyntaxHighlighter::lexChunk");
+    // The entries after the chunk's lines as they were, to tell where
+    // lexing meets them again
+    LexState state;
+    size_t chunk;
+    std::vector<LexState> following;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || forEdits != edits) {
+            if (chain == forEdits) {
+                lexing = false;
+            }
+            return;
+        }
+        state = lines[line] & ~CHANGED;
+        // A chunk short of the lines on screen stops at their end, so they
+        // are ready as soon as can be
+        chunk = line < visibleEnd ? std::min(visibleEnd - line, CHUNK_LINES) : CHUNK_LINES;
+        const size_t end = std::min(line + chunk, lines.size() - 1);
+        following.assign(lines.begin() + static_cast<ptrdiff_t>(line + 1), lines.begin() + static_cast<ptrdiff_t>(end + 1));
+    }
+
+    LineReader reader(snapshot, position);
+    std::vector<LexState> lexed;
+    lexed.reserve(std::min(following.size() + 1, chunk));
+    bool converged = false;
+    std::string_view text;
+    while (lexed.size() < chunk && reader.next(text)) {
+        state = grammar.lexLine(text, state, nullptr);
+        lexed.push_back(state);
+        if (lexed.size() > following.size()) {
+            break; // the last line
+        }
+        const LexState next = following[lexed.size() - 1];
+        if ((next & CHANGED) == 0 && next == state) {
+            converged = true;
+            break;
+        }
+    }
+    PROFILE_COUNT("lines lexed", lexed.size());
+
+    size_t nextLine;
+    bool ready;
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || forEdits != edits) {
+            if (chain == forEdits) {
+                lexing = false;
+            }
+            return;
+        }
+        const bool wasReady = staleLine >= visibleEnd;
+        for (size_t i = 0; i < lexed.size(); ++i) {
+            LexState& entry = lines[line + i];
+            if ((entry & CHANGED) != 0) {
+                entry &= ~CHANGED;
+                --changedLines;
+            }
+            if (line + i + 1 < lines.size()) {
+                lines[line + i + 1] = lexed[i] | (lines[line + i + 1] & CHANGED);
+            }
+        }
+        nextLine = line + lexed.size();
+        if (converged) {
+            // Every line up to the next changed one lexes as it did before
+            if (changedLines == 0) {
+                nextLine = lines.size();
+            }
+            else {
+                while (nextLine < lines.size() && (lines[nextLine] & CHANGED) == 0) {
+                    ++nextLine;
+                }
+            }
+        }
+        staleLine = nextLine;
+        done = staleLine >= lines.size();
+        ready = (!wasReady && staleLine >= visibleEnd) || done;
+        if (done) {
+            lexing = false;
+        }
+    }
+    if (ready && onReady) {
+        onReady();
+    }
+    if (done) {
+        return;
+    }
+
+    // On with the next chunk, past any lines that did not need lexing
+    reader.skip(nextLine - line - lexed.size());
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!stopping && forEdits == edits) {
+        submit(std::move(snapshot), nextLine, reader.getPosition(), forEdits);
+    }
+    else if (chain == forEdits) {
+        lexing = false;
+    }
+}
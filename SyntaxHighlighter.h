@@ -0,0 +1,86 @@
+#ifndef SYNTAXHIGHLIGHTER_H
+#define SYNTAXHIGHLIGHTER_H
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "DocumentText.h"
+#include "Grammar.h"
+#include "TaskScheduler.h"
+
+// Highlights a document with a grammar without lexing it all again after
+// each edit. It keeps the lexer state each line starts in, and only tokens
+// of the lines being painted are made, from their line's state.
+//
+// An edit marks the lines it touched as changed. Lexing starts again at
+// the first stale line and goes on until a line ends in the state the next
+// line already had, with that line unchanged: from there on every line lexes
+// as before, so it skips to the next changed line, if any. Typing inside a
+// line usually re-lexes just that line; opening a block comment re-lexes up
+// to wherever the comment now ends.
+//
+// Lexing runs on the shared pool from a snapshot, a chunk of lines per task,
+// and its results are dropped if the document was edited meanwhile. Chunks
+// up to the end of the lines on screen run as visible work and the rest of
+// the file as idle work.
+class SyntaxHighlighter {
+public:
+    static constexpr size_t CHUNK_LINES = 4096;
+
+    // Called on a pool thread once the lines on screen can all be painted
+    using ReadyCallback = std::function<void()>;
+
+    // The document's line count is taken now, so it is made on the thread
+    // that owns the document with nothing editing it; so is update(). The
+    // edit listener it adds runs on whichever thread edits.
+    SyntaxHighlighter(DocumentText& document, const Grammar& grammar, ReadyCallback onReady);
+    // Waits for lexing under way
+    ~SyntaxHighlighter();
+
+    SyntaxHighlighter(const SyntaxHighlighter&) = delete;
+    SyntaxHighlighter& operator=(const SyntaxHighlighter&) = delete;
+
+    // The lines on screen, inclusive; lexes whatever is stale
+    void update(size_t firstVisible, size_t lastVisible);
+    // Tokens for a line, given its text from its start; as much of it as is
+    // painted will do. False while the state the line starts in is stale.
+    bool getTokens(size_t line, std::string_view text, std::vector<Token>& tokens) const;
+    [[nodiscard]] bool isComplete() const;
+    // Lines up to this one start in a known state
+    [[nodiscard]] size_t getStaleLine() const;
+    [[nodiscard]] const Grammar& getGrammar() const;
+
+private:
+    // A line's entry is the state it starts in, flagged while the line has
+    // changed since it was last lexed
+    static constexpr LexState CHANGED = 0x80000000u;
+
+    DocumentText& document;
+    const Grammar& grammar;
+    ReadyCallback onReady;
+    size_t listener;
+
+    mutable std::mutex mutex;
+    std::vector<LexState> lines;
+    size_t changedLines = 0;
+    size_t staleLine = 0;  // the first line not known to start in the right state
+    size_t visibleEnd = 0; // one past the last line on screen
+    uint64_t edits = 0;    // counts edits, so lexing can tell its snapshot is out of date
+    uint64_t chain = 0;    // lexing under way for this count of edits, if any
+    bool lexing = false;
+    bool stopping = false;
+    TaskGroup tasks;
+
+    void onInserted(size_t position, const char* text, size_t len);
+    void onDeleted(size_t start);
+    // Caller holds the mutex
+    void markChanged(size_t line);
+    void resize(size_t count);
+    void lexChunk(DocumentSnapshot snapshot, size_t line, size_t position, uint64_t forEdits);
+    void submit(DocumentSnapshot snapshot, size_t line, size_t position, uint64_t forEdits);
+};
+
+#endif // SYNTAXHIGHLIGHTER_H
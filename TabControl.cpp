@@ -32,42 +32,25 @@
 
     }
 
-    void TabControl::addTab(const std::wstring& title, HWND content, const std::wstring& filePath) {
+    void TabControl::setContent(HWND content) {
+        this->content = content;
+        placeContent();
+    }
+
+    void TabControl::addTab(const std::wstring& title) {
         TCITEM tie;
         tie.mask = TCIF_TEXT;
         tie.pszText = const_cast<wchar_t*>(title.c_str());
         TabCtrl_InsertItem(hTabControl, TabCtrl_GetItemCount(hTabControl), &tie);
-        tabContents.push_back(content);
-        filePaths.push_back(filePath);
-
-        // Get the display area of the tab control
-        RECT rcDisplay;
-        GetClientRect(hTabControl, &rcDisplay);
-        TabCtrl_AdjustRect(hTabControl, FALSE, &rcDisplay);
-
-        // Set the position and size of the new content window
-        SetWindowPos(content, nullptr,
-            rcDisplay.left, rcDisplay.top,
-            rcDisplay.right - rcDisplay.left,
-            rcDisplay.bottom - rcDisplay.top,
-            SWP_NOZORDER);
-
-        if (tabContents.size() == 1) {
-            ShowWindow(content, SW_SHOW);
-        }
-        else {
-            ShowWindow(content, SW_HIDE);
-        }
-
         InvalidateRect(hTabControl, nullptr, TRUE);
     }
     void TabControl::removeTab(int index) {
-        if (index >= 0 && index < tabContents.size()) {
-            // Remove the tab and associated window
+        if (index >= 0 && index < getTabCount()) {
+            if (onTabClosing) {
+                onTabClosing(index);
+            }
+            // Remove the tab; the content window stays for the others
             TabCtrl_DeleteItem(hTabControl, index);
-            DestroyWindow(tabContents[index]);
-            tabContents.erase(tabContents.begin() + index);
-            filePaths.erase(filePaths.begin() + index);
 
             // Notify the TextEditor class to handle document removal
             if (onTabRemoved) {
@@ -75,7 +58,7 @@
             }
 
             // Ensure a valid tab is selected if any remain
-            int tabCount = tabContents.size();
+            int tabCount = getTabCount();
             if (tabCount > 0) {
                 if (index >= tabCount) {
                     setCurrentTab(tabCount - 1);  // Select the last tab
@@ -95,17 +78,17 @@
     }
 
     void TabControl::setCurrentTab(int index) const {
-        if (index >= 0 && index < tabContents.size()) {
+        if (index >= 0 && index < getTabCount()) {
             TabCtrl_SetCurSel(hTabControl, index);
-            showTabContent(index);
         }
+        showTabContent(index);
         if (onTabChanged) {
             onTabChanged(index);
         }
     }
 
     int TabControl::getTabCount() const {
-        return tabContents.size();
+        return TabCtrl_GetItemCount(hTabControl);
     }
 
     HWND TabControl::getTabControlHandle() const {
@@ -113,30 +96,7 @@
     }
 
     HWND TabControl::getCurrentEditControl() const {
-        int currentIndex = TabCtrl_GetCurSel(hTabControl);
-        if (currentIndex >= 0 && currentIndex < tabContents.size()) {
-            return tabContents[currentIndex];
-        }
-        return nullptr;
-    }
-
-    void TabControl::setCurrentFilePath(const std::wstring& path) {
-        int currentIndex = getCurrentTabIndex();
-        if (currentIndex >= 0 && currentIndex < filePaths.size()) {
-            filePaths[currentIndex] = path;
-        }
-    }
-
-    std::vector<std::wstring>& TabControl::getFilePaths() {
-        return filePaths;
-    }
-
-    std::wstring TabControl::getCurrentFilePath() {
-        int index = getCurrentTabIndex();
-        if (index >= 0 && index < filePaths.size()) {
-            return filePaths[index];
-        }
-        return L"";
+        return content;
     }
 
     void TabControl::changeTabName(const std::wstring& filePath) const {
@@ -151,24 +111,25 @@
             // Resize the tab control itself
             SetWindowPos(hTabControl, nullptr, 0, 0, width, height, SWP_NOMOVE | SWP_NOZORDER);
 
-            // Get the rectangle for the tab control
-            RECT rcTabControl;
-            GetClientRect(hTabControl, &rcTabControl);
-
-            // Adjust the rectangle to exclude the tab headers
-            RECT rcDisplay = rcTabControl;
-            TabCtrl_AdjustRect(hTabControl, FALSE, &rcDisplay);
-
-            // Resize and reposition all tab contents
-            for (HWND hContent : tabContents) {
-                SetWindowPos(hContent, nullptr,
-                    rcDisplay.left, rcDisplay.top,
-                    rcDisplay.right - rcDisplay.left,
-                    rcDisplay.bottom - rcDisplay.top,
-                    SWP_NOZORDER);
-            }
+            // Only the content window is moved, however many tabs there are
+            placeContent();
         }
     }
+
+    void TabControl::placeContent() const {
+        if (content == nullptr) {
+            return;
+        }
+        // Get the display area of the tab control
+        RECT rcDisplay;
+        GetClientRect(hTabControl, &rcDisplay);
+        TabCtrl_AdjustRect(hTabControl, FALSE, &rcDisplay);
+        SetWindowPos(content, nullptr,
+            rcDisplay.left, rcDisplay.top,
+            rcDisplay.right - rcDisplay.left,
+            rcDisplay.bottom - rcDisplay.top,
+            SWP_NOZORDER);
+    }
    
 
 
@@ -200,8 +161,6 @@
 
     HWND hTabControl;
     WNDPROC OldTabProc;
-    std::vector<HWND> tabContents;
-    std::vector<std::wstring> filePaths;
 
     LRESULT CALLBACK TabControl::TabProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
         auto* pThis = reinterpret_cast<TabControl *>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
@@ -281,17 +240,10 @@
     }
 
     void TabControl::showTabContent(int index) const {
-        for (int i = 0; i < tabContents.size(); ++i) {
-            ShowWindow(tabContents[i], i == index ? SW_SHOW : SW_HIDE);
+        // The document in the content window is swapped by onTabChanged
+        if (content != nullptr) {
+            ShowWindow(content, index >= 0 ? SW_SHOW : SW_HIDE);
         }
-        RECT rcDisplay;
-        GetClientRect(hTabControl, &rcDisplay);
-        TabCtrl_AdjustRect(hTabControl, FALSE, &rcDisplay);
-        SetWindowPos(tabContents[index], nullptr,
-            rcDisplay.left, rcDisplay.top,
-            rcDisplay.right - rcDisplay.left,
-            rcDisplay.bottom - rcDisplay.top,
-            SWP_NOZORDER);
     }
 
     LRESULT TabControl::OnPaint(HWND hWnd) const {
@@ -13,31 +13,32 @@ class TabControl {
 public:
     explicit TabControl(HWND parentWindow);
 
-    void addTab(const std::wstring& title, HWND content, const std::wstring& filePath = L"");
+    // The one window shown below whichever tab is selected
+    void setContent(HWND content);
+    void addTab(const std::wstring& title);
     void removeTab(int index);
     [[nodiscard]] int getCurrentTabIndex() const;
     void setCurrentTab(int index) const;
     [[nodiscard]] int getTabCount() const;
     [[nodiscard]] HWND getTabControlHandle() const;
     [[nodiscard]] HWND getCurrentEditControl() const;
-    void setCurrentFilePath(const std::wstring& path);
-    std::vector<std::wstring>& getFilePaths();
-    std::wstring getCurrentFilePath();
     void changeTabName(const std::wstring& filePath) const;
     void Resize(int width, int height) const;
 
     static void DrawTabWithCloseButton(HDC hdc, const RECT& rect, LPCTSTR text, bool isSelected);
     std::function<void(int)> onTabChanged;
     std::function<void(int)> onTabRemoved;
+    // Called while the tab and its document are still there
+    std::function<void(int)> onTabClosing;
 
 private:
     HWND hTabControl;
     WNDPROC OldTabProc;
-    std::vector<HWND> tabContents;
-    std::vector<std::wstring> filePaths;
+    HWND content = nullptr;
 
     static LRESULT CALLBACK TabProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
     void showTabContent(int index) const;
+    void placeContent() const;
     LRESULT OnPaint(HWND hWnd) const;
 };
 
@@ -0,0 +1,100 @@
+#include <algorithm>
+
+#include "TailFollower.h"
+
+
+namespace {
+    // Length of text without a UTF-8 sequence cut off at its end
+    size_t completeUtf8(const std::string& text) {
+        for (size_t back = 1; back <= 3 && back <= text.size(); ++back) {
+            const auto c = static_cast<unsigned char>(text[text.size() - back]);
+            if ((c & 0xC0) == 0x80) {
+                continue; // continuation byte, the lead is further back
+            }
+            const size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            return length > back ? text.size() - back : text.size();
+        }
+        return text.size();
+    }
+}
+
+TailFollower::TailFollower(std::wstring path) : path(std::move(path)) {}
+
+bool TailFollower::start(uint64_t offset) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    const size_t check = static_cast<size_t>(std::min<uint64_t>(offset, CHECK_BYTES));
+    const bool ok = readAt(hFile, offset - check, check, lastBytes);
+    CloseHandle(hFile);
+    this->offset = offset;
+    fileSize = offset;
+    return ok;
+}
+
+TailState TailFollower::poll(std::string& appended, FileStamp& stamp) {
+    appended.clear();
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return TailState::Unchanged; // rotated away and not created again yet
+    }
+    LARGE_INTEGER size;
+    FILETIME lastWrite;
+    if (!GetFileSizeEx(hFile, &size) || !GetFileTime(hFile, nullptr, nullptr, &lastWrite)) {
+        CloseHandle(hFile);
+        return TailState::Unchanged;
+    }
+    fileSize = static_cast<uint64_t>(size.QuadPart);
+
+    TailState state = TailState::Unchanged;
+    std::string check;
+    if (fileSize < offset || !readAt(hFile, offset - lastBytes.size(), lastBytes.size(), check) || check != lastBytes) {
+        state = TailState::Replaced;
+    }
+    else if (fileSize > offset &&
+        readAt(hFile, offset, static_cast<size_t>(std::min<uint64_t>(fileSize - offset, MAX_READ)), appended)) {
+        appended.resize(completeUtf8(appended));
+        const bool afterCR = !lastBytes.empty() && lastBytes.back() == '\r';
+        const size_t taken = appended.size();
+        offset += taken;
+        lastBytes += appended.substr(appended.size() - std::min(appended.size(), CHECK_BYTES));
+        lastBytes.erase(0, lastBytes.size() - std::min(lastBytes.size(), CHECK_BYTES));
+        if (afterCR && !appended.empty() && appended.front() == '\n') {
+            appended.erase(0, 1);
+        }
+        state = taken > 0 ? TailState::Appended : TailState::Unchanged;
+    }
+    CloseHandle(hFile);
+
+    stamp.size = offset;
+    stamp.lastWrite = (static_cast<uint64_t>(lastWrite.dwHighDateTime) << 32) | lastWrite.dwLowDateTime;
+    return state;
+}
+
+uint64_t TailFollower::getOffset() const {
+    return offset;
+}
+
+bool TailFollower::isBehind() const {
+    return fileSize > offset;
+}
+
+bool TailFollower::readAt(HANDLE hFile, uint64_t position, size_t len, std::string& out) const {
+    out.resize(len);
+    size_t done = 0;
+    while (done < len) {
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(position + done);
+        overlapped.OffsetHigh = static_cast<DWORD>((position + done) >> 32);
+        DWORD got = 0;
+        if (!ReadFile(hFile, out.data() + done, static_cast<DWORD>(len - done), &got, &overlapped) || got == 0) {
+            out.resize(done);
+            return false;
+        }
+        done += got;
+    }
+    return true;
+}
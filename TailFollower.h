@@ -0,0 +1,45 @@
+#ifndef TAILFOLLOWER_H
+#define TAILFOLLOWER_H
+
+#include <Windows.h>
+#include <string>
+
+#include "FileIO.h"
+
+enum class TailState { Unchanged, Appended, Replaced };
+
+// Reads what other programs append to a file, for following a growing log.
+// It remembers how far into the file it has read and the bytes just before
+// that point; a file that shrank or whose remembered bytes changed has been
+// replaced (rotated or rewritten) rather than appended to.
+class TailFollower {
+public:
+    // Larger appends are taken over several calls
+    static constexpr size_t MAX_READ = 16 * 1024 * 1024;
+    static constexpr size_t CHECK_BYTES = 64;
+
+    explicit TailFollower(std::wstring path);
+
+    // Follows from this many bytes into the file, the part already loaded
+    bool start(uint64_t offset);
+
+    // The bytes appended since the last call. A CRLF split between two
+    // calls loses its LF, since the CR already ended the line, and a UTF-8
+    // sequence cut off at the end waits for the rest of it. The stamp is
+    // that of the file up to what has been read.
+    TailState poll(std::string& appended, FileStamp& stamp);
+
+    [[nodiscard]] uint64_t getOffset() const;
+    // More was appended than the last call read
+    [[nodiscard]] bool isBehind() const;
+
+private:
+    std::wstring path;
+    uint64_t offset = 0;
+    uint64_t fileSize = 0;
+    std::string lastBytes;
+
+    bool readAt(HANDLE hFile, uint64_t position, size_t len, std::string& out) const;
+};
+
+#endif // TAILFOLLOWER_H
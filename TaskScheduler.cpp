@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <chrono>
+
+#include "TaskScheduler.h"
+
+namespace {
+    // Which pool, if any, the calling thread works for
+    thread_local const TaskScheduler* currentScheduler = nullptr;
+    thread_local int currentIndex = -1;
+}
+
+
+TaskScheduler::TaskScheduler(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers[i]->thread = std::thread(&TaskScheduler::run, this, static_cast<int>(i));
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::shared() {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+void TaskScheduler::submit(Task task, TaskPriority priority, CancelToken token, const void* affinity) {
+    push(Entry{ std::move(task), std::move(token), nullptr }, priority, affinity);
+}
+
+size_t TaskScheduler::getThreadCount() const {
+    return workers.size();
+}
+
+void TaskScheduler::push(Entry entry, TaskPriority priority, const void* affinity) {
+    const size_t level = static_cast<size_t>(priority);
+    const int target = affinity != nullptr
+        ? static_cast<int>(std::hash<const void*>{}(affinity) % workers.size())
+        : currentWorker();
+    if (target >= 0) {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->queues[level].push_back(std::move(entry));
+    }
+    else {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        sharedQueues[level].push_back(std::move(entry));
+    }
+
+    // Pairs with the sleeper count going up before a worker checks queued,
+    // so either it sees this task or this sees it asleep
+    queued.fetch_add(1);
+    if (sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+}
+
+int TaskScheduler::currentWorker() const {
+    return currentScheduler == this ? currentIndex : -1;
+}
+
+bool TaskScheduler::take(int worker, Entry& entry) {
+    if (queued.load() == 0) {
+        return false;
+    }
+    const size_t count = workers.size();
+    for (size_t level = 0; level < PRIORITIES; ++level) {
+        if (worker >= 0) {
+            Worker& own = *workers[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.queues[level].empty()) {
+                entry = std::move(own.queues[level].back());
+                own.queues[level].pop_back();
+                --queued;
+                return true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            if (!sharedQueues[level].empty()) {
+                entry = std::move(sharedQueues[level].front());
+                sharedQueues[level].pop_front();
+                --queued;
+                return true;
+            }
+        }
+        // Steal the oldest task, the one its owner would get to last
+        const size_t first = worker >= 0 ? static_cast<size_t>(worker) + 1 : 0;
+        for (size_t i = 0; i < count; ++i) {
+            const size_t victim = (first + i) % count;
+            if (static_cast<int>(victim) == worker) {
+                continue;
+            }
+            Worker& other = *workers[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.queues[level].empty()) {
+                entry = std::move(other.queues[level].front());
+                other.queues[level].pop_front();
+                --queued;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::runEntry(Entry& entry) {
+    if (!entry.token.isCancelled()) {
+        entry.task();
+    }
+    // Whatever the task holds goes before its group can see it finished
+    entry.task = nullptr;
+    if (entry.group != nullptr) {
+        entry.group->finishOne();
+    }
+}
+
+bool TaskScheduler::runOne() {
+    const int worker = currentWorker();
+    Entry entry;
+    if (worker < 0 || !take(worker, entry)) {
+        return false;
+    }
+    runEntry(entry);
+    return true;
+}
+
+void TaskScheduler::run(int index) {
+    currentScheduler = this;
+    currentIndex = index;
+    for (;;) {
+        Entry entry;
+        if (take(index, entry)) {
+            runEntry(entry);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (stopping && queued.load() == 0) {
+            return;
+        }
+        ++sleepers;
+        wake.wait(lock, [this] { return queued.load() > 0 || stopping; });
+        --sleepers;
+    }
+}
+
+
+TaskGroup::TaskGroup(TaskScheduler& scheduler)
+    : scheduler(scheduler) {}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(TaskScheduler::Task task, TaskPriority priority, CancelToken token, const void* affinity) {
+    ++pending;
+    scheduler.push(TaskScheduler::Entry{ std::move(task), std::move(token), this }, priority, affinity);
+}
+
+void TaskGroup::wait() {
+    const bool onWorker = scheduler.currentWorker() >= 0;
+    while (pending.load() > 0) {
+        if (scheduler.runOne()) {
+            continue;
+        }
+        // A worker looks for more to run now and then, in case a task it
+        // waits for is stuck behind work queued meanwhile
+        std::unique_lock<std::mutex> lock(mutex);
+        if (onWorker) {
+            finished.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending.load() == 0; });
+        }
+        else {
+            finished.wait(lock, [this] { return pending.load() == 0; });
+        }
+    }
+    // The last task to finish may still be notifying
+    std::lock_guard<std::mutex> lock(mutex);
+}
+
+bool TaskGroup::isFinished() const {
+    return pending.load() == 0;
+}
+
+void TaskGroup::finishOne() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) {
+        finished.notify_all();
+    }
+}
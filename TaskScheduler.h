@@ -0,0 +1,111 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CancelToken.h"
+
+// Visible work (what is on screen) runs before normal work, which runs
+// before idle work, whatever order it was queued in
+enum class TaskPriority : uint8_t { Visible, Normal, Idle };
+
+class TaskGroup;
+
+// One pool of worker threads, one per core, shared by all background work
+// that keeps the CPU busy: indexing, search, saving, compression. Threads
+// that mostly block on a file or an event keep threads of their own.
+//
+// Each worker has a queue per priority. A worker takes the newest task from
+// its own queue, so work a task splits off runs while its data is still in
+// cache, and an idle worker steals the oldest task from another. Tasks
+// queued from outside the pool go to a shared queue, unless they name an
+// affinity (usually their document), which always sends them to the same
+// worker. A task whose token is cancelled by the time its turn comes is
+// dropped without running.
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+
+    // 0 means one thread per core
+    explicit TaskScheduler(size_t threads = 0);
+    // Runs whatever is still queued, then stops the workers
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // The pool the editor uses
+    static TaskScheduler& shared();
+
+    void submit(Task task, TaskPriority priority = TaskPriority::Normal, CancelToken token = {},
+        const void* affinity = nullptr);
+    [[nodiscard]] size_t getThreadCount() const;
+
+private:
+    friend class TaskGroup;
+    static constexpr size_t PRIORITIES = 3;
+
+    struct Entry {
+        Task task;
+        CancelToken token;
+        TaskGroup* group = nullptr;
+    };
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Entry> queues[PRIORITIES];
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex sharedMutex;
+    std::deque<Entry> sharedQueues[PRIORITIES];
+    std::atomic<size_t> queued{ 0 };
+    std::atomic<size_t> sleepers{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void push(Entry entry, TaskPriority priority, const void* affinity);
+    [[nodiscard]] int currentWorker() const;
+    bool take(int worker, Entry& entry);
+    static void runEntry(Entry& entry);
+    bool runOne();
+    void run(int index);
+};
+
+// Tasks that are waited for together. wait() on a worker thread runs other
+// queued tasks meanwhile, so a task may split itself up and wait for the
+// parts without tying up its thread.
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskScheduler& scheduler = TaskScheduler::shared());
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(TaskScheduler::Task task, TaskPriority priority = TaskPriority::Normal, CancelToken token = {},
+        const void* affinity = nullptr);
+    void wait();
+    [[nodiscard]] bool isFinished() const;
+
+private:
+    friend class TaskScheduler;
+    TaskScheduler& scheduler;
+    std::atomic<size_t> pending{ 0 };
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    void finishOne();
+};
+
+#endif // TASKSCHEDULER_H
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "Profiler.h"
+#include "TextBlocks.h"
+
+
+TextBlocks::TextBlocks(std::shared_ptr<MemoryAccount> account)
+    : account(std::move(account)),
+      front(TaggedAllocator<Block, MemoryTag::Text>(this->account.get())),
+      behind(TaggedAllocator<Block, MemoryTag::Text>(this->account.get())) {}
+
+TextBlocks& TextBlocks::operator=(const TextBlocks& other) {
+    // Lists keep the account they were made with, so it has to stay alive
+    if (front.get_allocator().getAccount() == nullptr) {
+        account = other.account;
+    }
+    front = other.front;
+    behind = other.behind;
+    length = other.length;
+    return *this;
+}
+
+TextBlocks& TextBlocks::operator=(TextBlocks&& other) {
+    if (front.get_allocator().getAccount() == nullptr) {
+        account = other.account;
+    }
+    front = std::move(other.front);
+    behind = std::move(other.behind);
+    length = other.length;
+    return *this;
+}
+
+const std::shared_ptr<MemoryAccount>& TextBlocks::getAccount() const {
+    return account;
+}
+
+void TextBlocks::clear() {
+    front.clear();
+    behind.clear();
+    length = 0;
+}
+
+void TextBlocks::adopt(std::shared_ptr<char[]> storage, size_t length) {
+    clear();
+    if (length > 0) {
+        char* data = storage.get();
+        front.push_back(Block{ std::move(storage), data, length, 0, 0 });
+    }
+    this->length = length;
+}
+
+size_t TextBlocks::getLength() const {
+    return length;
+}
+
+size_t TextBlocks::blockCount() const {
+    return front.size() + behind.size();
+}
+
+TextSpans TextBlocks::getSpans(size_t pos, size_t len) const {
+    TextSpans spans;
+    if (pos >= length || len == 0) {
+        return spans;
+    }
+    const size_t end = std::min(pos + len, length);
+
+    // Find the block holding pos the way the line index finds a line, then
+    // walk on from it
+    bool isBehind = !behind.empty() && pos >= startOf(behind.back(), true);
+    size_t index;
+    if (!isBehind) {
+        index = std::upper_bound(front.begin(), front.end(), pos,
+            [](size_t value, const Block& block) { return value < block.anchor; }) - front.begin() - 1;
+    }
+    else {
+        index = std::lower_bound(behind.begin(), behind.end(), length - pos,
+            [](const Block& block, size_t value) { return block.anchor < value; }) - behind.begin();
+    }
+    while (pos < end) {
+        const Block& block = isBehind ? behind[index] : front[index];
+        const size_t offset = pos - startOf(block, isBehind);
+        const size_t take = std::min(block.size - offset, end - pos);
+        spans.push_back(std::string_view(block.data + offset, take));
+        pos += take;
+        if (isBehind) {
+            --index; // stored backwards
+        }
+        else if (++index == front.size()) {
+            isBehind = true;
+            index = behind.size() - 1;
+        }
+    }
+    return spans;
+}
+
+void TextBlocks::insert(size_t position, const char* text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    position = std::min(position, length);
+    moveSplitTo(position);
+
+    // Typing goes into the block it follows when that block is free to change
+    if (!front.empty()) {
+        Block& block = front.back();
+        const size_t offset = position - block.anchor;
+        if (isWritable(block) && block.size + len <= block.capacity) {
+            memmove(block.data + offset + len, block.data + offset, block.size - offset);
+            memcpy(block.data + offset, text, len);
+            block.size += len;
+            length += len;
+            return;
+        }
+        if (offset < block.size) {
+            // The rest of the block goes behind as a view of the same storage
+            behind.push_back(Block{ block.storage, block.data + offset, block.size - offset,
+                block.capacity > offset ? block.capacity - offset : 0, length - position });
+            block.size = offset;
+        }
+    }
+    if (!behind.empty()) {
+        Block& block = behind.back();
+        if (isWritable(block) && block.size + len <= block.capacity) {
+            memmove(block.data + len, block.data, block.size);
+            memcpy(block.data, text, len);
+            block.size += len;
+            block.anchor += len;
+            length += len;
+            return;
+        }
+    }
+
+    Block block = makeBlock(len, position);
+    memcpy(block.data, text, len);
+    front.push_back(std::move(block));
+    length += len;
+    mergeAtSplit();
+}
+
+void TextBlocks::erase(size_t start, size_t end) {
+    end = std::min(end, length);
+    if (start >= end) {
+        return;
+    }
+    moveSplitTo(start);
+
+    if (!front.empty()) {
+        Block& block = front.back();
+        const size_t blockEnd = block.anchor + block.size;
+        if (blockEnd > end) {
+            // Inside one block: closed up in place, or cut into two views
+            const size_t from = start - block.anchor;
+            const size_t to = end - block.anchor;
+            if (isWritable(block)) {
+                memmove(block.data + from, block.data + to, block.size - to);
+                block.size -= to - from;
+                length -= end - start;
+                mergeAtSplit();
+                return;
+            }
+            behind.push_back(Block{ block.storage, block.data + to, block.size - to,
+                block.capacity > to ? block.capacity - to : 0, length - end });
+            block.size = from;
+        }
+        else if (blockEnd > start) {
+            block.size = start - block.anchor;
+        }
+    }
+
+    // Blocks starting inside the range are dropped or lose their front
+    while (!behind.empty() && startOf(behind.back(), true) < end) {
+        Block& block = behind.back();
+        const size_t cut = end - startOf(block, true);
+        if (cut >= block.size) {
+            behind.pop_back();
+            continue;
+        }
+        block.data += cut;
+        block.size -= cut;
+        block.capacity = block.capacity > cut ? block.capacity - cut : 0;
+        block.anchor = length - end;
+        break;
+    }
+    length -= end - start;
+    mergeAtSplit();
+}
+
+bool TextBlocks::isWritable(const Block& block) {
+    // Only the editing thread copies the list, so a storage this block alone
+    // holds cannot be picked up by a snapshot while it is being written
+    if (block.capacity == 0 || block.storage.use_count() != 1) {
+        return false;
+    }
+    // Whatever the last snapshot to let go read comes before the write
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+TextBlocks::Block TextBlocks::makeBlock(size_t size, size_t anchor) const {
+    // Small blocks get room to grow, large ones hold exactly their text
+    const size_t capacity = size <= BLOCK_SIZE ? std::min(BLOCK_SIZE, std::max(size * 2, MIN_CAPACITY)) : 0;
+    PROFILE_COUNT("blocks allocated", 1);
+    PROFILE_COUNT("block bytes allocated", std::max(size, capacity));
+    std::shared_ptr<char[]> storage = allocateShared(account, MemoryTag::Text, std::max(size, capacity));
+    char* data = storage.get();
+    return Block{ std::move(storage), data, size, capacity, anchor };
+}
+
+size_t TextBlocks::startOf(const Block& block, bool isBehind) const {
+    return isBehind ? length - block.anchor : block.anchor;
+}
+
+void TextBlocks::flip(Block& block) const {
+    block.anchor = length - block.anchor;
+}
+
+void TextBlocks::moveSplitTo(size_t position) {
+    // Counted rather than timed: a move is usually quicker than reading the clock
+    // Front ends up with the blocks starting before position
+    while (!front.empty() && front.back().anchor >= position) {
+        Block block = std::move(front.back());
+        front.pop_back();
+        flip(block);
+        behind.push_back(std::move(block));
+        PROFILE_COUNT("blocks moved across the split", 1);
+    }
+    while (!behind.empty() && startOf(behind.back(), true) < position) {
+        Block block = std::move(behind.back());
+        behind.pop_back();
+        flip(block);
+        front.push_back(std::move(block));
+        PROFILE_COUNT("blocks moved across the split", 1);
+    }
+}
+
+void TextBlocks::join(Block& block, const Block& next) const {
+    if (isWritable(block) && block.size + next.size <= block.capacity) {
+        memcpy(block.data + block.size, next.data, next.size);
+        block.size += next.size;
+        return;
+    }
+    Block joined = makeBlock(block.size + next.size, block.anchor);
+    memcpy(joined.data, block.data, block.size);
+    memcpy(joined.data + block.size, next.data, next.size);
+    block = std::move(joined);
+}
+
+void TextBlocks::mergeAtSplit() {
+    // Small blocks on either side of an edit are merged, so edits spread
+    // over a file do not leave it in crumbs
+    auto fits = [](const Block& block, const Block& next) { return block.size + next.size <= BLOCK_SIZE / 2; };
+    if (!front.empty() && !behind.empty() && fits(front.back(), behind.back())) {
+        join(front.back(), behind.back());
+        behind.pop_back();
+    }
+    if (front.size() >= 2 && fits(front[front.size() - 2], front.back())) {
+        join(front[front.size() - 2], front.back());
+        front.pop_back();
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef TEXTBLOCKS_H
+#define TEXTBLOCKS_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "MemoryAccount.h"
+
+// A range of text as the contiguous pieces it is stored in. Iterating it
+// yields the non-empty pieces in order; most ranges are one or two pieces
+// and those are kept without allocating.
+class TextSpans {
+public:
+    void push_back(std::string_view part) {
+        if (partCount == INLINE_PARTS) {
+            moreParts.assign(inlineParts, inlineParts + INLINE_PARTS);
+        }
+        if (partCount >= INLINE_PARTS) {
+            moreParts.push_back(part);
+        }
+        else {
+            inlineParts[partCount] = part;
+        }
+        ++partCount;
+        totalSize += part.size();
+    }
+
+    [[nodiscard]] size_t count() const { return partCount; }
+    [[nodiscard]] const std::string_view& operator[](size_t index) const { return begin()[index]; }
+    [[nodiscard]] const std::string_view* begin() const { return partCount <= INLINE_PARTS ? inlineParts : moreParts.data(); }
+    [[nodiscard]] const std::string_view* end() const { return begin() + partCount; }
+    [[nodiscard]] size_t size() const { return totalSize; }
+
+private:
+    static constexpr size_t INLINE_PARTS = 2;
+
+    std::string_view inlineParts[INLINE_PARTS];
+    std::vector<std::string_view> moreParts;
+    size_t partCount = 0;
+    size_t totalSize = 0;
+};
+
+// Document text as a list of blocks that share their memory. The bytes a
+// block shows are never written while anything else holds its storage, so a
+// copy of the list is a snapshot that any thread can read while editing goes
+// on. An edit writes in place only to a block nothing else holds; otherwise
+// it cuts the block into views of the same storage and puts the new text in
+// a block of its own, copying at most a few small neighbours to merge them.
+// A file's text loaded in one piece, or a large paste, stays one block that
+// edits cut into views without copying it.
+// Like the line index, blocks in front of the last edit hold absolute start
+// positions and blocks behind it positions counted from the end, so an edit
+// only touches the blocks around it.
+// Blocks and the lists of them are charged to the account as text. A copy
+// shares the blocks' charge but not the lists', and text assigned to blocks
+// with an account stays charged to that account.
+class TextBlocks {
+public:
+    // Blocks up to this size are edited in place; neighbours that together
+    // fit in half of it are merged
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    explicit TextBlocks(std::shared_ptr<MemoryAccount> account = nullptr);
+    TextBlocks(const TextBlocks&) = default;
+    TextBlocks(TextBlocks&&) = default;
+    TextBlocks& operator=(const TextBlocks& other);
+    TextBlocks& operator=(TextBlocks&& other);
+
+    [[nodiscard]] const std::shared_ptr<MemoryAccount>& getAccount() const;
+    void clear();
+    // Takes over text already in memory, such as a file just read, as one block
+    void adopt(std::shared_ptr<char[]> storage, size_t length);
+    [[nodiscard]] size_t getLength() const;
+    [[nodiscard]] size_t blockCount() const;
+    [[nodiscard]] TextSpans getSpans(size_t pos, size_t len) const;
+    void insert(size_t position, const char* text, size_t len);
+    void erase(size_t start, size_t end);
+
+private:
+    struct Block {
+        std::shared_ptr<char[]> storage;
+        char* data;      // first byte of the block's text inside storage
+        size_t size;
+        size_t capacity; // bytes from data it may fill while it is storage's only holder, 0 for none
+        size_t anchor;   // start, absolute in front, counted from the end behind
+    };
+
+    using Blocks = std::vector<Block, TaggedAllocator<Block, MemoryTag::Text>>;
+
+    static constexpr size_t MIN_CAPACITY = 256;
+
+    std::shared_ptr<MemoryAccount> account; // first, so it outlives the lists
+    Blocks front;  // ascending
+    Blocks behind; // descending, the block right after the split last
+    size_t length = 0;
+
+    [[nodiscard]] static bool isWritable(const Block& block);
+    [[nodiscard]] Block makeBlock(size_t size, size_t anchor) const;
+    [[nodiscard]] size_t startOf(const Block& block, bool isBehind) const;
+    void flip(Block& block) const;
+    void moveSplitTo(size_t position);
+    void join(Block& block, const Block& next) const;
+    void mergeAtSplit();
+};
+
+#endif // TEXTBLOCKS_H
@@ -11,6 +11,77 @@ constexpr int FILE_MENU_SAVE_ALL = 6;
 
 constexpr int EDIT_MENU_UNDO = 101;
 constexpr int EDIT_MENU_REDO = 102;
+constexpr int EDIT_MENU_FIND = 103;
+constexpr int EDIT_MENU_FIND_NEXT = 104;
+constexpr int EDIT_MENU_MATCH = 105;
+
+constexpr int VIEW_MENU_FOLLOW = 201;
+constexpr int VIEW_MENU_MEMORY = 202;
+constexpr int VIEW_MENU_TRACE = 203;
+constexpr int VIEW_MENU_FOLD = 204;
+constexpr int VIEW_MENU_UNFOLD_ALL = 205;
+
+constexpr UINT_PTR SEARCH_TIMER = 1;
+constexpr UINT_PTR MEMORY_TIMER = 2;
+constexpr UINT MEMORY_CHECK_MS = 5000;
+
+namespace {
+    // Plain text keeps the colour the DC already has
+    COLORREF tokenColor(TokenKind kind, COLORREF text) {
+        switch (kind) {
+        case TokenKind::Keyword:
+        case TokenKind::Literal:
+            return RGB(0, 0, 255);
+        case TokenKind::Type:
+            return RGB(43, 145, 175);
+        case TokenKind::Number:
+            return RGB(9, 134, 88);
+        case TokenKind::String:
+            return RGB(163, 21, 21);
+        case TokenKind::Comment:
+            return RGB(0, 128, 0);
+        case TokenKind::Preprocessor:
+            return RGB(128, 128, 128);
+        case TokenKind::Key:
+            return RGB(4, 81, 165);
+        default:
+            return text;
+        }
+    }
+
+    // Behind every search hit in the view while the find box is open
+    constexpr COLORREF SEARCH_HIT_COLOR = RGB(255, 225, 120);
+
+    // Draws a run of a line of the view starting at the control's character
+    // charIndex. Tabs are left to the control; each piece between them is
+    // drawn where the control reports its first character.
+    void drawPieces(HDC hdc, HWND hWnd, const RECT& clientRect, LRESULT charIndex, int top, const wchar_t* run, int runLen) {
+        for (int piece = 0; piece < runLen;) {
+            int pieceEnd = piece;
+            while (pieceEnd < runLen && run[pieceEnd] != L'\t') {
+                ++pieceEnd;
+            }
+            if (pieceEnd > piece) {
+                const LRESULT at = SendMessage(hWnd, EM_POSFROMCHAR, charIndex + piece, 0);
+                if (at != -1 && static_cast<short>(LOWORD(at)) < clientRect.right) {
+                    ExtTextOutW(hdc, static_cast<short>(LOWORD(at)), top, 0, nullptr, run + piece, pieceEnd - piece, nullptr);
+                }
+            }
+            piece = pieceEnd + 1;
+        }
+    }
+
+    const wchar_t* eolName(EolStyle style) {
+        switch (style) {
+        case EolStyle::LF:
+            return L"LF";
+        case EolStyle::CR:
+            return L"CR";
+        default:
+            return L"CRLF";
+        }
+    }
+}
 
 
 
@@ -21,10 +92,69 @@ TextEditor::TextEditor() {
     addMenus();
     addControls();
     m_nFontHeight = 16;
+    // Typing is applied on the engine thread, which reports back with
+    // WM_EDIT_COMMITTED once it has caught up
+    editEngine = std::make_unique<EditEngine>(commandHistory, [hWnd = hMainWindow](uint64_t) {
+        PostMessage(hWnd, WM_EDIT_COMMITTED, 0, 0);
+    });
+    // Changes to open files by other programs come back as WM_FILE_CHANGED
+    fileWatcher = std::make_unique<FileWatcher>([hWnd = hMainWindow] {
+        PostMessage(hWnd, WM_FILE_CHANGED, 0, 0);
+    });
+    // Background tabs are dehydrated past the memory budget, and all of them
+    // once the system runs low on memory
+    lowMemory = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    SetTimer(hMainWindow, MEMORY_TIMER, MEMORY_CHECK_MS, nullptr);
+#ifdef EDITOR_PROFILE
+    // Profiling builds trace the whole session and write it out at exit
+    Profiler::instance().setTracing(true);
+#endif
+    tabControl->onTabChanged = [this](int index) {
+        onTabShown(index);
+    };
+    // The index and view of a file are remembered for when it is next opened
+    tabControl->onTabClosing = [this](int index) {
+        editEngine->sync();
+        cacheDocument(index);
+        fileWatcher->unwatch(documents.at(index).path);
+    };
     tabControl->onTabRemoved = [this](int index) {
-        if (index >= 0 && index < documents.size()) {
-            // Erase the document at the given index
-            documents.erase(documents.begin() + index);
+        if (DocumentText* document = documents.get(index)) {
+            if (search && search->getDocument() == document) {
+                search.reset();
+            }
+            // Closing a tab that is still loading cancels the load
+            std::erase_if(pendingLoads, [&](const PendingLoad& load) {
+                return load.placeholder == document;
+            });
+            std::erase_if(pendingReloads, [&](const PendingReload& reload) {
+                return reload.document == document;
+            });
+            declinedChanges.erase(document);
+            dehydratedTabs.erase(document);
+            std::erase_if(pendingDehydrations, [&](const PendingDehydration& pending) {
+                return pending.document == document;
+            });
+            dehydration.forget(document);
+            followers.erase(document);
+            highlighters.erase(document);
+            foldMaps.erase(document);
+            bracketIndexes.erase(document);
+            // A background save still finishes, but has no document to update
+            for (PendingSave& save : pendingSaves) {
+                if (save.document == document) {
+                    save.document = nullptr;
+                }
+            }
+            // Closing drops the journal along with the unsaved edits
+            dropJournal(document);
+            if (traceRecorder) {
+                traceRecorder->recordClose(*document);
+            }
+            // Erase the document at the given index. If it was shown, the
+            // view's buffer is freed when the next tab is shown.
+            DocumentRegistry::Entry closed = documents.remove(index);
+            freeViewBuffer(closed.view);
 
             // Ensure that the current tab index is within bounds
             if (tabControl->getCurrentTabIndex() >= documents.size()) {
@@ -32,7 +162,7 @@ TextEditor::TextEditor() {
             }
         }
         };
-
+    restoreSession();
 }
 
 
@@ -82,6 +212,7 @@ void TextEditor::addMenus() {
     hMenu = CreateMenu();
     HMENU hFileMenu = CreateMenu();
     HMENU hEditMenu = CreateMenu();
+    HMENU hViewMenu = CreateMenu();
 
     AppendMenu(hFileMenu, MF_STRING, FILE_MENU_NEW, L"New File");
     AppendMenu(hFileMenu, MF_STRING, FILE_MENU_OPEN, L"Open File");
@@ -93,10 +224,22 @@ void TextEditor::addMenus() {
 
     AppendMenu(hEditMenu, MF_STRING, EDIT_MENU_UNDO, L"Undo\tCtrl+Z");
     AppendMenu(hEditMenu, MF_STRING, EDIT_MENU_REDO, L"Redo\tCtrl+Y");
+    AppendMenu(hEditMenu, MF_SEPARATOR, 0, nullptr);
+    AppendMenu(hEditMenu, MF_STRING, EDIT_MENU_FIND, L"Find\tCtrl+F");
+    AppendMenu(hEditMenu, MF_STRING, EDIT_MENU_FIND_NEXT, L"Find Next\tF3");
+    AppendMenu(hEditMenu, MF_STRING, EDIT_MENU_MATCH, L"Go to Matching Bracket\tCtrl+]");
+
+    AppendMenu(hViewMenu, MF_STRING, VIEW_MENU_FOLLOW, L"Follow File");
+    AppendMenu(hViewMenu, MF_STRING, VIEW_MENU_MEMORY, L"Memory Report");
+    AppendMenu(hViewMenu, MF_STRING, VIEW_MENU_TRACE, L"Record Edit Trace");
+    AppendMenu(hViewMenu, MF_SEPARATOR, 0, nullptr);
+    AppendMenu(hViewMenu, MF_STRING, VIEW_MENU_FOLD, L"Toggle Fold");
+    AppendMenu(hViewMenu, MF_STRING, VIEW_MENU_UNFOLD_ALL, L"Unfold All");
 
 
     AppendMenu(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hFileMenu), L"File");
     AppendMenu(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hEditMenu), L"Edit");
+    AppendMenu(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hViewMenu), L"View");
 
     SetMenu(hMainWindow, hMenu);
 }
@@ -104,16 +247,26 @@ void TextEditor::addMenus() {
 void TextEditor::addControls() {
     tabControl = new TabControl(hMainWindow);
 
-    HWND hEditFile = CreateWindowW(
+    hView = CreateWindowW(
         L"EDIT", nullptr,
-        WS_CHILD | WS_VISIBLE | ES_MULTILINE | ES_AUTOVSCROLL | ES_AUTOHSCROLL | WS_VSCROLL | WS_HSCROLL,
+        WS_CHILD | WS_VISIBLE | ES_MULTILINE | ES_AUTOVSCROLL | ES_AUTOHSCROLL | ES_NOHIDESEL | WS_VSCROLL | WS_HSCROLL,
         0, 30, 700, 670,
         hMainWindow, nullptr, GetModuleHandle(nullptr), nullptr
     );
+    tabControl->setContent(hView);
+    SubclassEditControl(hView);
+
+    documents.add(std::make_unique<DocumentText>(hView));
+    documents.setShown(documents.get(0));
+    tabControl->addTab(L"Untitled");
 
-    documents.push_back(std::make_unique<DocumentText>(hEditFile));
-    tabControl->addTab(L"Untitled", hEditFile);
-    SubclassEditControl(hEditFile);  // Apply subclassing to the first edit control
+    // Hidden until Find is used; sits below the tab control when shown
+    hFindBox = CreateWindowW(
+        L"EDIT", nullptr,
+        WS_CHILD | WS_BORDER | ES_AUTOHSCROLL,
+        0, 0, 0, 0,
+        hMainWindow, nullptr, GetModuleHandle(nullptr), nullptr
+    );
 }
 
 void TextEditor::SubclassEditControl(HWND hEditControl) {
@@ -121,6 +274,8 @@ void TextEditor::SubclassEditControl(HWND hEditControl) {
 }
 
 LRESULT TextEditor::handleMessage(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp) {
+    // Handlers that read or change a document call editEngine->sync() first,
+    // so typing still on its way is applied; the rest never wait for it
     try {
         switch (msg) {
         case WM_COMMAND:
@@ -137,13 +292,68 @@ LRESULT TextEditor::handleMessage(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp) {
 
         case WM_SIZE:
             if (tabControl) {
-                RECT rcClient;
-                GetClientRect(hWnd, &rcClient);
-                tabControl->Resize(rcClient.right - rcClient.left, rcClient.bottom - rcClient.top);
+                layoutControls();
+            }
+            return 0;
+
+        case WM_TIMER:
+            if (wp == SEARCH_TIMER) {
+                editEngine->sync();
+                if (!search || !search->searchMore(SEARCH_BUDGET)) {
+                    KillTimer(hWnd, SEARCH_TIMER);
+                }
+            }
+            if (wp == MEMORY_TIMER) {
+                BOOL low = FALSE;
+                trimTabs(lowMemory != nullptr && QueryMemoryResourceNotification(lowMemory, &low) && low);
+            }
+            return 0;
+
+        case WM_LOAD_PROGRESS:
+            onLoadProgress(static_cast<size_t>(wp));
+            return 0;
+
+        case WM_SAVE_PROGRESS:
+            onSaveProgress();
+            return 0;
+
+        case WM_FILE_CHANGED:
+            checkExternalChanges();
+            return 0;
+
+        case WM_RELOAD_PROGRESS:
+            onReloadProgress(static_cast<size_t>(wp));
+            return 0;
+
+        case WM_EDIT_COMMITTED:
+            updateSearch(false);
+            updateHighlighting();
+            return 0;
+
+        case WM_HIGHLIGHT_READY:
+            InvalidateRect(hView, nullptr, FALSE);
+            return 0;
+
+        case WM_BRACKETS_READY:
+            if (const auto brackets = bracketIndexes.find(reinterpret_cast<const DocumentText*>(wp)); brackets != bracketIndexes.end()) {
+                editEngine->sync();
+                brackets->second->install();
             }
             return 0;
 
+        case WM_TAB_COMPRESSED:
+            onTabCompressed();
+            return 0;
+
+        case WM_JOURNAL_FAILED:
+            onJournalFailed(reinterpret_cast<const DocumentText*>(wp));
+            return 0;
+
         case WM_DESTROY:
+            storeSession();
+#ifdef EDITOR_PROFILE
+            writeProfile();
+#endif
             PostQuitMessage(0);
             return 0;
 
@@ -190,6 +400,17 @@ void TextEditor::handleUnknownException() const {
 
 
 LRESULT TextEditor::handleCommand(WPARAM wp, LPARAM lp) {
+    if (hFindBox != nullptr && reinterpret_cast<HWND>(lp) == hFindBox) {
+        if (HIWORD(wp) == EN_CHANGE) {
+            updateSearch(true);
+        }
+        return 0;
+    }
+
+    // Menu commands and their accelerators all read or change the documents
+    if (lp == 0) {
+        editEngine->sync();
+    }
     switch (wp) {
     case FILE_MENU_NEW:
         createNewTab();
@@ -217,30 +438,42 @@ LRESULT TextEditor::handleCommand(WPARAM wp, LPARAM lp) {
     case EDIT_MENU_REDO:
         redo();
         return 0;
+    case EDIT_MENU_FIND:
+        toggleFindBox();
+        return 0;
+    case EDIT_MENU_FIND_NEXT:
+        findNext();
+        return 0;
+    case EDIT_MENU_MATCH:
+        goToMatchingBracket();
+        return 0;
+    case VIEW_MENU_FOLLOW:
+        toggleFollow();
+        return 0;
+    case VIEW_MENU_MEMORY:
+        showMemoryReport();
+        return 0;
+    case VIEW_MENU_TRACE:
+        toggleEditTrace();
+        return 0;
+    case VIEW_MENU_FOLD:
+        toggleFold();
+        return 0;
+    case VIEW_MENU_UNFOLD_ALL:
+        unfoldAll();
+        return 0;
     default: ;
     }
     return 0;
 }
 
 void TextEditor::createNewTab() {
-    RECT rcClient;
-    GetClientRect(hMainWindow, &rcClient);
-
-    HWND newEditFile = CreateWindowW(
-        L"EDIT", nullptr,
-        WS_CHILD | ES_MULTILINE | ES_AUTOVSCROLL | ES_AUTOHSCROLL | WS_VSCROLL | WS_HSCROLL,
-        0, 0, rcClient.right - rcClient.left, rcClient.bottom - rcClient.top,
-        hMainWindow, nullptr, GetModuleHandle(nullptr), nullptr
-    );
-
-    documents.push_back(std::make_unique<DocumentText>(newEditFile));
-    tabControl->addTab(L"Untitled", newEditFile);
-    SubclassEditControl(newEditFile);
+    const size_t index = documents.add(std::make_unique<DocumentText>(hView));
+    if (traceRecorder) {
+        traceRecorder->recordOpen(*documents.get(static_cast<int>(index)));
+    }
+    tabControl->addTab(L"Untitled");
     tabControl->setCurrentTab(tabControl->getTabCount() - 1);
-
-    RECT rcMain;
-    GetClientRect(hMainWindow, &rcMain);
-    tabControl->Resize(rcMain.right - rcMain.left, rcMain.bottom - rcMain.top);
 }
 
 void TextEditor::openFile() {
@@ -251,60 +484,210 @@ void TextEditor::openFile() {
     ofn.hwndOwner = hMainWindow;
     ofn.lpstrFile = filePath;
     ofn.nMaxFile = MAX_PATH;
-    ofn.lpstrFilter = L"Text Files (*.txt)\0*.txt\0All Files (*.*)\0*.*\0";
+    ofn.lpstrFilter = L"Text Files (*.txt)\0*.txt\0Compressed Files (*.gz)\0*.gz\0All Files (*.*)\0*.*\0";
     ofn.nFilterIndex = 1;
 
-    if (GetOpenFileNameW(&ofn)) {
-        wchar_t* fileName = wcsrchr(filePath, L'\\');
-        if (fileName != nullptr) {
-            fileName++;
+    if (GetOpenFileNameW(&ofn) && !openPath(filePath)) {
+        MessageBoxW(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
+    }
+}
+
+bool TextEditor::openPath(const std::wstring& filePath) {
+    const size_t slash = filePath.rfind(L'\\');
+    const std::wstring fileName = slash != std::wstring::npos ? filePath.substr(slash + 1) : filePath;
+
+    // The file is read on a worker; progress comes back as WM_LOAD_PROGRESS
+    const size_t id = nextLoadId++;
+    auto loader = std::make_unique<DocumentLoader>(hView, [hWnd = hMainWindow, id](const LoadProgress&) {
+        PostMessage(hWnd, WM_LOAD_PROGRESS, static_cast<WPARAM>(id), 0);
+    });
+    // A save cut short by a crash is undone before the file is read
+    rollBackInterruptedSave(filePath);
+    if (!loader->start(filePath)) {
+        return false;
+    }
+    const size_t index = documents.add(std::make_unique<DocumentText>(hView), filePath);
+    pendingLoads.push_back(PendingLoad{ id, documents.get(static_cast<int>(index)), std::move(loader) });
+    tabControl->addTab(fileName);
+    fileWatcher->watch(filePath);
+    // Read-only until the load is done
+    tabControl->setCurrentTab(tabControl->getTabCount() - 1);
+    updateWindowTitle();
+    return true;
+}
+
+void TextEditor::restoreSession() {
+    // Files that have gone away since are skipped
+    std::vector<std::wstring> paths;
+    size_t currentTab = 0;
+    if (!DocumentCache::loadSession(paths, currentTab)) {
+        return;
+    }
+    int restoredCurrent = -1;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (GetFileAttributesW(paths[i].c_str()) != INVALID_FILE_ATTRIBUTES && openPath(paths[i]) && i <= currentTab) {
+            restoredCurrent = tabControl->getTabCount() - 1;
         }
-        else {
-            fileName = filePath;
+    }
+    if (restoredCurrent >= 0) {
+        tabControl->setCurrentTab(restoredCurrent);
+        updateWindowTitle();
+    }
+}
+
+void TextEditor::storeSession() {
+    // Untitled tabs have nothing to reopen
+    editEngine->sync();
+    std::vector<std::wstring> paths;
+    size_t currentTab = 0;
+    const int current = tabControl->getCurrentTabIndex();
+    for (int i = 0; i < tabControl->getTabCount(); ++i) {
+        const std::wstring& path = documents.at(i).path;
+        if (path.empty()) {
+            continue;
         }
+        if (i <= current) {
+            currentTab = paths.size();
+        }
+        paths.push_back(path);
+        cacheDocument(i);
+    }
+    DocumentCache::storeSession(paths, currentTab);
+}
 
-        HWND newEditFile = CreateWindowW(
-            L"EDIT", nullptr,
-            WS_CHILD | ES_MULTILINE | ES_AUTOVSCROLL | ES_AUTOHSCROLL | WS_VSCROLL | WS_HSCROLL,
-            0, 30, 700, 670,
-            hMainWindow, nullptr, GetModuleHandle(nullptr), nullptr
-        );
-
-        // Initialize the document
-        auto newDocument = std::make_unique<DocumentText>(newEditFile);
-        if (newDocument->initFile(filePath)) {
-            documents.push_back(std::move(newDocument));
-            tabControl->addTab(fileName, newEditFile, filePath);
-            SubclassEditControl(newEditFile);
-            tabControl->setCurrentTab(tabControl->getTabCount() - 1);
-            displayFile(documents.back().get(), newEditFile);
-            updateWindowTitle();
+void TextEditor::cacheDocument(int index) {
+    if (index < 0 || index >= documents.size()) {
+        return;
+    }
+    const std::wstring& path = documents.at(index).path;
+    DocumentText* document = documents.get(index);
+    if (path.empty() || isLoading(document) || isSaving(document)) {
+        return;
+    }
+    const TabView tabView = getView(index);
+    ViewState view;
+    view.caret = tabView.selectionStart;
+    view.firstVisibleLine = tabView.firstVisibleLine;
+    DocumentCache::store(path, *document, view);
+}
+
+void TextEditor::onLoadProgress(size_t id) {
+    auto load = std::find_if(pendingLoads.begin(), pendingLoads.end(),
+        [id](const PendingLoad& pending) { return pending.id == id; });
+    if (load == pendingLoads.end()) {
+        return; // tab closed while the message was queued
+    }
+    DocumentText* placeholder = load->placeholder;
+    const int index = documents.indexOf(placeholder);
+    if (index < 0) {
+        return;
+    }
+    // A tab in the background shows its first screen once it is selected
+    const bool isShown = documents.getShown() == placeholder;
+    const LoadProgress progress = load->loader->getProgress();
+
+    if (progress.state == LoadState::Loading) {
+        if (progress.firstScreenReady && !load->firstScreenShown && isShown) {
+            showFirstScreen(*load);
         }
-        else {
-            // Handle failure to initialize document
-            DestroyWindow(newEditFile);  // Cleanup the edit control if file load failed
-            MessageBoxW(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
+        if (isShown && progress.totalBytes > 0) {
+            std::wstring title = L"Nickolas Text Editor - " + getCurrentFilePath() +
+                L" (loading " + std::to_wstring(progress.bytesRead * 100 / progress.totalBytes) + L"%)";
+            SetWindowTextW(hMainWindow, title.c_str());
         }
+        return;
+    }
+
+    std::unique_ptr<DocumentText> document = load->loader->takeDocument();
+    if (document) {
+        PROFILE_DURATION("DocumentLoader first screen", load->loader->getTimeToFirstScreen() * 1e6);
+        PROFILE_DURATION("DocumentLoader indexed", load->loader->getTimeToIndexed() * 1e6);
+        PROFILE_COUNT("bytes opened", progress.totalBytes);
+    }
+    ViewState view;
+    const bool restoreView = load->loader->getCachedView(view);
+    pendingLoads.erase(load);
+
+    if (!document) {
+        MessageBoxW(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
+        tabControl->removeTab(index);
+        return;
+    }
 
+    editEngine->sync();
+    if (search && search->getDocument() == placeholder) {
+        search.reset();
+    }
+    // Edits are tracked against the file from here on
+    const std::wstring path = documents.at(index).path;
+    FileStamp stamp;
+    if (FileStamp::read(path, stamp)) {
+        document->markLoaded(stamp);
+    }
+
+    // A journal left behind by a crash holds edits that were never saved
+    if (EditJournal::hasRecovery(path)) {
+        const int answer = MessageBoxW(hMainWindow,
+            (L"Unsaved changes to " + path + L" were recovered. Restore them?").c_str(),
+            L"Recover", MB_YESNO | MB_ICONQUESTION);
+        if (answer == IDYES) {
+            EditJournal::recover(path, *document);
+        }
+        else {
+            DeleteFileW(EditJournal::journalPath(path).c_str());
+        }
+    }
+    DocumentText* loaded = document.get();
+    documents.replace(index, std::move(document));
+    if (traceRecorder) {
+        traceRecorder->recordOpen(*loaded);
     }
+    startLanguage(index);
+    refreshView(index);
+    if (restoreView) {
+        setView(index, TabView{ view.caret, view.caret, view.firstVisibleLine });
+    }
+    startJournal(path, loaded);
+    if (isShown) {
+        SendMessage(hView, EM_SETREADONLY, FALSE, 0);
+        updateWindowTitle();
+    }
+}
+
+bool TextEditor::isLoading(const DocumentText* document) const {
+    return std::any_of(pendingLoads.begin(), pendingLoads.end(),
+        [document](const PendingLoad& load) { return load.placeholder == document; });
 }
 
 
-void TextEditor::saveFile() const {
-    std::wstring currentFilePath = tabControl->getCurrentFilePath();
+void TextEditor::saveFile() {
+    std::wstring currentFilePath = getCurrentFilePath();
     if (currentFilePath.empty()) {
         saveFileAs();
     }
     else {
         int currentTabIndex = tabControl->getCurrentTabIndex();
-        if (currentTabIndex >= 0 && currentTabIndex < documents.size()) {
-            writeFile(currentFilePath, documents[currentTabIndex].get());
-
+        if (DocumentText* document = documents.get(currentTabIndex)) {
+            if (isLoading(document) || isSaving(document)) {
+                return; // nothing to save until the file has been read, or Save All is writing it
+            }
+            if (!confirmEolConversion(currentFilePath, *document)) {
+                return;
+            }
+            // Only what changed since the last save is written when possible
+            if (saveInPlace(currentFilePath, *document) || writeFile(currentFilePath, document)) {
+                if (traceRecorder) {
+                    traceRecorder->recordSave(*document);
+                }
+                if (auto journal = journals.find(document); journal != journals.end()) {
+                    journal->second->reset();
+                }
+            }
         }
     }
 }
 
-void TextEditor::saveFileAs() const {
+void TextEditor::saveFileAs() {
     OPENFILENAMEW ofn = { 0 };
     wchar_t filePath[MAX_PATH] = L"";
 
@@ -327,9 +710,20 @@ void TextEditor::saveFileAs() const {
         }
 
         int currentTabIndex = tabControl->getCurrentTabIndex();
-        if (currentTabIndex >= 0 && currentTabIndex < documents.size()) {
-            writeFile(filePath, documents[currentTabIndex].get());
-            tabControl->setCurrentFilePath(filePath);
+        DocumentText* document = documents.get(currentTabIndex);
+        if (document != nullptr && !isLoading(document) && !isSaving(document) && confirmEolConversion(filePath, *document)) {
+            if (writeFile(filePath, document)) {
+                if (traceRecorder) {
+                    traceRecorder->recordSave(*document);
+                }
+                // The journal follows the document to its new file
+                dropJournal(document);
+                startJournal(filePath, document);
+            }
+            fileWatcher->unwatch(getCurrentFilePath());
+            fileWatcher->watch(filePath);
+            documents.at(currentTabIndex).path = filePath;
+            startLanguage(currentTabIndex);
             updateWindowTitle();
             tabControl->changeTabName(fileName);
             InvalidateRect(hMainWindow, nullptr, TRUE);
@@ -337,70 +731,1073 @@ void TextEditor::saveFileAs() const {
     }
 }
 
-void TextEditor::saveAllFiles() const {
-    for (int i = 0; i < tabControl->getTabCount(); ++i) {
-        tabControl->setCurrentTab(i);
-        saveFile();
+void TextEditor::saveAllFiles() {
+    if (backgroundSave) {
+        return; // the previous Save All is still writing
+    }
+
+    // Snapshots are taken here, between edits; the writing happens on
+    // workers and the tabs stay as they are
+    std::vector<SaveSnapshot> snapshots;
+    untitledSkipped = 0;
+    for (const DocumentRegistry::Entry& entry : documents) {
+        DocumentText* document = entry.document.get();
+        if (isLoading(document) || !document->isModified()) {
+            continue;
+        }
+        if (entry.path.empty()) {
+            ++untitledSkipped;
+            continue;
+        }
+        if (!confirmEolConversion(entry.path, *document)) {
+            continue;
+        }
+        snapshots.push_back(takeSnapshot(entry.path, *document));
+        if (traceRecorder) {
+            traceRecorder->recordSave(*document);
+        }
+        auto journal = journals.find(document);
+        pendingSaves.push_back(PendingSave{ document, journal != journals.end() ? journal->second->mark() : 0 });
+    }
+
+    backgroundSave = std::make_unique<BackgroundSaver>(std::move(snapshots), [hWnd = hMainWindow](size_t) {
+        PostMessage(hWnd, WM_SAVE_PROGRESS, 0, 0);
+    });
+    backgroundSave->start();
+    onSaveProgress();
+}
+
+void TextEditor::onSaveProgress() {
+    if (!backgroundSave) {
+        return;
+    }
+    if (!backgroundSave->isFinished()) {
+        std::wstring title = L"Nickolas Text Editor - Saving " + std::to_wstring(backgroundSave->getFinishedCount() + 1) +
+            L" of " + std::to_wstring(backgroundSave->size());
+        SetWindowTextW(hMainWindow, title.c_str());
+        return;
+    }
+    backgroundSave->wait();
+    editEngine->sync();
+
+    std::wstring failures;
+    for (size_t i = 0; i < backgroundSave->size(); ++i) {
+        const SaveSnapshot& snapshot = backgroundSave->getSnapshot(i);
+        DocumentText* document = pendingSaves[i].document;
+        if (backgroundSave->getState(i) == SaveState::Failed) {
+            failures += L"\n" + snapshot.path;
+            continue;
+        }
+        if (document == nullptr) {
+            continue;
+        }
+        // Edits made while the file was being written stay unsaved
+        FileStamp stamp;
+        if (FileStamp::read(snapshot.path, stamp)) {
+            document->markSaved(stamp, snapshot.version);
+        }
+        if (auto journal = journals.find(document); journal != journals.end()) {
+            journal->second->reset(pendingSaves[i].journalMark);
+        }
+    }
+    backgroundSave.reset();
+    pendingSaves.clear();
+    updateWindowTitle();
+
+    if (!failures.empty()) {
+        MessageBoxW(hMainWindow, (L"Failed to save:" + failures).c_str(), L"Error", MB_OK | MB_ICONERROR);
+    }
+    if (untitledSkipped > 0) {
+        MessageBoxW(hMainWindow, (std::to_wstring(untitledSkipped) + L" untitled document(s) were not saved; use Save As to name them.").c_str(),
+            L"Save All", MB_OK | MB_ICONINFORMATION);
+    }
+}
+
+bool TextEditor::confirmEolConversion(const std::wstring& path, const DocumentText& document) const {
+    // Saving writes every line break in the one style; a file that mixes
+    // them would change lines the user never touched
+    if (!document.hasMixedEol()) {
+        return true;
     }
+    const std::wstring style = eolName(document.getEolStyle());
+    const int answer = MessageBoxW(hMainWindow,
+        (path + L" mixes line endings. Saving will write all of them as " + style + L". Save anyway?").c_str(),
+        L"Line Endings", MB_YESNO | MB_ICONWARNING);
+    return answer == IDYES;
 }
 
-void TextEditor::displayFile(const DocumentText* document, HWND editControl) {
+bool TextEditor::isSaving(const DocumentText* document) const {
+    return std::any_of(pendingSaves.begin(), pendingSaves.end(),
+        [document](const PendingSave& save) { return save.document == document; });
+}
+
+void TextEditor::displayFile(const DocumentText* document, HWND editControl) const {
+    PROFILE_SCOPE("TextEditor::displayFile");
     // Get the full document content directly from the buffer
     size_t totalLen = document->getLength();
+    PROFILE_COUNT("bytes displayed", totalLen);
 
     if (totalLen == 0) {
         SetWindowTextW(editControl, L"");
         return;
     }
 
-    // Allocate buffer and get all text
-    char* content = new char[totalLen + 1];
-    document->getText(0, totalLen, content);
-
-    // Convert LF to CRLF for the Edit control (if needed)
+    // Convert LF to CRLF for the Edit control straight from the stored
+    // blocks, leaving out the lines folded away
     std::string result;
-    result.reserve(totalLen * 2);  // Worst case: every char is LF
+    result.reserve(totalLen + totalLen / 16);
+    const auto folds = foldMaps.find(document);
+    if (folds == foldMaps.end() || folds->second->empty()) {
+        for (const std::string_view chunk : document->getSpans(0, totalLen)) {
+            appendWithCrlf(result, chunk);
+        }
+    }
+    else {
+        appendLines(result, *document, *folds->second, 0, document->lineStarts.size());
+    }
+    setEditText(editControl, result);
+}
 
-    for (size_t i = 0; i < totalLen; ++i) {
-        if (content[i] == '\n' && (i == 0 || content[i-1] != '\r')) {
-            result += '\r';
+void TextEditor::appendLines(std::string& result, const DocumentText& document, const FoldMap& folds, size_t first, size_t end) {
+    // Lines first to end that are not folded away
+    const LineIndex& lines = document.lineStarts;
+    for (const auto& [shownFirst, shownEnd] : folds.getShownLines()) {
+        const size_t from = std::max(shownFirst, first);
+        const size_t to = std::min(shownEnd, end);
+        if (from >= to) {
+            continue;
+        }
+        const size_t start = lines[from];
+        const size_t stop = to < lines.size() ? lines[to] : document.getLength();
+        for (const std::string_view chunk : document.getSpans(start, stop - start)) {
+            appendWithCrlf(result, chunk);
         }
-        result += content[i];
     }
+}
 
-    delete[] content;
+void TextEditor::appendWithCrlf(std::string& result, std::string_view text) {
+    const char* run = text.data();
+    const char* end = text.data() + text.size();
+    while (const char* newline = static_cast<const char*>(memchr(run, '\n', end - run))) {
+        result.append(run, newline);
+        result += "\r\n";
+        run = newline + 1;
+    }
+    result.append(run, end);
+}
 
+void TextEditor::setEditText(HWND editControl, const std::string& text) {
     // Convert to wide string
-    int wideSize = MultiByteToWideChar(CP_UTF8, 0, result.c_str(), -1, nullptr, 0);
+    int wideSize = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
     std::vector<wchar_t> wideBuffer(wideSize);
-    MultiByteToWideChar(CP_UTF8, 0, result.c_str(), -1, wideBuffer.data(), wideSize);
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wideBuffer.data(), wideSize);
 
     SetWindowTextW(editControl, wideBuffer.data());
 }
 
-void TextEditor::writeFile(const std::wstring& path, const DocumentText* document) const {
-    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (hFile == INVALID_HANDLE_VALUE) {
+bool TextEditor::writeFile(const std::wstring& path, DocumentText* document) const {
+    PROFILE_SCOPE("TextEditor::writeFile");
+    if (!writeWhole(path, document->getSpans(0, document->getLength()), document->getEolStyle())) {
         MessageBoxW(hMainWindow, L"Failed to save file", L"Error", MB_OK | MB_ICONERROR);
+        return false;
+    }
+    // The file now holds exactly the document, so later saves can go in place
+    FileStamp stamp;
+    if (FileStamp::read(path, stamp)) {
+        document->markSaved(stamp);
+    }
+    return true;
+}
+
+void TextEditor::checkExternalChanges() {
+    // The prompt below runs a message loop, which may deliver another
+    // WM_FILE_CHANGED; that one is covered by this pass
+    if (checkingChanges) {
         return;
     }
+    checkingChanges = true;
+    editEngine->sync();
+    for (size_t i = 0; i < documents.size(); ++i) {
+        DocumentText* document = documents.get(static_cast<int>(i));
+        const std::wstring path = documents.at(i).path;
+        FileStamp stamp;
+        if (path.empty() || isLoading(document) || isSaving(document) || isReloading(document) ||
+            !FileStamp::read(path, stamp) || stamp == document->getSavedStamp()) {
+            continue; // untitled, busy, gone or unchanged
+        }
+        if (followers.contains(document) && followTail(static_cast<int>(i))) {
+            continue; // appended to
+        }
+        if (auto declined = declinedChanges.find(document); declined != declinedChanges.end() && declined->second == stamp) {
+            continue;
+        }
+        if (document->isModified()) {
+            const int answer = MessageBoxW(hMainWindow,
+                (path + L" was changed by another program. Reload it and lose your changes?").c_str(),
+                L"File Changed", MB_YESNO | MB_ICONQUESTION);
+            if (documents.get(static_cast<int>(i)) != document) {
+                break; // the tabs changed while the prompt was up; the next notification looks again
+            }
+            if (answer != IDYES) {
+                declinedChanges[document] = stamp;
+                continue;
+            }
+        }
+        startReload(static_cast<int>(i), stamp);
+    }
+    checkingChanges = false;
+}
 
-    char buf[LONGEST_LINE];
-    for (size_t i = 0; i < document->lineStarts.size(); ++i) {
-        ULONG len = document->get_line(i, buf, LONGEST_LINE);
-        DWORD bytesWritten;
-        WriteFile(hFile, buf, len, &bytesWritten, nullptr);
-        if (i < document->lineStarts.size() - 1) {  // Don't add newline after the last line
-            WriteFile(hFile, "\r\n", 2, &bytesWritten, nullptr);
+bool TextEditor::startReload(int index, const FileStamp& stamp) {
+    // The stamp is read before the file, so a change made during the read
+    // leaves the document out of date and is picked up by the next check
+    const size_t id = nextLoadId++;
+    auto loader = std::make_unique<DocumentLoader>(nullptr, [hWnd = hMainWindow, id](const LoadProgress& progress) {
+        if (progress.state != LoadState::Loading) {
+            PostMessage(hWnd, WM_RELOAD_PROGRESS, static_cast<WPARAM>(id), 0);
         }
+    });
+    if (!loader->start(documents.at(index).path)) {
+        return false;
+    }
+    // Nothing is typed meanwhile, since the reload replaces what differs
+    // from the file and would take typed text out again
+    pendingReloads.push_back(PendingReload{ id, documents.get(index), stamp, std::move(loader) });
+    if (documents.get(index) == documents.getShown()) {
+        SendMessage(hView, EM_SETREADONLY, TRUE, 0);
+    }
+    return true;
+}
+
+void TextEditor::onReloadProgress(size_t id) {
+    auto reload = std::find_if(pendingReloads.begin(), pendingReloads.end(),
+        [id](const PendingReload& pending) { return pending.id == id; });
+    if (reload == pendingReloads.end()) {
+        return; // tab closed while the file was read
+    }
+    editEngine->sync();
+    std::unique_ptr<DocumentText> updated = reload->loader->takeDocument();
+    const LoadProgress progress = reload->loader->getProgress();
+    DocumentText* document = reload->document;
+    const FileStamp stamp = reload->stamp;
+    pendingReloads.erase(reload);
+    if (document == documents.getShown()) {
+        SendMessage(hView, EM_SETREADONLY, followers.contains(document), 0);
+    }
+    const int index = documents.indexOf(document);
+    if (!updated || index < 0) {
+        return; // unreadable for now; the next change notification tries again
+    }
+    const std::wstring path = documents.at(index).path;
+
+    // The caret and the top of the view follow the replaced text, whether
+    // the tab is shown or parked
+    DocumentMarkers& markers = document->getMarkers();
+    const TabView view = getView(index);
+    const MarkerId caret = markers.addMarker(view.selectionStart, MarkerGravity::Before);
+    const MarkerId top = markers.addMarker(document->lineStarts[std::min(view.firstVisibleLine, document->lineStarts.size() - 1)],
+        MarkerGravity::Before);
+
+    // One undo step, kept out of the journal: once it is applied the
+    // document matches the file again and the journal starts over
+    dropJournal(document);
+    {
+        PROFILE_SCOPE("TextEditor::applyReload");
+        const std::vector<DiffHunk> hunks = diffDocuments(*document, *updated);
+        PROFILE_COUNT("reload ranges replaced", hunks.size());
+        if (!hunks.empty()) {
+            commandHistory.executeCommand(makeReloadCommand(*document, *updated, hunks));
+        }
+    }
+    document->markReloaded(stamp, updated->getEolStyle(), updated->hasMixedEol());
+    declinedChanges.erase(document);
+    auto follower = followers.find(document);
+    if (follower == followers.end()) {
+        startJournal(path, document);
+    }
+    else if (!follower->second->start(progress.totalBytes)) {
+        followers.erase(follower); // the rotated file is gone again
+        if (document == documents.getShown()) {
+            SendMessage(hView, EM_SETREADONLY, FALSE, 0);
+        }
+        startJournal(path, document);
+    }
+
+    refreshView(index);
+    // A followed file that was rotated starts over at its end
+    const size_t position = followers.contains(document) ? document->getLength() : markers.getPosition(caret);
+    setView(index, TabView{ position, position, document->lineStarts.lineOf(markers.getPosition(top)) });
+    markers.removeMarker(caret);
+    markers.removeMarker(top);
+    if (index == tabControl->getCurrentTabIndex()) {
+        updateSearch(false);
+        updateWindowTitle();
     }
+}
 
-    CloseHandle(hFile);
+bool TextEditor::isReloading(const DocumentText* document) const {
+    return std::any_of(pendingReloads.begin(), pendingReloads.end(),
+        [document](const PendingReload& reload) { return reload.document == document; });
+}
+
+void TextEditor::toggleFollow() {
+    const int index = tabControl->getCurrentTabIndex();
+    if (index < 0 || index >= documents.size()) {
+        return;
+    }
+    DocumentText* document = documents.get(index);
+    const std::wstring path = documents.at(index).path;
+    HWND editControl = hView;
+    if (followers.erase(document) > 0) {
+        SendMessage(editControl, EM_SETREADONLY, FALSE, 0);
+        startJournal(path, document);
+        updateWindowTitle();
+        return;
+    }
+    if (path.empty() || isGzipPath(path) || isLoading(document) || isSaving(document) || isReloading(document)) {
+        return; // only a plain file on disk can grow
+    }
+    if (document->isModified()) {
+        MessageBoxW(hMainWindow, L"Save or undo your changes before following this file.", L"Follow File", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+
+    // Picks up from the end of what was loaded. There is nothing to journal
+    // while the tab is read-only.
+    auto follower = std::make_unique<TailFollower>(path);
+    if (!follower->start(document->getSavedStamp().size)) {
+        MessageBoxW(hMainWindow, L"Failed to open file", L"Error", MB_OK | MB_ICONERROR);
+        return;
+    }
+    followers[document] = std::move(follower);
+    dropJournal(document);
+    SendMessage(editControl, EM_SETREADONLY, TRUE, 0);
+    document->setCaretPosition(document->getLength());
+    SendMessage(editControl, EM_SCROLLCARET, 0, 0);
+    followTail(index);
+    updateWindowTitle();
+}
+
+bool TextEditor::followTail(int index) {
+    // Only the new bytes are read, added to the document and sent to the
+    // view if the tab is shown; nothing already loaded is copied again
+    DocumentText* document = documents.get(index);
+    TailFollower& follower = *followers.at(document);
+    std::string appended;
+    FileStamp stamp;
+    const TailState state = follower.poll(appended, stamp);
+    if (state == TailState::Replaced) {
+        return false; // rotated or rewritten, so it is reloaded whole
+    }
+    if (state == TailState::Unchanged) {
+        return true;
+    }
+
+    TabView view = getView(index);
+    const bool atEnd = view.selectionStart == document->getLength();
+    const size_t oldLength = document->getLength();
+    document->appendFromFile(appended, stamp);
+    if (const auto brackets = bracketIndexes.find(document); brackets != bracketIndexes.end()) {
+        brackets->second->update();
+    }
+    const bool isShown = document == documents.getShown();
+    if (isShown) {
+        std::string text;
+        for (const std::string_view chunk : document->getSpans(oldLength, document->getLength() - oldLength)) {
+            appendWithCrlf(text, chunk);
+        }
+        const int wideSize = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+        std::vector<wchar_t> wideText(wideSize);
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wideText.data(), wideSize);
+        const int editLength = GetWindowTextLengthW(hView);
+        SendMessage(hView, EM_SETSEL, static_cast<WPARAM>(editLength), static_cast<LPARAM>(editLength));
+        SendMessage(hView, EM_REPLACESEL, FALSE, reinterpret_cast<LPARAM>(wideText.data()));
+    }
+    else {
+        refreshView(index); // built again when the tab is shown
+    }
+
+    // The view keeps up with the end unless the caret was moved away from it
+    if (atEnd) {
+        view.selectionStart = view.selectionEnd = document->getLength();
+    }
+    setView(index, view);
+    if (atEnd && isShown) {
+        SendMessage(hView, EM_SCROLLCARET, 0, 0);
+    }
+    if (index == tabControl->getCurrentTabIndex()) {
+        updateSearch(false);
+        updateHighlighting();
+    }
+    // Large appends are read a piece at a time between other messages
+    if (follower.isBehind()) {
+        PostMessage(hMainWindow, WM_FILE_CHANGED, 0, 0);
+    }
+    return true;
+}
+
+void TextEditor::onTabShown(int index) {
+    // Trimming the other tabs is left to the memory timer, so a switch
+    // costs the same however many tabs are open
+    editEngine->sync();
+    rehydrateTab(index);
+    showDocument(index);
+    if (DocumentText* document = documents.get(index)) {
+        dehydration.touch(document);
+    }
+    updateHighlighting();
+}
+
+void TextEditor::showDocument(int index) {
+    PROFILE_SCOPE("TextEditor::showDocument");
+    DocumentText* document = documents.get(index);
+    DocumentText* previous = documents.getShown();
+    if (document == previous) {
+        return;
+    }
+
+    // The view's buffer is parked with the tab going into the background,
+    // or freed if that tab was closed, and the shown tab's parked buffer is
+    // swapped in. An Edit control that cannot swap buffers reports none and
+    // has its text set instead.
+    auto current = reinterpret_cast<HLOCAL>(SendMessage(hView, EM_GETHANDLE, 0, 0));
+    HLOCAL next = nullptr;
+    if (current != nullptr) {
+        next = document != nullptr && documents.at(index).view.buffer != nullptr
+            ? static_cast<HLOCAL>(documents.at(index).view.buffer)
+            : LocalAlloc(LMEM_MOVEABLE | LMEM_ZEROINIT, sizeof(wchar_t));
+    }
+    if (previous != nullptr) {
+        const int previousIndex = documents.indexOf(previous);
+        TabView parked = getView(previousIndex);
+        parked.buffer = next != nullptr ? current : nullptr;
+        documents.at(previousIndex).view = parked;
+    }
+    if (next != nullptr) {
+        SendMessage(hView, EM_SETHANDLE, reinterpret_cast<WPARAM>(next), 0);
+        if (previous == nullptr) {
+            LocalFree(current);
+        }
+    }
+    documents.setShown(document);
+    if (document == nullptr) {
+        if (next == nullptr) {
+            SetWindowTextW(hView, L"");
+        }
+        return;
+    }
+
+    TabView& view = documents.at(index).view;
+    const bool rebuild = next == nullptr || view.buffer == nullptr;
+    view.buffer = nullptr; // the view's own while it is shown
+    if (rebuild) {
+        auto load = std::find_if(pendingLoads.begin(), pendingLoads.end(),
+            [document](const PendingLoad& pending) { return pending.placeholder == document; });
+        if (load == pendingLoads.end()) {
+            displayFile(document, hView);
+        }
+        else if (load->loader->getProgress().firstScreenReady) {
+            showFirstScreen(*load);
+        }
+    }
+    setView(index, view);
+    SendMessage(hView, EM_SETREADONLY, isLoading(document) || isReloading(document) || followers.contains(document), 0);
+}
+
+TabView TextEditor::getView(int index) const {
+    const DocumentRegistry::Entry& entry = documents.at(index);
+    TabView view;
+    if (entry.document.get() != documents.getShown()) {
+        view = entry.view;
+        view.buffer = nullptr;
+        return view;
+    }
+    entry.document->getSelection(view.selectionStart, view.selectionEnd);
+    size_t lastLine;
+    getVisibleLines(view.firstVisibleLine, lastLine);
+    return view;
+}
+
+void TextEditor::setView(int index, const TabView& view) {
+    DocumentRegistry::Entry& entry = documents.at(index);
+    const size_t length = entry.document->getLength();
+    const size_t start = std::min(view.selectionStart, length);
+    const size_t end = std::min(view.selectionEnd, length);
+    if (entry.document.get() != documents.getShown()) {
+        entry.view.selectionStart = start;
+        entry.view.selectionEnd = end;
+        entry.view.firstVisibleLine = view.firstVisibleLine;
+        return;
+    }
+    entry.document->setSelection(start, end);
+    scrollToLine(view.firstVisibleLine);
+}
+
+void TextEditor::getVisibleLines(size_t& firstLine, size_t& lastLine) const {
+    // The document lines at the top and bottom of the view, which has the
+    // folded lines left out
+    RECT rcEdit;
+    GetClientRect(hView, &rcEdit);
+    firstLine = SendMessage(hView, EM_GETFIRSTVISIBLELINE, 0, 0);
+    lastLine = firstLine + (rcEdit.bottom - rcEdit.top) / m_nFontHeight + 1;
+    const auto folds = foldMaps.find(documents.getShown());
+    if (folds != foldMaps.end() && !folds->second->empty()) {
+        const size_t lineCount = documents.getShown()->lineStarts.size();
+        firstLine = std::min(folds->second->toDocumentLine(firstLine), lineCount - 1);
+        lastLine = std::min(folds->second->toDocumentLine(lastLine), lineCount);
+    }
+}
+
+void TextEditor::scrollToLine(size_t line) {
+    const auto folds = foldMaps.find(documents.getShown());
+    const size_t viewLine = folds != foldMaps.end() && !folds->second->empty() ? folds->second->toVisibleLine(line) : line;
+    const auto firstVisible = static_cast<LONG_PTR>(SendMessage(hView, EM_GETFIRSTVISIBLELINE, 0, 0));
+    SendMessage(hView, EM_LINESCROLL, 0, static_cast<LPARAM>(static_cast<LONG_PTR>(viewLine) - firstVisible));
+}
+
+void TextEditor::refreshView(int index) {
+    // The document was changed other than through the view
+    DocumentRegistry::Entry& entry = documents.at(index);
+    if (entry.document.get() == documents.getShown()) {
+        displayFile(entry.document.get(), hView);
+    }
+    else {
+        freeViewBuffer(entry.view);
+    }
+}
+
+void TextEditor::freeViewBuffer(TabView& view) {
+    if (view.buffer != nullptr) {
+        LocalFree(static_cast<HLOCAL>(view.buffer));
+        view.buffer = nullptr;
+    }
+}
+
+void TextEditor::showFirstScreen(PendingLoad& load) const {
+    std::string text;
+    appendWithCrlf(text, load.loader->getFirstScreen());
+    setEditText(hView, text);
+    load.firstScreenShown = true;
+}
+
+void TextEditor::trimTabs(bool underPressure) {
+    // Loads, reloads and followed files are about to replace or grow their
+    // text, so those tabs stay as they are
+    editEngine->sync();
+    std::vector<DehydrationPolicy::Tab> tabs;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        DocumentText* document = documents.get(static_cast<int>(i));
+        if (!dehydratedTabs.contains(document)) {
+            const bool busy = isLoading(document) || isReloading(document) || followers.contains(document);
+            const size_t memory = document->getMemoryAccount()->getReserved(MemoryTag::Text) +
+                getViewMemory(static_cast<int>(i)).reserved;
+            tabs.push_back(DehydrationPolicy::Tab{ document, memory, !busy });
+        }
+        else if (underPressure && !document->isDehydrated()) {
+            // Save All or an undo may have needed the text since
+            startCompression(document);
+        }
+    }
+    for (DocumentText* document : dehydration.select(tabs, getCurrentDocument(), underPressure)) {
+        dehydrateTab(documents.indexOf(document));
+    }
+}
+
+void TextEditor::dehydrateTab(int index) {
+    // Its selection and scroll position stay parked
+    DocumentRegistry::Entry& entry = documents.at(index);
+    freeViewBuffer(entry.view);
+    dehydratedTabs.insert(entry.document.get());
+    startCompression(entry.document.get());
+}
+
+void TextEditor::rehydrateTab(int index) {
+    DocumentText* document = documents.get(index);
+    if (dehydratedTabs.erase(document) == 0) {
+        return;
+    }
+    std::erase_if(pendingDehydrations, [document](const PendingDehydration& pending) {
+        return pending.document == document;
+    });
+
+    // The text alone is DocumentText::rehydrate's own scope
+    PROFILE_SCOPE("TextEditor::rehydrateTab");
+    PROFILE_COUNT("bytes rehydrated", document->getLength());
+    document->rehydrate();
+    showDocument(index);
+}
+
+void TextEditor::startCompression(DocumentText* document) {
+    if (std::any_of(pendingDehydrations.begin(), pendingDehydrations.end(),
+        [document](const PendingDehydration& pending) { return pending.document == document; })) {
+        return;
+    }
+    auto compression = std::make_shared<Compression>();
+    pendingDehydrations.push_back(PendingDehydration{ document, compression });
+    TaskScheduler::shared().submit([compression, snapshot = document->snapshot(), hWnd = hMainWindow] {
+        compression->text = CompressedText::compress(snapshot);
+        compression->done = true;
+        PostMessage(hWnd, WM_TAB_COMPRESSED, 0, 0);
+    }, TaskPriority::Idle);
+}
+
+void TextEditor::onTabCompressed() {
+    // A copy of a version the document has since moved past is dropped, and
+    // the tab only goes without its view buffer
+    editEngine->sync();
+    std::erase_if(pendingDehydrations, [](PendingDehydration& pending) {
+        if (!pending.compression->done) {
+            return false;
+        }
+        pending.document->dehydrate(std::move(pending.compression->text));
+        return true;
+    });
+}
+
+MemoryUsage TextEditor::getViewMemory(int index) const {
+    // The Edit control's copy is UTF-16 with CRLF line breaks, in a local
+    // memory block that it grows as it needs to
+    const DocumentRegistry::Entry& entry = documents.at(index);
+    MemoryUsage usage;
+    auto buffer = static_cast<HLOCAL>(entry.view.buffer);
+    if (entry.document.get() == documents.getShown()) {
+        buffer = reinterpret_cast<HLOCAL>(SendMessage(hView, EM_GETHANDLE, 0, 0));
+        usage.live = (static_cast<size_t>(GetWindowTextLengthW(hView)) + 1) * sizeof(wchar_t);
+    }
+    else if (buffer != nullptr) {
+        usage.live = (entry.document->getLength() + entry.document->lineStarts.size()) * sizeof(wchar_t);
+    }
+    usage.reserved = buffer != nullptr ? LocalSize(buffer) : 0;
+    return usage;
+}
+
+std::vector<DocumentMemory> TextEditor::getMemoryReport() const {
+    std::vector<DocumentMemory> report;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const DocumentRegistry::Entry& entry = documents.at(i);
+        const std::wstring name = entry.path.empty() ? L"Untitled" : entry.path;
+        const int size = WideCharToMultiByte(CP_UTF8, 0, name.c_str(), static_cast<int>(name.size()), nullptr, 0, nullptr, nullptr);
+        DocumentMemory memory{ std::string(size, '\0'), entry.document->getMemoryReport() };
+        WideCharToMultiByte(CP_UTF8, 0, name.c_str(), static_cast<int>(name.size()), memory.name.data(), size, nullptr, nullptr);
+        memory.report[MemoryTag::View] = getViewMemory(static_cast<int>(i));
+        report.push_back(std::move(memory));
+    }
+    return report;
+}
+
+void TextEditor::showMemoryReport() const {
+    // Totals by component here, every document's numbers in the JSON file
+    const std::vector<DocumentMemory> report = getMemoryReport();
+    MemoryReport all;
+    for (const DocumentMemory& document : report) {
+        all += document.report;
+    }
+
+    std::wstring message = std::to_wstring(report.size()) + L" documents\n\n";
+    auto addLine = [&message](const wchar_t* name, const MemoryUsage& usage) {
+        wchar_t line[160];
+        swprintf(line, 160, L"%ls: %.1f MB live, %.1f MB reserved\n", name,
+            static_cast<double>(usage.live) / (1024 * 1024), static_cast<double>(usage.reserved) / (1024 * 1024));
+        message += line;
+    };
+    addLine(L"Text", all[MemoryTag::Text]);
+    addLine(L"Line index", all[MemoryTag::LineIndex]);
+    addLine(L"Undo", all[MemoryTag::Undo]);
+    addLine(L"Compressed", all[MemoryTag::Compressed]);
+    addLine(L"View", all[MemoryTag::View]);
+    addLine(L"Total", all.total());
+
+    wchar_t base[MAX_PATH];
+    const DWORD length = GetTempPathW(MAX_PATH, base);
+    if (length != 0 && length < MAX_PATH) {
+        const std::wstring path = std::wstring(base, length) + L"NickolasTextEditor-memory.json";
+        const std::string json = memoryReportJson(report);
+        TextSpans spans;
+        spans.push_back(json);
+        message += writeWhole(path, spans, EolStyle::LF) ? L"\nWritten to " + path : L"\nFailed to write " + path;
+    }
+    MessageBoxW(hMainWindow, message.c_str(), L"Memory Report", MB_OK | MB_ICONINFORMATION);
+}
+
+void TextEditor::toggleEditTrace() {
+    // Every document open so far goes into the trace as it is now; typing is
+    // recorded by the engine, which handleMessage has already synced
+    if (traceRecorder) {
+        editEngine->setRecorder(nullptr);
+        const bool written = traceRecorder->stop();
+        const std::wstring message = (written ? L"Edit trace written to " : L"Failed to write ") + traceRecorder->getPath();
+        traceRecorder.reset();
+        CheckMenuItem(hMenu, VIEW_MENU_TRACE, MF_BYCOMMAND | MF_UNCHECKED);
+        MessageBoxW(hMainWindow, message.c_str(), L"Edit Trace", MB_OK | (written ? MB_ICONINFORMATION : MB_ICONERROR));
+        return;
+    }
+
+    wchar_t base[MAX_PATH];
+    const DWORD length = GetTempPathW(MAX_PATH, base);
+    if (length == 0 || length >= MAX_PATH) {
+        return;
+    }
+    const std::wstring path = std::wstring(base, length) + L"NickolasTextEditor-" + std::to_wstring(GetTickCount64()) + L".edittrace";
+    auto recorder = std::make_unique<EditTraceRecorder>(path);
+    if (!recorder->start()) {
+        MessageBoxW(hMainWindow, (L"Failed to create " + path).c_str(), L"Edit Trace", MB_OK | MB_ICONERROR);
+        return;
+    }
+    for (const DocumentRegistry::Entry& entry : documents) {
+        if (!isLoading(entry.document.get())) {
+            recorder->recordOpen(*entry.document);
+        }
+    }
+    traceRecorder = std::move(recorder);
+    editEngine->setRecorder(traceRecorder.get());
+    CheckMenuItem(hMenu, VIEW_MENU_TRACE, MF_BYCOMMAND | MF_CHECKED);
+}
+
+void TextEditor::writeProfile() const {
+    // Next to each other in the temp folder: the summary as text, and the
+    // trace for chrome://tracing or Perfetto
+    wchar_t base[MAX_PATH];
+    const DWORD length = GetTempPathW(MAX_PATH, base);
+    if (length == 0 || length >= MAX_PATH) {
+        return;
+    }
+    const std::wstring folder(base, length);
+    const Profiler& profiler = Profiler::instance();
+    if (!profiler.writeSummary(folder + L"NickolasTextEditor-profile.txt") ||
+        !profiler.writeTrace(folder + L"NickolasTextEditor-trace.json")) {
+        OutputDebugStringW(L"Failed to write the profile\n");
+        return;
+    }
+    const std::string summary = profiler.summary();
+    OutputDebugStringW(std::wstring(summary.begin(), summary.end()).c_str());
+}
+
+void TextEditor::startJournal(const std::wstring& path, DocumentText* document) {
+    auto journal = std::make_unique<EditJournal>(path, [hWnd = hMainWindow, document] {
+        PostMessage(hWnd, WM_JOURNAL_FAILED, reinterpret_cast<WPARAM>(document), 0);
+    });
+    if (journal->start()) {
+        journal->attach(*document);
+        journals[document] = std::move(journal);
+    }
+}
+
+void TextEditor::onJournalFailed(const DocumentText* document) {
+    // The journal keeps retrying, so this is said once each time it starts failing
+    const int index = documents.indexOf(document);
+    const auto journal = journals.find(document);
+    if (index < 0 || journal == journals.end() || !journal->second->isFailing()) {
+        return; // closed, or writing again
+    }
+    const std::wstring message = L"Edits to " + documents.at(index).path +
+        L" could not be written to its crash journal, so they would be lost in a crash. Save the file to keep them.";
+    MessageBoxW(hMainWindow, message.c_str(), L"Crash Journal", MB_OK | MB_ICONWARNING);
+}
+
+void TextEditor::startLanguage(int index) {
+    // A new name may mean another language, or none. Brackets are indexed
+    // in the languages that are highlighted, where they nest.
+    DocumentText* document = documents.get(index);
+    highlighters.erase(document);
+    foldMaps.erase(document);
+    bracketIndexes.erase(document);
+    if (const Grammar* grammar = grammarForPath(documents.at(index).path)) {
+        highlighters[document] = std::make_unique<SyntaxHighlighter>(*document, *grammar, [hWnd = hMainWindow] {
+            PostMessage(hWnd, WM_HIGHLIGHT_READY, 0, 0);
+        });
+        bracketIndexes[document] = std::make_unique<BracketIndex>(*document, [hWnd = hMainWindow, document] {
+            PostMessage(hWnd, WM_BRACKETS_READY, reinterpret_cast<WPARAM>(document), 0);
+        });
+        foldMaps[document] = std::make_unique<FoldMap>(*document);
+    }
+    updateHighlighting();
+    InvalidateRect(hMainWindow, nullptr, FALSE);
+}
+
+void TextEditor::updateHighlighting() {
+    // Only the shown document has lines on screen; the others finish off
+    // what their last edits left stale
+    const auto highlighter = highlighters.find(getCurrentDocument());
+    if (highlighter == highlighters.end()) {
+        return;
+    }
+    editEngine->sync();
+    size_t firstLine;
+    size_t lastLine;
+    getVisibleLines(firstLine, lastLine);
+    highlighter->second->update(firstLine, lastLine);
+}
+
+void TextEditor::goToMatchingBracket() {
+    // The bracket at the caret, else the one just before it
+    editEngine->sync();
+    DocumentText* document = getCurrentDocument();
+    const auto brackets = bracketIndexes.find(document);
+    if (brackets == bracketIndexes.end()) {
+        return;
+    }
+    const size_t caret = document->getCaretPosition();
+    size_t match = brackets->second->findMatch(caret);
+    if (match == BracketIndex::npos && caret > 0) {
+        match = brackets->second->findMatch(caret - 1);
+    }
+    if (match != BracketIndex::npos) {
+        setCursorPosition(match);
+    }
+}
+
+void TextEditor::toggleFold() {
+    // Unfolds what the caret's line opens or sits in, else folds the pair
+    // opening on it or around it
+    DocumentText* document = getCurrentDocument();
+    const auto brackets = bracketIndexes.find(document);
+    if (brackets == bracketIndexes.end()) {
+        return;
+    }
+    FoldMap& folds = *foldMaps.at(document);
+    const size_t line = document->lineStarts.lineOf(document->getCaretPosition());
+    const size_t foldEnd = folds.getFoldEnd(line);
+    if (foldEnd != FoldMap::npos) {
+        changeFolds(folds, line, foldEnd, [&] { folds.unfold(line); });
+        return;
+    }
+    FoldRegion region;
+    if (brackets->second->findFold(document->getCaretPosition(), region) && !folds.isHidden(region.firstLine)) {
+        changeFolds(folds, region.firstLine, region.lastLine, [&] { folds.fold(region); });
+    }
+}
+
+void TextEditor::unfoldAll() {
+    const auto folds = foldMaps.find(getCurrentDocument());
+    if (folds != foldMaps.end() && !folds->second->empty()) {
+        changeFolds(*folds->second, 0, getCurrentDocument()->lineStarts.size() - 1, [&] { folds->second->unfoldAll(); });
+    }
+}
+
+void TextEditor::changeFolds(FoldMap& folds, size_t first, size_t last, const std::function<void()>& change) {
+    // Only the view lines between the first and last lines change, so only
+    // the text of the lines that are shown there now is sent to the view.
+    // The selection and the top of the view stay on the same text.
+    DocumentText* document = getCurrentDocument();
+    size_t selectionStart;
+    size_t selectionEnd;
+    document->getSelection(selectionStart, selectionEnd);
+    size_t topLine;
+    size_t bottomLine;
+    getVisibleLines(topLine, bottomLine);
+    const bool whole = folds.isHidden(first) || folds.isHidden(last);
+    const size_t viewFirst = folds.toVisibleLine(first);
+    const size_t viewLast = folds.toVisibleLine(last);
+    change();
+
+    SendMessage(hView, WM_SETREDRAW, FALSE, 0);
+    if (whole) {
+        displayFile(document, hView);
+    }
+    else {
+        std::string text;
+        appendLines(text, *document, folds, first + 1, last);
+        const int wideSize = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+        std::vector<wchar_t> wideText(wideSize);
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, wideText.data(), wideSize);
+        const LRESULT start = SendMessage(hView, EM_LINEINDEX, viewFirst + 1, 0);
+        const LRESULT end = SendMessage(hView, EM_LINEINDEX, viewLast, 0);
+        SendMessage(hView, EM_SETSEL, static_cast<WPARAM>(start), static_cast<LPARAM>(end));
+        SendMessage(hView, EM_REPLACESEL, FALSE, reinterpret_cast<LPARAM>(wideText.data()));
+    }
+    document->setSelection(selectionStart, selectionEnd);
+    scrollToLine(topLine);
+    SendMessage(hView, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(hView, nullptr, TRUE);
+}
+
+void TextEditor::reveal(size_t start, size_t end) {
+    // The outermost fold hiding either end is opened, then whatever still
+    // hides it inside
+    const auto folds = foldMaps.find(getCurrentDocument());
+    if (folds == foldMaps.end()) {
+        return;
+    }
+    const LineIndex& lines = getCurrentDocument()->lineStarts;
+    for (const size_t line : { lines.lineOf(start), lines.lineOf(end) }) {
+        size_t first;
+        size_t last;
+        while (folds->second->isHidden(line) && folds->second->findFold(line, line, first, last)) {
+            changeFolds(*folds->second, first, last, [&] { folds->second->unfold(first); });
+        }
+    }
+}
+
+bool TextEditor::unfoldAround(size_t start, size_t end, bool addsLines) {
+    // Line breaks added or taken away next to a fold would move lines in or
+    // out of it that the view still shows or hides, so the folds on the
+    // lines the edit touches are opened first
+    DocumentText* document = getCurrentDocument();
+    const auto folds = foldMaps.find(document);
+    if (folds == foldMaps.end() || folds->second->empty()) {
+        return false;
+    }
+    const size_t firstLine = document->lineStarts.lineOf(start);
+    const size_t lastLine = document->lineStarts.lineOf(end);
+    if (!addsLines && firstLine == lastLine) {
+        return false;
+    }
+    bool unfolded = false;
+    size_t first;
+    size_t last;
+    while (folds->second->findFold(firstLine, lastLine, first, last)) {
+        changeFolds(*folds->second, first, last, [&] { folds->second->unfold(first); });
+        unfolded = true;
+    }
+    return unfolded;
+}
+
+void TextEditor::getEditSelection(size_t& start, size_t& end) {
+    // Positions are mapped through the folds with the line index, so typing
+    // still on its way is applied first; without folds the view alone does
+    DocumentText* document = getCurrentDocument();
+    if (const auto folds = foldMaps.find(document); folds != foldMaps.end() && !folds->second->empty()) {
+        editEngine->sync();
+    }
+    document->getSelection(start, end);
+}
+
+void TextEditor::dropJournal(DocumentText* document) {
+    auto journal = journals.find(document);
+    if (journal == journals.end()) {
+        return;
+    }
+    journal->second->detach(*document);
+    journal->second->discard();
+    journals.erase(journal);
+}
+
+void TextEditor::layoutControls() const {
+    RECT rcClient;
+    GetClientRect(hMainWindow, &rcClient);
+    int width = rcClient.right - rcClient.left;
+    int height = rcClient.bottom - rcClient.top;
+
+    if (hFindBox != nullptr && IsWindowVisible(hFindBox)) {
+        height -= FIND_BOX_HEIGHT;
+        SetWindowPos(hFindBox, nullptr, 0, height, width, FIND_BOX_HEIGHT, SWP_NOZORDER);
+    }
+    tabControl->Resize(width, height);
+}
+
+void TextEditor::toggleFindBox() {
+    if (IsWindowVisible(hFindBox)) {
+        ShowWindow(hFindBox, SW_HIDE);
+        KillTimer(hMainWindow, SEARCH_TIMER);
+        SetFocus(tabControl->getCurrentEditControl());
+        InvalidateRect(tabControl->getCurrentEditControl(), nullptr, FALSE);
+    }
+    else {
+        ShowWindow(hFindBox, SW_SHOW);
+        SendMessage(hFindBox, EM_SETSEL, 0, -1);
+        SetFocus(hFindBox);
+        updateSearch(true);
+    }
+    layoutControls();
+}
+
+void TextEditor::updateSearch(bool selectMatch) {
+    DocumentText* document = getCurrentDocument();
+    if (document == nullptr || !IsWindowVisible(hFindBox)) {
+        return;
+    }
+    editEngine->sync();
+    if (!search || search->getDocument() != document) {
+        search = std::make_unique<DocumentSearch>(*document);
+    }
+
+    // The find box holds UTF-16, the document is searched as UTF-8
+    int wideLen = GetWindowTextLengthW(hFindBox);
+    std::wstring wideQuery(wideLen + 1, L'\0');
+    GetWindowTextW(hFindBox, wideQuery.data(), wideLen + 1);
+    int size = WideCharToMultiByte(CP_UTF8, 0, wideQuery.c_str(), wideLen, nullptr, 0, nullptr, nullptr);
+    std::string query(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wideQuery.c_str(), wideLen, query.data(), size, nullptr, nullptr);
+
+    // Resolve the visible lines now, the rest is filled in on WM_TIMER
+    HWND editControl = tabControl->getCurrentEditControl();
+    size_t firstLine;
+    size_t lastLine;
+    getVisibleLines(firstLine, lastLine);
+    const LineIndex& lines = document->lineStarts;
+    size_t viewStart = firstLine < lines.size() ? lines[firstLine] : document->getLength();
+    size_t viewEnd = lastLine < lines.size() ? lines[lastLine] : document->getLength();
+    search->setQuery(query, viewStart, viewEnd);
+
+    if (selectMatch && !query.empty()) {
+        size_t match = search->findNext(document->getCaretPosition());
+        if (match != DocumentSearch::npos) {
+            reveal(match, match + query.size());
+            document->setSelection(match, match + query.size());
+            SendMessage(editControl, EM_SCROLLCARET, 0, 0);
+        }
+    }
+
+    if (!search->isComplete()) {
+        SetTimer(hMainWindow, SEARCH_TIMER, 0, nullptr);
+    }
+    InvalidateRect(editControl, nullptr, FALSE);
+}
+
+bool TextEditor::showsSearchHits() const {
+    return search && search->getDocument() == getCurrentDocument() && !search->getQuery().empty() &&
+        IsWindowVisible(hFindBox);
+}
+
+void TextEditor::updateSearchHits() {
+    // Edits since the hits were found leave them stale: the lines on screen
+    // are searched again before they are painted, the rest on the timer
+    if (!showsSearchHits()) {
+        return;
+    }
+    editEngine->sync();
+    if (search->isCurrent()) {
+        return;
+    }
+    const DocumentText* document = getCurrentDocument();
+    size_t firstLine;
+    size_t lastLine;
+    getVisibleLines(firstLine, lastLine);
+    const LineIndex& lines = document->lineStarts;
+    size_t viewStart = firstLine < lines.size() ? lines[firstLine] : document->getLength();
+    size_t viewEnd = lastLine < lines.size() ? lines[lastLine] : document->getLength();
+    const std::string query = search->getQuery();
+    search->setQuery(query, viewStart, viewEnd);
+    if (!search->isComplete()) {
+        SetTimer(hMainWindow, SEARCH_TIMER, 0, nullptr);
+    }
+}
+
+void TextEditor::findNext() {
+    editEngine->sync();
+    DocumentText* document = getCurrentDocument();
+    if (!search || search->getDocument() != document || search->getQuery().empty()) {
+        return;
+    }
+
+    // Wrapping around needs the whole document, so finish the lazy pass first
+    while (search->searchMore(SEARCH_BUDGET)) {}
+
+    size_t match = search->findNext(document->getCaretPosition() + 1);
+    if (match != DocumentSearch::npos) {
+        HWND editControl = tabControl->getCurrentEditControl();
+        reveal(match, match + search->getQuery().size());
+        document->setSelection(match, match + search->getQuery().size());
+        SendMessage(editControl, EM_SCROLLCARET, 0, 0);
+    }
 }
 
 void TextEditor::updateWindowTitle() const {
-    std::wstring currentFilePath = tabControl->getCurrentFilePath();
+    std::wstring currentFilePath = getCurrentFilePath();
     std::wstring title = L"Nickolas Text Editor - " + (currentFilePath.empty() ? L"Untitled" : currentFilePath);
+    if (followers.contains(getCurrentDocument())) {
+        title += L" (following)";
+    }
     SetWindowTextW(hMainWindow, title.c_str());
 }
 
@@ -409,10 +1806,11 @@ LRESULT TextEditor::OnPaint(HWND hWnd) const {
     HDC hdc = BeginPaint(hWnd, &ps);
 
 
-    // Paint the document content
-    int currentTab = tabControl->getCurrentTabIndex();
-    if (currentTab >= 0 && currentTab < documents.size()) {
-        DocumentText* currentDoc = documents[currentTab].get();
+    // Paint the document content; only a paint that has lines to draw waits
+    // for the engine
+    const DocumentText* currentDoc = getCurrentDocument();
+    if (currentDoc != nullptr && !IsRectEmpty(&ps.rcPaint)) {
+        editEngine->sync();
         RECT rcClient;
         GetClientRect(tabControl->getCurrentEditControl(), &rcClient);
 
@@ -431,40 +1829,230 @@ LRESULT TextEditor::OnPaint(HWND hWnd) const {
 
 
 LONG TextEditor::PaintLine(HDC hdc, ULONG nLineNo, const DocumentText* document, const RECT& clientRect) const {
-    char buf[LONGEST_LINE];
-
     RECT rect = clientRect;
     rect.top = nLineNo * m_nFontHeight;
     rect.bottom = rect.top + m_nFontHeight;
 
-    ULONG len = document->get_line(nLineNo, buf, LONGEST_LINE);
+    // Only the columns that fit in the window are converted, however long the line is
+    const size_t visibleColumns = (clientRect.right - clientRect.left) / std::max(1, m_nFontHeight / 2) + 1;
+    const size_t sliceLength = document->getLineOffset(nLineNo, visibleColumns);
+    std::string slice;
+    slice.reserve(sliceLength);
+    for (const std::string_view chunk : document->getLineSlice(nLineNo, 0, sliceLength)) {
+        slice.append(chunk);
+    }
+
+    std::wstring wideSlice(slice.size(), L'\0');
+    int wideLen = slice.empty() ? 0 : MultiByteToWideChar(CP_UTF8, 0, slice.data(), static_cast<int>(slice.size()),
+        wideSlice.data(), static_cast<int>(wideSlice.size()));
 
-    TCHAR wbuf[LONGEST_LINE];
-    MultiByteToWideChar(CP_ACP, 0, buf, -1, wbuf, LONGEST_LINE);
+    ExtTextOutW(hdc, rect.left, rect.top, ETO_OPAQUE, &rect, wideSlice.c_str(), wideLen, nullptr);
 
-    ExtTextOutW(hdc, rect.left, rect.top, ETO_OPAQUE, &rect, wbuf, len, nullptr);
+    return 0;
+}
+LRESULT TextEditor::paintView(HWND hWnd) {
+    // The control paints into a bitmap, the token colours and search hits
+    // are drawn over its text there and the bitmap goes to the screen whole,
+    // so nothing flickers between the two
+    editEngine->sync();
+    updateHighlighting();
+    updateSearchHits();
+    PAINTSTRUCT ps;
+    HDC hdc = BeginPaint(hWnd, &ps);
+    RECT rcClient;
+    GetClientRect(hWnd, &rcClient);
+    HDC memDC = CreateCompatibleDC(hdc);
+    HBITMAP bitmap = CreateCompatibleBitmap(hdc, rcClient.right, rcClient.bottom);
+    HGDIOBJ oldBitmap = SelectObject(memDC, bitmap);
+
+    // The control takes its colours from the parent, as it would on screen
+    const bool readOnly = (GetWindowLongPtr(hWnd, GWL_STYLE) & ES_READONLY) != 0;
+    auto brush = reinterpret_cast<HBRUSH>(SendMessage(GetParent(hWnd), readOnly ? WM_CTLCOLORSTATIC : WM_CTLCOLOREDIT,
+        reinterpret_cast<WPARAM>(memDC), reinterpret_cast<LPARAM>(hWnd)));
+    FillRect(memDC, &rcClient, brush != nullptr ? brush : GetSysColorBrush(readOnly ? COLOR_3DFACE : COLOR_WINDOW));
+    DefSubclassProc(hWnd, WM_PAINT, reinterpret_cast<WPARAM>(memDC), 0);
+
+    const auto font = reinterpret_cast<HFONT>(SendMessage(hWnd, WM_GETFONT, 0, 0));
+    HGDIOBJ oldFont = font != nullptr ? SelectObject(memDC, font) : nullptr;
+    paintHighlighting(memDC, hWnd, rcClient);
+    paintSearchHits(memDC, hWnd, rcClient);
+    if (oldFont != nullptr) {
+        SelectObject(memDC, oldFont);
+    }
 
+    HideCaret(hWnd);
+    BitBlt(hdc, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right - ps.rcPaint.left, ps.rcPaint.bottom - ps.rcPaint.top,
+        memDC, ps.rcPaint.left, ps.rcPaint.top, SRCCOPY);
+    ShowCaret(hWnd);
+    SelectObject(memDC, oldBitmap);
+    DeleteObject(bitmap);
+    DeleteDC(memDC);
+    EndPaint(hWnd, &ps);
     return 0;
 }
+
+void TextEditor::paintVisibleLines(HWND hWnd, const RECT& clientRect,
+    const std::function<void(size_t line, LRESULT lineIndex, int left, int top)>& paintLine) const {
+    const DocumentText* document = getCurrentDocument();
+    DWORD selStart = 0, selEnd = 0;
+    SendMessage(hWnd, EM_GETSEL, reinterpret_cast<WPARAM>(&selStart), reinterpret_cast<LPARAM>(&selEnd));
+
+    // View lines are document lines unless some are folded away
+    const auto folds = foldMaps.find(document);
+    const FoldMap* foldMap = folds != foldMaps.end() && !folds->second->empty() ? folds->second.get() : nullptr;
+    const size_t viewLines = SendMessage(hWnd, EM_GETLINECOUNT, 0, 0);
+    for (size_t viewLine = SendMessage(hWnd, EM_GETFIRSTVISIBLELINE, 0, 0); viewLine < viewLines; ++viewLine) {
+        const size_t line = foldMap != nullptr ? foldMap->toDocumentLine(viewLine) : viewLine;
+        if (line >= document->lineStarts.size()) {
+            break;
+        }
+        const LRESULT lineIndex = SendMessage(hWnd, EM_LINEINDEX, viewLine, 0);
+        const LRESULT origin = lineIndex < 0 ? -1 : SendMessage(hWnd, EM_POSFROMCHAR, lineIndex, 0);
+        if (origin == -1) {
+            break;
+        }
+        const int left = static_cast<short>(LOWORD(origin));
+        const int top = static_cast<short>(HIWORD(origin));
+        if (top >= clientRect.bottom) {
+            break;
+        }
+        const size_t lineLength = SendMessage(hWnd, EM_LINELENGTH, lineIndex, 0);
+        if (lineLength == 0 || (selStart != selEnd && selStart <= lineIndex + lineLength && selEnd >= static_cast<DWORD>(lineIndex))) {
+            continue;
+        }
+        paintLine(line, lineIndex, left, top);
+    }
+}
+
+void TextEditor::paintHighlighting(HDC hdc, HWND hWnd, const RECT& clientRect) const {
+    const DocumentText* document = getCurrentDocument();
+    const auto highlighter = highlighters.find(document);
+    if (highlighter == highlighters.end()) {
+        return;
+    }
+
+    // Runs are drawn where the control put their first character, in the
+    // control's own font and background, so only the colour changes. Lines
+    // in the selection are left as the control drew them.
+    TEXTMETRICW metrics{};
+    GetTextMetricsW(hdc, &metrics);
+    const int narrowest = std::max<int>(1, metrics.tmAveCharWidth / 2);
+    const COLORREF color = GetTextColor(hdc);
+    const int mode = SetBkMode(hdc, OPAQUE);
+
+    std::string slice;
+    std::wstring wideRun;
+    std::vector<Token> tokens;
+    paintVisibleLines(hWnd, clientRect, [&](size_t line, LRESULT lineIndex, int left, int top) {
+        // Only the columns that can reach the right edge are lexed
+        const size_t visibleColumns = (clientRect.right - std::min(left, 0)) / narrowest + 1;
+        const size_t sliceLength = document->getLineOffset(line, visibleColumns);
+        slice.clear();
+        for (const std::string_view chunk : document->getLineSlice(line, 0, sliceLength)) {
+            slice.append(chunk);
+        }
+        if (!highlighter->second->getTokens(line, slice, tokens)) {
+            return;
+        }
+
+        // Tabs are left to the control; each piece between them starts at
+        // the position it reports
+        size_t wideOffset = 0;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            const size_t start = tokens[i].start;
+            const size_t end = i + 1 < tokens.size() ? tokens[i + 1].start : slice.size();
+            if (start >= end) {
+                continue;
+            }
+            wideRun.resize(end - start);
+            const int runLen = MultiByteToWideChar(CP_UTF8, 0, slice.data() + start, static_cast<int>(end - start),
+                wideRun.data(), static_cast<int>(wideRun.size()));
+            SetTextColor(hdc, tokenColor(tokens[i].kind, color));
+            drawPieces(hdc, hWnd, clientRect, lineIndex + wideOffset, top, wideRun.data(), runLen);
+            wideOffset += runLen;
+        }
+    });
+    SetTextColor(hdc, color);
+    SetBkMode(hdc, mode);
+}
+
+void TextEditor::paintSearchHits(HDC hdc, HWND hWnd, const RECT& clientRect) const {
+    if (!showsSearchHits() || !search->isCurrent()) {
+        return;
+    }
+
+    // Hits are drawn over whatever colours the text has, in the control's
+    // text colour on a background of their own; one under the selection is
+    // left to it
+    const DocumentText* document = getCurrentDocument();
+    const size_t queryLength = search->getQuery().size();
+    TEXTMETRICW metrics{};
+    GetTextMetricsW(hdc, &metrics);
+    const int narrowest = std::max<int>(1, metrics.tmAveCharWidth / 2);
+    const COLORREF background = SetBkColor(hdc, SEARCH_HIT_COLOR);
+    const int mode = SetBkMode(hdc, OPAQUE);
+
+    std::string slice;
+    std::wstring wideRun;
+    paintVisibleLines(hWnd, clientRect, [&](size_t line, LRESULT lineIndex, int left, int top) {
+        const size_t visibleColumns = (clientRect.right - std::min(left, 0)) / narrowest + 1;
+        const size_t sliceLength = document->getLineOffset(line, visibleColumns);
+        const size_t lineStart = document->lineStarts[line];
+        const std::vector<size_t> hits = search->getMatches(lineStart, lineStart + sliceLength);
+        if (hits.empty()) {
+            return;
+        }
+        slice.clear();
+        for (const std::string_view chunk : document->getLineSlice(line, 0, sliceLength)) {
+            slice.append(chunk);
+        }
+
+        // Hits come in order, so the columns in front of each are counted
+        // on from the last one's
+        size_t counted = 0;
+        size_t wideOffset = 0;
+        for (const size_t hit : hits) {
+            const size_t start = hit - lineStart;
+            const size_t end = std::min(start + queryLength, slice.size());
+            wideOffset += MultiByteToWideChar(CP_UTF8, 0, slice.data() + counted, static_cast<int>(start - counted), nullptr, 0);
+            counted = start;
+            wideRun.resize(end - start);
+            const int runLen = MultiByteToWideChar(CP_UTF8, 0, slice.data() + start, static_cast<int>(end - start),
+                wideRun.data(), static_cast<int>(wideRun.size()));
+            drawPieces(hdc, hWnd, clientRect, lineIndex + wideOffset, top, wideRun.data(), runLen);
+        }
+    });
+    SetBkMode(hdc, mode);
+    SetBkColor(hdc, background);
+}
 LRESULT CALLBACK TextEditor::SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData) {
     auto* pThis = reinterpret_cast<TextEditor*>(dwRefData);
 
     switch (uMsg) {
+    case WM_PAINT:
+        if (pThis->highlighters.contains(pThis->getCurrentDocument()) || pThis->showsSearchHits()) {
+            return pThis->paintView(hWnd);
+        }
+        break;
     case WM_CHAR: {
         if (wParam >= 32 || wParam == VK_TAB || wParam == VK_RETURN) {
-            DWORD start, end;
-            SendMessage(hWnd, EM_GETSEL, reinterpret_cast<WPARAM>(&start), reinterpret_cast<LPARAM>(&end));
+            if (!pThis->acceptsInput()) {
+                return 0;
+            }
+            size_t start, end;
+            pThis->getEditSelection(start, end);
+            if (pThis->unfoldAround(start, end, wParam == VK_RETURN)) {
+                pThis->getEditSelection(start, end);
+            }
 
             // If there's a selection, delete it first
             if (start != end) {
-                pThis->commandHistory.executeCommand(
-                    std::make_unique<DeleteCommand>(*(pThis->getCurrentDocument()), start, end - start));
+                pThis->queueDelete(start, end);
             }
 
-            char ch = static_cast<char>(wParam);
-            std::string insertText(1, ch);
-            pThis->commandHistory.executeCommand(
-                std::make_unique<InsertCommand>(*(pThis->getCurrentDocument()), insertText, start));
+            // Line breaks are stored as LF whatever the file uses
+            char ch = wParam == VK_RETURN ? '\n' : static_cast<char>(wParam);
+            pThis->queueInsert(start, std::string(1, ch));
 
             // Let default proc handle the visual update
             LRESULT result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
@@ -484,27 +2072,48 @@ LRESULT CALLBACK TextEditor::SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wPara
             case 'Y':
                 pThis->redo();
                 return 0;
+            case 'F':
+                pThis->toggleFindBox();
+                return 0;
+            case VK_OEM_6: // ]
+                pThis->goToMatchingBracket();
+                return 0;
             default:
                 break;
             }
         }
 
-        if (wParam == VK_BACK || wParam == VK_DELETE) {
-            DWORD start, end;
-            SendMessage(hWnd, EM_GETSEL, reinterpret_cast<WPARAM>(&start), reinterpret_cast<LPARAM>(&end));
+        if (wParam == VK_F3) {
+            pThis->findNext();
+            return 0;
+        }
 
-            if (start == end) {
-                if (wParam == VK_BACK && start > 0) {
-                    --start;
-                }
-                else if (wParam == VK_DELETE && end < pThis->getCurrentDocument()->getLength()) {
-                    ++end;
+        if (wParam == VK_BACK || wParam == VK_DELETE) {
+            if (!pThis->acceptsInput()) {
+                return 0;
+            }
+            size_t start, end;
+            const auto getRange = [&] {
+                pThis->getEditSelection(start, end);
+
+                // Delete at the end of the text is left for the engine to drop,
+                // since the document's length may still be catching up
+                if (start == end) {
+                    if (wParam == VK_BACK && start > 0) {
+                        --start;
+                    }
+                    else if (wParam == VK_DELETE) {
+                        ++end;
+                    }
                 }
+            };
+            getRange();
+            if (pThis->unfoldAround(start, end, false)) {
+                getRange();
             }
 
             if (start != end) {
-                pThis->commandHistory.executeCommand(
-                    std::make_unique<DeleteCommand>(*(pThis->getCurrentDocument()), start, end - start));
+                pThis->queueDelete(start, end);
             }
 
             LRESULT result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
@@ -514,22 +2123,26 @@ LRESULT CALLBACK TextEditor::SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wPara
         break;
     }
     case WM_PASTE: {
+        if (!pThis->acceptsInput()) {
+            return 0;
+        }
         if (OpenClipboard(hWnd)) {
             HANDLE hData = GetClipboardData(CF_TEXT);
             if (hData != nullptr) {
                 char* pszText = static_cast<char*>(GlobalLock(hData));
                 if (pszText != nullptr) {
-                    DWORD start, end;
-                    SendMessage(hWnd, EM_GETSEL, reinterpret_cast<WPARAM>(&start), reinterpret_cast<LPARAM>(&end));
+                    size_t start, end;
+                    pThis->getEditSelection(start, end);
+                    if (pThis->unfoldAround(start, end, strchr(pszText, '\n') != nullptr)) {
+                        pThis->getEditSelection(start, end);
+                    }
 
                     // Delete selection first if any
                     if (start != end) {
-                        pThis->commandHistory.executeCommand(
-                            std::make_unique<DeleteCommand>(*(pThis->getCurrentDocument()), start, end - start));
+                        pThis->queueDelete(start, end);
                     }
 
-                    pThis->commandHistory.executeCommand(
-                        std::make_unique<InsertCommand>(*(pThis->getCurrentDocument()), pszText, start));
+                    pThis->queueInsert(start, DocumentText::normalizeEol(pszText));
 
                     GlobalUnlock(hData);
                 }
@@ -541,12 +2154,17 @@ LRESULT CALLBACK TextEditor::SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wPara
         return result;
     }
     case WM_CUT: {
-        DWORD start, end;
-        SendMessage(hWnd, EM_GETSEL, reinterpret_cast<WPARAM>(&start), reinterpret_cast<LPARAM>(&end));
+        if (!pThis->acceptsInput()) {
+            return 0;
+        }
+        size_t start, end;
+        pThis->getEditSelection(start, end);
+        if (pThis->unfoldAround(start, end, false)) {
+            pThis->getEditSelection(start, end);
+        }
 
         if (start != end) {
-            pThis->commandHistory.executeCommand(
-                std::make_unique<DeleteCommand>(*(pThis->getCurrentDocument()), start, end - start));
+            pThis->queueDelete(start, end);
         }
 
         LRESULT result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
@@ -560,18 +2178,49 @@ LRESULT CALLBACK TextEditor::SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wPara
     return DefSubclassProc(hWnd, uMsg, wParam, lParam);
 }
 
+bool TextEditor::acceptsInput() const {
+    // A loading tab shows a placeholder that the loaded document replaces,
+    // which would leave its edits in the history pointing at nothing
+    // A followed tab only takes what appendFromFile adds, so it keeps
+    // matching the file it grows with, and one being reloaded would have
+    // its typing diffed away.
+    const DocumentText* document = getCurrentDocument();
+    if (document == nullptr || isLoading(document) || isReloading(document) || followers.contains(document)) {
+        return false;
+    }
+    return (GetWindowLongPtr(hView, GWL_STYLE) & ES_READONLY) == 0;
+}
+
+void TextEditor::queueInsert(size_t position, std::string text) {
+    editEngine->submit(EditOp{ getCurrentDocument(), EditKind::Insert, position, 0, std::move(text) });
+}
+
+void TextEditor::queueDelete(size_t start, size_t end) {
+    editEngine->submit(EditOp{ getCurrentDocument(), EditKind::Delete, start, end - start, {} });
+}
+
 DocumentText* TextEditor::getCurrentDocument() const {
-    int currentTabIndex = tabControl->getCurrentTabIndex();
-    if (currentTabIndex >= 0 && currentTabIndex < documents.size()) {
-        return documents[currentTabIndex].get();
+    return documents.get(tabControl->getCurrentTabIndex());
+}
+
+std::wstring TextEditor::getCurrentFilePath() const {
+    const int currentTabIndex = tabControl->getCurrentTabIndex();
+    if (documents.get(currentTabIndex) == nullptr) {
+        return L"";
     }
-    return nullptr;
+    return documents.at(currentTabIndex).path;
 }
 
 void TextEditor::undo() {
+    editEngine->sync();
     size_t currentPosition = getCurrentDocument()->getCaretPosition();
     commandHistory.undo();
+    if (traceRecorder) {
+        traceRecorder->recordUndo();
+    }
     updateEditControl();
+    updateSearch(false);
+    updateHighlighting();
 
     size_t newPosition = commandHistory.getLastCursorPosition();
     if (newPosition == 0) {
@@ -581,9 +2230,15 @@ void TextEditor::undo() {
 }
 
 void TextEditor::redo() {
+    editEngine->sync();
     size_t currentPosition = getCurrentDocument()->getCaretPosition();
     commandHistory.redo();
+    if (traceRecorder) {
+        traceRecorder->recordRedo();
+    }
     updateEditControl();
+    updateSearch(false);
+    updateHighlighting();
 
     size_t newPosition = commandHistory.getLastCursorPosition();
     if (newPosition == 0) {
@@ -592,17 +2247,15 @@ void TextEditor::redo() {
     setCursorPosition(newPosition);
 }
 
-void TextEditor::setCursorPosition(size_t position) const {
+void TextEditor::setCursorPosition(size_t position) {
     HWND currentEditControl = tabControl->getCurrentEditControl();
-    SendMessage(currentEditControl, EM_SETSEL, position, position);
+    reveal(position, position);
+    getCurrentDocument()->setCaretPosition(position);
     SendMessage(currentEditControl, EM_SCROLLCARET, 0, 0);
 }
 
 void TextEditor::updateEditControl() const {
-    int currentTabIndex = tabControl->getCurrentTabIndex();
-    if (currentTabIndex >= 0 && currentTabIndex < documents.size()) {
-        DocumentText* currentDoc = documents[currentTabIndex].get();
-        HWND editControl = tabControl->getCurrentEditControl();
-        displayFile(currentDoc, editControl);
+    if (const DocumentText* currentDoc = getCurrentDocument()) {
+        displayFile(currentDoc, hView);
     }
 }
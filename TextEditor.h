@@ -2,7 +2,9 @@
 #define TEXTEDITOR_H
 
 #include <Windows.h>
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <commctrl.h>
@@ -10,6 +12,27 @@
 #include <memory>
 #include "TabControl.h"
 #include "DocumentText.h"
+#include "DocumentSearch.h"
+#include "DocumentLoader.h"
+#include "DocumentCache.h"
+#include "DocumentDiff.h"
+#include "DocumentSaver.h"
+#include "BackgroundSaver.h"
+#include "FileIO.h"
+#include "Gzip.h"
+#include "EditJournal.h"
+#include "FileWatcher.h"
+#include "TailFollower.h"
+#include "EditEngine.h"
+#include "DehydrationPolicy.h"
+#include "DocumentRegistry.h"
+#include "Profiler.h"
+#include "EditTrace.h"
+#include "SyntaxHighlighter.h"
+#include "BracketIndex.h"
+#include "FoldMap.h"
+#include <unordered_map>
+#include <unordered_set>
 
 class TextEditor {
 public:
@@ -18,14 +41,101 @@ public:
     HMENU hMenu{};
     static HINSTANCE hInstance;
     TabControl* tabControl = nullptr;
-    std::vector<std::unique_ptr<DocumentText>> documents;
+    // One Edit control shows whichever document's tab is selected; the
+    // others keep their text and view parked in the registry
+    HWND hView{};
+    DocumentRegistry documents;
     int m_nFontHeight = 16;
-    static constexpr int LONGEST_LINE = 1024;
+    static constexpr int FIND_BOX_HEIGHT = 24;
+    static constexpr size_t SEARCH_BUDGET = 4 * 1024 * 1024;
+    static constexpr UINT WM_LOAD_PROGRESS = WM_APP + 1;
+    static constexpr UINT WM_SAVE_PROGRESS = WM_APP + 2;
+    static constexpr UINT WM_FILE_CHANGED = WM_APP + 3;
+    static constexpr UINT WM_RELOAD_PROGRESS = WM_APP + 4;
+    static constexpr UINT WM_EDIT_COMMITTED = WM_APP + 5;
+    static constexpr UINT WM_TAB_COMPRESSED = WM_APP + 6;
+    static constexpr UINT WM_HIGHLIGHT_READY = WM_APP + 7;
+    static constexpr UINT WM_JOURNAL_FAILED = WM_APP + 8;
+    static constexpr UINT WM_BRACKETS_READY = WM_APP + 9;
+    HWND hFindBox{};
+    std::unique_ptr<DocumentSearch> search;
+
+    // Files still loading in the background. Their tab holds an empty,
+    // read-only placeholder document until the loader hands over the real one.
+    struct PendingLoad {
+        size_t id;
+        DocumentText* placeholder;
+        std::unique_ptr<DocumentLoader> loader;
+        bool firstScreenShown = false;
+    };
+    std::vector<PendingLoad> pendingLoads;
+    size_t nextLoadId = 1;
+
+    // Save All runs in the background; each snapshot has an entry here whose
+    // document is cleared if its tab closes before the save finishes
+    struct PendingSave {
+        DocumentText* document;
+        uint64_t journalMark;
+    };
+    std::unique_ptr<BackgroundSaver> backgroundSave;
+    std::vector<PendingSave> pendingSaves;
+    size_t untitledSkipped = 0;
+
+    // Crash journal of every document that has a file on disk
+    std::unordered_map<const DocumentText*, std::unique_ptr<EditJournal>> journals;
+
+    // Lexer state of every document in a language the grammars know; the
+    // lines on screen are lexed first, on the pool
+    std::unordered_map<const DocumentText*, std::unique_ptr<SyntaxHighlighter>> highlighters;
+    // Bracket pairs of the same documents, and the ones folded away
+    std::unordered_map<const DocumentText*, std::unique_ptr<BracketIndex>> bracketIndexes;
+    std::unordered_map<const DocumentText*, std::unique_ptr<FoldMap>> foldMaps;
+
+    // Files changed by another program are read again in the background and
+    // only the lines that differ are replaced
+    struct PendingReload {
+        size_t id;
+        DocumentText* document;
+        FileStamp stamp;
+        std::unique_ptr<DocumentLoader> loader;
+    };
+    std::unique_ptr<FileWatcher> fileWatcher;
+    std::vector<PendingReload> pendingReloads;
+    // Versions of a file the user chose not to reload over their changes
+    std::unordered_map<const DocumentText*, FileStamp> declinedChanges;
+    bool checkingChanges = false;
+
+    // Tabs following their file as it grows; they are read-only meanwhile
+    std::unordered_map<const DocumentText*, std::unique_ptr<TailFollower>> followers;
+
+    // Background tabs past the memory budget keep their text compressed and
+    // no view buffer until they are shown again. The text is
+    // compressed from a snapshot on the pool and swapped in once it is done.
+    struct Compression {
+        CompressedText text;
+        std::atomic<bool> done{ false };
+    };
+    struct PendingDehydration {
+        DocumentText* document;
+        std::shared_ptr<Compression> compression;
+    };
+    DehydrationPolicy dehydration;
+    std::unordered_set<const DocumentText*> dehydratedTabs;
+    std::vector<PendingDehydration> pendingDehydrations;
+    HANDLE lowMemory{};
+
+    // Set while View > Record Edit Trace is on; the engine records typing
+    // into it, this window everything else
+    std::unique_ptr<EditTraceRecorder> traceRecorder;
+
+    // Applies typing off the UI thread; declared after the documents, the
+    // history and the trace recorder so it stops before they go
+    std::unique_ptr<EditEngine> editEngine;
 
     TextEditor();
     void undo();
     void redo();
-    void setCursorPosition(size_t position) const;
+    void setCursorPosition(size_t position);
     void updateEditControl() const;
     void show() const;
     static LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp);
@@ -46,16 +156,99 @@ private:
     LRESULT handleCommand(WPARAM wp, LPARAM lp);
     void createNewTab();
     void openFile();
-    void saveFile() const;
-    void saveFileAs() const;
-    void saveAllFiles() const;
-    static void displayFile(const DocumentText* document, HWND editControl);
-    void writeFile(const std::wstring& path, const DocumentText* document) const;
+    bool openPath(const std::wstring& filePath);
+    void restoreSession();
+    void storeSession();
+    void cacheDocument(int index);
+    void saveFile();
+    void saveFileAs();
+    void saveAllFiles();
+    void displayFile(const DocumentText* document, HWND editControl) const;
+    static void appendLines(std::string& result, const DocumentText& document, const FoldMap& folds, size_t first, size_t end);
+    static void appendWithCrlf(std::string& result, std::string_view text);
+    static void setEditText(HWND editControl, const std::string& text);
+    void onLoadProgress(size_t id);
+    [[nodiscard]] bool isLoading(const DocumentText* document) const;
+    void onSaveProgress();
+    [[nodiscard]] bool isSaving(const DocumentText* document) const;
+    // Asks before a save turns a file's mixed line endings into one style
+    [[nodiscard]] bool confirmEolConversion(const std::wstring& path, const DocumentText& document) const;
+    bool writeFile(const std::wstring& path, DocumentText* document) const;
+    void checkExternalChanges();
+    bool startReload(int index, const FileStamp& stamp);
+    void onReloadProgress(size_t id);
+    [[nodiscard]] bool isReloading(const DocumentText* document) const;
+    void toggleFollow();
+    bool followTail(int index);
+    void onTabShown(int index);
+    void showDocument(int index);
+    [[nodiscard]] TabView getView(int index) const;
+    void setView(int index, const TabView& view);
+    // Document lines, whatever is folded
+    void getVisibleLines(size_t& firstLine, size_t& lastLine) const;
+    void scrollToLine(size_t line);
+    void refreshView(int index);
+    static void freeViewBuffer(TabView& view);
+    void showFirstScreen(PendingLoad& load) const;
+    void trimTabs(bool underPressure);
+    void dehydrateTab(int index);
+    void rehydrateTab(int index);
+    void startCompression(DocumentText* document);
+    void onTabCompressed();
+    // Each open document's memory, its view's included
+    [[nodiscard]] std::vector<DocumentMemory> getMemoryReport() const;
+    [[nodiscard]] MemoryUsage getViewMemory(int index) const;
+    void showMemoryReport() const;
+    void toggleEditTrace();
+    void writeProfile() const;
+    void startJournal(const std::wstring& path, DocumentText* document);
+    void onJournalFailed(const DocumentText* document);
+    void startLanguage(int index);
+    void updateHighlighting();
+    void goToMatchingBracket();
+    void toggleFold();
+    void unfoldAll();
+    // Folds or unfolds with change, which touches only lines first to last,
+    // and brings the view's text in step
+    void changeFolds(FoldMap& folds, size_t first, size_t last, const std::function<void()>& change);
+    // Unfolds what hides start or end
+    void reveal(size_t start, size_t end);
+    // Unfolds what an edit of start to end would break; true if anything was
+    bool unfoldAround(size_t start, size_t end, bool addsLines);
+    void dropJournal(DocumentText* document);
     void updateWindowTitle() const;
+    void layoutControls() const;
+    void toggleFindBox();
+    void updateSearch(bool selectMatch);
+    void findNext();
+    // True while the find box is open on the shown document with a query,
+    // whose hits are then all painted in the view
+    [[nodiscard]] bool showsSearchHits() const;
+    void updateSearchHits();
     LONG PaintLine(HDC hdc, ULONG nLineNo, const DocumentText* document, const RECT& clientRect) const;
+    // The view of a highlighted or searched document is painted here: the
+    // control's own text, then the token colours and the search hits over it
+    // from its first visible line
+    LRESULT paintView(HWND hWnd);
+    // Calls paintLine with each non-empty view line on screen that the
+    // selection leaves alone: its document line, the control's index of its
+    // first character and where the control drew that
+    void paintVisibleLines(HWND hWnd, const RECT& clientRect,
+        const std::function<void(size_t line, LRESULT lineIndex, int left, int top)>& paintLine) const;
+    void paintHighlighting(HDC hdc, HWND hWnd, const RECT& clientRect) const;
+    void paintSearchHits(HDC hdc, HWND hWnd, const RECT& clientRect) const;
 
+    // False while the shown document must not be edited: typing into it
+    // would reach a document about to be replaced
+    [[nodiscard]] bool acceptsInput() const;
+    // The selection as document positions, once typing that may still be
+    // on its way has been applied where folds need it
+    void getEditSelection(size_t& start, size_t& end);
+    void queueInsert(size_t position, std::string text);
+    void queueDelete(size_t start, size_t end);
     static LRESULT CALLBACK SubclassEditProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, UINT_PTR uIdSubclass, DWORD_PTR dwRefData);
     [[nodiscard]] DocumentText* getCurrentDocument() const;
+    [[nodiscard]] std::wstring getCurrentFilePath() const;
 
 };
 